@@ -0,0 +1,582 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : fs3_bench.c
+//  Description    : This is the synthetic benchmark for the FS3 client. It
+//                   runs every combination of the access patterns, file
+//                   counts, working sets, I/O sizes and file popularities
+//                   it is given through the driver, one run each, and
+//                   prints a row per run: ops/s, MB/s, latency percentiles
+//                   and network commands per op, as CSV or JSON.
+//
+//   Author        : Patrick McDaniel
+//   Last Modified : Mon 19 Oct 2026 04:50:48 AM UTC
+//
+
+// Include Files
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+// Project Includes
+#include <fs3_driver.h>
+#include <fs3_controller.h>
+#include <fs3_common.h>
+#include <fs3_cache.h>
+#include <fs3_network.h>
+#include <cmpsc311_log.h>
+#include <cmpsc311_util.h>
+
+// Defines
+#define FS3_BENCH_MAX_FILES 256     // Files a run can spread over
+#define FS3_BENCH_MAX_VALUES 16     // Values in one list option
+#define FS3_BENCH_MAX_IO (1 << 20)  // Largest I/O size
+#define FS3_BENCH_FILL 65536        // Bytes written at a time filling a file
+#define FS3_BENCH_SEQREAD 0
+#define FS3_BENCH_SEQWRITE 1
+#define FS3_BENCH_RANDREAD 2
+#define FS3_BENCH_RANDWRITE 3
+#define FS3_BENCH_PATTERNS 4
+#define FS3_BENCH_ARGUMENTS "hvc:w:a:b:n:P:f:W:s:z:o:r:l:i:p:"
+#define USAGE \
+	"USAGE: fs3_bench [-h] [-v] [-c <cache size>] [-w <window>] [-a <sectors>] [-b <backend>] [-n <ops>] [-P <patterns>]\n" \
+	"                 [-f <files>] [-W <kbytes>] [-s <bytes>] [-z <theta>] [-o csv|json] [-r <seed>] [-l <logfile>]\n" \
+	"                 [-i <ip>] [-p <port>]\n" \
+	"\n" \
+	"where:\n" \
+	"    -h - help mode (display this message)\n" \
+	"    -v - verbose output\n" \
+	"    -c - set the cache size (in number of sectors)\n" \
+	"    -w - keep up to <window> network commands in flight (2-64)\n" \
+	"    -a - read ahead <sectors> sectors after every read\n" \
+	"    -b - send commands to <backend>: tcp, uring, shm or inproc (as fs3_sim)\n" \
+	"    -n - operations in each run (default 10000)\n" \
+	"    -P - access patterns, any of seqread, seqwrite, randread, randwrite (default all four)\n" \
+	"    -f - number of files the run spreads over (default 16)\n" \
+	"    -W - working set, in KB, split evenly over the files (default 4096)\n" \
+	"    -s - size of each read or write, in bytes (default 4096)\n" \
+	"    -z - Zipf exponent of file popularity, 0 for uniform (default 0)\n" \
+	"    -o - print the results as csv (default) or json\n" \
+	"    -r - seed of the random generators (default 1)\n" \
+	"    -l - write log messages to the filename <logfile>\n" \
+	"    -i - IP address of server to connect to.\n" \
+	"    -p - port number of server to connect to.\n" \
+	"\n" \
+	"    -P, -f, -W, -s and -z take comma separated lists, there is one run for each combination of them.\n" \
+	"    Every run starts with a cold cache on files filled beforehand (outside the timing).\n" \
+	"\n" \
+
+// What one run measured
+typedef struct {
+	unsigned long  ops;        // Operations timed
+	unsigned long  bytes;      // Bytes read or written
+	unsigned long  commands;   // Network commands sent
+	double         secs;       // Time of the run
+	double         p50;        // Median latency, usecs
+	double         p99;        // 99th percentile latency, usecs
+	double         p999;       // 99.9th percentile latency, usecs
+} FS3BenchResult;
+
+//
+// Global Data
+uint16_t fs3BenchCache = FS3_DEFAULT_CACHE_SIZE;       // Cache lines
+unsigned long fs3BenchOps = 10000;                    // Operations in each run
+int fs3BenchJson = 0;                                 // Print JSON rather than CSV
+uint64_t fs3BenchRandom = 1;                          // State of the random generator
+char *fs3BenchPatterns[FS3_BENCH_PATTERNS] = { "seqread", "seqwrite", "randread", "randwrite" };
+int16_t fs3BenchHandles[FS3_BENCH_MAX_FILES];         // The files, opened on first use and kept open
+uint32_t fs3BenchSizes[FS3_BENCH_MAX_FILES];          // How much of each has been written
+double fs3BenchPopularity[FS3_BENCH_MAX_FILES];       // Cumulative chance of each file in the run
+int fs3BenchRows = 0;                                 // Results printed so far
+char *fs3BenchBuffer;                                 // Data read and written
+
+//
+// Functional Prototypes
+
+int bench_list(char *arg, double *vals, double low, double high);  // Parse a list option
+int bench_patterns(char *arg, double *vals);                        // Parse the pattern list
+int bench_run(int pattern, int files, uint32_t fsize, int iosize, double theta, FS3BenchResult *res); // Run one case
+int bench_fill(int files, uint32_t fsize);                          // Make the files big enough
+int bench_file(int files);                                          // Pick a file
+uint64_t bench_random(void);                                        // Next random number
+int bench_compare(const void *a, const void *b);                    // Order latencies
+void bench_print(int pattern, int files, uint32_t wset, int iosize, double theta, FS3BenchResult *res); // Print a row
+
+//
+// Functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : main
+// Description  : The main function for the FS3 benchmark
+//
+// Inputs       : argc - the number of command line parameters
+//                argv - the parameters
+// Outputs      : 0 if successful, -1 if failure
+
+int main( int argc, char *argv[] ) {
+
+	// Local variables
+	double patterns[FS3_BENCH_MAX_VALUES] = { FS3_BENCH_SEQREAD, FS3_BENCH_SEQWRITE, FS3_BENCH_RANDREAD, FS3_BENCH_RANDWRITE };
+	double files[FS3_BENCH_MAX_VALUES] = { 16 }, wsets[FS3_BENCH_MAX_VALUES] = { 4096 };
+	double sizes[FS3_BENCH_MAX_VALUES] = { 4096 }, thetas[FS3_BENCH_MAX_VALUES] = { 0 };
+	int npatterns = 4, nfiles = 1, nwsets = 1, nsizes = 1, nthetas = 1;
+	int ch, verbose = 0, log_initialized = 0, p, f, w, s, z, iosize;
+	uint32_t fsize;
+	FS3BenchResult res;
+
+	// Process the command line parameters
+	while ((ch = getopt(argc, argv, FS3_BENCH_ARGUMENTS)) != -1) {
+
+		switch (ch) {
+		case 'h': // Help, print usage
+			fprintf( stderr, USAGE );
+			return( -1 );
+
+		case 'v': // Verbose Flag
+			verbose = 1;
+			break;
+
+		case 'l': // Set the log filename
+			initializeLogWithFilename( optarg );
+			log_initialized = 1;
+			break;
+
+		case 'c': // Set the cache size
+			if ( sscanf(optarg, "%hu", &fs3BenchCache) != 1) {
+				logMessage(LOG_ERROR_LEVEL, "Failed parsing cache size [%s]", optarg);
+				return(-1);
+			}
+			break;
+
+		case 'w': // Set the network window
+			if ( (sscanf(optarg, "%d", &fs3_network_window) != 1) || (fs3_network_window < 2) ||
+					(fs3_network_window > FS3_NET_MAX_WINDOW) ) {
+				logMessage(LOG_ERROR_LEVEL, "Bad network window [%s]", optarg);
+				return(-1);
+			}
+			break;
+
+		case 'a': // Set the read ahead
+			if ( (sscanf(optarg, "%d", &fs3_readahead) != 1) || (fs3_readahead < 0) ) {
+				logMessage(LOG_ERROR_LEVEL, "Bad read ahead [%s]", optarg);
+				return(-1);
+			}
+			break;
+
+		case 'b': // Select the network backend
+			if ( network_fs3_set_backend(optarg) == -1 ) {
+				return(-1);
+			}
+			break;
+
+		case 'n': // Set the operations in each run
+			if ( (sscanf(optarg, "%lu", &fs3BenchOps) != 1) || (fs3BenchOps < 1) ) {
+				logMessage(LOG_ERROR_LEVEL, "Bad operation count [%s]", optarg);
+				return(-1);
+			}
+			break;
+
+		case 'P': // Set the patterns
+			if ( (npatterns = bench_patterns(optarg, patterns)) == -1 ) {
+				return(-1);
+			}
+			break;
+
+		case 'f': // Set the file counts
+			if ( (nfiles = bench_list(optarg, files, 1, FS3_BENCH_MAX_FILES)) == -1 ) {
+				return(-1);
+			}
+			break;
+
+		case 'W': // Set the working sets
+			if ( (nwsets = bench_list(optarg, wsets, 1, 1 << 20)) == -1 ) {
+				return(-1);
+			}
+			break;
+
+		case 's': // Set the I/O sizes
+			if ( (nsizes = bench_list(optarg, sizes, 1, FS3_BENCH_MAX_IO)) == -1 ) {
+				return(-1);
+			}
+			break;
+
+		case 'z': // Set the file popularities
+			if ( (nthetas = bench_list(optarg, thetas, 0, 10)) == -1 ) {
+				return(-1);
+			}
+			break;
+
+		case 'o': // Set the output format
+			if ( (strcmp(optarg, "csv") != 0) && (strcmp(optarg, "json") != 0) ) {
+				logMessage(LOG_ERROR_LEVEL, "Unknown output format [%s]", optarg);
+				return(-1);
+			}
+			fs3BenchJson = (strcmp(optarg, "json") == 0);
+			break;
+
+		case 'r': // Seed the random generator
+			if ( (sscanf(optarg, "%lu", (unsigned long *)&fs3BenchRandom) != 1) || (fs3BenchRandom == 0) ) {
+				logMessage(LOG_ERROR_LEVEL, "Bad seed [%s]", optarg);
+				return(-1);
+			}
+			break;
+
+		case 'i': // Get the IP address
+			if (inet_addr(optarg) == INADDR_NONE) {
+				logMessage( LOG_ERROR_LEVEL, "Bad IP address [%s]", optarg );
+				return(-1);
+			}
+			fs3_network_address = (unsigned char *)strdup(optarg);
+			break;
+
+		case 'p': // Set the network port number
+			if ( sscanf(optarg, "%hu", &fs3_network_port) != 1 ) {
+				logMessage( LOG_ERROR_LEVEL, "Bad  port number [%s]", optarg );
+				return(-1);
+			}
+			break;
+
+		default:  // Default (unknown)
+			fprintf( stderr, "Unknown command line option (%c), aborting.\n", ch );
+			return( -1 );
+		}
+	}
+
+	// Setup the log as needed
+	if ( ! log_initialized ) {
+		initializeLogWithFilehandle( CMPSC311_LOG_STDERR );
+	}
+	FS3ControllerLLevel = registerLogLevel("FS3_CONTROLLER", 0); // Controller log level
+	FS3DriverLLevel= registerLogLevel("FS3_DRIVER", 0);          // Driver log level
+	FS3SimulatorLLevel= registerLogLevel("FS3_SIMULATOR", 0);    // Benchmark log level
+	if ( verbose ) {
+		enableLogLevels(FS3ControllerLLevel | FS3DriverLLevel | FS3SimulatorLLevel);
+	}
+
+	// Startup the interface
+	memset(fs3BenchHandles, 0xff, sizeof(fs3BenchHandles));
+	if ( ((fs3BenchBuffer = malloc(FS3_BENCH_MAX_IO)) == NULL) || (fs3_mount_disk() == -1) ||
+			(fs3_init_cache(fs3BenchCache) == -1) ) {
+		logMessage( LOG_ERROR_LEVEL, "FS3 benchmark failed initialization.");
+		return( -1 );
+	}
+	for (ch=0; ch<FS3_BENCH_MAX_IO; ch++) {
+		fs3BenchBuffer[ch] = 'a' + ch % 26;
+	}
+
+	// Run every combination, the widest sweep innermost
+	if ( fs3BenchJson ) {
+		printf("[\n");
+	} else {
+		printf("pattern,files,working_set_kb,io_size,zipf,ops,secs,ops_per_sec,mb_per_sec,p50_us,p99_us,p999_us,commands_per_op\n");
+	}
+	for (f=0; f<nfiles; f++) {
+		for (w=0; w<nwsets; w++) {
+			for (s=0; s<nsizes; s++) {
+				iosize = (int)sizes[s];
+				fsize = (uint32_t)(wsets[w] * 1024 / files[f]) / iosize * iosize;
+				if ( fsize == 0 ) {
+					logMessage( LOG_ERROR_LEVEL, "Working set of %.0f KB over %.0f files is less than one %d byte I/O per file, skipped.",
+							wsets[w], files[f], iosize );
+					continue;
+				}
+				for (z=0; z<nthetas; z++) {
+					for (p=0; p<npatterns; p++) {
+						if ( bench_run((int)patterns[p], (int)files[f], fsize, iosize, thetas[z], &res) == -1 ) {
+							logMessage( LOG_ERROR_LEVEL, "FS3 benchmark run failed (%s, %.0f files, %u bytes each, %d byte I/O).",
+									fs3BenchPatterns[(int)patterns[p]], files[f], fsize, iosize );
+							return( -1 );
+						}
+						bench_print((int)patterns[p], (int)files[f], (uint32_t)wsets[w], iosize, thetas[z], &res);
+					}
+				}
+			}
+		}
+	}
+	if ( fs3BenchJson ) {
+		printf("\n]\n");
+	}
+
+	// Shut down the interface
+	if ((fs3_unmount_disk() == -1) || (fs3_close_cache() == -1)) {
+		logMessage( LOG_ERROR_LEVEL, "FS3 benchmark failed shutdown.");
+		return( -1 );
+	}
+	free(fs3BenchBuffer);
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : bench_list
+// Description  : Parse a comma separated list of numbers
+//
+// Inputs       : arg - the list
+//                vals - where to put the numbers
+//                low - the smallest number allowed
+//                high - the largest number allowed
+// Outputs      : the number of values, -1 if failure
+
+int bench_list(char *arg, double *vals, double low, double high) {
+
+	// Local variables
+	char *pos = arg, *next;
+	int count = 0;
+
+	do {
+		vals[count] = strtod(pos, &next);
+		if ( (next == pos) || ((*next != ',') && (*next != 0x0)) || (vals[count] < low) || (vals[count] > high) ) {
+			logMessage( LOG_ERROR_LEVEL, "Bad value in list [%s], each must be %.0f to %.0f", arg, low, high );
+			return( -1 );
+		}
+		count ++;
+		pos = next + 1;
+	} while ( (*next == ',') && (count < FS3_BENCH_MAX_VALUES) );
+	if ( *next != 0x0 ) {
+		logMessage( LOG_ERROR_LEVEL, "Too many values in list [%s]", arg );
+		return( -1 );
+	}
+	return( count );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : bench_patterns
+// Description  : Parse a comma separated list of access patterns
+//
+// Inputs       : arg - the list
+//                vals - where to put the patterns
+// Outputs      : the number of patterns, -1 if failure
+
+int bench_patterns(char *arg, double *vals) {
+
+	// Local variables
+	char *list = strdup(arg), *name, *save = NULL;
+	int count = 0, i;
+
+	for (name=strtok_r(list, ",", &save); name != NULL; name=strtok_r(NULL, ",", &save)) {
+		for (i=0; (i<FS3_BENCH_PATTERNS) && (strcmp(name, fs3BenchPatterns[i]) != 0); i++);
+		if ( (i == FS3_BENCH_PATTERNS) || (count == FS3_BENCH_MAX_VALUES) ) {
+			logMessage( LOG_ERROR_LEVEL, "Bad access pattern [%s]", name );
+			free(list);
+			return( -1 );
+		}
+		vals[count++] = i;
+	}
+	free(list);
+	return( (count > 0) ? count : -1 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : bench_run
+// Description  : Run one case of the benchmark: fill the files, drop the
+//                cache, then time each read or write on its own
+//
+// Inputs       : pattern - FS3_BENCH_SEQREAD ... FS3_BENCH_RANDWRITE
+//                files - the number of files
+//                fsize - the bytes of each file used
+//                iosize - the size of each read or write
+//                theta - the Zipf exponent of file popularity
+//                res - where to put what was measured
+// Outputs      : 0 if successful, -1 if failure
+
+int bench_run(int pattern, int files, uint32_t fsize, int iosize, double theta, FS3BenchResult *res) {
+
+	// Local variables
+	uint32_t cursor[FS3_BENCH_MAX_FILES], off;
+	unsigned long *latency, commands, n;
+	struct timespec start, end, t0, t1;
+	double total = 0;
+	int f, write = (pattern == FS3_BENCH_SEQWRITE) || (pattern == FS3_BENCH_RANDWRITE);
+	int random = (pattern == FS3_BENCH_RANDREAD) || (pattern == FS3_BENCH_RANDWRITE);
+
+	// Get the files ready, start with a cold cache
+	if ( (bench_fill(files, fsize) == -1) || (fs3_close_cache() == -1) || (fs3_init_cache(fs3BenchCache) == -1) ) {
+		return( -1 );
+	}
+	for (f=0; f<files; f++) {
+		total += pow(f + 1, -theta);
+		fs3BenchPopularity[f] = total;
+		cursor[f] = 0;
+	}
+	for (f=0; f<files; f++) {
+		fs3BenchPopularity[f] /= total;
+	}
+	if ( (latency = malloc(sizeof(unsigned long) * fs3BenchOps)) == NULL ) {
+		return( -1 );
+	}
+
+	// Each operation is a seek and a read or write, sequential ones carry on where the file left off
+	commands = network_fs3_commands();
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (n=0; n<fs3BenchOps; n++) {
+		f = bench_file(files);
+		if ( random ) {
+			off = (uint32_t)(bench_random() % (fsize / iosize)) * iosize;
+		} else {
+			off = cursor[f];
+			cursor[f] = (off + iosize < fsize) ? off + iosize : 0;
+		}
+		clock_gettime(CLOCK_MONOTONIC, &t0);
+		if ( (fs3_seek(fs3BenchHandles[f], off) == -1) ||
+				((write) ? fs3_write(fs3BenchHandles[f], fs3BenchBuffer, iosize) :
+				fs3_read(fs3BenchHandles[f], fs3BenchBuffer, iosize)) != iosize ) {
+			logMessage( LOG_ERROR_LEVEL, "Benchmark %s of %d bytes at %u in file %d failed", (write) ? "write" : "read", iosize, off, f );
+			free(latency);
+			return( -1 );
+		}
+		clock_gettime(CLOCK_MONOTONIC, &t1);
+		latency[n] = (t1.tv_sec - t0.tv_sec) * 1000000000UL + t1.tv_nsec - t0.tv_nsec;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	// Work out the rates and the latency percentiles
+	qsort(latency, fs3BenchOps, sizeof(unsigned long), bench_compare);
+	res->ops = fs3BenchOps;
+	res->bytes = fs3BenchOps * iosize;
+	res->commands = network_fs3_commands() - commands;
+	res->secs = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+	res->p50 = latency[(fs3BenchOps - 1) * 500 / 1000] / 1e3;
+	res->p99 = latency[(fs3BenchOps - 1) * 990 / 1000] / 1e3;
+	res->p999 = latency[(fs3BenchOps - 1) * 999 / 1000] / 1e3;
+	free(latency);
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : bench_fill
+// Description  : Open the files a run uses and write them out to its size;
+//                they stay open, later runs grow them as they need to (the
+//                driver never gives a file's sectors back)
+//
+// Inputs       : files - the number of files
+//                fsize - the bytes of each file used
+// Outputs      : 0 if successful, -1 if failure
+
+int bench_fill(int files, uint32_t fsize) {
+
+	// Local variables
+	char fname[FS3_MAX_PATH_LENGTH];
+	int f, len;
+
+	for (f=0; f<files; f++) {
+		if ( fs3BenchHandles[f] == -1 ) {
+			snprintf(fname, sizeof(fname), "fs3_bench.%03d", f);
+			if ( (fs3BenchHandles[f] = fs3_open(fname)) == -1 ) {
+				logMessage( LOG_ERROR_LEVEL, "Benchmark can't open file [%s]", fname );
+				return( -1 );
+			}
+		}
+		if ( (fs3BenchSizes[f] < fsize) && (fs3_seek(fs3BenchHandles[f], fs3BenchSizes[f]) == -1) ) {
+			return( -1 );
+		}
+		while ( fs3BenchSizes[f] < fsize ) {
+			len = CMPSC311_MINVAL(fsize - fs3BenchSizes[f], FS3_BENCH_FILL);
+			if ( fs3_write(fs3BenchHandles[f], fs3BenchBuffer, len) != len ) {
+				logMessage( LOG_ERROR_LEVEL, "Benchmark can't fill file %d to %u bytes (is the disk full?)", f, fsize );
+				return( -1 );
+			}
+			fs3BenchSizes[f] += len;
+		}
+	}
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : bench_file
+// Description  : Pick the file of the next operation by its popularity
+//
+// Inputs       : files - the number of files
+// Outputs      : the file
+
+int bench_file(int files) {
+
+	// Local variables
+	double u = (bench_random() >> 11) * (1.0 / 9007199254740992.0);
+	int low = 0, high = files - 1, mid;
+
+	while ( low < high ) {
+		mid = (low + high) / 2;
+		if ( fs3BenchPopularity[mid] > u ) {
+			high = mid;
+		} else {
+			low = mid + 1;
+		}
+	}
+	return( low );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : bench_random
+// Description  : The next number of the random generator (xorshift64*), the
+//                same sequence for the same seed on every host
+//
+// Inputs       : none
+// Outputs      : the number
+
+uint64_t bench_random(void) {
+	fs3BenchRandom ^= fs3BenchRandom >> 12;
+	fs3BenchRandom ^= fs3BenchRandom << 25;
+	fs3BenchRandom ^= fs3BenchRandom >> 27;
+	return( fs3BenchRandom * 2685821657736338717ULL );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : bench_compare
+// Description  : Order two latencies for qsort
+//
+// Inputs       : a - the first
+//                b - the second
+// Outputs      : <0, 0 or >0
+
+int bench_compare(const void *a, const void *b) {
+	unsigned long x = *(const unsigned long *)a, y = *(const unsigned long *)b;
+	return( (x > y) - (x < y) );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : bench_print
+// Description  : Print the row of one run (the columns never change order,
+//                new ones go on the end)
+//
+// Inputs       : pattern - the access pattern
+//                files - the number of files
+//                wset - the working set, in KB
+//                iosize - the size of each read or write
+//                theta - the Zipf exponent
+//                res - what was measured
+// Outputs      : none
+
+void bench_print(int pattern, int files, uint32_t wset, int iosize, double theta, FS3BenchResult *res) {
+
+	// Local variables
+	double ops = (res->secs > 0) ? res->ops / res->secs : 0;
+	double mbs = (res->secs > 0) ? res->bytes / res->secs / 1e6 : 0;
+	double commands = (double)res->commands / res->ops;
+
+	if ( fs3BenchJson ) {
+		printf("%s  {\"pattern\": \"%s\", \"files\": %d, \"working_set_kb\": %u, \"io_size\": %d, \"zipf\": %.2f, "
+				"\"ops\": %lu, \"secs\": %.6f, \"ops_per_sec\": %.1f, \"mb_per_sec\": %.3f, "
+				"\"p50_us\": %.1f, \"p99_us\": %.1f, \"p999_us\": %.1f, \"commands_per_op\": %.3f}",
+				(fs3BenchRows > 0) ? ",\n" : "", fs3BenchPatterns[pattern], files, wset, iosize, theta,
+				res->ops, res->secs, ops, mbs, res->p50, res->p99, res->p999, commands);
+	} else {
+		printf("%s,%d,%u,%d,%.2f,%lu,%.6f,%.1f,%.3f,%.1f,%.1f,%.1f,%.3f\n", fs3BenchPatterns[pattern], files, wset, iosize, theta,
+				res->ops, res->secs, ops, mbs, res->p50, res->p99, res->p999, commands);
+	}
+	fflush(stdout);
+	fs3BenchRows ++;
+}
@@ -5,17 +5,27 @@
 //                   FS3 filesystem interface.
 //
 //  Author         : Patrick McDaniel
-//  Last Modified  : Sun 17 Oct 2021 09:36:52 AM EDT
+//  Last Modified  : Mon 19 Oct 2026 04:51:45 AM UTC
 //
 
 // Includes
 #include "cmpsc311_log.h"
+#include "cmpsc311_util.h"
 
 // Project Includes
 #include "fs3_cache.h"
+#include "fs3_network.h"
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <errno.h>
+#include <limits.h>
+#include <sched.h>
+#include <signal.h>
 
 //
 // Support Macros/Data
@@ -24,20 +34,105 @@
 
 typedef struct
 {
-    char buf[1024];
     int trkFind;
     int secFind;
     int lastAcc;
+    int16_t owner;
+    uint32_t seq;
 } cache;
-// struct that holds initialized variables associated to the file
+// struct that holds initialized variables associated to the file (the sector data lives in the slab, seq is odd while a shared line is rewritten)
+
+typedef struct
+{
+    int trkFind;
+    int secFind;
+    int refBit;
+} l2cache;
+// struct that describes one sector slot of the L2 spill file (the data lives in the file)
+
+typedef struct
+{
+    int used;
+    int quota;
+    int reserve;
+    int pinned;
+    int hit;
+    int miss;
+} cachePart;
+// struct that holds the accounting of one file's share of the cache
+
+typedef struct
+{
+    int32_t pid;
+    int hit;
+    int miss;
+} cacheShareProc;
+// struct that holds the lookups of one process attached to a shared cache
+
+typedef struct
+{
+    uint32_t magic;
+    uint32_t lines;
+    uint32_t lock __attribute__((aligned(64)));
+    int clk __attribute__((aligned(64)));
+    cacheShareProc procs[FS3_CACHE_SHARE_PROCS] __attribute__((aligned(64)));
+} cacheShareHdr;
+// struct at the front of a shared cache segment, the lines and the slab follow (lock is the pid of the process inserting, 0 when free)
+
+#define CACHE_PART(fd) (((fd) < 0) ? FS3_CACHE_MAX_PARTITIONS : (fd)) // Partition index, unowned lines share the last one
+#define CACHE_VICTIM_OWN 0          // Only the requesting partition's own lines
+#define CACHE_VICTIM_OVER_RESERVE 1 // Unpinned lines whose partition holds more than its reservation
+#define CACHE_VICTIM_UNPINNED 2     // Any unpinned line
+
+#define CACHE_HUGE_PAGE_SIZE (2 * 1024 * 1024)                               // Size of an x86-64 huge page
+#define CACHE_LINE(i) (cacheData + ((size_t)(i) * FS3_CACHE_SLOT_SIZE))       // Sector slot of a cache line
+#define CACHE_SLAB_SMALL 0                                                    // Slab uses regular pages
+#define CACHE_SLAB_THP 1                                                      // Slab is eligible for transparent huge pages
+#define CACHE_SLAB_HUGETLB 2                                                  // Slab is backed by reserved huge pages
+#define CACHE_SLAB_SHARED 3                                                   // Slab is part of a segment shared with other processes
+
+#define CACHE_SHARE_MAGIC 0x46533343                                          // "FS3C", set once the segment is laid out
+#define CACHE_SHARE_LINES ((sizeof(cacheShareHdr) + 63) & ~(size_t)63)         // Offset of the lines in the segment
+#define CACHE_SHARE_SLAB(n) ((CACHE_SHARE_LINES + (size_t)(n) * sizeof(cache) + 4095) & ~(size_t)4095) // Offset of the slab
+#define CACHE_SHARE_SIZE(n) (CACHE_SHARE_SLAB(n) + (size_t)(n) * FS3_CACHE_SLOT_SIZE) // Size of a segment of n lines
+#define CACHE_SHARE_RETRIES 64                                                // Reads of a line being rewritten before calling it a miss
+#define CACHE_SHARE_CHECK 1024                                                // Lock attempts between checks that its holder is alive
+#define CACHE_SHARE_WAIT 1000                                                 // Milliseconds to wait for another process to lay out the segment
+
+static int fs3_cache_victim(int16_t fd, int mode); // Pick the LRU line a partition may replace
+static int fs3_cache_insert(int16_t fd, FS3TrackIndex trk, FS3SectorIndex sct, void *buf); // Put a sector in a line
+static void fs3_cache_reset_partitions(void);      // Empty the partitions' accounting
 
 // global variables that are modifiable
-cache *cacheStruct;
+cache *cacheStruct; // Lines of the cache (inside the segment when shared)
+char *cacheData;  // Slab of sector slots, one per cache line
+size_t slabSize;  // Length of the slab mapping
+int slabMode;     // How the slab was allocated (CACHE_SLAB_*)
 int hit;
 int miss;
+int leaseMiss; // Lookups turned away because the lease wasn't held (counted in miss too)
 int cacheIns;
 int clk;
 int maxCache;
+cachePart cacheParts[FS3_CACHE_MAX_PARTITIONS + 1];
+
+// Shared cache state (private cache when cacheShare is NULL)
+cacheShareHdr *cacheShare = NULL;
+char shareName[NAME_MAX];
+int shareProc = -1; // Slot of this process in the segment's table, -1 if it was full
+char shareBuf[FS3_SECTOR_SIZE] __attribute__((aligned(FS3_CACHE_LINE_ALIGN))); // Copy of the sector handed out on a shared hit
+
+// L2 victim cache state (disabled when l2Fd is -1)
+l2cache *l2Struct;
+int32_t l2Index[FS3_NET_MAX_TRACKS][FS3_TRACK_SIZE]; // Slot holding each sector, -1 if not in L2
+int l2Fd = -1;
+int l2Hand;
+int maxL2;
+int l2Hit;
+int l2Miss;
+int l2Ins;
+int l2Evict;
+char l2Buf[FS3_SECTOR_SIZE] __attribute__((aligned(FS3_CACHE_LINE_ALIGN))); // Staging buffer used when promoting a sector out of L2
 //
 // Implementation
 
@@ -60,15 +155,339 @@ int fs3_init_cache(uint16_t cachelines)
         return -1;
     }
 
-    for (i = 0; i < (0x8); i++) // Walk array marking cachelines unused.
+    slabSize = (size_t)cachelines * FS3_CACHE_SLOT_SIZE; // Sector data goes in a separate page-aligned slab
+    cacheData = MAP_FAILED;
+    if (slabSize >= CACHE_HUGE_PAGE_SIZE) // Big enough to be worth huge pages, try reserved ones first
+    {
+        slabSize = (slabSize + CACHE_HUGE_PAGE_SIZE - 1) & ~((size_t)CACHE_HUGE_PAGE_SIZE - 1);
+        slabMode = CACHE_SLAB_HUGETLB;
+        cacheData = mmap(NULL, slabSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    }
+    if (cacheData == MAP_FAILED) // No reserved huge pages, fall back to regular pages and ask for THP
+    {
+        slabMode = CACHE_SLAB_SMALL;
+        cacheData = mmap(NULL, slabSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (cacheData == MAP_FAILED)
+        {
+            logMessage(LOG_ERROR_LEVEL, "Failed mapping cache slab of %lu bytes (%s)", slabSize, strerror(errno));
+            free(cacheStruct);
+            cacheStruct = NULL;
+            cacheData = NULL;
+            return -1;
+        }
+        if ((slabSize >= CACHE_HUGE_PAGE_SIZE) && (madvise(cacheData, slabSize, MADV_HUGEPAGE) == 0))
+        {
+            slabMode = CACHE_SLAB_THP;
+        }
+    }
+
+    for (i = 0; i < cachelines; i++) // Walk array marking cachelines unused.
     {
         cacheStruct[i].trkFind = -1;
         cacheStruct[i].secFind = -1;
         cacheStruct[i].lastAcc = 0;
+        cacheStruct[i].owner = FS3_CACHE_NO_OWNER;
+        cacheStruct[i].seq = 0;
     }
+    fs3_cache_reset_partitions();
     return 0; // If run correctly, return success
 }
 
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_cache_reset_partitions
+// Description  : Empty the accounting of every partition, quotas are kept
+//                across re-initialization
+//
+// Inputs       : none
+// Outputs      : none
+
+static void fs3_cache_reset_partitions(void)
+{
+    int i;
+    for (i = 0; i <= FS3_CACHE_MAX_PARTITIONS; i++)
+    {
+        cacheParts[i].used = 0;
+        cacheParts[i].pinned = 0;
+        cacheParts[i].hit = 0;
+        cacheParts[i].miss = 0;
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_init_shared_cache
+// Description  : Attach to a cache shared by the processes on this host
+//                through a named shared-memory segment, laying it out with
+//                a number of lines if this process is the first. The
+//                segment outlives the processes, so the next one starts
+//                warm (remove /dev/shm/<name> to drop it). Lookups take
+//                no lock: each line has a sequence number that is odd
+//                while the line is rewritten, and a reader that sees it
+//                change under its copy tries again. Inserts take a lock
+//                in the segment.
+//
+// Inputs       : name - the name of the segment
+//                cachelines - the number of lines, if the segment is new
+// Outputs      : 0 if successful, -1 if failure
+
+int fs3_init_shared_cache(const char *name, uint16_t cachelines)
+{
+    char path[NAME_MAX];
+    struct stat st;
+    void *seg;
+    int32_t owner;
+    int fd, created, waited, pass, i;
+
+    if (fs3_network_leases) // A lease is one process's, it can't vouch for lines other processes read
+    {
+        logMessage(LOG_ERROR_LEVEL, "A shared cache can't be kept coherent by a lease");
+        return -1;
+    }
+    snprintf(path, sizeof(path), "/%s", name);
+    created = 1;
+    if ((fd = shm_open(path, O_RDWR | O_CREAT | O_EXCL, S_IRUSR | S_IWUSR)) == -1)
+    {
+        created = 0; // Another process made it, use theirs
+        if ((errno != EEXIST) || ((fd = shm_open(path, O_RDWR, 0)) == -1))
+        {
+            logMessage(LOG_ERROR_LEVEL, "Failed opening shared cache [%s] (%s)", name, strerror(errno));
+            return -1;
+        }
+    }
+    if (created && (ftruncate(fd, CACHE_SHARE_SIZE(cachelines)) == -1))
+    {
+        logMessage(LOG_ERROR_LEVEL, "Failed sizing shared cache [%s] (%s)", name, strerror(errno));
+        close(fd);
+        shm_unlink(path);
+        return -1;
+    }
+    for (waited = 0; (fstat(fd, &st) == 0) && (st.st_size < (off_t)sizeof(cacheShareHdr)) && (waited < CACHE_SHARE_WAIT); waited++)
+    {
+        usleep(1000); // Created, but not sized yet
+    }
+    if ((st.st_size < (off_t)sizeof(cacheShareHdr)) ||
+        ((seg = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED))
+    {
+        logMessage(LOG_ERROR_LEVEL, "Failed mapping shared cache [%s]", name);
+        close(fd);
+        return -1;
+    }
+    close(fd);
+    cacheShare = seg;
+    slabSize = st.st_size;
+
+    if (created) // Lay it out, the others wait for the magic
+    {
+        cacheStruct = (cache *)((char *)seg + CACHE_SHARE_LINES);
+        for (i = 0; i < cachelines; i++)
+        {
+            cacheStruct[i].trkFind = -1;
+            cacheStruct[i].secFind = -1;
+            cacheStruct[i].owner = FS3_CACHE_NO_OWNER;
+        }
+        cacheShare->lines = cachelines;
+        __atomic_store_n(&cacheShare->magic, CACHE_SHARE_MAGIC, __ATOMIC_RELEASE);
+    }
+    for (waited = 0; (__atomic_load_n(&cacheShare->magic, __ATOMIC_ACQUIRE) != CACHE_SHARE_MAGIC) && (waited < CACHE_SHARE_WAIT); waited++)
+    {
+        usleep(1000);
+    }
+    if ((cacheShare->magic != CACHE_SHARE_MAGIC) || (CACHE_SHARE_SIZE(cacheShare->lines) != slabSize))
+    {
+        logMessage(LOG_ERROR_LEVEL, "Shared cache [%s] was never laid out (remove /dev/shm%s)", name, path);
+        munmap(seg, slabSize);
+        cacheShare = NULL;
+        return -1;
+    }
+    if (cacheShare->lines != cachelines)
+    {
+        logMessage(LOG_WARNING_LEVEL, "Shared cache [%s] has %u lines, not %u", name, cacheShare->lines, cachelines);
+    }
+
+    maxCache = cacheShare->lines;
+    cacheStruct = (cache *)((char *)seg + CACHE_SHARE_LINES);
+    cacheData = (char *)seg + CACHE_SHARE_SLAB(maxCache);
+    slabMode = CACHE_SLAB_SHARED;
+    strncpy(shareName, name, sizeof(shareName) - 1);
+    fs3_cache_reset_partitions();
+
+    shareProc = -1; // Take this process's old slot, a free one, or the one of a process that is gone
+    for (pass = 0; (shareProc == -1) && (pass < 3); pass++)
+    {
+        for (i = 0; (shareProc == -1) && (i < FS3_CACHE_SHARE_PROCS); i++)
+        {
+            owner = __atomic_load_n(&cacheShare->procs[i].pid, __ATOMIC_RELAXED);
+            if (((pass == 0) && (owner == getpid())) || ((pass == 1) && (owner == 0)) ||
+                ((pass == 2) && (kill(owner, 0) == -1) && (errno == ESRCH)))
+            {
+                if ((owner == getpid()) || __atomic_compare_exchange_n(&cacheShare->procs[i].pid, &owner, getpid(), 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                {
+                    if (owner != getpid())
+                    {
+                        cacheShare->procs[i].hit = cacheShare->procs[i].miss = 0;
+                    }
+                    shareProc = i;
+                }
+            }
+        }
+    }
+    logMessage(LOG_INFO_LEVEL, "Shared cache [%s] %s, %d lines", name, (created) ? "created" : "attached", maxCache);
+    return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_cache_lock
+// Description  : Take the insert lock of a shared cache (nothing to do for
+//                a private one); a lock left by a process that died is
+//                taken over, dropping the line it was rewriting
+//
+// Inputs       : none
+// Outputs      : none
+
+static void fs3_cache_lock(void)
+{
+    uint32_t holder = 0;
+    int tries = 0;
+    int i;
+
+    if (cacheShare == NULL)
+    {
+        return;
+    }
+    while (!__atomic_compare_exchange_n(&cacheShare->lock, &holder, (uint32_t)getpid(), 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+    {
+        if ((++tries % CACHE_SHARE_CHECK == 0) && (kill((pid_t)holder, 0) == -1) && (errno == ESRCH) &&
+            __atomic_compare_exchange_n(&cacheShare->lock, &holder, (uint32_t)getpid(), 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+        {
+            for (i = 0; i < maxCache; i++)
+            {
+                if (cacheStruct[i].seq & 1) // Half written, nothing in it can be trusted
+                {
+                    cacheStruct[i].trkFind = -1;
+                    cacheStruct[i].secFind = -1;
+                    __atomic_store_n(&cacheStruct[i].seq, cacheStruct[i].seq + 1, __ATOMIC_RELEASE);
+                }
+            }
+            logMessage(LOG_WARNING_LEVEL, "Shared cache lock taken over from process %u", holder);
+            return;
+        }
+        holder = 0;
+        sched_yield(); // The holder is a few copies from done, let it run
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_cache_unlock
+// Description  : Release the insert lock of a shared cache
+//
+// Inputs       : none
+// Outputs      : none
+
+static void fs3_cache_unlock(void)
+{
+    if (cacheShare != NULL)
+    {
+        __atomic_store_n(&cacheShare->lock, 0, __ATOMIC_RELEASE);
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_cache_rewrite_begin
+// Description  : Mark a line as being rewritten (odd sequence) for lookups
+//                in other processes, before anything in it changes
+//
+// Inputs       : i - the line
+// Outputs      : none
+
+static void fs3_cache_rewrite_begin(int i)
+{
+    if (cacheShare != NULL)
+    {
+        __atomic_store_n(&cacheStruct[i].seq, cacheStruct[i].seq + 1, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_RELEASE); // Odd is visible before the line changes
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_cache_rewrite_end
+// Description  : Mark a line as rewritten (even sequence) once everything
+//                in it has changed
+//
+// Inputs       : i - the line
+// Outputs      : none
+
+static void fs3_cache_rewrite_end(int i)
+{
+    if (cacheShare != NULL)
+    {
+        __atomic_store_n(&cacheStruct[i].seq, cacheStruct[i].seq + 1, __ATOMIC_RELEASE); // The line is visible before even
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_cache_tick
+// Description  : Advance the LRU clock (the segment's when shared)
+//
+// Inputs       : none
+// Outputs      : the time of the access
+
+static int fs3_cache_tick(void)
+{
+    if (cacheShare != NULL)
+    {
+        return __atomic_fetch_add(&cacheShare->clk, 1, __ATOMIC_RELAXED);
+    }
+    return clk++;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_cache_read_line
+// Description  : Check whether a line holds a sector; in a shared cache the
+//                sector is copied out and the copy kept only if the line
+//                didn't change under it
+//
+// Inputs       : i - the line
+//                trk - the track number of the sector
+//                sct - the sector number of the sector
+// Outputs      : the sector data, NULL if the line holds something else
+
+static char *fs3_cache_read_line(int i, FS3TrackIndex trk, FS3SectorIndex sct)
+{
+    uint32_t seq;
+    int tries;
+
+    if (cacheShare == NULL)
+    {
+        return ((cacheStruct[i].secFind == sct) && (cacheStruct[i].trkFind == trk)) ? CACHE_LINE(i) : NULL;
+    }
+    for (tries = 0; tries < CACHE_SHARE_RETRIES; tries++)
+    {
+        seq = __atomic_load_n(&cacheStruct[i].seq, __ATOMIC_ACQUIRE);
+        if (seq & 1)
+        {
+            continue; // Being rewritten, look again
+        }
+        if ((cacheStruct[i].secFind != sct) || (cacheStruct[i].trkFind != trk))
+        {
+            return NULL;
+        }
+        memcpy(shareBuf, CACHE_LINE(i), FS3_SECTOR_SIZE);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&cacheStruct[i].seq, __ATOMIC_RELAXED) == seq)
+        {
+            return shareBuf;
+        }
+    }
+    return NULL; // Kept changing, the network has it
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 //
 // Function     : fs3_close_cache
@@ -79,12 +498,24 @@ int fs3_init_cache(uint16_t cachelines)
 
 int fs3_close_cache(void)
 {
+    if (cacheShare != NULL) // The lines stay in the segment for the next process
+    {
+        munmap(cacheShare, slabSize);
+        cacheShare = NULL;
+        cacheStruct = NULL;
+        cacheData = NULL;
+    }
     if (cacheStruct != NULL)
     {
         free(cacheStruct);  // When closing, free all memory from cache
         cacheStruct = NULL; // After freeing, set cacheStruct to NULL since it is still being pointed to
     }
-    return 0;
+    if (cacheData != NULL)
+    {
+        munmap(cacheData, slabSize);
+        cacheData = NULL;
+    }
+    return fs3_close_l2_cache();
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -97,52 +528,158 @@ int fs3_close_cache(void)
 // Outputs      : 0 if inserted, -1 if not inserted
 
 int fs3_put_cache(FS3TrackIndex trk, FS3SectorIndex sct, void *buf)
+{
+    return fs3_put_cache_file(FS3_CACHE_NO_OWNER, trk, sct, buf);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_put_cache_file
+// Description  : Put an element in the cache, charging it to a file's partition
+//
+// Inputs       : fd - the file (partition) that owns the sector
+//                trk - the track number of the sector to put in cache
+//                sct - the sector number of the sector to put in cache
+//                buf - the sector data
+// Outputs      : 0 if inserted, -1 if not inserted
+
+int fs3_put_cache_file(int16_t fd, FS3TrackIndex trk, FS3SectorIndex sct, void *buf)
+{
+    int ret;
+
+    fs3_cache_lock();
+    ret = fs3_cache_insert((cacheShare != NULL) ? FS3_CACHE_NO_OWNER : fd, trk, sct, buf); // Shared lines belong to no one process's file
+    fs3_cache_unlock();
+    return ret;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_cache_insert
+// Description  : Put a sector in the line holding it, or in a free or
+//                victim line (a shared cache is locked by the caller)
+//
+// Inputs       : fd - the file (partition) that owns the sector
+//                trk - the track number of the sector to put in cache
+//                sct - the sector number of the sector to put in cache
+//                buf - the sector data
+// Outputs      : 0 if inserted, -1 if not inserted
+
+static int fs3_cache_insert(int16_t fd, FS3TrackIndex trk, FS3SectorIndex sct, void *buf)
 {
     int i;
-    int current;
     int memInd;
+    cachePart *part = &cacheParts[CACHE_PART(fd)];
+    fs3_l2_invalidate(trk, sct); // The L1 copy is authoritative from here on, drop any stale victim
     for (i = 0; i < maxCache; i++)
     {
         if (cacheStruct[i].secFind == sct && cacheStruct[i].trkFind == trk) // Case where you find a sector and track and you put it in the cache
         {
-            memcpy(cacheStruct[i].buf, buf, 1024);
-            cacheStruct[i].lastAcc = clk;
-            clk++;
+            fs3_cache_rewrite_begin(i);
+            memcpy(CACHE_LINE(i), buf, FS3_SECTOR_SIZE);
+            fs3_cache_rewrite_end(i);
+            cacheStruct[i].lastAcc = fs3_cache_tick();
             cacheIns++; // Updating cache Inserts in every case for metrics
             return 0;
         }
     }
-    for (i = 0; i < maxCache; i++)
+
+    memInd = -1;
+    if ((part->quota > 0) && (part->used >= part->quota)) // Partition is at its quota, it can only replace its own lines
     {
-        if (cacheStruct[i].secFind == -1 && cacheStruct[i].trkFind == -1) // Case where you don't find a sector and a track and put mem in cache
+        memInd = fs3_cache_victim(fd, CACHE_VICTIM_OWN);
+    }
+    else
+    {
+        for (i = 0; i < maxCache; i++)
         {
-            memcpy(cacheStruct[i].buf, buf, 1024);
-            cacheStruct[i].trkFind = trk;
-            cacheStruct[i].secFind = sct;
-            cacheStruct[i].lastAcc = clk;
-            clk++;
-            cacheIns++; // Updating cache Inserts in every case for metrics
-            return 0;
+            if (cacheStruct[i].secFind == -1 && cacheStruct[i].trkFind == -1) // Case where you don't find a sector and a track and put mem in cache
+            {
+                memInd = i;
+                break;
+            }
+        }
+        if (memInd == -1) // LRU case, prefer lines of partitions over their reservation, then any unpinned line, then our own
+        {
+            if ((memInd = fs3_cache_victim(fd, CACHE_VICTIM_OVER_RESERVE)) == -1)
+            {
+                if ((memInd = fs3_cache_victim(fd, CACHE_VICTIM_UNPINNED)) == -1)
+                {
+                    memInd = fs3_cache_victim(fd, CACHE_VICTIM_OWN);
+                }
+            }
         }
     }
-    current = cacheStruct[0].lastAcc; // LRU case, where you walk through the array searching for the least used access time and replacing that mem with the new one
-    for (i = 0; i < maxCache; i++)
+    if (memInd == -1) // Everything resident is pinned by other files
     {
-        if (cacheStruct[i].lastAcc < current)
+        return -1;
+    }
+
+    if (cacheStruct[memInd].trkFind != -1)
+    {
+        fs3_l2_put(cacheStruct[memInd].trkFind, cacheStruct[memInd].secFind, CACHE_LINE(memInd)); // Spill the victim to L2 (if enabled)
+        if (cacheShare == NULL) // Shared lines are unowned, and maybe another process's insert
         {
-            current = cacheStruct[i].lastAcc;
-            memInd = i; // Saving that new minimum memory index
+            cacheParts[CACHE_PART(cacheStruct[memInd].owner)].used--;
         }
     }
-    memcpy(cacheStruct[memInd].buf, buf, 1024); // Memcopies and setting that mem to its specific track and sec values
+    fs3_cache_rewrite_begin(memInd);
+    memcpy(CACHE_LINE(memInd), buf, FS3_SECTOR_SIZE); // Memcopies and setting that mem to its specific track and sec values
     cacheStruct[memInd].trkFind = trk;
     cacheStruct[memInd].secFind = sct;
-    cacheStruct[memInd].lastAcc = clk;
-    clk++;
+    cacheStruct[memInd].owner = fd;
+    fs3_cache_rewrite_end(memInd);
+    cacheStruct[memInd].lastAcc = fs3_cache_tick();
+    if (cacheShare == NULL)
+    {
+        part->used++;
+    }
     cacheIns++; // Updating cache Inserts in every case for metrics
     return 0;
 }
 
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_cache_victim
+// Description  : Find the least recently used line that may be replaced on
+//                behalf of a partition
+//
+// Inputs       : fd - the partition that needs a line
+//                mode - which lines are eligible (CACHE_VICTIM_*)
+// Outputs      : index of the victim line, -1 if none is eligible
+
+static int fs3_cache_victim(int16_t fd, int mode)
+{
+    int i;
+    int memInd = -1;
+    cachePart *owner;
+
+    for (i = 0; i < maxCache; i++)
+    {
+        owner = &cacheParts[CACHE_PART(cacheStruct[i].owner)];
+        if (mode == CACHE_VICTIM_OWN)
+        {
+            if (cacheStruct[i].owner != fd)
+            {
+                continue;
+            }
+        }
+        else if (owner->pinned) // Pinned files are never evicted by somebody else
+        {
+            continue;
+        }
+        else if ((mode == CACHE_VICTIM_OVER_RESERVE) && (cacheStruct[i].owner != fd) && (owner->used <= owner->reserve))
+        {
+            continue;
+        }
+        if ((memInd == -1) || (cacheStruct[i].lastAcc < cacheStruct[memInd].lastAcc))
+        {
+            memInd = i; // Saving that new minimum memory index
+        }
+    }
+    return memInd;
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 //
 // Function     : fs3_get_cache
@@ -154,22 +691,243 @@ int fs3_put_cache(FS3TrackIndex trk, FS3SectorIndex sct, void *buf)
 
 void *fs3_get_cache(FS3TrackIndex trk, FS3SectorIndex sct)
 {
-    return NULL;
+    return fs3_get_cache_file(FS3_CACHE_NO_OWNER, trk, sct);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_get_cache_file
+// Description  : Get an element from the cache, accounting the lookup to a
+//                file's partition
+//
+// Inputs       : fd - the file (partition) doing the lookup
+//                trk - the track number of the sector to find
+//                sct - the sector number of the sector to find
+// Outputs      : returns NULL if not found or failed, pointer to buffer if found
+
+void *fs3_get_cache_file(int16_t fd, FS3TrackIndex trk, FS3SectorIndex sct)
+{
     int i;
+    char *line;
+    cachePart *part = &cacheParts[CACHE_PART(fd)];
+    cacheShareProc *proc = ((cacheShare != NULL) && (shareProc != -1)) ? &cacheShare->procs[shareProc] : NULL;
+    if (!network_fs3_lease_valid()) // Another client may have written it since, only the server knows
+    {
+        miss++;
+        part->miss++;
+        leaseMiss++;
+        return NULL;
+    }
     for (i = 0; i < maxCache; i++)
     {
-        if (cacheStruct[i].secFind == sct && cacheStruct[i].trkFind == trk) // Walk through array and see if track and sec are in the cache
+        if ((line = fs3_cache_read_line(i, trk, sct)) != NULL) // Walk through array and see if track and sec are in the cache
         {
-            cacheStruct[i].lastAcc = clk;
-            clk++;
+            cacheStruct[i].lastAcc = fs3_cache_tick();
             hit++;                     // Update my hits for metrics
-            return cacheStruct[i].buf; // If track and sec found, then return the buffer and continue function in driver.c
+            part->hit++;
+            if (proc != NULL)
+            {
+                proc->hit++; // And where the other processes can see them
+            }
+            return line; // If track and sec found, then return the buffer and continue function in driver.c
         }
     }
     miss++; // Update my misses for metrics
+    part->miss++;
+    if (proc != NULL)
+    {
+        proc->miss++;
+    }
+
+    if (fs3_l2_get(trk, sct, l2Buf) == 0) // L1 missed, try the victim cache before going to the network
+    {
+        if (fs3_put_cache_file(fd, trk, sct, l2Buf) == -1) // Promote back into L1, the get removed it from L2
+        {
+            fs3_l2_put(trk, sct, l2Buf); // Every line is pinned, it stays in L2 instead
+        }
+        return l2Buf;
+    }
     return NULL;
 }
 
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_peek_cache
+// Description  : Check whether a sector is resident, without touching the
+//                LRU order or the metrics
+//
+// Inputs       : trk - the track number of the sector to find
+//                sct - the sector number of the sector to find
+// Outputs      : 1 if the sector is in the cache (and can be used), 0 if not
+
+int fs3_peek_cache(FS3TrackIndex trk, FS3SectorIndex sct)
+{
+    int i;
+    if (!network_fs3_lease_valid())
+    {
+        return 0;
+    }
+    for (i = 0; i < maxCache; i++)
+    {
+        if (cacheStruct[i].secFind == sct && cacheStruct[i].trkFind == trk)
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_invalidate_cache
+// Description  : Drop a sector from the cache (and the victim cache), for
+//                when the disk changed it behind the cache's back
+//
+// Inputs       : trk - the track number of the sector
+//                sct - the sector number of the sector
+// Outputs      : 0 if successful, -1 if failure
+
+int fs3_invalidate_cache(FS3TrackIndex trk, FS3SectorIndex sct)
+{
+    int i;
+    fs3_l2_invalidate(trk, sct);
+    fs3_cache_lock();
+    for (i = 0; i < maxCache; i++)
+    {
+        if (cacheStruct[i].secFind == sct && cacheStruct[i].trkFind == trk)
+        {
+            if (cacheShare == NULL) // Shared lines are unowned, and maybe another process's insert
+            {
+                cacheParts[CACHE_PART(cacheStruct[i].owner)].used--;
+            }
+            fs3_cache_rewrite_begin(i);
+            cacheStruct[i].trkFind = -1; // Free the line for the next put
+            cacheStruct[i].secFind = -1;
+            cacheStruct[i].owner = FS3_CACHE_NO_OWNER;
+            cacheStruct[i].lastAcc = 0;
+            fs3_cache_rewrite_end(i);
+            break;
+        }
+    }
+    fs3_cache_unlock();
+    return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_invalidate_cache_all
+// Description  : Drop every sector from the cache (and the victim cache),
+//                for when too much changed behind the cache's back to say
+//                what
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int fs3_invalidate_cache_all(void)
+{
+    int i;
+    for (i = 0; i < maxCache; i++)
+    {
+        if (cacheStruct[i].trkFind != -1)
+        {
+            fs3_invalidate_cache(cacheStruct[i].trkFind, cacheStruct[i].secFind);
+        }
+    }
+    for (i = 0; (l2Fd != -1) && (i < maxL2); i++)
+    {
+        if (l2Struct[i].trkFind != -1)
+        {
+            fs3_l2_invalidate(l2Struct[i].trkFind, l2Struct[i].secFind);
+        }
+    }
+    return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_set_cache_quota
+// Description  : Set the quota (maximum lines) and reservation (lines other
+//                files may not take away) of a file's cache partition
+//
+// Inputs       : fd - the file to configure, FS3_CACHE_ALL_FILES for all of them
+//                quota - maximum number of lines, 0 for no limit
+//                reserve - minimum number of lines kept for the file
+// Outputs      : 0 if successful, -1 if failure
+
+int fs3_set_cache_quota(int16_t fd, int quota, int reserve)
+{
+    int i;
+    if ((quota < 0) || (reserve < 0) || ((quota > 0) && (reserve > quota)) || (fd >= FS3_CACHE_MAX_PARTITIONS))
+    {
+        return -1;
+    }
+    if ((cacheShare != NULL) && ((quota > 0) || (reserve > 0))) // Other processes don't know this process's files
+    {
+        logMessage(LOG_ERROR_LEVEL, "Cache quotas don't apply to a shared cache");
+        return -1;
+    }
+    for (i = 0; i < FS3_CACHE_MAX_PARTITIONS; i++)
+    {
+        if ((fd == FS3_CACHE_ALL_FILES) || (fd == i))
+        {
+            cacheParts[i].quota = quota;
+            cacheParts[i].reserve = reserve;
+        }
+    }
+    return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_cache_pin
+// Description  : Pin a file's partition so its lines are not evicted by
+//                other files, the caller then loads the file's sectors
+//
+// Inputs       : fd - the file to pin
+//                sectors - the number of sectors the file occupies
+// Outputs      : 0 if successful, -1 if the file cannot be held resident
+
+int fs3_cache_pin(int16_t fd, int sectors)
+{
+    int i;
+    int pinned = 0;
+    if ((fd < 0) || (fd >= FS3_CACHE_MAX_PARTITIONS) || (cacheShare != NULL)) // Other processes would evict a pinned file anyway
+    {
+        return -1;
+    }
+    for (i = 0; i < FS3_CACHE_MAX_PARTITIONS; i++) // Always leave at least one line for the unpinned files
+    {
+        if (cacheParts[i].pinned && (i != fd))
+        {
+            pinned += CMPSC311_MAXVAL(cacheParts[i].used, cacheParts[i].reserve);
+        }
+    }
+    if ((pinned + sectors >= maxCache) || ((cacheParts[fd].quota > 0) && (sectors > cacheParts[fd].quota)))
+    {
+        return -1;
+    }
+    cacheParts[fd].pinned = 1;
+    return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_cache_unpin
+// Description  : Make a pinned file's lines evictable again
+//
+// Inputs       : fd - the file to unpin
+// Outputs      : 0 if successful, -1 if failure
+
+int fs3_cache_unpin(int16_t fd)
+{
+    if ((fd < 0) || (fd >= FS3_CACHE_MAX_PARTITIONS))
+    {
+        return -1;
+    }
+    cacheParts[fd].pinned = 0;
+    return 0;
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 //
 // Function     : fs3_log_cache_metrics
@@ -180,8 +938,13 @@ void *fs3_get_cache(FS3TrackIndex trk, FS3SectorIndex sct)
 
 int fs3_log_cache_metrics(void)
 {
-    int cacheGet = miss + hit;                                  // Update my cache gets everytime my missess and hits update
-    float cacheHitRatio = ((float)hit / (float)cacheIns) * 100; // Update my cache hit ratio everytime by hits and cache inserts update
+    int i;
+    int resident;
+    cachePart *part;
+    cacheShareProc *proc;
+    int cacheGet = miss + hit;                                                   // Update my cache gets everytime my missess and hits update
+    float cacheHitRatio = (cacheGet) ? ((float)hit / (float)cacheGet) * 100 : 0; // Hit ratio of the L1 lookups
+    float l2HitRatio = (l2Hit + l2Miss) ? ((float)l2Hit / (float)(l2Hit + l2Miss)) * 100 : 0;
 
     printf("** FS3 cache Metrics **\n");
     printf("Cache inserts    [    %d]\n", cacheIns); // Print statements that form metrics for end of program reports
@@ -189,5 +952,259 @@ int fs3_log_cache_metrics(void)
     printf("Cache hits       [    %d]\n", hit);
     printf("Cache misses     [    %d]\n", miss);
     printf("Cache hit ratio  [%%%.2f]\n", cacheHitRatio);
+    if (leaseMiss > 0)
+    {
+        printf("Lease misses     [    %d]\n", leaseMiss); // Lookups made while the lease wasn't held
+    }
+    printf("Cache slab       [%s, %lu KB]\n", (slabMode == CACHE_SLAB_HUGETLB) ? "hugetlb" : (slabMode == CACHE_SLAB_THP) ? "thp" : (slabMode == CACHE_SLAB_SHARED) ? "shared" : "4k pages",
+           slabSize / 1024);
+    if (cacheShare != NULL) // Every process attached to the segment, its memory is paid for once
+    {
+        for (i = 0, resident = 0; i < maxCache; i++)
+        {
+            resident += (cacheStruct[i].trkFind != -1);
+        }
+        printf("Shared cache     [%s, %d/%d lines]\n", shareName, resident, maxCache);
+        for (i = 0; i < FS3_CACHE_SHARE_PROCS; i++)
+        {
+            proc = &cacheShare->procs[i];
+            if (proc->pid == 0)
+            {
+                continue;
+            }
+            printf("Process [%7d] hits [%6d] misses [%6d] ratio [%%%6.2f]%s\n", proc->pid, proc->hit, proc->miss,
+                   (proc->hit + proc->miss) ? ((float)proc->hit / (float)(proc->hit + proc->miss)) * 100 : 0,
+                   (i == shareProc) ? " this process" : ((kill(proc->pid, 0) == -1) && (errno == ESRCH)) ? " exited" : "");
+        }
+    }
+    if (l2Fd != -1)
+    {
+        printf("L2 inserts       [    %d]\n", l2Ins); // Victim cache metrics, only when the L2 tier is enabled
+        printf("L2 evictions     [    %d]\n", l2Evict);
+        printf("L2 hits          [    %d]\n", l2Hit);
+        printf("L2 misses        [    %d]\n", l2Miss);
+        printf("L2 hit ratio     [%%%.2f]\n", l2HitRatio);
+        printf("Total hit ratio  [%%%.2f]\n", (cacheGet) ? ((float)(hit + l2Hit) / (float)cacheGet) * 100 : 0);
+    }
+    for (i = 0; i <= FS3_CACHE_MAX_PARTITIONS; i++) // Per-file occupancy and hit ratio, for every partition that was used
+    {
+        part = &cacheParts[i];
+        if ((part->hit + part->miss == 0) && (part->used == 0))
+        {
+            continue;
+        }
+        if (i == FS3_CACHE_MAX_PARTITIONS)
+        {
+            printf("Partition [  none] ");
+        }
+        else
+        {
+            printf("Partition [%6d] ", i);
+        }
+        printf("lines [%5d/%5d] reserve [%5d] hits [%6d] misses [%6d] ratio [%%%6.2f]%s\n", part->used,
+               (part->quota > 0) ? part->quota : maxCache, part->reserve, part->hit, part->miss,
+               (part->hit + part->miss) ? ((float)part->hit / (float)(part->hit + part->miss)) * 100 : 0,
+               (part->pinned) ? " pinned" : "");
+    }
+    return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_init_l2_cache
+// Description  : Initialize the L2 victim cache, a preallocated local file
+//                that holds sectors evicted from the in-memory cache
+//
+// Inputs       : path - the file to spill sectors into
+//                cachelines - the number of sectors the file holds
+// Outputs      : 0 if successful, -1 if failure
+
+int fs3_init_l2_cache(const char *path, uint32_t cachelines)
+{
+    int i, j;
+
+    if ((path == NULL) || (cachelines == 0))
+    {
+        return -1;
+    }
+    if (cacheShare != NULL) // A victim in this process's file would go stale when another process writes the sector
+    {
+        logMessage(LOG_ERROR_LEVEL, "An L2 cache can't sit under a shared cache");
+        return -1;
+    }
+    if ((l2Fd = open(path, O_RDWR | O_CREAT, S_IRUSR | S_IWUSR)) == -1)
+    {
+        logMessage(LOG_ERROR_LEVEL, "Failed opening L2 cache file [%s] (%s)", path, strerror(errno));
+        return -1;
+    }
+    if ((errno = posix_fallocate(l2Fd, 0, (off_t)cachelines * FS3_SECTOR_SIZE)) != 0) // Reserve the blocks up front so spills never hit ENOSPC
+    {
+        logMessage(LOG_ERROR_LEVEL, "Failed preallocating L2 cache file [%s] (%s)", path, strerror(errno));
+        close(l2Fd);
+        l2Fd = -1;
+        return -1;
+    }
+
+    l2Struct = malloc(sizeof(l2cache) * cachelines);
+    if (l2Struct == NULL)
+    {
+        close(l2Fd);
+        l2Fd = -1;
+        return -1;
+    }
+    for (i = 0; i < cachelines; i++) // Walk the slots marking them unused
+    {
+        l2Struct[i].trkFind = -1;
+        l2Struct[i].secFind = -1;
+        l2Struct[i].refBit = 0;
+    }
+    for (i = 0; i < FS3_NET_MAX_TRACKS; i++)
+    {
+        for (j = 0; j < FS3_TRACK_SIZE; j++)
+        {
+            l2Index[i][j] = -1;
+        }
+    }
+    maxL2 = cachelines;
+    l2Hand = 0;
+    return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_close_l2_cache
+// Description  : Close the L2 victim cache (the file is left in place for reuse)
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int fs3_close_l2_cache(void)
+{
+    if (l2Fd != -1)
+    {
+        close(l2Fd);
+        l2Fd = -1;
+    }
+    if (l2Struct != NULL)
+    {
+        free(l2Struct);
+        l2Struct = NULL;
+    }
+    return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_l2_put
+// Description  : Spill a sector evicted from L1 into the L2 file, picking the
+//                victim slot with the CLOCK (second chance) policy
+//
+// Inputs       : trk - the track number of the sector
+//                sct - the sector number of the sector
+//                buf - the sector data
+// Outputs      : 0 if inserted, -1 if not inserted
+
+int fs3_l2_put(FS3TrackIndex trk, FS3SectorIndex sct, void *buf)
+{
+    int slot;
+
+    if ((l2Fd == -1) || (trk >= FS3_NET_MAX_TRACKS) || (sct >= FS3_TRACK_SIZE))
+    {
+        return -1;
+    }
+
+    slot = l2Index[trk][sct];
+    if (slot == -1)
+    {
+        while (l2Struct[l2Hand].refBit) // Sweep the hand, clearing reference bits until an unreferenced slot turns up
+        {
+            l2Struct[l2Hand].refBit = 0;
+            l2Hand = (l2Hand + 1) % maxL2;
+        }
+        slot = l2Hand;
+        l2Hand = (l2Hand + 1) % maxL2;
+        if (l2Struct[slot].trkFind != -1)
+        {
+            l2Index[l2Struct[slot].trkFind][l2Struct[slot].secFind] = -1; // Drop the old occupant
+            l2Evict++;
+        }
+    }
+
+    if (pwrite(l2Fd, buf, FS3_SECTOR_SIZE, (off_t)slot * FS3_SECTOR_SIZE) != FS3_SECTOR_SIZE)
+    {
+        logMessage(LOG_ERROR_LEVEL, "L2 cache write failed (%s)", strerror(errno));
+        l2Struct[slot].trkFind = -1;
+        l2Struct[slot].secFind = -1;
+        l2Index[trk][sct] = -1;
+        return -1;
+    }
+    l2Struct[slot].trkFind = trk;
+    l2Struct[slot].secFind = sct;
+    l2Struct[slot].refBit = 1;
+    l2Index[trk][sct] = slot;
+    l2Ins++;
+    return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_l2_get
+// Description  : Read a sector out of the L2 file; a hit removes it from L2
+//                since the caller promotes it back into L1
+//
+// Inputs       : trk - the track number of the sector to find
+//                sct - the sector number of the sector to find
+//                buf - the buffer to read the sector into
+// Outputs      : 0 if found, -1 if not found or failed
+
+int fs3_l2_get(FS3TrackIndex trk, FS3SectorIndex sct, void *buf)
+{
+    int slot;
+
+    if ((l2Fd == -1) || (trk >= FS3_NET_MAX_TRACKS) || (sct >= FS3_TRACK_SIZE))
+    {
+        return -1;
+    }
+    if ((slot = l2Index[trk][sct]) == -1)
+    {
+        l2Miss++;
+        return -1;
+    }
+    if (pread(l2Fd, buf, FS3_SECTOR_SIZE, (off_t)slot * FS3_SECTOR_SIZE) != FS3_SECTOR_SIZE)
+    {
+        logMessage(LOG_ERROR_LEVEL, "L2 cache read failed (%s)", strerror(errno));
+        fs3_l2_invalidate(trk, sct);
+        l2Miss++;
+        return -1;
+    }
+    fs3_l2_invalidate(trk, sct);
+    l2Hit++;
+    return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_l2_invalidate
+// Description  : Remove a sector from the L2 cache if it is present
+//
+// Inputs       : trk - the track number of the sector
+//                sct - the sector number of the sector
+// Outputs      : 0 if successful, -1 if failure
+
+int fs3_l2_invalidate(FS3TrackIndex trk, FS3SectorIndex sct)
+{
+    int slot;
+
+    if ((l2Fd == -1) || (trk >= FS3_NET_MAX_TRACKS) || (sct >= FS3_TRACK_SIZE))
+    {
+        return -1;
+    }
+    if ((slot = l2Index[trk][sct]) != -1)
+    {
+        l2Struct[slot].trkFind = -1;
+        l2Struct[slot].secFind = -1;
+        l2Struct[slot].refBit = 0;
+        l2Index[trk][sct] = -1;
+    }
     return 0;
 }
@@ -8,7 +8,7 @@
 //                   filesystem.
 //
 //  Author         : Patrick McDaniel
-//  Last Modified  : Sun 17 Oct 2021 09:36:52 AM EDT
+//  Last Modified  : Mon 19 Oct 2026 03:55:00 AM UTC
 //
 
 // Include
@@ -16,6 +16,13 @@
 
 // Defines
 #define FS3_DEFAULT_CACHE_SIZE 2048; // 256 cache entries, by default
+#define FS3_DEFAULT_L2_CACHE_SIZE 16384 // 16 MB spill file, by default
+#define FS3_CACHE_LINE_ALIGN 64 // Sector slots start on a CPU cache line
+#define FS3_CACHE_SLOT_SIZE (((FS3_SECTOR_SIZE) + FS3_CACHE_LINE_ALIGN - 1) & ~(FS3_CACHE_LINE_ALIGN - 1))
+#define FS3_CACHE_MAX_PARTITIONS 1024 // One partition per file handle
+#define FS3_CACHE_NO_OWNER -1 // Lines not charged to any file
+#define FS3_CACHE_ALL_FILES -1 // Apply a quota to every partition
+#define FS3_CACHE_SHARE_PROCS 64 // Processes a shared cache keeps lookup counts for
 
 //
 // Cache Functions
@@ -35,4 +42,55 @@ void * fs3_get_cache(FS3TrackIndex trk, FS3SectorIndex sct);
 int fs3_log_cache_metrics(void);
     // Log the metrics for the cache 
 
+//
+// Partitioned Cache Functions
+
+int fs3_put_cache_file(int16_t fd, FS3TrackIndex trk, FS3SectorIndex sct, void *buf);
+    // Put an element in the cache, charged to the file's partition
+
+void * fs3_get_cache_file(int16_t fd, FS3TrackIndex trk, FS3SectorIndex sct);
+    // Get an element from the cache, accounted to the file's partition
+
+int fs3_peek_cache(FS3TrackIndex trk, FS3SectorIndex sct);
+    // Check whether a sector is resident (no LRU or metrics update)
+
+int fs3_invalidate_cache(FS3TrackIndex trk, FS3SectorIndex sct);
+    // Drop a sector from the cache, the disk holds something newer
+
+int fs3_invalidate_cache_all(void);
+    // Drop every sector from the cache
+
+int fs3_set_cache_quota(int16_t fd, int quota, int reserve);
+    // Set the maximum and reserved number of lines for a file (0 quota = no limit)
+
+int fs3_cache_pin(int16_t fd, int sectors);
+    // Keep a file's lines from being evicted by other files
+
+int fs3_cache_unpin(int16_t fd);
+    // Allow a pinned file's lines to be evicted again
+
+//
+// Shared Cache Functions
+
+int fs3_init_shared_cache(const char *name, uint16_t cachelines);
+    // Attach to the cache other processes on this host share through the segment name (created with cachelines lines if new)
+
+//
+// L2 Victim Cache Functions
+
+int fs3_init_l2_cache(const char *path, uint32_t cachelines);
+    // Initialize the file-backed victim cache that holds sectors evicted from L1
+
+int fs3_close_l2_cache(void);
+    // Close the victim cache
+
+int fs3_l2_put(FS3TrackIndex trk, FS3SectorIndex sct, void *buf);
+    // Spill a sector into the victim cache
+
+int fs3_l2_get(FS3TrackIndex trk, FS3SectorIndex sct, void *buf);
+    // Read (and remove) a sector from the victim cache, -1 if not found
+
+int fs3_l2_invalidate(FS3TrackIndex trk, FS3SectorIndex sct);
+    // Drop a sector from the victim cache if present
+
 #endif
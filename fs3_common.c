@@ -5,7 +5,7 @@
 //                   client and server of the FS3 filesystem.
 //
 //  Author         : Patrick McDaniel
-//  Last Modified  : 
+//  Last Modified  : Mon 19 Oct 2026 02:44:02 AM UTC
 //
 
 // Includes
@@ -24,5 +24,47 @@ unsigned long FS3SimulatorLLevel = 0;      // Driver log level (global)
 unsigned long FS3CacheLLevel = 0;          // Cache log level
 unsigned long FS3ExtendedDebugLLevel = 0;  // Extended debugging level
 
+//
+// Implementation
+
+// Constructing the commandblock -Shifting values come from readme (Op is not 8, but 4)
+FS3CmdBlk construct_fs3_cmdblock(uint8_t op, int16_t sec, int_fast32_t trk, uint8_t ret)
+{
+	uint64_t opNew = op;
+	uint64_t secNew = sec;
+	uint64_t trkNew = trk;
+	uint64_t retNew = ret;
+	FS3CmdBlk x = 0;
+
+	x = x | (opNew << 60);
+
+	x = x | (secNew << 44);
+
+	x = x | (trkNew << 12);
+
+	x = x | (retNew << 4);
+
+	return x;
+}
+// create an FS3 array opcode from the variable fields
+
+// This deconstructs the command block
+int deconstruct_fs3_cmdblock(FS3CmdBlk cmdblock, uint8_t *op, int16_t *sec, int32_t *trk, uint8_t *ret)
+{
+
+	uint64_t opDec = 255;
+	uint64_t secDec = 65535;
+	uint64_t trkDec = 4294967295;
+	uint64_t retDec = 255;
+
+	*op = (cmdblock >> 60) & opDec;
+
+	*sec = (cmdblock >> 44) & secDec;
+
+	*trk = (cmdblock >> 12) & trkDec;
 
+	*ret = (cmdblock >> 4) & retDec;
 
+	return (0);
+}
+// extract register state from bus values
@@ -8,7 +8,7 @@
 //                  server executable of the FS3 filesystem.
 //
 //  Author        : Patrick McDaniel
-//  Last Modified : Thu 21 Oct 2021 07:03:31 AM EDT
+//  Last Modified : Mon 19 Oct 2026 02:44:02 AM UTC
 //
 
 // Include Files
@@ -23,5 +23,13 @@ extern unsigned long FS3SimulatorLLevel;      // Driver log level
 extern unsigned long FS3CacheLLevel;          // Cache log level
 extern unsigned long FS3ExtendedDebugLLevel;  // Extended debugging level
 
+//
+// Functional Prototypes
+
+FS3CmdBlk construct_fs3_cmdblock(uint8_t op, int16_t sec, int_fast32_t trk, uint8_t ret);
+	// Creates command block
+
+int deconstruct_fs3_cmdblock(FS3CmdBlk cmdblock, uint8_t *op, int16_t *sec, int32_t *trk, uint8_t *ret);
+	// Deconstructs command block --> used to assess values in buf return by syscall
 
 #endif
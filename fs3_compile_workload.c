@@ -0,0 +1,281 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : fs3_compile_workload.c
+//  Description    : This is the workload compiler for the FS3 simulator. It
+//                   parses a text workload once and writes the compiled form
+//                   (see fs3_workload.h) that fs3_sim replays straight from
+//                   a mapping, with file names interned and the write text
+//                   already unescaped.
+//
+//   Author        : Patrick McDaniel
+//   Last Modified : Mon 19 Oct 2026 04:03:18 AM UTC
+//
+
+// Include Files
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+// Project Includes
+#include <fs3_workload.h>
+#include <cmpsc311_log.h>
+
+// Defines
+#define FS3_COMPILE_ARGUMENTS "hv"
+#define USAGE \
+	"USAGE: fs3_compile_workload [-h] [-v] <workload-file> <compiled-file>\n" \
+	"\n" \
+	"where:\n" \
+	"    -h - help mode (display this message)\n" \
+	"    -v - verbose output\n" \
+	"\n" \
+	"    <workload-file> - the text workload to compile\n" \
+	"    <compiled-file> - where to write the compiled workload, for fs3_sim to replay\n" \
+	"\n" \
+
+//
+// Global Data
+char fs3CompileNames[FS3_WL_MAX_FILES][FS3_WL_NAME_MAX]; // The file table
+int fs3CompileFiles;                                     // Files in the table
+FS3WorkloadRecord *fs3CompileOps;                        // The records
+uint64_t fs3CompileOpCount, fs3CompileOpSize;            // Records made, allocated
+char *fs3CompilePayload;                                 // The write text
+uint64_t fs3CompilePayloadLen, fs3CompilePayloadSize;    // Bytes of text, allocated
+
+//
+// Functional Prototypes
+
+int compile_workload(char *wload, char *output);    // Compile a workload
+int compile_file(char *fname);                       // Intern a file name
+int compile_write(char *output);                     // Write the compiled workload
+
+//
+// Functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : main
+// Description  : The main function for the workload compiler
+//
+// Inputs       : argc - the number of command line parameters
+//                argv - the parameters
+// Outputs      : 0 if successful, -1 if failure
+
+int main( int argc, char *argv[] ) {
+
+	// Local variables
+	int ch, verbose = 0;
+
+	// Process the command line parameters
+	while ((ch = getopt(argc, argv, FS3_COMPILE_ARGUMENTS)) != -1) {
+
+		switch (ch) {
+		case 'h': // Help, print usage
+			fprintf( stderr, USAGE );
+			return( -1 );
+
+		case 'v': // Verbose Flag
+			verbose = 1;
+			break;
+
+		default:  // Default (unknown)
+			fprintf( stderr, "Unknown command line option (%c), aborting.\n", ch );
+			return( -1 );
+		}
+	}
+
+	// Setup the log as needed
+	initializeLogWithFilehandle( CMPSC311_LOG_STDERR );
+	if ( verbose ) {
+		enableLogLevels( LOG_INFO_LEVEL );
+	}
+
+	// The workload and the output should be the next options
+	if ( optind + 2 > argc ) {
+		fprintf( stderr, "Missing command line parameters, use -h to see usage, aborting.\n" );
+		return( -1 );
+	}
+	if ( compile_workload(argv[optind], argv[optind+1]) == -1 ) {
+		logMessage( LOG_ERROR_LEVEL, "Compiling workload [%s] failed.", argv[optind] );
+		return( -1 );
+	}
+
+	// Return successfully
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : compile_workload
+// Description  : Parse a text workload and write it out compiled
+//
+// Inputs       : wload - the text workload
+//                output - the compiled workload to write
+// Outputs      : 0 if successful, -1 if failure
+
+int compile_workload(char *wload, char *output) {
+
+	// Local variables
+	FS3WorkloadOp op;
+	FS3WorkloadRecord *rec;
+	char *data = NULL, *pos, *end;
+	struct stat stats;
+	int fd, got, file, linecount = 0;
+
+	// Map the workload privately, the parser works on it in place
+	if ( ((fd=open(wload, O_RDONLY)) == -1) || (fstat(fd, &stats) == -1) ) {
+		logMessage( LOG_ERROR_LEVEL, "Failure opening the workload file [%s], error: %s.",
+			wload, strerror(errno) );
+		return( -1 );
+	}
+	if ( (stats.st_size > 0) && ((data = mmap(NULL, stats.st_size, PROT_READ|PROT_WRITE, MAP_PRIVATE, fd, 0)) == MAP_FAILED) ) {
+		logMessage( LOG_ERROR_LEVEL, "Failure mapping the workload file [%s], error: %s.",
+			wload, strerror(errno) );
+		close( fd );
+		return( -1 );
+	}
+	close( fd );
+	if ( fs3_workload_compiled(data, stats.st_size) != 0 ) {
+		logMessage( LOG_ERROR_LEVEL, "Workload [%s] is already compiled.", wload );
+		munmap( data, stats.st_size );
+		return( -1 );
+	}
+	pos = data;
+	end = data + stats.st_size;
+
+	// Turn every line into a record, the text of writes goes into the payload
+	while ( (got = fs3_workload_parse_line(&pos, end, &op, linecount + 1)) == 1 ) {
+		linecount ++;
+		if ( (linecount == INT_MAX) || ((file = compile_file(op.fname)) == -1) ) {
+			logMessage( LOG_ERROR_LEVEL, "Workload line %d can't be compiled.", linecount );
+			munmap( data, stats.st_size );
+			return( -1 );
+		}
+
+		if ( fs3CompileOpCount == fs3CompileOpSize ) {
+			fs3CompileOpSize = (fs3CompileOpSize) ? fs3CompileOpSize * 2 : 4096;
+			fs3CompileOps = realloc(fs3CompileOps, sizeof(FS3WorkloadRecord) * fs3CompileOpSize);
+			CMPSC311_ASSERT0(fs3CompileOps != NULL, "Out of memory for the records");
+		}
+		rec = &fs3CompileOps[fs3CompileOpCount++];
+		memset(rec, 0x0, sizeof(FS3WorkloadRecord));
+		rec->command = op.command;
+		rec->file = file;
+		rec->len = op.len;
+		rec->off = op.off;
+
+		if ( (op.command == FS3_WL_WRITEAT) || (op.command == FS3_WL_WRITE) ) {
+			if ( fs3CompilePayloadLen + op.len > UINT32_MAX ) {
+				logMessage( LOG_ERROR_LEVEL, "Workload has more write text than a compiled one holds, line %d.", linecount );
+				munmap( data, stats.st_size );
+				return( -1 );
+			}
+			while ( fs3CompilePayloadLen + op.len > fs3CompilePayloadSize ) {
+				fs3CompilePayloadSize = (fs3CompilePayloadSize) ? fs3CompilePayloadSize * 2 : 65536;
+				fs3CompilePayload = realloc(fs3CompilePayload, fs3CompilePayloadSize);
+				CMPSC311_ASSERT0(fs3CompilePayload != NULL, "Out of memory for the payload");
+			}
+			rec->text = (uint32_t)fs3CompilePayloadLen;
+			memcpy(&fs3CompilePayload[fs3CompilePayloadLen], op.text, op.len);
+			fs3CompilePayloadLen += op.len;
+		}
+	}
+	munmap( data, stats.st_size );
+	if ( got == -1 ) {
+		return( -1 );
+	}
+
+	// Write it out, and say what it came to
+	if ( compile_write(output) == -1 ) {
+		return( -1 );
+	}
+	printf("Compiled [%s] into [%s]: %lu commands on %d files, %lu bytes of text\n", wload, output,
+			(unsigned long)fs3CompileOpCount, fs3CompileFiles, (unsigned long)fs3CompilePayloadLen);
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : compile_file
+// Description  : Find a file name in the file table, adding it the first
+//                time it is seen
+//
+// Inputs       : fname - the file name
+// Outputs      : the index of the file in the table, -1 if failure
+
+int compile_file(char *fname) {
+
+	// Local variables
+	static int last = -1;
+	int i;
+
+	// Commands tend to come in runs on one file
+	if ( (last != -1) && (strcmp(fs3CompileNames[last], fname) == 0) ) {
+		return( last );
+	}
+	for (i=0; i<fs3CompileFiles; i++) {
+		if ( strcmp(fs3CompileNames[i], fname) == 0 ) {
+			return( last = i );
+		}
+	}
+
+	// New file, make sure it fits
+	if ( fs3CompileFiles == FS3_WL_MAX_FILES ) {
+		logMessage( LOG_ERROR_LEVEL, "Workload uses more than %d files.", FS3_WL_MAX_FILES );
+		return( -1 );
+	}
+	if ( strlen(fname) >= FS3_WL_NAME_MAX ) {
+		logMessage( LOG_ERROR_LEVEL, "Workload file name too long [%s].", fname );
+		return( -1 );
+	}
+	strcpy(fs3CompileNames[fs3CompileFiles], fname);
+	logMessage( LOG_INFO_LEVEL, "File %d is [%s]", fs3CompileFiles, fname );
+	return( last = fs3CompileFiles++ );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : compile_write
+// Description  : Write the compiled workload: the header, the file table,
+//                the records and the payload
+//
+// Inputs       : output - the file to write
+// Outputs      : 0 if successful, -1 if failure
+
+int compile_write(char *output) {
+
+	// Local variables
+	FS3WorkloadHeader hdr;
+	FILE *fhandle;
+
+	memset(&hdr, 0x0, sizeof(hdr));
+	hdr.magic = FS3_WL_MAGIC;
+	hdr.version = FS3_WL_VERSION;
+	hdr.files = fs3CompileFiles;
+	hdr.ops = fs3CompileOpCount;
+	hdr.payload = fs3CompilePayloadLen;
+
+	if ( (fhandle=fopen(output, "w")) == NULL ) {
+		logMessage( LOG_ERROR_LEVEL, "Failure opening the compiled workload [%s], error: %s.",
+			output, strerror(errno) );
+		return( -1 );
+	}
+	if ( (fwrite(&hdr, sizeof(hdr), 1, fhandle) != 1) ||
+			(fwrite(fs3CompileNames, FS3_WL_NAME_MAX, fs3CompileFiles, fhandle) != fs3CompileFiles) ||
+			(fwrite(fs3CompileOps, sizeof(FS3WorkloadRecord), fs3CompileOpCount, fhandle) != fs3CompileOpCount) ||
+			(fwrite(fs3CompilePayload, 1, fs3CompilePayloadLen, fhandle) != fs3CompilePayloadLen) ||
+			(fclose(fhandle) != 0) ) {
+		logMessage( LOG_ERROR_LEVEL, "Failure writing the compiled workload [%s], error: %s.",
+			output, strerror(errno) );
+		return( -1 );
+	}
+	return( 0 );
+}
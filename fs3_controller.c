@@ -0,0 +1,440 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : fs3_controller.c
+//  Description    : This is the reference implementation of the FS3 disk
+//                   controller, executing command blocks against an
+//                   in-memory disk on behalf of a client connection.
+//
+//  Author         : Patrick McDaniel
+//  Last Modified  : Mon 19 Oct 2026 03:50:31 AM UTC
+//
+
+// Includes
+#include <string.h>
+#include <time.h>
+#include <gcrypt.h>
+
+// Project Includes
+#include <fs3_controller.h>
+#include <fs3_common.h>
+#include <cmpsc311_log.h>
+#include <cmpsc311_util.h>
+
+//
+// Global data
+
+FS3Track *fs3_controller_disk = NULL;           // The disk the controller operates on
+uint16_t fs3_controller_caps = FS3_CAP_ALL;     // Capabilities this controller offers
+
+// Defines
+#define FS3_CONTROLLER_MAX_RECALLS 4096 // Recalls kept for a session before it has to drop everything
+
+// Mounts that other connections can join (or that hold a lease)
+typedef struct {
+	int32_t  id;    // Session id handed out to the client, 0 when the slot is free
+	uint16_t caps;  // Capabilities granted at mount
+	int      refs;  // Connections in the session
+	int      lease; // Slot of the session's lease (+1), 0 without one
+} FS3ControllerMount;
+
+// The lease of one session, and the sectors recalled from it
+typedef struct {
+	int      mount;     // Mount holding the lease (+1), 0 when the slot is free
+	uint64_t renewed;   // When the session last sent a command (usecs)
+	uint32_t recalled;  // Recalls queued so far (never reset, writes wait on it)
+	uint32_t collected; // Of those, the ones the session collected (or that went with it)
+	uint32_t list[FS3_CONTROLLER_MAX_RECALLS]; // Recalls waiting, track << 16 | sector
+	int      head;      // Oldest recall waiting
+	int      count;     // Recalls waiting
+	int      overflow;  // More were recalled than the list holds
+} FS3ControllerLease;
+
+FS3ControllerMount fs3Mounts[FS3_CONTROLLER_MAX_MOUNTS];
+int32_t fs3NextSession = 1;
+FS3ControllerLease fs3Leases[FS3_CONTROLLER_MAX_LEASES];
+uint32_t fs3LeaseHolders[FS3_MAX_TRACKS][FS3_TRACK_SIZE]; // Leases each sector may be cached under (bit per lease)
+
+//
+// Implementation
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_controller_usecs
+// Description  : Read the monotonic clock
+//
+// Inputs       : none
+// Outputs      : the time in usecs
+
+static uint64_t fs3_controller_usecs(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return((uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_controller_release
+// Description  : Give up a lease when its session goes away; whatever was
+//                recalled from it counts as collected
+//
+// Inputs       : lease - the slot of the lease
+// Outputs      : none
+
+static void fs3_controller_release(int lease)
+{
+	FS3ControllerLease *l = &fs3Leases[lease];
+	int t, s;
+
+	for (t=0; t<FS3_MAX_TRACKS; t++) {
+		for (s=0; s<FS3_TRACK_SIZE; s++) {
+			fs3LeaseHolders[t][s] &= ~(1u << lease);
+		}
+	}
+	l->mount = 0;
+	l->collected = l->recalled;
+	l->count = l->head = l->overflow = 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_controller_cover
+// Description  : Account for a run of sectors a session read or wrote: it
+//                may cache the run under its lease from now on, and a write
+//                recalls the run from every other lease holding it
+//
+// Inputs       : ses - the state of the client connection
+//                trk - the track of the run
+//                sec - the first sector of the run
+//                cnt - the sectors in the run
+//                write - 1 if the run was written
+// Outputs      : none
+
+static void fs3_controller_cover(FS3ControllerSession *ses, int trk, int sec, int cnt, int write)
+{
+	FS3ControllerLease *l;
+	uint32_t own = 0, others;
+	int lease, i;
+
+	if ((ses->mount > 0) && (fs3Mounts[ses->mount - 1].lease > 0)) {
+		own = 1u << (fs3Mounts[ses->mount - 1].lease - 1);
+	}
+	for (i=sec; i<sec+cnt; i++) {
+		others = fs3LeaseHolders[trk][i] & ~own;
+		for (; write && others; others &= others - 1) {
+			lease = __builtin_ctz(others);
+			l = &fs3Leases[lease];
+			if (l->count < FS3_CONTROLLER_MAX_RECALLS) {
+				l->list[(l->head + l->count++) % FS3_CONTROLLER_MAX_RECALLS] = ((uint32_t)trk << 16) | i;
+			} else {
+				l->overflow = 1;
+			}
+			l->recalled++;
+			ses->held |= 1u << lease;
+			ses->heldSeq[lease] = l->recalled;
+		}
+		fs3LeaseHolders[trk][i] = (write) ? own : (fs3LeaseHolders[trk][i] | own);
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_controller_held
+// Description  : Check whether the reply to a session's last command (a
+//                write) has to wait for other sessions to drop their
+//                copies: each lease it recalled sectors from has to have
+//                collected the recalls, or have run out
+//
+// Inputs       : ses - the state of the client connection
+// Outputs      : usecs until the last lease it waits for runs out, 0 if
+//                the reply can go now
+
+int fs3_controller_held(FS3ControllerSession *ses)
+{
+	FS3ControllerLease *l;
+	uint64_t now, left = 0;
+	uint32_t held;
+	int lease;
+
+	if (ses->held == 0) {
+		return(0);
+	}
+	now = fs3_controller_usecs();
+	for (held = ses->held; held; held &= held - 1) {
+		lease = __builtin_ctz(held);
+		l = &fs3Leases[lease];
+		if ((l->mount == 0) || ((int32_t)(l->collected - ses->heldSeq[lease]) >= 0) ||
+				(now - l->renewed >= FS3_LEASE_USECS)) {
+			ses->held &= ~(1u << lease);
+			continue;
+		}
+		left = CMPSC311_MAXVAL(left, FS3_LEASE_USECS - (now - l->renewed));
+	}
+	return((int)left);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_controller_disconnect
+// Description  : Take a connection out of its session (unmount or hang up),
+//                the session goes away with its last connection
+//
+// Inputs       : ses - the state of the client connection
+// Outputs      : none
+
+void fs3_controller_disconnect(FS3ControllerSession *ses)
+{
+	if ((ses->mount > 0) && (--fs3Mounts[ses->mount - 1].refs == 0)) {
+		fs3Mounts[ses->mount - 1].id = 0;
+		if (fs3Mounts[ses->mount - 1].lease > 0) {
+			fs3_controller_release(fs3Mounts[ses->mount - 1].lease - 1);
+			fs3Mounts[ses->mount - 1].lease = 0;
+		}
+	}
+	ses->mount = 0;
+	ses->mounted = 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_controller_execute
+// Description  : Execute one command block against the disk
+//
+// Inputs       : ses - the state of the client connection
+//                cmd - the command block received
+//                buf - the sector payload (received for writes, filled for reads),
+//                      FS3_OP_PAYLOAD bytes long
+//                ret - the command block to send back
+// Outputs      : 0 if successful, -1 if the command failed
+
+int fs3_controller_execute(FS3ControllerSession *ses, FS3CmdBlk cmd, void *buf, FS3CmdBlk *ret)
+{
+	uint8_t op, rt;
+	int16_t sec;
+	int32_t trk;
+	int failed = 0;
+	int cnt, off, srcTrk, i;
+	FS3ControllerLease *lease = NULL;
+	uint8_t *recalls = buf;
+
+	deconstruct_fs3_cmdblock(cmd, &op, &sec, &trk, &rt);
+	ses->held = 0;
+	if ((op != FS3_OP_MOUNT) && (op != FS3_OP_JOIN) && (!ses->mounted)) {
+		logMessage(LOG_ERROR_LEVEL, "FS3 controller: op %d on unmounted disk", op);
+		*ret = construct_fs3_cmdblock(op, sec, trk, 1);
+		return(-1);
+	}
+	if ((op != FS3_OP_MOUNT) && (ses->mount > 0) && (fs3Mounts[ses->mount - 1].lease > 0)) {
+		lease = &fs3Leases[fs3Mounts[ses->mount - 1].lease - 1];
+		lease->renewed = fs3_controller_usecs(); // Hearing from the session renews its lease
+	}
+
+	switch (op) {
+	case FS3_OP_MOUNT: // Mount, granting whatever extensions both sides know
+		fs3_controller_disconnect(ses);
+		ses->mounted = 1;
+		ses->track = 0;
+		ses->caps = 0;
+		if (trk == FS3_CAP_PROBE) {
+			ses->caps = (uint16_t)sec & fs3_controller_caps;
+			for (i=0; (ses->caps & (FS3_CAP_SESSION|FS3_CAP_LEASE)) && (i<FS3_CONTROLLER_MAX_MOUNTS); i++) {
+				if (fs3Mounts[i].id == 0) { // Make the mount joinable (and give its lease a home)
+					fs3Mounts[i].id = fs3NextSession++;
+					fs3Mounts[i].caps = ses->caps;
+					fs3Mounts[i].refs = 1;
+					fs3Mounts[i].lease = 0;
+					ses->mount = i + 1;
+					break;
+				}
+			}
+			for (i=0; (ses->mount > 0) && (ses->caps & FS3_CAP_LEASE) && (i<FS3_CONTROLLER_MAX_LEASES); i++) {
+				if (fs3Leases[i].mount == 0) {
+					fs3Leases[i].mount = ses->mount;
+					fs3Leases[i].renewed = fs3_controller_usecs();
+					fs3Mounts[ses->mount - 1].lease = i + 1;
+					break;
+				}
+			}
+			if (ses->mount == 0) {
+				ses->caps &= ~(FS3_CAP_SESSION|FS3_CAP_LEASE); // No room to share this one
+			} else {
+				if (fs3Mounts[ses->mount - 1].lease == 0) {
+					ses->caps &= ~FS3_CAP_LEASE; // Every lease is taken, the client can't cache
+				}
+				fs3Mounts[ses->mount - 1].caps = ses->caps;
+			}
+			sec = ses->caps;
+			trk = FS3_CAP_ACK;
+		}
+		logMessage(FS3ControllerLLevel, "FS3 MOUNT: success (caps 0x%x)", ses->caps);
+		break;
+
+	case FS3_OP_TSEEK: // Seek to a track
+		if ((trk < 0) || (trk >= FS3_MAX_TRACKS)) {
+			failed = 1;
+			break;
+		}
+		ses->track = trk;
+		logMessage(FS3ControllerLLevel, "FS3 TSEEK: track switch %d success", trk);
+		break;
+
+	case FS3_OP_SKRDSECT: // Seek and read, fused
+	case FS3_OP_SKWRSECT: // Seek and write, fused
+		if ((!(ses->caps & FS3_CAP_SEEKXFER)) || (trk < 0) || (trk >= FS3_MAX_TRACKS)) {
+			failed = 1;
+			break;
+		}
+		ses->track = trk;
+		// Fall through to the transfer
+
+	case FS3_OP_RDSECT: // Read a sector from the current track
+	case FS3_OP_WRSECT: // Write a sector to the current track
+		if ((sec < 0) || (sec >= FS3_TRACK_SIZE) || (buf == NULL)) {
+			failed = 1;
+			break;
+		}
+		if ((op == FS3_OP_RDSECT) || (op == FS3_OP_SKRDSECT)) {
+			memcpy(buf, fs3_controller_disk[ses->track][sec], FS3_SECTOR_SIZE);
+		} else {
+			memcpy(fs3_controller_disk[ses->track][sec], buf, FS3_SECTOR_SIZE);
+		}
+		fs3_controller_cover(ses, ses->track, sec, 1, (op == FS3_OP_WRSECT) || (op == FS3_OP_SKWRSECT));
+		logMessage(FS3ControllerLLevel, "FS3 op %d: sector %d in track %d success.", op, sec, ses->track);
+		break;
+
+	case FS3_OP_RDRANGE: // Read a run of sectors
+	case FS3_OP_WRRANGE: // Write a run of sectors
+		cnt = FS3_RANGE_COUNT(trk);
+		if ((!(ses->caps & FS3_CAP_RANGE)) || (FS3_RANGE_TRACK(trk) >= FS3_MAX_TRACKS) || (cnt < 1) ||
+				(cnt > FS3_MAX_RANGE) || (sec < 0) || (sec + cnt > FS3_TRACK_SIZE) || (buf == NULL)) {
+			failed = 1;
+			break;
+		}
+		ses->track = FS3_RANGE_TRACK(trk);
+		if (op == FS3_OP_RDRANGE) {
+			memcpy(buf, fs3_controller_disk[ses->track][sec], cnt * FS3_SECTOR_SIZE);
+		} else {
+			memcpy(fs3_controller_disk[ses->track][sec], buf, cnt * FS3_SECTOR_SIZE);
+		}
+		fs3_controller_cover(ses, ses->track, sec, cnt, op == FS3_OP_WRRANGE);
+		logMessage(FS3ControllerLLevel, "FS3 op %d: sectors %d-%d in track %d success.", op, sec, sec + cnt - 1, ses->track);
+		break;
+
+	case FS3_OP_HASH: // Hash a run of sectors
+		cnt = FS3_RANGE_COUNT(trk);
+		if ((!(ses->caps & FS3_CAP_HASH)) || (FS3_RANGE_TRACK(trk) >= FS3_MAX_TRACKS) || (cnt < 1) ||
+				(cnt > FS3_MAX_RANGE) || (sec < 0) || (sec + cnt > FS3_TRACK_SIZE) || (buf == NULL)) {
+			failed = 1;
+			break;
+		}
+		ses->track = FS3_RANGE_TRACK(trk);
+		for (i=0; i<cnt; i++) {
+			gcry_md_hash_buffer(GCRY_MD_SHA1, (char *)buf + i * FS3_HASH_SIZE, fs3_controller_disk[ses->track][sec + i], FS3_SECTOR_SIZE);
+		}
+		logMessage(FS3ControllerLLevel, "FS3 HASH: sectors %d-%d in track %d success.", sec, sec + cnt - 1, ses->track);
+		break;
+
+	case FS3_OP_WRDELTA: // Seek and write part of a sector
+		cnt = FS3_DELTA_LENGTH(trk);
+		if ((!(ses->caps & FS3_CAP_DELTA)) || (FS3_RANGE_TRACK(trk) >= FS3_MAX_TRACKS) || (sec < 0) ||
+				(sec >= FS3_TRACK_SIZE) || (buf == NULL)) {
+			failed = 1;
+			break;
+		}
+		off = (((uint8_t *)buf)[0] << 8) | ((uint8_t *)buf)[1];
+		if ((cnt < 1) || (((((uint8_t *)buf)[2] << 8) | ((uint8_t *)buf)[3]) != cnt) || (off + cnt > FS3_SECTOR_SIZE)) {
+			failed = 1;
+			break;
+		}
+		ses->track = FS3_RANGE_TRACK(trk);
+		memcpy(&fs3_controller_disk[ses->track][sec][off], (char *)buf + FS3_DELTA_HDR_SIZE, cnt);
+		fs3_controller_cover(ses, ses->track, sec, 1, 1);
+		logMessage(FS3ControllerLLevel, "FS3 WRDELTA: bytes %d-%d of sector %d in track %d success.", off, off + cnt - 1, sec, ses->track);
+		break;
+
+	case FS3_OP_COPY: // Copy a run of sectors inside the disk
+		cnt = FS3_RANGE_COUNT(trk);
+		if ((!(ses->caps & FS3_CAP_COPY)) || (FS3_RANGE_TRACK(trk) >= FS3_MAX_TRACKS) || (cnt < 1) ||
+				(cnt > FS3_MAX_RANGE) || (sec < 0) || (sec + cnt > FS3_TRACK_SIZE) || (buf == NULL)) {
+			failed = 1;
+			break;
+		}
+		srcTrk = (((uint8_t *)buf)[0] << 8) | ((uint8_t *)buf)[1];
+		off = (((uint8_t *)buf)[2] << 8) | ((uint8_t *)buf)[3];
+		if ((srcTrk >= FS3_MAX_TRACKS) || (off + cnt > FS3_TRACK_SIZE)) {
+			failed = 1;
+			break;
+		}
+		ses->track = FS3_RANGE_TRACK(trk);
+		memmove(fs3_controller_disk[ses->track][sec], fs3_controller_disk[srcTrk][off], cnt * FS3_SECTOR_SIZE); // The runs may overlap
+		fs3_controller_cover(ses, ses->track, sec, cnt, 1);
+		logMessage(FS3ControllerLLevel, "FS3 COPY: sectors %d-%d of track %d to %d-%d of track %d success.",
+				off, off + cnt - 1, srcTrk, sec, sec + cnt - 1, ses->track);
+		break;
+
+	case FS3_OP_JOIN: // Hand out the session id, or join a session
+		if (trk == 0) {
+			if ((ses->mount == 0) || (!(ses->caps & FS3_CAP_SESSION))) {
+				failed = 1;
+				break;
+			}
+			trk = fs3Mounts[ses->mount - 1].id;
+			break;
+		}
+		for (i=0; i<FS3_CONTROLLER_MAX_MOUNTS; i++) {
+			if ((fs3Mounts[i].id == trk) && (trk != 0) && (fs3Mounts[i].caps & FS3_CAP_SESSION)) {
+				break;
+			}
+		}
+		if (i == FS3_CONTROLLER_MAX_MOUNTS) {
+			failed = 1;
+			break;
+		}
+		fs3_controller_disconnect(ses);
+		fs3Mounts[i].refs++;
+		ses->mount = i + 1;
+		ses->mounted = 1;
+		ses->track = 0;
+		ses->caps = fs3Mounts[i].caps;
+		logMessage(FS3ControllerLLevel, "FS3 JOIN: session %d success", trk);
+		break;
+
+	case FS3_OP_LEASE: // Hand the session the sectors recalled from its lease
+		if ((!(ses->caps & FS3_CAP_LEASE)) || (lease == NULL) || (buf == NULL)) {
+			failed = 1;
+			break;
+		}
+		if (lease->overflow) {
+			trk = FS3_LEASE_ALL;
+			lease->count = lease->head = lease->overflow = 0;
+		} else {
+			for (trk=0; (trk<FS3_LEASE_BATCH) && (lease->count > 0); trk++, lease->count--) {
+				recalls[trk * 4] = (uint8_t)(lease->list[lease->head] >> 24);
+				recalls[trk * 4 + 1] = (uint8_t)(lease->list[lease->head] >> 16);
+				recalls[trk * 4 + 2] = (uint8_t)(lease->list[lease->head] >> 8);
+				recalls[trk * 4 + 3] = (uint8_t)(lease->list[lease->head] & 0xff);
+				lease->head = (lease->head + 1) % FS3_CONTROLLER_MAX_RECALLS;
+			}
+		}
+		lease->collected = lease->recalled - lease->count;
+		logMessage(FS3ControllerLLevel, "FS3 LEASE: %d recalls collected, %d waiting", trk, lease->count);
+		break;
+
+	case FS3_OP_UMOUNT: // Unmount
+		fs3_controller_disconnect(ses);
+		logMessage(FS3ControllerLLevel, "FS3 UMOUNT: success");
+		break;
+
+	default:
+		logMessage(LOG_ERROR_LEVEL, "FS3 controller: unknown op instruction [%d]", op);
+		failed = 1;
+		break;
+	}
+
+	*ret = construct_fs3_cmdblock(op, sec, trk, failed);
+	if ((lease != NULL) && (op != FS3_OP_UMOUNT) && ((lease->count > 0) || lease->overflow)) {
+		*ret |= FS3_LEASE_RECALL; // Tell the session to come and collect them
+	}
+	return((failed) ? -1 : 0);
+}
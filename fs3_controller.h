@@ -8,7 +8,7 @@
 //                   filessystem interface.
 //
 //  Author         : Patrick McDaniel
-//  Last Modified  : Thu 16 Sep 2021 02:54:13 PM EDT
+//  Last Modified  : Mon 19 Oct 2026 03:50:31 AM UTC
 //
 
 // Include
@@ -36,12 +36,115 @@ typedef enum {
 	FS3_OP_RDSECT = 2,  // Read a sector from the disk
 	FS3_OP_WRSECT = 3,  // Write a sector to the disk
 	FS3_OP_UMOUNT = 4,  // Unmount the ffilesystem
-	FS3_OP_MAXVAL = 5   // Maximum opcode value
+	FS3_OP_MAXVAL = 5,  // Maximum opcode value
+
+	// Extensions, only sent once the server granted them at mount
+	FS3_OP_SKRDSECT = 6, // Seek to a track and read a sector (FS3_CAP_SEEKXFER)
+	FS3_OP_SKWRSECT = 7, // Seek to a track and write a sector (FS3_CAP_SEEKXFER)
+	FS3_OP_RDRANGE  = 8, // Read a run of sectors on a track (FS3_CAP_RANGE)
+	FS3_OP_WRRANGE  = 9, // Write a run of sectors on a track (FS3_CAP_RANGE)
+	FS3_OP_JOIN     = 10, // Get the mount's session id (trk 0) or join it from another connection (FS3_CAP_SESSION)
+	FS3_OP_WRDELTA  = 11, // Seek to a track and write part of a sector (FS3_CAP_DELTA)
+	FS3_OP_HASH     = 12, // Hash each sector of a run on a track, nothing else moves (FS3_CAP_HASH)
+	FS3_OP_COPY     = 13, // Copy a run of sectors from one place on the disk to another (FS3_CAP_COPY)
+	FS3_OP_LEASE    = 14, // Renew the session's lease and collect the sectors recalled from it (FS3_CAP_LEASE)
+	FS3_OP_EXTMAX   = 15 // Maximum extended opcode value
 
 } FS3OpCodes;
 
+// Capability negotiation: the client mounts with trk = FS3_CAP_PROBE and the
+// capabilities it wants in sec; a server that understands the extensions
+// answers trk = FS3_CAP_ACK and the granted capabilities in sec. The stock
+// controller echoes the request, which reads as "no capabilities".
+#define FS3_CAP_PROBE 0x46533350 // "FS3P"
+#define FS3_CAP_ACK   0x46533341 // "FS3A"
+#define FS3_CAP_SEEKXFER 0x0001  // Fused seek+read and seek+write opcodes
+#define FS3_CAP_RANGE    0x0002  // Multi-sector range read and write opcodes
+#define FS3_CAP_SESSION  0x0004  // Other connections can join a mount
+#define FS3_CAP_COMPRESS 0x0008  // Sector payloads travel in compressed frames (fs3_lz.h), a transport matter
+#define FS3_CAP_DELTA    0x0010  // Partial sector write opcode
+#define FS3_CAP_HASH     0x0020  // Sector hash opcode
+#define FS3_CAP_COPY     0x0040  // Server-side sector copy opcode
+#define FS3_CAP_LEASE    0x0080  // Sessions cache sectors under a lease, writes recall other sessions' copies
+#define FS3_CAP_ALL (FS3_CAP_SEEKXFER|FS3_CAP_RANGE|FS3_CAP_SESSION|FS3_CAP_COMPRESS|FS3_CAP_DELTA|FS3_CAP_HASH|FS3_CAP_COPY|FS3_CAP_LEASE)
+
+// Range commands put the first sector in sec and pack the sector count above
+// the track number in trk; the payload is count sectors back to back
+#define FS3_MAX_RANGE 64 // Most sectors moved by one range command
+#define FS3_RANGE_TRK(trk, cnt) ((int32_t)(((uint32_t)(cnt) << 16) | ((uint32_t)(trk) & 0xffff)))
+#define FS3_RANGE_TRACK(trk) ((int32_t)((uint32_t)(trk) & 0xffff))
+#define FS3_RANGE_COUNT(trk) ((int)(((uint32_t)(trk) >> 16) & 0xffff))
+
+// Delta writes pack the number of bytes changed above the track the same
+// way; the payload is a header giving the offset and length of the change in
+// the sector (network order) followed by the changed bytes
+#define FS3_DELTA_HDR_SIZE 4
+#define FS3_DELTA_TRK(trk, len) FS3_RANGE_TRK(trk, len)
+#define FS3_DELTA_LENGTH(trk) FS3_RANGE_COUNT(trk)
+
+// Hash commands address a run like a range read, and get back the SHA1 of
+// each sector in the run, one after the other
+#define FS3_HASH_SIZE 20
+
+// Copy commands address the destination run like a range write; the payload
+// is a header giving the track and first sector of the source run (network
+// order), and the sectors themselves never cross the wire
+#define FS3_COPY_HDR_SIZE 4
+
+// Leases: a session that was granted FS3_CAP_LEASE may cache every sector it
+// read or wrote for as long as its lease runs, and any command it sends
+// renews the lease. A write to a sector another session holds queues a
+// recall for that session, and the write is only answered once the session
+// collected its recalls (FS3_OP_LEASE) or its lease ran out. Every reply to
+// a session with recalls waiting carries FS3_LEASE_RECALL in the bits below
+// ret. The LEASE reply gives the number of recalls in trk, and the payload
+// holds them (track and sector, 2 bytes each, network order)
+#define FS3_LEASE_USECS 100000                // A lease runs this long after the session's last command
+#define FS3_LEASE_RECALL 0x1ULL               // Reply flag: the session has recalls to collect
+#define FS3_LEASE_BATCH (FS3_SECTOR_SIZE / 4) // Most recalls handed back by one LEASE command
+#define FS3_LEASE_ALL 0xffff                  // LEASE reply count: too many were recalled, drop everything
+
+// Which commands carry a sector payload on the wire (request or reply), and how many sectors it holds
+#define FS3_OP_IS_RANGE(op) (((op) == FS3_OP_RDRANGE) || ((op) == FS3_OP_WRRANGE) || ((op) == FS3_OP_HASH))
+#define FS3_OP_SENDS_SECTOR(op) (((op) == FS3_OP_WRSECT) || ((op) == FS3_OP_SKWRSECT) || ((op) == FS3_OP_WRRANGE) || \
+                                 ((op) == FS3_OP_WRDELTA) || ((op) == FS3_OP_COPY))
+#define FS3_OP_RECVS_SECTOR(op) (((op) == FS3_OP_RDSECT) || ((op) == FS3_OP_SKRDSECT) || ((op) == FS3_OP_RDRANGE) || \
+                                 ((op) == FS3_OP_HASH) || ((op) == FS3_OP_LEASE))
+#define FS3_OP_PAYLOAD(op, trk) (((op) == FS3_OP_HASH) ? FS3_RANGE_COUNT(trk) * FS3_HASH_SIZE : \
+                                 FS3_OP_IS_RANGE(op) ? FS3_RANGE_COUNT(trk) * FS3_SECTOR_SIZE : \
+                                 ((op) == FS3_OP_WRDELTA) ? FS3_DELTA_HDR_SIZE + FS3_DELTA_LENGTH(trk) : \
+                                 ((op) == FS3_OP_COPY) ? FS3_COPY_HDR_SIZE : FS3_SECTOR_SIZE)
+#define FS3_OP_TRACK(op, trk) ((FS3_OP_IS_RANGE(op) || ((op) == FS3_OP_WRDELTA) || ((op) == FS3_OP_COPY)) ? FS3_RANGE_TRACK(trk) : (trk)) // Track a command works on
+
+// Controller state for one client connection; connections that joined the
+// same mount share its session (and capabilities) but seek on their own
+#define FS3_CONTROLLER_MAX_MOUNTS 256
+#define FS3_CONTROLLER_MAX_LEASES 32 // Sessions holding leases at once
+typedef struct {
+	int           mounted; // Client has mounted the disk
+	FS3TrackIndex track;   // Current track (set by TSEEK)
+	uint16_t      caps;    // Capabilities granted at mount
+	int           mount;   // Slot of the shared mount (+1), 0 when not sharing one
+	uint32_t      held;    // Leases the last write recalled sectors from (bit per lease)
+	uint32_t      heldSeq[FS3_CONTROLLER_MAX_LEASES]; // Recall each of them has to collect before the write is answered
+} FS3ControllerSession;
+
+//
+// Global data
+extern FS3Track *fs3_controller_disk;   // The disk the controller operates on
+extern uint16_t fs3_controller_caps;    // Capabilities this controller offers
+
 //
 // Functional Prototypes
 
+int fs3_controller_execute(FS3ControllerSession *ses, FS3CmdBlk cmd, void *buf, FS3CmdBlk *ret);
+	// Execute one command block against the disk (server side)
+
+void fs3_controller_disconnect(FS3ControllerSession *ses);
+	// A connection went away, leave the mount it belonged to
+
+int fs3_controller_held(FS3ControllerSession *ses);
+	// Usecs the reply to the last command still has to wait for recalls (0 to send it now)
+
 
 #endif
@@ -5,11 +5,12 @@
 //                   for used to access the FS3 storage system.
 //
 //   Author        : *** Devon Burke ***
-//   Last Modified : *** 11/21/2021 ***
+//   Last Modified : Mon 19 Oct 2026 04:46:54 AM UTC
 //
 
 // Includes
 #include <string.h>
+#include <stdlib.h>
 #include "cmpsc311_log.h"
 #include "fs3_controller.h"
 #include <unistd.h>
@@ -22,6 +23,8 @@
 #include "fs3_driver.h"
 #include "fs3_cache.h"
 #include "fs3_network.h"
+#include "fs3_trace.h"
+#include "cmpsc311_util.h"
 
 //
 // Defines
@@ -33,6 +36,10 @@ typedef uint64_t FS3CmdBlk;
 int mountStatus = 0;
 // Mount flag that is used to define whether it is mounted or not
 FS3CmdBlk y = 0;
+uint8_t rOp;
+int16_t rSec;
+int32_t rTrk;
+// Fields of the command block returned by the controller (kept apart so the request fields are not clobbered)
 
 struct state
 {
@@ -46,53 +53,46 @@ struct state
 struct state newFiles[1024];
 // giving my struct an identifier to access objects inside struct
 
-int64_t arr2[64][1024];
+int64_t arr2[FS3_NET_MAX_TRACKS][1024];
 // Global 2D array
+int fs3Tracks = FS3_MAX_TRACKS;
+// Tracks of the disk (those of every server when it is striped)
+
+char pipeBufs[FS3_NET_MAX_WINDOW][FS3_SECTOR_SIZE];
+// Sector buffers for the commands a read or write keeps in flight
+char deltaBufs[2][FS3_DELTA_HDR_SIZE + FS3_SECTOR_SIZE];
+// Payloads of the delta writes of a write, only its first and last sectors can be partial
+char copyHdrs[FS3_NET_MAX_WINDOW][FS3_COPY_HDR_SIZE];
+// Source of each copy command a file copy keeps in flight
+char copyBuf[FS3_NET_MAX_WINDOW * FS3_SECTOR_SIZE];
+// Bytes a file copy has to move through the client (partial sectors, or no copy opcode)
+int fs3_readahead = 0;
+// Number of sectors to prefetch after each read
+uint16_t fs3Caps = 0;
+// Protocol extensions granted by the server at mount
+int32_t curTrack[FS3_NET_MAX_CONNECTIONS];
+// Track the controller's head is on for each connection, -1 when unknown
 
 //
 // Implementation
 
-// Constructing the commandblock -Shifting values come from readme (Op is not 8, but 4)
-FS3CmdBlk construct_fs3_cmdblock(uint8_t op, int16_t sec, int_fast32_t trk, uint8_t ret)
-{
-	uint64_t opNew = op;
-	uint64_t secNew = sec;
-	uint64_t trkNew = trk;
-	uint64_t retNew = ret;
-	FS3CmdBlk x = 0;
-
-	x = x | (opNew << 60);
-
-	x = x | (secNew << 44);
-
-	x = x | (trkNew << 12);
-
-	x = x | (retNew << 4);
-
-	return x;
-}
-// create an FS3 array opcode from the variable fields
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function : fs3_forget_heads
+// Description : Mark the head position of every connection as unknown, so
+// the next classic transfer seeks first
+//
+// Inputs : none
+// Outputs : none
 
-// This deconstructs the command block
-int deconstruct_fs3_cmdblock(FS3CmdBlk cmdblock, uint8_t *op, int16_t *sec, int32_t *trk, uint8_t *ret)
+static void fs3_forget_heads(void)
 {
-
-	uint64_t opDec = 255;
-	uint64_t secDec = 65535;
-	uint64_t trkDec = 4294967295;
-	uint64_t retDec = 255;
-
-	*op = (cmdblock >> 60) & opDec;
-
-	*sec = (cmdblock >> 44) & secDec;
-
-	*trk = (cmdblock >> 12) & trkDec;
-
-	*ret = (cmdblock >> 4) & retDec;
-
-	return (0);
+	int i;
+	for (i = 0; i < FS3_NET_MAX_CONNECTIONS; i++)
+	{
+		curTrack[i] = -1;
+	}
 }
-// extract register state from bus values
 
 ////////////////////////////////////////////////////////////////////////////////
 //
@@ -120,7 +120,8 @@ int32_t fs3_mount_disk(void)
 		newFiles[i].FileIsOpen = 0;
 	}
 
-	for (i = 0; i < 64; i++)
+	fs3Tracks = network_fs3_tracks(); // Striping over more servers makes the disk bigger
+	for (i = 0; i < fs3Tracks; i++)
 	{ // Sets 2D equal to -1 which will be used for read/write functions
 		for (j = 0; j < 1024; j++)
 		{
@@ -128,15 +129,23 @@ int32_t fs3_mount_disk(void)
 		}
 	}
 
+	sec = FS3_CLIENT_CAPS; // Offer the protocol extensions we know, the reply says which ones the server takes
+	trk = FS3_CAP_PROBE;
 	x = construct_fs3_cmdblock(op, sec, trk, ret);
-	x = network_fs3_syscall(x, &y, NULL);
-	deconstruct_fs3_cmdblock(x, &op, &sec, &trk, &ret);
+	if (network_fs3_syscall(x, &y, NULL) == -1)
+	{
+		return -1;
+	}
+	deconstruct_fs3_cmdblock(y, &rOp, &rSec, &rTrk, &ret);
 	if (ret == 1) // If ret returns a value of 1 the program failed
 	{
 		return -1;
 	}
 	else
 	{
+		fs3Caps = (rTrk == FS3_CAP_ACK) ? ((uint16_t)rSec & FS3_CLIENT_CAPS) : 0; // A stock server just echoes the probe
+		fs3_forget_heads();
+		logMessage(FS3DriverLLevel, "FS3 mounted, server capabilities 0x%x", fs3Caps);
 		mountStatus = 1;
 		return 0;
 	}
@@ -170,7 +179,7 @@ int32_t fs3_unmount_disk(void)
 
 	x = construct_fs3_cmdblock(op, sec, trk, ret);
 	x = network_fs3_syscall(x, &y, NULL);
-	deconstruct_fs3_cmdblock(x, &op, &sec, &trk, &ret);
+	deconstruct_fs3_cmdblock(y, &rOp, &rSec, &rTrk, &ret);
 
 	if (ret == 1)
 	{
@@ -184,13 +193,13 @@ int32_t fs3_unmount_disk(void)
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-// Function : fs3_open
+// Function : fs3_do_open
 // Description : This function opens the file and returns a file handle
 //
 // Inputs : path - filename of the file to open
 // Outputs : file handle if successful, -1 if failure
 
-int16_t fs3_open(char *path)
+static int16_t fs3_do_open(char *path)
 {
 	int i;
 	for (i = 0; i < 1024; i++)
@@ -226,13 +235,13 @@ int16_t fs3_open(char *path)
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-// Function : fs3_close
+// Function : fs3_do_close
 // Description : This function closes the file
 //
 // Inputs : fd - the file descriptor
 // Outputs : 0 if successful, -1 if failure
 
-int16_t fs3_close(int16_t fd)
+static int16_t fs3_do_close(int16_t fd)
 {
 	int i;
 	for (i = 0; i < 1024; i++)
@@ -253,118 +262,271 @@ int16_t fs3_close(int16_t fd)
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-// Function : fs3_read
-// Description : Reads "count" bytes from the file handle "fh" into the
-// buffer "buf"
+// Function : fs3_locate_sectors
+// Description : Find the tracks and sectors holding a run of a file's sectors,
+// optionally allocating free sectors for the part of the run past the end
 //
-// Inputs : fd - filename of the file to read from
-// buf - pointer to buffer to read into
-// count - number of bytes to read
-// Outputs : bytes read if successful, -1 if failure
+// Inputs : fd - the file handle
+// first - index of the first sector of the run within the file
+// n - the number of sectors in the run
+// alloc - allocate sectors the file does not have yet
+// trks - the track of each sector (output)
+// secs - the sector within the track of each sector (output)
+// Outputs : number of sectors found (or allocated)
 
-int32_t fs3_read(int16_t fd, void *buf, int32_t count)
+static int fs3_locate_sectors(int16_t fd, int first, int n, int alloc, int32_t *trks, int16_t *secs)
 {
-	uint8_t op = 2; // Read Op = 2
-	uint8_t opT = 1;
-	int16_t sec = -1; // Set others to 0 since its 1 file
-	int32_t trk = -1;
-	uint8_t ret = 0;
-	FS3CmdBlk x;
-	FS3SectorIndex secInd;
-	int sec_pos = 0;
-	int count2 = 0;
-	char buf2[1024]; // Character array that will be used to later for memcpy
 	int i;
 	int j;
-	int bool = 0;
-	int size;
-	int count3 = count;
+	int count2 = 0;
+	int found;
 
-	while (count > 0)
+	for (i = 0; i < fs3Tracks; i++) // One walk of the 2D array picks up the whole run
 	{
-		bool = 0;
-		sec_pos = newFiles[fd].position % 1024; // While loop that loops through find/setting track and sec to perform read function on
-		secInd = newFiles[fd].position / 1024;
-		count2 = 0;
-		for (i = 0; i < 64; i++)
+		for (j = 0; j < 1024; j++)
 		{
-			for (j = 0; j < 1024; j++)
+			if (arr2[i][j] == fd)
 			{
-				if (arr2[i][j] == fd)
+				if ((count2 >= first) && (count2 < first + n))
 				{
-					if (count2 == secInd)
-					{
-						trk = i;
-						sec = j;
-						bool = 1; // Flag thats used for breaking outer for loop
-						break;
-					}
-					else
-					{
-						count2++; // Count2 increments until it equals sector index to run function
-					}
+					trks[count2 - first] = i;
+					secs[count2 - first] = j;
 				}
+				count2++; // Count2 increments for every sector of the file
 			}
-			if (bool == 1)
+		}
+	}
+	found = CMPSC311_MINVAL(CMPSC311_MAXVAL(count2 - first, 0), n);
+
+	for (i = 0; (i < fs3Tracks) && alloc && (found < n); i++) // Allocate the rest of the run from the free sectors
+	{
+		for (j = 0; (j < 1024) && (found < n); j++)
+		{
+			if (arr2[i][j] == -1)
 			{
-				break;
+				arr2[i][j] = fd;
+				trks[found] = i;
+				secs[found] = j;
+				found++;
 			}
 		}
-		if (trk == -1 && sec == -1)
+	}
+	return found;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function : fs3_pipeline_sectors
+// Description : Read or write a set of sectors, keeping up to
+// fs3_network_window commands in flight instead of waiting on every reply;
+// runs of adjacent sectors with adjacent buffers go as range commands
+//
+// Inputs : op - FS3_OP_RDSECT, FS3_OP_WRSECT, FS3_OP_WRDELTA, FS3_OP_HASH or FS3_OP_COPY
+// n - the number of sectors
+// trks - the track of each sector
+// secs - the sector within the track of each sector
+// bufs - the data buffer of each sector (the delta payload for FS3_OP_WRDELTA,
+// the digest for FS3_OP_HASH, the source header for FS3_OP_COPY)
+// lens - the bytes changed in each sector for FS3_OP_WRDELTA, the sectors in
+// each run for FS3_OP_COPY, NULL otherwise
+// Outputs : 0 if successful, -1 if failure
+
+static int fs3_pipeline_sectors(uint8_t op, int n, int32_t *trks, int16_t *secs, char **bufs, int *lens)
+{
+	uint8_t opT = 1; // op code for Tseek
+	uint8_t ret = 0;
+	int submitted = 0;
+	int failed = 0;
+	int sent;
+	int run;
+	int limit;
+	int conn;
+	int stride = (op == FS3_OP_HASH) ? FS3_HASH_SIZE : FS3_SECTOR_SIZE; // Buffer space per sector
+
+	while (((submitted < n) && (!failed)) || (network_fs3_outstanding() > 0))
+	{
+		while ((submitted < n) && (!failed) && (network_fs3_outstanding() + 2 <= fs3_network_window))
 		{
-			break; // If track and sec remain -1 break loop
+			run = 1;
+			limit = CMPSC311_MINVAL(FS3_MAX_RANGE, network_fs3_extent(trks[submitted], secs[submitted])); // A range can't run onto another server
+			while (((fs3Caps & FS3_CAP_RANGE) || (op == FS3_OP_HASH)) && (op != FS3_OP_WRDELTA) && (op != FS3_OP_COPY) && (submitted + run < n) && (run < limit) && // Sectors next to each other on the track and in memory go as one range
+				   (trks[submitted + run] == trks[submitted]) && (secs[submitted + run] == secs[submitted] + run) &&
+				   (bufs[submitted + run] == bufs[submitted] + run * stride))
+			{
+				run++;
+			}
+			if (op == FS3_OP_WRDELTA) // Only the changed bytes go, behind their offset and length
+			{
+				sent = network_fs3_submit(construct_fs3_cmdblock(op, secs[submitted], FS3_DELTA_TRK(trks[submitted], lens[submitted]), 0),
+										  bufs[submitted]);
+			}
+			else if (op == FS3_OP_COPY) // The caller already made the runs, each one is a destination run
+			{
+				sent = network_fs3_submit(construct_fs3_cmdblock(op, secs[submitted], FS3_RANGE_TRK(trks[submitted], lens[submitted]), 0),
+										  bufs[submitted]);
+			}
+			else if (op == FS3_OP_HASH) // Hashes always address a run, even of one sector
+			{
+				sent = network_fs3_submit(construct_fs3_cmdblock(op, secs[submitted], FS3_RANGE_TRK(trks[submitted], run), 0), bufs[submitted]);
+			}
+			else if (run > 1)
+			{
+				sent = network_fs3_submit(construct_fs3_cmdblock((op == FS3_OP_RDSECT) ? FS3_OP_RDRANGE : FS3_OP_WRRANGE,
+																 secs[submitted], FS3_RANGE_TRK(trks[submitted], run), 0), bufs[submitted]);
+			}
+			else if (fs3Caps & FS3_CAP_SEEKXFER) // Server takes the fused seek+transfer, one command per sector
+			{
+				sent = network_fs3_submit(construct_fs3_cmdblock((op == FS3_OP_RDSECT) ? FS3_OP_SKRDSECT : FS3_OP_SKWRSECT,
+																 secs[submitted], trks[submitted], 0), bufs[submitted]);
+			}
+			else // Classic sequence, the Tseek is only needed when the head is on another track
+			{
+				sent = 0;
+				if (network_fs3_track(trks[submitted], secs[submitted]) != curTrack[network_fs3_route(trks[submitted], secs[submitted])])
+				{
+					sent = network_fs3_submit(construct_fs3_cmdblock(opT, secs[submitted], trks[submitted], 0), NULL);
+				}
+				if (sent == 0)
+				{
+					sent = network_fs3_submit(construct_fs3_cmdblock(op, secs[submitted], trks[submitted], 0), bufs[submitted]);
+				}
+			}
+			if (sent == -1)
+			{
+				fs3_forget_heads();
+				return -1; // The connection is unusable, nothing left to collect
+			}
+			conn = network_fs3_route(trks[submitted], secs[submitted]); // Each connection has its own head, on its server's track
+			curTrack[conn] = network_fs3_track(trks[submitted], secs[submitted]);
+			submitted += run;
 		}
-
-		if (mountStatus == 0) // Check if its mount, if not return -1
+		if (network_fs3_complete(NULL, &y, NULL) == -1)
 		{
+			fs3_forget_heads();
 			return -1;
 		}
-		if (newFiles[fd].FileIsOpen == 0) // Check if the file is open, if not return -1
+		deconstruct_fs3_cmdblock(y, &rOp, &rSec, &rTrk, &ret);
+		if (ret == 1) // Keep draining so the replies stay in step, but stop sending more
 		{
-			return -1;
+			failed = 1;
+			fs3_forget_heads(); // A failed seek leaves the head somewhere unknown
 		}
-		if (ret == 1) // If ret returns a value of 1 the program failed
+	}
+	return (failed) ? -1 : 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function : fs3_do_read
+// Description : Reads "count" bytes from the file handle "fh" into the
+// buffer "buf"
+//
+// Inputs : fd - filename of the file to read from
+// buf - pointer to buffer to read into
+// count - number of bytes to read
+// Outputs : bytes read if successful, -1 if failure
+
+static int32_t fs3_do_read(int16_t fd, void *buf, int32_t count)
+{
+	int32_t trks[FS3_NET_MAX_WINDOW];
+	int16_t secs[FS3_NET_MAX_WINDOW];
+	int32_t mTrks[FS3_NET_MAX_WINDOW]; // The sectors that missed in the cache
+	int16_t mSecs[FS3_NET_MAX_WINDOW];
+	char *mBufs[FS3_NET_MAX_WINDOW];
+	int mIdx[FS3_NET_MAX_WINDOW];
+	int segOff[FS3_NET_MAX_WINDOW]; // Where each sector's piece goes in buf
+	int segPos[FS3_NET_MAX_WINDOW]; // Where the piece starts in the sector
+	int segLen[FS3_NET_MAX_WINDOW]; // Length of the piece
+	char *newerBuf;
+	int first;
+	int n;
+	int got;
+	int nmiss;
+	int k;
+	int done = 0;
+
+	if ((mountStatus == 0) || (fd < 0) || (fd >= 1024) || (newFiles[fd].FileIsOpen == 0)) // Must be mounted and the file open
+	{
+		return -1;
+	}
+	network_fs3_set_key(fd); // File affinity keeps this file's commands on one connection
+	if (count > newFiles[fd].size - newFiles[fd].position) // Nothing to read past the end of the file
+	{
+		count = newFiles[fd].size - newFiles[fd].position;
+	}
+
+	while (done < count)
+	{
+		first = newFiles[fd].position / 1024; // Work on as many sectors as can be in flight at once
+		n = CMPSC311_MINVAL(((newFiles[fd].position % 1024) + (count - done) + 1023) / 1024, FS3_NET_MAX_WINDOW);
+		if ((got = fs3_locate_sectors(fd, first, n, 0, trks, secs)) == 0)
 		{
-			return -1;
+			break; // If no sector holds the data, stop here
 		}
 
-		if (1024 - sec_pos < count) // Function that finds size of write
+		nmiss = 0;
+		for (k = 0; k < got; k++)
 		{
-			size = 1024 - sec_pos;
+			segPos[k] = (k == 0) ? newFiles[fd].position % 1024 : 0;
+			segOff[k] = (k == 0) ? done : segOff[k - 1] + segLen[k - 1];
+			segLen[k] = CMPSC311_MINVAL(1024 - segPos[k], count - segOff[k]);
+			newerBuf = fs3_get_cache_file(fd, trks[k], secs[k]);
+			if (newerBuf != NULL)
+			{
+				memcpy(&((char *)buf)[segOff[k]], &newerBuf[segPos[k]], segLen[k]); // If fs3_get_cache is not null use the buf return as newBuf
+			}
+			else
+			{
+				mTrks[nmiss] = trks[k];
+				mSecs[nmiss] = secs[k];
+				mBufs[nmiss] = pipeBufs[nmiss];
+				mIdx[nmiss] = k;
+				nmiss++;
+			}
 		}
-		else
+
+		if ((nmiss > 0) && (fs3_pipeline_sectors(FS3_OP_RDSECT, nmiss, mTrks, mSecs, mBufs, NULL) == -1)) // Fetch all of the misses together
 		{
-			size = count;
+			return -1;
 		}
-		char *newerBuf = fs3_get_cache(trk, sec);
-		if (newerBuf == NULL)
+		for (k = 0; k < nmiss; k++)
 		{
-			x = construct_fs3_cmdblock(opT, sec, trk, ret); // TSeek operations
-			x = network_fs3_syscall(x, &y, NULL);
-			deconstruct_fs3_cmdblock(x, &opT, &sec, &trk, &ret); // Three system calls in order to complete the folowing
+			memcpy(&((char *)buf)[segOff[mIdx[k]]], &mBufs[k][segPos[mIdx[k]]], segLen[mIdx[k]]); // Memcpy data in the sector (at specific position) to buf
+			fs3_put_cache_file(fd, mTrks[k], mSecs[k], mBufs[k]);
+		}
+
+		newFiles[fd].position += segOff[got - 1] + segLen[got - 1] - done; // Setting position to value of count
+		done = segOff[got - 1] + segLen[got - 1];
+	}
 
-			x = construct_fs3_cmdblock(op, sec, trk, ret); // Do system call to update fields
-			x = network_fs3_syscall(x, &y, buf2);
-			deconstruct_fs3_cmdblock(x, &op, &sec, &trk, &ret);
-			memcpy(&((char *)buf)[count3 - count], &buf2[sec_pos], size); // Memcpy data in buf2 (at specific position) to buf
-			fs3_put_cache(trk, sec, buf2);
+	if (fs3_readahead > 0) // Warm the cache with the sectors that follow, for the next sequential read
+	{
+		first = (newFiles[fd].position + 1023) / 1024;
+		got = fs3_locate_sectors(fd, first, CMPSC311_MINVAL(fs3_readahead, FS3_NET_MAX_WINDOW), 0, trks, secs);
+		for (k = 0, nmiss = 0; k < got; k++)
+		{
+			if (fs3_peek_cache(trks[k], secs[k]) == 0)
+			{
+				mTrks[nmiss] = trks[k];
+				mSecs[nmiss] = secs[k];
+				mBufs[nmiss] = pipeBufs[nmiss];
+				nmiss++;
+			}
 		}
-		else
+		if ((nmiss > 0) && (fs3_pipeline_sectors(FS3_OP_RDSECT, nmiss, mTrks, mSecs, mBufs, NULL) == 0))
 		{
-			memcpy(&((char *)buf)[count3 - count], &newerBuf[sec_pos], size); // If fs3_get_cache is not null use the buf return as newBuf
+			for (k = 0; k < nmiss; k++)
+			{
+				fs3_put_cache_file(fd, mTrks[k], mSecs[k], mBufs[k]);
+			}
 		}
-
-		newFiles[fd].position += size; // Setting position to value of count
-		count -= size;
-		trk = -1; // Set trk and sec = -1 to allow process to repeat of finding new sectors/tracks to perform function
-		sec = -1;
 	}
-	return (count3 - count); // Return number of bytes written
+	return (done); // Return number of bytes read
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-// Function : fs3_write
+// Function : fs3_do_write
 // Description : Writes "count" bytes to the file handle "fh" from the
 // buffer "buf"
 //
@@ -373,145 +535,155 @@ int32_t fs3_read(int16_t fd, void *buf, int32_t count)
 // count - number of bytes to write
 // Outputs : bytes written if successful, -1 if failure
 
-int32_t fs3_write(int16_t fd, void *buf, int32_t count)
+static int32_t fs3_do_write(int16_t fd, void *buf, int32_t count)
 {
-	uint8_t op = 3;	 // Op code for Write
-	uint8_t opT = 1; // op code for Tseek
-	uint8_t opR = 2; // Op code for Read
-	int16_t sec = -1;
-	FS3SectorIndex secInd; // sector index
-	int sec_pos = 0;
-	int count2 = 0;
-	int32_t trk = -1;
-	uint8_t ret = 0;
-	char buf2[1024]; // Local buffer
-	FS3CmdBlk x;
-	int i;
-	int j;
-	int size;
-	int bool = 0;
-	int count3 = count;
+	int32_t trks[FS3_NET_MAX_WINDOW];
+	int16_t secs[FS3_NET_MAX_WINDOW];
+	char *bufs[FS3_NET_MAX_WINDOW];
+	int32_t rTrks[FS3_NET_MAX_WINDOW]; // Partly written sectors that have to be read first
+	int16_t rSecs[FS3_NET_MAX_WINDOW];
+	char *rBufs[FS3_NET_MAX_WINDOW];
+	int32_t dTrks[2]; // Partly written sectors sent as deltas (first and last)
+	int16_t dSecs[2];
+	char *dBufs[2];
+	int dLens[2];
+	int segOff[FS3_NET_MAX_WINDOW]; // Where each sector's piece comes from in buf
+	int segPos[FS3_NET_MAX_WINDOW]; // Where the piece starts in the sector
+	int segLen[FS3_NET_MAX_WINDOW]; // Length of the piece
+	int known[FS3_NET_MAX_WINDOW];  // The whole sector is known after the write (it can be cached)
+	char *newerBuf;
+	int first;
+	int n;
+	int got;
+	int nread;
+	int ndelta;
+	int lo;
+	int hi;
+	int k;
+	int done = 0;
 
-	while (count > 0)
+	if ((mountStatus == 0) || (fd < 0) || (fd >= 1024) || (newFiles[fd].FileIsOpen == 0)) // Must be mounted and the file open
 	{
-		bool = 0;
-		sec_pos = newFiles[fd].position % 1024;
-		secInd = newFiles[fd].position / 1024; // While loop that loops through finding/setting track and sec to perform function on
-		count2 = 0;
-		for (i = 0; i < 64; i++)
+		return -1;
+	}
+	network_fs3_set_key(fd); // File affinity keeps this file's commands on one connection
+
+	while (done < count)
+	{
+		first = newFiles[fd].position / 1024; // Work on as many sectors as can be in flight at once
+		n = CMPSC311_MINVAL(((newFiles[fd].position % 1024) + (count - done) + 1023) / 1024, FS3_NET_MAX_WINDOW);
+		if ((got = fs3_locate_sectors(fd, first, n, 1, trks, secs)) == 0)
+		{
+			break; // The disk is full
+		}
+
+		nread = 0;
+		for (k = 0; k < got; k++)
 		{
-			for (j = 0; j < 1024; j++)
+			segPos[k] = (k == 0) ? newFiles[fd].position % 1024 : 0;
+			segOff[k] = (k == 0) ? done : segOff[k - 1] + segLen[k - 1];
+			segLen[k] = CMPSC311_MINVAL(1024 - segPos[k], count - segOff[k]);
+			bufs[k] = pipeBufs[k];
+			known[k] = 1;
+			if (segLen[k] == 1024)
 			{
-				if (arr2[i][j] == fd)
-				{
-					if (count2 == secInd)
-					{
-						trk = i;
-						sec = j;
-						bool = 1;
-						break;
-					}
-					else
-					{
-						count2++; // Count2 increments until it equals sector index to run function
-					}
-				}
+				continue; // The whole sector is overwritten, no need for the old contents
 			}
-			if (bool == 1) // Flag that says if bool == 1 then function must of broke out of nested for loop so break this for loop as well
+			if ((newerBuf = fs3_get_cache_file(fd, trks[k], secs[k])) != NULL)
 			{
-				break;
+				memcpy(bufs[k], newerBuf, 1024);
 			}
-		}
-		if (trk == -1 && sec == -1) // If track and sec remain -1 loop through and check if 2d array = -1 then set trk and sec to their respective values
-		{
-			for (i = 0; i < 64; i++)
+			else if ((first + k) * 1024 >= newFiles[fd].size)
 			{
-				for (j = 0; j < 1024; j++)
-				{
-					if (arr2[i][j] == -1)
-					{
-						trk = i;
-						sec = j;
-						arr2[i][j] = fd;
-						bool = 1;
-						break;
-					}
-				}
-				if (bool == 1)
-				{
-					break;
-				}
+				memset(bufs[k], 0, 1024); // Sector is past the end of the file, nothing worth reading
+			}
+			else if (fs3Caps & FS3_CAP_DELTA)
+			{
+				known[k] = 0; // The server merges the delta, the rest of the sector stays unread (and uncached)
+			}
+			else
+			{
+				rTrks[nread] = trks[k];
+				rSecs[nread] = secs[k];
+				rBufs[nread] = bufs[k];
+				nread++;
 			}
 		}
-		if (mountStatus == 0) // Check if its mount, if not return -1
-		{
-			return -1;
-		}
-		if (newFiles[fd].FileIsOpen == 0) // Check if the file is open, if not return -1
+
+		if ((nread > 0) && (fs3_pipeline_sectors(FS3_OP_RDSECT, nread, rTrks, rSecs, rBufs, NULL) == -1)) // Read the partial sectors
 		{
 			return -1;
 		}
-		if (ret == 1) // If ret returns a value of 1 the program failed
+		for (k = 0; k < got; k++)
 		{
-			return -1;
+			memcpy(&bufs[k][segPos[k]], &((char *)buf)[segOff[k]], segLen[k]); // Write operations
 		}
 
-		if (1024 - sec_pos < count) // Function that finds size of write
+		lo = 0; // Whole sectors lo..hi-1 go as writes (in ranges), the partial ones at either end as deltas
+		hi = got;
+		ndelta = 0;
+		if (fs3Caps & FS3_CAP_DELTA)
 		{
-			size = 1024 - sec_pos;
+			for (k = 0; k < got; k++)
+			{
+				if (segLen[k] == 1024)
+				{
+					continue;
+				}
+				dTrks[ndelta] = trks[k];
+				dSecs[ndelta] = secs[k];
+				dLens[ndelta] = segLen[k];
+				dBufs[ndelta] = deltaBufs[ndelta];
+				dBufs[ndelta][0] = (char)(segPos[k] >> 8); // Offset and length, network order
+				dBufs[ndelta][1] = (char)(segPos[k] & 0xff);
+				dBufs[ndelta][2] = (char)(segLen[k] >> 8);
+				dBufs[ndelta][3] = (char)(segLen[k] & 0xff);
+				memcpy(&dBufs[ndelta][FS3_DELTA_HDR_SIZE], &((char *)buf)[segOff[k]], segLen[k]);
+				ndelta++;
+			}
+			lo = (segLen[0] < 1024) ? 1 : 0;
+			hi = ((got > lo) && (segLen[got - 1] < 1024)) ? got - 1 : got;
 		}
-		else
+		if ((hi > lo) && (fs3_pipeline_sectors(FS3_OP_WRSECT, hi - lo, &trks[lo], &secs[lo], &bufs[lo], NULL) == -1))
 		{
-			size = count;
+			return -1;
 		}
-		char *newerBuf = fs3_get_cache(trk, sec);
-		if (newerBuf == NULL)
+		if ((ndelta > 0) && (fs3_pipeline_sectors(FS3_OP_WRDELTA, ndelta, dTrks, dSecs, dBufs, dLens) == -1))
 		{
-			x = construct_fs3_cmdblock(opT, sec, trk, ret); // TSeek operations
-			x = network_fs3_syscall(x, &y, NULL);
-			deconstruct_fs3_cmdblock(x, &opT, &sec, &trk, &ret); // Three system calls in order to complete the folowing
-
-			x = construct_fs3_cmdblock(opR, sec, trk, ret); // Read system call
-			x = network_fs3_syscall(x, &y, buf2);
-			deconstruct_fs3_cmdblock(x, &opR, &sec, &trk, &ret);
-
-			memcpy(&buf2[sec_pos], &((char *)buf)[count3 - count], size); // Write operations
-			x = construct_fs3_cmdblock(op, sec, trk, ret);
-			x = network_fs3_syscall(x, &y, buf2);
-			deconstruct_fs3_cmdblock(x, &op, &sec, &trk, &ret);
-			fs3_put_cache(trk, sec, buf2);
+			return -1;
 		}
-		else
+		for (k = 0; k < got; k++)
 		{
-			memcpy(&newerBuf[sec_pos], &((char *)buf)[count3 - count], size);
-			x = construct_fs3_cmdblock(op, sec, trk, ret);
-			x = network_fs3_syscall(x, &y, newerBuf);
-			deconstruct_fs3_cmdblock(x, &op, &sec, &trk, &ret);
-			fs3_put_cache(trk, sec, newerBuf); // If fs3_get_cache is not null use the buf return as newBuf
+			if (known[k])
+			{
+				fs3_put_cache_file(fd, trks[k], secs[k], bufs[k]);
+			}
+			else
+			{
+				fs3_invalidate_cache(trks[k], secs[k]); // A line the lookup couldn't use (lease lapsed, shared line busy) is stale now
+			}
 		}
 
-		newFiles[fd].position += size; // Setting position to value of count
-		count -= size;				   // Decrementing count to how many bytes are left over
+		newFiles[fd].position += segOff[got - 1] + segLen[got - 1] - done; // Setting position to value of count
+		done = segOff[got - 1] + segLen[got - 1];
 		if (newFiles[fd].position > newFiles[fd].size)
 		{
 			newFiles[fd].size = newFiles[fd].position; // If the write goes beyond, the size should increase --> updating size to value of file position
 		}
-		trk = -1; // Set trk and sec = -1 to allow process to repeat of finding new sectors/tracks to perform function
-		sec = -1;
 	}
-	return (count3 - count); // Return number of bytes written
+	return (done); // Return number of bytes written
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-// Function : fs3_seek
+// Function : fs3_do_seek
 // Description : Seek to specific point in the file
 //
 // Inputs : fd - filename of the file to write to
 // loc - offfset of file in relation to beginning of file
 // Outputs : 0 if successful, -1 if failure
 
-int32_t fs3_seek(int16_t fd, uint32_t loc)
+static int32_t fs3_do_seek(int16_t fd, uint32_t loc)
 {
 	if (mountStatus == 0)
 	{ // Check if it is mount, if not return error
@@ -536,4 +708,467 @@ int32_t fs3_seek(int16_t fd, uint32_t loc)
 	}
 
 	return -1; // Return error if handle is bad, file is closed, and loc is beyond end of file
-}
\ No newline at end of file
+}
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function : fs3_pin
+// Description : Pin a file in the cache, loading all of its sectors so that
+// it stays fully resident while other files are read and written
+//
+// Inputs : fd - the file handle to pin
+// Outputs : 0 if successful, -1 if failure
+
+int32_t fs3_pin(int16_t fd)
+{
+	int32_t trks[FS3_NET_MAX_WINDOW];
+	int16_t secs[FS3_NET_MAX_WINDOW];
+	char *bufs[FS3_NET_MAX_WINDOW];
+	int i;
+	int j;
+	int k;
+	int n = 0;
+	int sectors = 0;
+
+	if ((mountStatus == 0) || (fd < 0) || (fd >= 1024) || (newFiles[fd].FileIsOpen == 0))
+	{
+		return -1;
+	}
+	network_fs3_set_key(fd); // File affinity keeps this file's commands on one connection
+	for (i = 0; i < fs3Tracks; i++) // Count the sectors so the cache can refuse files that would not fit
+	{
+		for (j = 0; j < 1024; j++)
+		{
+			if (arr2[i][j] == fd)
+			{
+				sectors++;
+			}
+		}
+	}
+	if (fs3_cache_pin(fd, sectors) == -1)
+	{
+		return -1;
+	}
+
+	for (i = 0; i < fs3Tracks; i++)
+	{
+		for (j = 0; j < 1024; j++)
+		{
+			if ((arr2[i][j] == fd) && (fs3_get_cache_file(fd, i, j) == NULL)) // Load every sector that is not already resident
+			{
+				trks[n] = i;
+				secs[n] = j;
+				bufs[n] = pipeBufs[n];
+				n++;
+			}
+			if ((n == FS3_NET_MAX_WINDOW) || ((n > 0) && (i == fs3Tracks - 1) && (j == 1023)))
+			{
+				if (fs3_pipeline_sectors(FS3_OP_RDSECT, n, trks, secs, bufs, NULL) == -1)
+				{
+					fs3_cache_unpin(fd);
+					return -1;
+				}
+				for (k = 0; k < n; k++)
+				{
+					fs3_put_cache_file(fd, trks[k], secs[k], bufs[k]);
+				}
+				n = 0;
+			}
+		}
+	}
+	return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function : fs3_unpin
+// Description : Unpin a file, its sectors compete for the cache again
+//
+// Inputs : fd - the file handle to unpin
+// Outputs : 0 if successful, -1 if failure
+
+int32_t fs3_unpin(int16_t fd)
+{
+	if ((fd < 0) || (fd >= 1024))
+	{
+		return -1;
+	}
+	return fs3_cache_unpin(fd);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function : fs3_checksum_buffer
+// Description : Compute the checksum of a byte range of a file from a copy
+// of its bytes, the same way fs3_checksum does from the disk: the SHA1 of
+// the SHA1s of the pieces of the range in each 1024 byte sector of the file
+//
+// Inputs : data - the bytes of the range
+// off - where the range starts in the file
+// len - the length of the range
+// digest - where to put the checksum (FS3_CHECKSUM_SIZE bytes)
+// Outputs : 0 if successful, -1 if failure
+
+int32_t fs3_checksum_buffer(const void *data, uint32_t off, uint32_t len, unsigned char *digest)
+{
+	unsigned char *sums;
+	uint32_t pos = off;
+	uint32_t next;
+	int nsums = (len == 0) ? 0 : (off + len - 1) / 1024 - off / 1024 + 1;
+	int i = 0;
+
+	if ((sums = malloc(CMPSC311_MAXVAL(nsums, 1) * FS3_HASH_SIZE)) == NULL)
+	{
+		return -1;
+	}
+	while (pos < off + len)
+	{
+		next = CMPSC311_MINVAL((pos / 1024 + 1) * 1024, off + len); // End of the piece in this sector
+		gcry_md_hash_buffer(GCRY_MD_SHA1, &sums[i * FS3_HASH_SIZE], (const char *)data + (pos - off), next - pos);
+		pos = next;
+		i++;
+	}
+	gcry_md_hash_buffer(GCRY_MD_SHA1, digest, sums, nsums * FS3_HASH_SIZE);
+	free(sums);
+	return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function : fs3_checksum
+// Description : Compute the checksum of a byte range of a file (see
+// fs3_checksum_buffer); whole sectors are hashed by the server when it
+// offers FS3_OP_HASH, only partial sectors (and everything, otherwise) are
+// read back
+//
+// Inputs : fd - the file handle
+// off - where the range starts in the file
+// len - the length of the range
+// digest - where to put the checksum (FS3_CHECKSUM_SIZE bytes)
+// Outputs : 0 if successful, -1 if failure
+
+int32_t fs3_checksum(int16_t fd, uint32_t off, uint32_t len, unsigned char *digest)
+{
+	int32_t trks[FS3_NET_MAX_WINDOW];
+	int16_t secs[FS3_NET_MAX_WINDOW];
+	int32_t hTrks[FS3_NET_MAX_WINDOW]; // Whole sectors the server hashes
+	int16_t hSecs[FS3_NET_MAX_WINDOW];
+	char *hBufs[FS3_NET_MAX_WINDOW];
+	int32_t mTrks[FS3_NET_MAX_WINDOW]; // Sectors read back and hashed here
+	int16_t mSecs[FS3_NET_MAX_WINDOW];
+	char *mBufs[FS3_NET_MAX_WINDOW];
+	int mIdx[FS3_NET_MAX_WINDOW];
+	int segPos[FS3_NET_MAX_WINDOW]; // Where the piece starts in the sector
+	int segLen[FS3_NET_MAX_WINDOW]; // Length of the piece
+	unsigned char *sums;
+	char *newerBuf;
+	int first = off / 1024;
+	int nsums = (len == 0) ? 0 : (off + len - 1) / 1024 - off / 1024 + 1;
+	int base;
+	int n;
+	int nhash;
+	int nmiss;
+	int k;
+
+	if ((mountStatus == 0) || (fd < 0) || (fd >= 1024) || (newFiles[fd].FileIsOpen == 0) || // Must be mounted and the file open
+		(off + len < off) || (off + len > (uint32_t)newFiles[fd].size))
+	{
+		return -1;
+	}
+	if ((sums = malloc(CMPSC311_MAXVAL(nsums, 1) * FS3_HASH_SIZE)) == NULL)
+	{
+		return -1;
+	}
+	network_fs3_set_key(fd); // File affinity keeps this file's commands on one connection
+
+	for (base = 0; base < nsums; base += n)
+	{
+		n = CMPSC311_MINVAL(nsums - base, FS3_NET_MAX_WINDOW);
+		if (fs3_locate_sectors(fd, first + base, n, 0, trks, secs) != n)
+		{
+			free(sums);
+			return -1;
+		}
+
+		nhash = 0;
+		nmiss = 0;
+		for (k = 0; k < n; k++)
+		{
+			segPos[k] = (base + k == 0) ? off % 1024 : 0;
+			segLen[k] = CMPSC311_MINVAL(1024 - segPos[k], off + len - ((first + base + k) * 1024 + segPos[k]));
+			if ((segLen[k] == 1024) && (fs3Caps & FS3_CAP_HASH))
+			{
+				hTrks[nhash] = trks[k];
+				hSecs[nhash] = secs[k];
+				hBufs[nhash] = (char *)&sums[(base + k) * FS3_HASH_SIZE]; // Neighbouring sectors hash as one run
+				nhash++;
+			}
+			else if ((newerBuf = fs3_get_cache_file(fd, trks[k], secs[k])) != NULL)
+			{
+				gcry_md_hash_buffer(GCRY_MD_SHA1, &sums[(base + k) * FS3_HASH_SIZE], &newerBuf[segPos[k]], segLen[k]);
+			}
+			else
+			{
+				mTrks[nmiss] = trks[k];
+				mSecs[nmiss] = secs[k];
+				mBufs[nmiss] = pipeBufs[nmiss];
+				mIdx[nmiss] = k;
+				nmiss++;
+			}
+		}
+
+		if (((nhash > 0) && (fs3_pipeline_sectors(FS3_OP_HASH, nhash, hTrks, hSecs, hBufs, NULL) == -1)) ||
+			((nmiss > 0) && (fs3_pipeline_sectors(FS3_OP_RDSECT, nmiss, mTrks, mSecs, mBufs, NULL) == -1)))
+		{
+			free(sums);
+			return -1;
+		}
+		for (k = 0; k < nmiss; k++)
+		{
+			gcry_md_hash_buffer(GCRY_MD_SHA1, &sums[(base + mIdx[k]) * FS3_HASH_SIZE], &mBufs[k][segPos[mIdx[k]]], segLen[mIdx[k]]);
+			fs3_put_cache_file(fd, mTrks[k], mSecs[k], mBufs[k]);
+		}
+	}
+
+	gcry_md_hash_buffer(GCRY_MD_SHA1, digest, sums, nsums * FS3_HASH_SIZE);
+	free(sums);
+	return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function : fs3_copy_file_range
+// Description : Copy "len" bytes from the position of one file to the
+// position of another, advancing both. When the server offers FS3_OP_COPY
+// and both positions sit at the same place in a sector, whole sectors are
+// copied by the server (the destination sectors are allocated here) and only
+// the partial sectors at either end, and sectors striped onto another
+// server than their copy, go through the client
+//
+// Inputs : src - the file handle to copy from
+// dst - the file handle to copy to
+// len - number of bytes to copy
+// Outputs : bytes copied if successful, -1 if failure
+
+int32_t fs3_copy_file_range(int16_t src, int16_t dst, int32_t len)
+{
+	int32_t sTrks[FS3_NET_MAX_WINDOW];
+	int16_t sSecs[FS3_NET_MAX_WINDOW];
+	int32_t dTrks[FS3_NET_MAX_WINDOW];
+	int16_t dSecs[FS3_NET_MAX_WINDOW];
+	int32_t cTrks[FS3_NET_MAX_WINDOW]; // One copy command per run that is contiguous on both sides
+	int16_t cSecs[FS3_NET_MAX_WINDOW];
+	char *cBufs[FS3_NET_MAX_WINDOW];
+	int cLens[FS3_NET_MAX_WINDOW];
+	int32_t mTrks[FS3_NET_MAX_WINDOW]; // Sectors read and written again, from and to the source and destination
+	int16_t mSecs[FS3_NET_MAX_WINDOW];
+	int32_t wTrks[FS3_NET_MAX_WINDOW];
+	int16_t wSecs[FS3_NET_MAX_WINDOW];
+	char *mBufs[FS3_NET_MAX_WINDOW];
+	int moved[FS3_NET_MAX_WINDOW]; // Where each sector was carried in mBufs, -1 when the server copied it
+	char *cached;
+	int offload;
+	int piece;
+	int n;
+	int got;
+	int run;
+	int limit;
+	int ncopy;
+	int nmove;
+	int k;
+	int done = 0;
+
+	if ((mountStatus == 0) || (src < 0) || (src >= 1024) || (dst < 0) || (dst >= 1024) || (src == dst) || (len < 0) || // Must be mounted and both files open
+		(newFiles[src].FileIsOpen == 0) || (newFiles[dst].FileIsOpen == 0))
+	{
+		return -1;
+	}
+	if (len > newFiles[src].size - newFiles[src].position) // Nothing to copy past the end of the file
+	{
+		len = newFiles[src].size - newFiles[src].position;
+	}
+	offload = (fs3Caps & FS3_CAP_COPY) && ((newFiles[src].position % 1024) == (newFiles[dst].position % 1024));
+
+	while (done < len)
+	{
+		if ((!offload) || (newFiles[src].position % 1024 != 0) || (len - done < 1024)) // Partial sector (or no server copy), move it through the client
+		{
+			piece = (offload) ? 1024 - newFiles[src].position % 1024 : (int)sizeof(copyBuf); // Up to the next sector boundary, or a bufferful
+			piece = CMPSC311_MINVAL(len - done, piece);
+			if ((fs3_do_read(src, copyBuf, piece) != piece) || (fs3_do_write(dst, copyBuf, piece) != piece))
+			{
+				return -1;
+			}
+			done += piece;
+			continue;
+		}
+
+		network_fs3_set_key(dst); // The copies go on the destination file's connection
+		n = CMPSC311_MINVAL((len - done) / 1024, FS3_NET_MAX_WINDOW);
+		if (fs3_locate_sectors(src, newFiles[src].position / 1024, n, 0, sTrks, sSecs) != n)
+		{
+			return -1;
+		}
+		if ((got = fs3_locate_sectors(dst, newFiles[dst].position / 1024, n, 1, dTrks, dSecs)) == 0)
+		{
+			break; // The disk is full
+		}
+
+		ncopy = 0;
+		nmove = 0;
+		for (k = 0; k < got; k += run)
+		{
+			run = 1;
+			moved[k] = -1;
+			if (network_fs3_server(sTrks[k], sSecs[k]) != network_fs3_server(dTrks[k], dSecs[k])) // Striped onto two servers, neither can copy it
+			{
+				mTrks[nmove] = sTrks[k];
+				mSecs[nmove] = sSecs[k];
+				wTrks[nmove] = dTrks[k];
+				wSecs[nmove] = dSecs[k];
+				mBufs[nmove] = pipeBufs[nmove];
+				moved[k] = nmove++;
+				continue;
+			}
+			limit = CMPSC311_MINVAL(network_fs3_extent(sTrks[k], sSecs[k]), network_fs3_extent(dTrks[k], dSecs[k]));
+			limit = CMPSC311_MINVAL(limit, FS3_MAX_RANGE);
+			while ((k + run < got) && (run < limit) && (sTrks[k + run] == sTrks[k]) && (sSecs[k + run] == sSecs[k] + run) &&
+				   (dTrks[k + run] == dTrks[k]) && (dSecs[k + run] == dSecs[k] + run))
+			{
+				moved[k + run] = -1;
+				run++;
+			}
+			cTrks[ncopy] = dTrks[k];
+			cSecs[ncopy] = dSecs[k];
+			cLens[ncopy] = run;
+			cBufs[ncopy] = copyHdrs[ncopy];
+			cBufs[ncopy][0] = (char)(sTrks[k] >> 8); // Source track and sector, network order
+			cBufs[ncopy][1] = (char)(sTrks[k] & 0xff);
+			cBufs[ncopy][2] = (char)(sSecs[k] >> 8);
+			cBufs[ncopy][3] = (char)(sSecs[k] & 0xff);
+			ncopy++;
+		}
+		if (((ncopy > 0) && (fs3_pipeline_sectors(FS3_OP_COPY, ncopy, cTrks, cSecs, cBufs, cLens) == -1)) ||
+			((nmove > 0) && (fs3_pipeline_sectors(FS3_OP_RDSECT, nmove, mTrks, mSecs, mBufs, NULL) == -1)) ||
+			((nmove > 0) && (fs3_pipeline_sectors(FS3_OP_WRSECT, nmove, wTrks, wSecs, mBufs, NULL) == -1)))
+		{
+			return -1;
+		}
+		for (k = 0; k < got; k++) // The destination now holds the source's bytes, whatever was cached for it is stale
+		{
+			if (moved[k] != -1)
+			{
+				fs3_put_cache_file(dst, dTrks[k], dSecs[k], mBufs[moved[k]]);
+			}
+			else if (fs3_peek_cache(sTrks[k], sSecs[k]) && ((cached = fs3_get_cache_file(src, sTrks[k], sSecs[k])) != NULL)) // The lease may run out in between
+			{
+				memcpy(copyBuf, cached, 1024);
+				fs3_put_cache_file(dst, dTrks[k], dSecs[k], copyBuf);
+			}
+			else
+			{
+				fs3_invalidate_cache(dTrks[k], dSecs[k]);
+			}
+		}
+
+		newFiles[src].position += got * 1024;
+		newFiles[dst].position += got * 1024;
+		done += got * 1024;
+		if (newFiles[dst].position > newFiles[dst].size)
+		{
+			newFiles[dst].size = newFiles[dst].position;
+		}
+	}
+	return (done); // Return number of bytes copied
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function : fs3_open
+// Description : Open a file, recording the call when a trace is running
+// (see fs3_trace.h)
+//
+// Inputs : path - filename of the file to open
+// Outputs : file handle if successful, -1 if failure
+
+int16_t fs3_open(char *path)
+{
+	uint64_t start = fs3_trace_clock();
+	int16_t ret = fs3_do_open(path);
+
+	fs3_trace_record(FS3_TRACE_OPEN, -1, 0, ret, start, path);
+	return ret;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function : fs3_close
+// Description : Close a file, recording the call when a trace is running
+//
+// Inputs : fd - the file descriptor
+// Outputs : 0 if successful, -1 if failure
+
+int16_t fs3_close(int16_t fd)
+{
+	uint64_t start = fs3_trace_clock();
+	int16_t ret = fs3_do_close(fd);
+
+	fs3_trace_record(FS3_TRACE_CLOSE, fd, 0, ret, start, NULL);
+	return ret;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function : fs3_read
+// Description : Read from a file, recording the call when a trace is running
+//
+// Inputs : fd - the file handle to read from
+// buf - pointer to buffer to read into
+// count - number of bytes to read
+// Outputs : bytes read if successful, -1 if failure
+
+int32_t fs3_read(int16_t fd, void *buf, int32_t count)
+{
+	uint64_t start = fs3_trace_clock();
+	int32_t ret = fs3_do_read(fd, buf, count);
+
+	fs3_trace_record(FS3_TRACE_READ, fd, (uint32_t)count, ret, start, NULL);
+	return ret;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function : fs3_write
+// Description : Write to a file, recording the call when a trace is running
+// (the count, not the bytes written)
+//
+// Inputs : fd - the file handle to write to
+// buf - pointer to buffer to write from
+// count - number of bytes to write
+// Outputs : bytes written if successful, -1 if failure
+
+int32_t fs3_write(int16_t fd, void *buf, int32_t count)
+{
+	uint64_t start = fs3_trace_clock();
+	int32_t ret = fs3_do_write(fd, buf, count);
+
+	fs3_trace_record(FS3_TRACE_WRITE, fd, (uint32_t)count, ret, start, NULL);
+	return ret;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function : fs3_seek
+// Description : Seek in a file, recording the call when a trace is running
+//
+// Inputs : fd - the file handle
+// loc - offfset of file in relation to beginning of file
+// Outputs : 0 if successful, -1 if failure
+
+int32_t fs3_seek(int16_t fd, uint32_t loc)
+{
+	uint64_t start = fs3_trace_clock();
+	int32_t ret = fs3_do_seek(fd, loc);
+
+	fs3_trace_record(FS3_TRACE_SEEK, fd, loc, ret, start, NULL);
+	return ret;
+}
@@ -8,17 +8,24 @@
 //                   for used to access the FS3 storage system.
 //
 //  Author         : Patrick McDaniel
-//  Last Modified  : Sun 19 Sep 2021 08:12:43 AM PDT
+//  Last Modified  : Mon 19 Oct 2026 03:15:14 AM UTC
 //
 
 // Include files
 #include <stdint.h>
 #include "cmpsc311_log.h"
 #include "fs3_controller.h"
+#include "fs3_common.h"
 
 // Defines
 #define FS3_MAX_TOTAL_FILES 1024 // Maximum number of files ever
 #define FS3_MAX_PATH_LENGTH 128 // Maximum length of filename length
+#define FS3_CHECKSUM_SIZE FS3_HASH_SIZE // Bytes in a file checksum (SHA1)
+#define FS3_CLIENT_CAPS (FS3_CAP_SEEKXFER|FS3_CAP_RANGE|FS3_CAP_SESSION|FS3_CAP_DELTA|FS3_CAP_HASH|FS3_CAP_COPY) // Protocol extensions the driver asks for at mount (the network layer adds its own)
+
+//
+// Global data
+extern int fs3_readahead; // Sectors to prefetch after each read
 
 //
 // Interface functions
@@ -44,10 +51,19 @@ int32_t fs3_write(int16_t fd, void *buf, int32_t count);
 int32_t fs3_seek(int16_t fd, uint32_t loc);
 	// Seek to specific point in the file
 
-FS3CmdBlk construct_fs3_cmdblock(uint8_t op, int16_t sec, int_fast32_t trk, uint8_t ret);
-	// Creates command block
+int32_t fs3_pin(int16_t fd);
+	// Keep all of the file's sectors resident in the cache
+
+int32_t fs3_unpin(int16_t fd);
+	// Let the file's sectors be evicted again
+
+int32_t fs3_checksum(int16_t fd, uint32_t off, uint32_t len, unsigned char *digest);
+	// Checksum a byte range of a file, hashed by the server where it can be
+
+int32_t fs3_checksum_buffer(const void *data, uint32_t off, uint32_t len, unsigned char *digest);
+	// Checksum a copy of the same byte range, for comparison
 
-int deconstruct_fs3_cmdblock(FS3CmdBlk cmdblock, uint8_t *op, int16_t *sec, int32_t *trk, uint8_t *ret);
-	// Deconstructs command block --> used to assess values in buf return by syscall
+int32_t fs3_copy_file_range(int16_t src, int16_t dst, int32_t len);
+	// Copy bytes from one file's position to another's, by the server where it can be
 
 #endif
@@ -0,0 +1,207 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : fs3_inproc.c
+//  Description    : This is the in-process controller backend for the FS3
+//                   network layer. Commands run against a memory disk with
+//                   the reference controller, and instead of sleeping the
+//                   backend keeps a simulated clock driven by a latency
+//                   model (link round trip, seek distance, sectors moved),
+//                   so benchmarks are deterministic.
+//
+//  Author         : Patrick McDaniel
+//  Last Modified  : Mon 19 Oct 2026 03:15:14 AM UTC
+//
+
+// Includes
+#include <stdio.h>
+#include <stdlib.h>
+#include <cmpsc311_log.h>
+#include <cmpsc311_util.h>
+
+// Project Includes
+#include <fs3_inproc.h>
+#include <fs3_common.h>
+
+//
+// Global data
+unsigned long fs3_inproc_rtt = FS3_INPROC_DEFAULT_RTT;   // Round trip of the simulated link (usecs)
+unsigned long fs3_inproc_seek = FS3_INPROC_DEFAULT_SEEK; // Head movement per track (usecs)
+unsigned long fs3_inproc_xfer = FS3_INPROC_DEFAULT_XFER; // Moving one sector (usecs)
+
+FS3ControllerSession inprocSession; // Controller state of our one "connection"
+uint64_t inprocNow;                 // Simulated time at the client (usecs)
+uint64_t inprocCtrlFree;            // When the controller finishes its queued work
+unsigned long inprocTracksMoved;    // Metrics: total head movement
+unsigned long inprocSectorsMoved;   // Metrics: sectors transferred
+
+static int fs3_inproc_open(int conn);
+static int fs3_inproc_send(FS3NetPending *pend);
+static int fs3_inproc_recv(FS3NetPending *pend);
+static void fs3_inproc_close(int conn);
+static int fs3_inproc_ready(uint32_t conns);
+static int fs3_inproc_log_metrics(void);
+
+FS3NetBackend fs3_inproc_backend = {"inproc", 1, fs3_inproc_open, fs3_inproc_send, fs3_inproc_recv,
+                                    fs3_inproc_close, fs3_inproc_ready, fs3_inproc_log_metrics, 0};
+
+//
+// Implementation
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_inproc_set_model
+// Description  : Set the latency model
+//
+// Inputs       : spec - "<rtt>,<seek>,<xfer>" in usecs
+// Outputs      : 0 if successful, -1 if failure
+
+int fs3_inproc_set_model(const char *spec)
+{
+    if (sscanf(spec, "%lu,%lu,%lu", &fs3_inproc_rtt, &fs3_inproc_seek, &fs3_inproc_xfer) != 3)
+    {
+        logMessage(LOG_ERROR_LEVEL, "Bad latency model [%s], expected <rtt>,<seek>,<xfer>", spec);
+        return (-1);
+    }
+    return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_inproc_time
+// Description  : Return the simulated time spent on the controller so far
+//
+// Inputs       : none
+// Outputs      : the simulated time (usecs)
+
+uint64_t fs3_inproc_time(void)
+{
+    return (inprocNow);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_inproc_open
+// Description  : "Connect" to the in-process controller, creating the
+//                memory disk the first time (it survives unmounts, like a
+//                server's disk would)
+//
+// Inputs       : conn - the slot of the connection (only one is offered)
+// Outputs      : 0 if successful, -1 if failure
+
+static int fs3_inproc_open(int conn)
+{
+    if (fs3_controller_disk == NULL)
+    {
+        if ((fs3_controller_disk = calloc(FS3_MAX_TRACKS, sizeof(FS3Track))) == NULL)
+        {
+            logMessage(LOG_ERROR_LEVEL, "Unable to allocate the in-process disk");
+            return (-1);
+        }
+    }
+    inprocSession.mounted = 0;
+    inprocSession.track = 0;
+    inprocSession.caps = 0;
+    return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_inproc_send
+// Description  : Execute a command on the controller right away and work
+//                out when its reply would reach the client. Commands queue
+//                at the controller one after the other, so pipelined
+//                commands overlap their link time but not their service
+//
+// Inputs       : pend - the command being sent
+// Outputs      : 0 if successful, -1 if failure
+
+static int fs3_inproc_send(FS3NetPending *pend)
+{
+    uint8_t op;
+    int16_t sec;
+    int32_t trk;
+    uint8_t Cret;
+    int head;
+    uint64_t start;
+    unsigned long moved;
+    unsigned long sectors = 0;
+
+    deconstruct_fs3_cmdblock(pend->cmd, &op, &sec, &trk, &Cret);
+    head = inprocSession.track;
+    fs3_controller_execute(&inprocSession, pend->cmd, pend->buf, &pend->ret);
+    moved = abs((int)inprocSession.track - head);
+    if (op == FS3_OP_COPY)
+    {
+        sectors = FS3_RANGE_COUNT(trk); // Moved inside the controller, none of it on the wire
+    }
+    else if (FS3_OP_SENDS_SECTOR(op) || FS3_OP_RECVS_SECTOR(op))
+    {
+        sectors = (op == FS3_OP_WRDELTA) ? 1 : FS3_OP_PAYLOAD(op, trk) / FS3_SECTOR_SIZE; // A delta still rewrites a whole sector
+    }
+    inprocTracksMoved += moved;
+    inprocSectorsMoved += sectors;
+
+    start = CMPSC311_MAXVAL(inprocNow + fs3_inproc_rtt / 2, inprocCtrlFree); // Arrives half a round trip later, waits for the controller
+    inprocCtrlFree = start + moved * fs3_inproc_seek + sectors * fs3_inproc_xfer;
+    pend->due = inprocCtrlFree + fs3_inproc_rtt / 2;
+    return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_inproc_recv
+// Description  : Collect the reply of a command, moving the client's clock
+//                up to when it arrives
+//
+// Inputs       : pend - the oldest command in flight
+// Outputs      : 0 if successful, -1 if failure
+
+static int fs3_inproc_recv(FS3NetPending *pend)
+{
+    inprocNow = CMPSC311_MAXVAL(inprocNow, pend->due);
+    return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_inproc_close
+// Description  : "Disconnect" from the in-process controller
+//
+// Inputs       : conn - the slot of the connection
+// Outputs      : none
+
+static void fs3_inproc_close(int conn)
+{
+    fs3_controller_disconnect(&inprocSession);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_inproc_ready
+// Description  : Pick the connection to collect a reply from; there is only
+//                one and its replies are always ready
+//
+// Inputs       : conns - bit mask of the connections with commands in flight
+// Outputs      : the connection
+
+static int fs3_inproc_ready(uint32_t conns)
+{
+    return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_inproc_log_metrics
+// Description  : Log the simulated time and the work the controller did
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+static int fs3_inproc_log_metrics(void)
+{
+    printf("Latency model    [    rtt %lu, seek %lu, xfer %lu usecs]\n", fs3_inproc_rtt, fs3_inproc_seek, fs3_inproc_xfer);
+    printf("Tracks moved     [    %lu]\n", inprocTracksMoved);
+    printf("Sectors moved    [    %lu]\n", inprocSectorsMoved);
+    printf("Simulated time   [    %llu usecs]\n", (unsigned long long)inprocNow);
+    return (0);
+}
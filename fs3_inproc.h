@@ -0,0 +1,41 @@
+#ifndef FS3_INPROC_INCLUDED
+#define FS3_INPROC_INCLUDED
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File          : fs3_inproc.h
+//  Description   : This is the interface of the in-process controller
+//                  backend, which runs the FS3 controller on a memory disk
+//                  inside the client and keeps time with a latency model.
+//
+//  Author        : Patrick McDaniel
+//  Last Modified : Mon 19 Oct 2026 02:48:45 AM UTC
+//
+
+// Include Files
+#include <stdint.h>
+
+// Project Include Files
+#include <fs3_network.h>
+
+// Defines
+#define FS3_INPROC_DEFAULT_RTT 100  // Round trip of the simulated link (usecs)
+#define FS3_INPROC_DEFAULT_SEEK 20  // Head movement per track (usecs)
+#define FS3_INPROC_DEFAULT_XFER 10  // Moving one sector (usecs)
+
+//
+// Global data
+extern unsigned long fs3_inproc_rtt;   // Round trip of the simulated link (usecs)
+extern unsigned long fs3_inproc_seek;  // Head movement per track (usecs)
+extern unsigned long fs3_inproc_xfer;  // Moving one sector (usecs)
+
+//
+// Functional Prototypes
+
+int fs3_inproc_set_model(const char *spec);
+	// Set the latency model from "<rtt>,<seek>,<xfer>" (usecs)
+
+uint64_t fs3_inproc_time(void);
+	// Simulated time spent waiting on the controller so far (usecs)
+
+#endif
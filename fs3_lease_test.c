@@ -0,0 +1,163 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : fs3_lease_test.c
+//  Description    : This is the test of the cache under a lease (-k). It
+//                   writes part of a cached sector after the lease lapsed,
+//                   when the cache can't hand the old contents to the write
+//                   and only a delta goes to the server, then reads the
+//                   sector back once the lease runs again: the old line
+//                   must not be what it gets.
+//
+//   Author        : Patrick McDaniel
+//   Last Modified : Mon 19 Oct 2026 04:46:54 AM UTC
+//
+
+// Include Files
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+
+// Project Includes
+#include <fs3_driver.h>
+#include <fs3_controller.h>
+#include <fs3_common.h>
+#include <fs3_cache.h>
+#include <fs3_network.h>
+#include <cmpsc311_log.h>
+
+// Defines
+#define LEASE_TEST_ARGUMENTS "hvp:"
+#define LEASE_TEST_PIECE 16          // Bytes rewritten at the front of the sector
+#define LEASE_TEST_PASSES 4          // Times the lapse is tried, at the front and the middle of a file
+#define LEASE_TEST_CACHE 64          // Cache lines
+#define USAGE \
+	"USAGE: fs3_lease_test [-h] [-v] [-p <port>]\n" \
+	"\n" \
+	"where:\n" \
+	"    -h - help mode (display this message)\n" \
+	"    -v - verbose output\n" \
+	"    -p - the port of the (local) server\n" \
+	"\n" \
+
+//
+// Functional Prototypes
+
+int lease_test_pass(int16_t fh, int pass);  // Write part of a sector after a lapse, read it back
+
+//
+// Functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : main
+// Description  : The main function for the lease test
+//
+// Inputs       : argc - the number of command line parameters
+//                argv - the parameters
+// Outputs      : 0 if successful test, 1 if failure
+
+int main( int argc, char *argv[] ) {
+
+	// Local variables
+	int ch, verbose = 0, pass, failed = 0;
+	int16_t fh;
+
+	// Process the command line parameters
+	while ((ch = getopt(argc, argv, LEASE_TEST_ARGUMENTS)) != -1) {
+
+		switch (ch) {
+		case 'h': // Help, print usage
+			fprintf( stderr, USAGE );
+			return( 1 );
+
+		case 'v': // Verbose Flag
+			verbose = 1;
+			break;
+
+		case 'p': // Set the network port number
+			if ( sscanf(optarg, "%hu", &fs3_network_port) != 1 ) {
+				fprintf( stderr, "Bad port number [%s]\n", optarg );
+				return( 1 );
+			}
+			break;
+
+		default:  // Default (unknown)
+			fprintf( stderr, "Unknown command line option (%c), aborting.\n", ch );
+			return( 1 );
+		}
+	}
+
+	// Setup the log as needed
+	initializeLogWithFilehandle( CMPSC311_LOG_STDERR );
+	FS3ControllerLLevel = registerLogLevel("FS3_CONTROLLER", 0); // Controller log level
+	FS3DriverLLevel= registerLogLevel("FS3_DRIVER", 0);          // Driver log level
+	FS3SimulatorLLevel= registerLogLevel("FS3_SIMULATOR", 0);    // Test log level
+	if ( verbose ) {
+		enableLogLevels(FS3ControllerLLevel | FS3DriverLLevel | FS3SimulatorLLevel);
+	}
+
+	// Mount under a lease, so cached sectors can only be used while it runs
+	fs3_network_leases = 1;
+	if ( (fs3_mount_disk() == -1) || (fs3_init_cache(LEASE_TEST_CACHE) == -1) ||
+			((fh = fs3_open("lease_test")) == -1) ) {
+		logMessage( LOG_ERROR_LEVEL, "FS3 lease test failed initialization." );
+		return( 1 );
+	}
+	for (pass=0; pass<LEASE_TEST_PASSES; pass++) {
+		failed |= (lease_test_pass(fh, pass) == -1);
+	}
+	if ( (fs3_close(fh) == -1) || (fs3_unmount_disk() == -1) || (fs3_close_cache() == -1) ) {
+		logMessage( LOG_ERROR_LEVEL, "FS3 lease test failed shutdown." );
+		return( 1 );
+	}
+
+	// Say how it went
+	printf( "FS3 lease test: %s\n", (failed) ? "stale sector read after a lapsed lease" : "all passes successful" );
+	return( (failed) ? 1 : 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lease_test_pass
+// Description  : Write a whole sector (cached), let the lease lapse, write
+//                a piece of the sector and read the whole of it back
+//
+// Inputs       : fh - the file
+//                pass - which pass, picks the sector and the bytes
+// Outputs      : 0 if the sector reads back as written, -1 if not
+
+int lease_test_pass(int16_t fh, int pass) {
+
+	// Local variables
+	char sector[FS3_SECTOR_SIZE], want[FS3_SECTOR_SIZE], got[FS3_SECTOR_SIZE];
+	uint32_t loc = (pass % 2) * FS3_SECTOR_SIZE;
+
+	// The whole sector goes into the cache
+	memset( sector, 'a' + pass, FS3_SECTOR_SIZE );
+	if ( (fs3_seek(fh, loc) == -1) || (fs3_write(fh, sector, FS3_SECTOR_SIZE) != FS3_SECTOR_SIZE) ) {
+		logMessage( LOG_ERROR_LEVEL, "Pass %d, writing the sector failed.", pass );
+		return( -1 );
+	}
+
+	// Wait out the lease, then write the front of the sector
+	usleep( FS3_LEASE_USECS * 2 );
+	memcpy( want, sector, FS3_SECTOR_SIZE );
+	memset( want, 'A' + pass, LEASE_TEST_PIECE );
+	if ( (fs3_seek(fh, loc) == -1) || (fs3_write(fh, want, LEASE_TEST_PIECE) != LEASE_TEST_PIECE) ) {
+		logMessage( LOG_ERROR_LEVEL, "Pass %d, writing the piece failed.", pass );
+		return( -1 );
+	}
+
+	// The reply renewed the lease, so this read may come from the cache
+	if ( (fs3_seek(fh, loc) == -1) || (fs3_read(fh, got, FS3_SECTOR_SIZE) != FS3_SECTOR_SIZE) ) {
+		logMessage( LOG_ERROR_LEVEL, "Pass %d, reading the sector failed.", pass );
+		return( -1 );
+	}
+	if ( memcmp(want, got, FS3_SECTOR_SIZE) != 0 ) {
+		logMessage( LOG_ERROR_LEVEL, "Pass %d, sector at %u reads back '%c', wrote '%c'.", pass, loc, got[0], want[0] );
+		return( -1 );
+	}
+	return( 0 );
+}
@@ -0,0 +1,336 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : fs3_lz.c
+//  Description    : This is the payload codec for the FS3 wire protocol. A
+//                   block is a series of sequences, each a token (literal
+//                   count in the high nibble, match length - 4 in the low
+//                   nibble, 15 meaning more length bytes follow), the
+//                   literals, and a 2 byte little endian offset back to the
+//                   match. The last sequence is literals only. Sector data
+//                   is mostly text, which this squeezes at a few hundred
+//                   MB/s with a single hash probe per position.
+//
+//  Author         : Patrick McDaniel
+//  Last Modified  : Mon 19 Oct 2026 03:07:52 AM UTC
+//
+
+// Includes
+#include <string.h>
+#include <arpa/inet.h>
+
+// Project Includes
+#include <fs3_lz.h>
+
+// Defines
+#define LZ_MIN_MATCH 4       // Shortest match worth a sequence
+#define LZ_HASH_BITS 12      // Size of the match finder table
+#define LZ_SMALL_HASH_BITS 9 // Table used for a sector or two, clearing the big one costs more than it finds
+#define LZ_SMALL_BLOCK 4096  // Blocks up to this size use the small table
+#define LZ_LAST_LITERALS 5   // Bytes at the end that are always literals
+#define LZ_MATCH_LIMIT 12    // No match starts this close to the end
+#define LZ_MAX_OFFSET 65535  // Furthest a match can reach back
+#define LZ_SKIP_SHIFT 6      // Step further after every 64 positions without a match
+
+//
+// Implementation
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lz_read32
+// Description  : Read the 4 bytes at a position (any alignment)
+//
+// Inputs       : p - the bytes
+// Outputs      : the bytes as a word
+
+static uint32_t lz_read32(const uint8_t *p)
+{
+    uint32_t v;
+
+    memcpy(&v, p, sizeof(v));
+    return (v);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lz_put_length
+// Description  : Write the extra bytes of a length that overflowed its nibble
+//
+// Inputs       : op - where to write
+//                len - what is left of the length after the nibble
+// Outputs      : the position after the length bytes
+
+static uint8_t *lz_put_length(uint8_t *op, int len)
+{
+    while (len >= 255)
+    {
+        *op++ = 255;
+        len -= 255;
+    }
+    *op++ = (uint8_t)len;
+    return (op);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lz_put_sequence
+// Description  : Write one sequence (literals, then a match if mlen >= 0)
+//
+// Inputs       : op - where to write
+//                oend - end of the output buffer
+//                lit - the literals
+//                nlit - the number of literals
+//                off - the match offset
+//                mlen - the match length less LZ_MIN_MATCH, -1 for none
+// Outputs      : the position after the sequence, NULL if it doesn't fit
+
+static uint8_t *lz_put_sequence(uint8_t *op, uint8_t *oend, const uint8_t *lit, int nlit, int off, int mlen)
+{
+    uint8_t *token = op++;
+
+    if (op + nlit + nlit / 255 + 1 + ((mlen >= 0) ? 2 + mlen / 255 + 1 : 0) > oend) // Worst case size of the sequence
+    {
+        return (NULL);
+    }
+    *token = (uint8_t)(((nlit < 15) ? nlit : 15) << 4);
+    if (nlit >= 15)
+    {
+        op = lz_put_length(op, nlit - 15);
+    }
+    memcpy(op, lit, nlit);
+    op += nlit;
+    if (mlen < 0)
+    {
+        return (op);
+    }
+
+    *op++ = (uint8_t)(off & 0xff);
+    *op++ = (uint8_t)(off >> 8);
+    *token |= (uint8_t)((mlen < 15) ? mlen : 15);
+    if (mlen >= 15)
+    {
+        op = lz_put_length(op, mlen - 15);
+    }
+    return (op);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_lz_compress
+// Description  : Compress a block
+//
+// Inputs       : src - the bytes to compress
+//                len - the number of bytes
+//                dst - where to put the compressed block
+//                cap - the most bytes to write
+// Outputs      : the size of the compressed block, -1 if it doesn't fit
+
+int fs3_lz_compress(const void *src, int len, void *dst, int cap)
+{
+    uint32_t table[1 << LZ_HASH_BITS]; // Last position seen with each hash
+    const uint8_t *in = src;
+    const uint8_t *ip = in;
+    const uint8_t *anchor = in;
+    const uint8_t *iend = in + len;
+    const uint8_t *ilimit = in + ((len > LZ_MATCH_LIMIT) ? len - LZ_MATCH_LIMIT : 0);
+    const uint8_t *ref;
+    const uint8_t *mp;
+    uint8_t *op = dst;
+    uint8_t *oend = op + cap;
+    uint32_t h;
+    uint32_t seq;
+    int misses = 0;
+    int bits = (len <= LZ_SMALL_BLOCK) ? LZ_SMALL_HASH_BITS : LZ_HASH_BITS;
+
+    memset(table, 0, sizeof(uint32_t) << bits);
+    while (ip < ilimit)
+    {
+        seq = lz_read32(ip);
+        h = (seq * 2654435761u) >> (32 - bits);
+        ref = in + table[h];
+        table[h] = (uint32_t)(ip - in);
+        if ((ref >= ip) || (ip - ref > LZ_MAX_OFFSET) || (lz_read32(ref) != seq))
+        {
+            ip += 1 + (misses++ >> LZ_SKIP_SHIFT); // Stride over data that isn't matching
+            continue;
+        }
+        misses = 0;
+
+        // Extend the match as far as it goes, leaving the tail as literals
+        for (mp = ip + LZ_MIN_MATCH, ref += LZ_MIN_MATCH; (mp < iend - LZ_LAST_LITERALS) && (*mp == *ref); mp++, ref++);
+        if ((op = lz_put_sequence(op, oend, anchor, (int)(ip - anchor), (int)(mp - ref), (int)(mp - ip) - LZ_MIN_MATCH)) == NULL)
+        {
+            return (-1);
+        }
+        ip = anchor = mp;
+    }
+
+    if ((op = lz_put_sequence(op, oend, anchor, (int)(iend - anchor), 0, -1)) == NULL)
+    {
+        return (-1);
+    }
+    return ((int)(op - (uint8_t *)dst));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_lz_decompress
+// Description  : Expand a compressed block, checking every length and
+//                offset against the buffers (the block came off the wire)
+//
+// Inputs       : src - the compressed block
+//                len - its size
+//                dst - where to put the bytes
+//                cap - the most bytes to write
+// Outputs      : the number of bytes written, -1 if the block is corrupt
+
+int fs3_lz_decompress(const void *src, int len, void *dst, int cap)
+{
+    const uint8_t *ip = src;
+    const uint8_t *iend = ip + len;
+    uint8_t *out = dst;
+    uint8_t *op = out;
+    uint8_t *oend = out + cap;
+    const uint8_t *ref;
+    int token;
+    int n;
+    int off;
+    uint8_t b;
+
+    while (ip < iend)
+    {
+        token = *ip++;
+        n = token >> 4;
+        if (n == 15)
+        {
+            do
+            {
+                if (ip >= iend)
+                {
+                    return (-1);
+                }
+                b = *ip++;
+                n += b;
+            } while (b == 255);
+        }
+        if ((n > iend - ip) || (n > oend - op))
+        {
+            return (-1);
+        }
+        memcpy(op, ip, n);
+        ip += n;
+        op += n;
+        if (ip == iend) // The last sequence has no match
+        {
+            break;
+        }
+
+        if (iend - ip < 2)
+        {
+            return (-1);
+        }
+        off = ip[0] | (ip[1] << 8);
+        ip += 2;
+        n = token & 15;
+        if (n == 15)
+        {
+            do
+            {
+                if (ip >= iend)
+                {
+                    return (-1);
+                }
+                b = *ip++;
+                n += b;
+            } while (b == 255);
+        }
+        n += LZ_MIN_MATCH;
+        if ((off == 0) || (off > op - out) || (n > oend - op))
+        {
+            return (-1);
+        }
+        ref = op - off;
+        if (off >= n)
+        {
+            memcpy(op, ref, n);
+            op += n;
+            continue;
+        }
+        for (; n > 0; n--) // Byte at a time, the match overlaps what it writes
+        {
+            *op++ = *ref++;
+        }
+    }
+    return ((int)(op - out));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_lz_frame
+// Description  : Frame a payload for the wire, compressed when that is
+//                smaller and raw when it isn't
+//
+// Inputs       : src - the payload
+//                len - its size
+//                frame - where to build the frame (FS3_LZ_FRAME_MAX(len) bytes)
+// Outputs      : the size of the frame
+
+int fs3_lz_frame(const void *src, int len, void *frame)
+{
+    uint8_t *body = (uint8_t *)frame + FS3_LZ_HDR_SIZE;
+    uint32_t hdr;
+    int zlen;
+
+    if ((zlen = fs3_lz_compress(src, len, body, len - 1)) == -1) // Incompressible, send it as is
+    {
+        memcpy(body, src, len);
+        hdr = htonl((uint32_t)len);
+        zlen = len;
+    }
+    else
+    {
+        hdr = htonl(FS3_LZ_PACKED | (uint32_t)zlen);
+    }
+    memcpy(frame, &hdr, sizeof(hdr));
+    return (FS3_LZ_HDR_SIZE + zlen);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_lz_header
+// Description  : Read the header at the front of a frame
+//
+// Inputs       : frame - the frame
+// Outputs      : the header in host order
+
+uint32_t fs3_lz_header(const void *frame)
+{
+    uint32_t hdr;
+
+    memcpy(&hdr, frame, sizeof(hdr));
+    return (ntohl(hdr));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_lz_unframe
+// Description  : Recover a payload from the body of a frame
+//
+// Inputs       : hdr - the frame header (host order)
+//                body - the FS3_LZ_LENGTH(hdr) bytes behind it
+//                dst - where to put the payload
+//                len - the size the payload must have
+// Outputs      : 0 if successful, -1 if the frame doesn't hold len bytes
+
+int fs3_lz_unframe(uint32_t hdr, const void *body, void *dst, int len)
+{
+    if (!(hdr & FS3_LZ_PACKED))
+    {
+        if (FS3_LZ_LENGTH(hdr) != len)
+        {
+            return (-1);
+        }
+        memcpy(dst, body, len);
+        return (0);
+    }
+    return ((fs3_lz_decompress(body, FS3_LZ_LENGTH(hdr), dst, len) == len) ? 0 : -1);
+}
@@ -0,0 +1,43 @@
+#ifndef FS3_LZ_INCLUDED
+#define FS3_LZ_INCLUDED
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File          : fs3_lz.h
+//  Description   : This is the interface of the payload codec used on the
+//                  wire once a mount grants FS3_CAP_COMPRESS: a small LZ77
+//                  block compressor (LZ4 style sequences) and the frame that
+//                  carries a payload, compressed or raw.
+//
+//  Author        : Patrick McDaniel
+//  Last Modified : Mon 19 Oct 2026 03:07:52 AM UTC
+//
+
+// Include Files
+#include <stdint.h>
+
+// Defines
+#define FS3_LZ_HDR_SIZE 4                          // Frame header, network order: packed flag and body length
+#define FS3_LZ_PACKED 0x80000000u                  // Body is compressed (otherwise the raw payload)
+#define FS3_LZ_LENGTH(hdr) ((int)((hdr) & 0x00ffffffu)) // Bytes of body behind the header
+#define FS3_LZ_FRAME_MAX(len) ((len) + FS3_LZ_HDR_SIZE) // Largest frame for a payload of len bytes
+
+//
+// Functional Prototypes
+
+int fs3_lz_compress(const void *src, int len, void *dst, int cap);
+	// Compress len bytes into at most cap bytes, -1 if they don't fit
+
+int fs3_lz_decompress(const void *src, int len, void *dst, int cap);
+	// Expand a compressed block into at most cap bytes, -1 if it is corrupt
+
+int fs3_lz_frame(const void *src, int len, void *frame);
+	// Frame a payload, compressed if that makes it smaller (frame holds FS3_LZ_FRAME_MAX(len))
+
+uint32_t fs3_lz_header(const void *frame);
+	// Read the (host order) header at the front of a frame
+
+int fs3_lz_unframe(uint32_t hdr, const void *body, void *dst, int len);
+	// Recover the len byte payload from a frame body, -1 if it doesn't match
+
+#endif
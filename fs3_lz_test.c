@@ -0,0 +1,273 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : fs3_lz_test.c
+//  Description    : This is the test of the FS3 payload codec (fs3_lz). It
+//                   round trips text, random and incompressible payloads of
+//                   many sizes through the compressor and the frame, then
+//                   feeds the decoder truncated and corrupted frames, which
+//                   it must refuse without writing past its buffer.
+//
+//   Author        : Patrick McDaniel
+//   Last Modified : Mon 19 Oct 2026 04:38:18 AM UTC
+//
+
+// Include Files
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Project Includes
+#include <fs3_lz.h>
+
+// Defines
+#define LZ_TEST_MAX 65536          // Largest payload tested (a full range of sectors)
+#define LZ_TEST_GUARD 64           // Bytes past the end of an output buffer that must not change
+#define LZ_TEST_CORRUPTIONS 2000   // Corrupted frames fed to the decoder per payload
+#define LZ_TEST_SEED 311           // Payloads are the same every run
+
+// The kinds of payload
+typedef enum {
+	LZ_TEXT = 0,            // Words from a small vocabulary, compresses well
+	LZ_RANDOM = 1,          // Random letters, compresses a little
+	LZ_INCOMPRESSIBLE = 2,  // Random bytes, sent raw
+	LZ_ZEROS = 3,           // One byte repeated, long overlapping matches
+	LZ_KINDS = 4
+} LzTestKind;
+
+//
+// Global Data
+char *lzTestKinds[LZ_KINDS] = { "text", "random", "incompressible", "zeros" };
+int lzTestSizes[] = { 0, 1, 4, 12, 13, 17, 100, 1023, 1024, 1025, 4096, 4097, 16384, LZ_TEST_MAX };
+int lzTestFailures;     // Checks that failed
+int lzTestChecks;       // Checks made
+
+//
+// Functional Prototypes
+
+void lz_test_fill(LzTestKind kind, uint8_t *buf, int len);  // Make a payload
+void lz_test_check(int ok, const char *what, LzTestKind kind, int len); // Count a check
+int lz_test_guarded(const uint8_t *buf, int len);           // Guard bytes intact
+void lz_test_round_trip(LzTestKind kind, int len);          // Compress, frame and back again
+void lz_test_damage(LzTestKind kind, int len);              // Truncated and corrupt frames
+
+//
+// Functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : main
+// Description  : The main function for the codec test
+//
+// Inputs       : argc - the number of command line parameters
+//                argv - the parameters
+// Outputs      : 0 if every check passed, 1 otherwise
+
+int main( int argc, char *argv[] ) {
+
+	// Local variables
+	int kind, i;
+
+	srand( LZ_TEST_SEED );
+	for (kind=0; kind<LZ_KINDS; kind++) {
+		for (i=0; i<sizeof(lzTestSizes)/sizeof(int); i++) {
+			lz_test_round_trip( kind, lzTestSizes[i] );
+			lz_test_damage( kind, lzTestSizes[i] );
+		}
+	}
+
+	// Say how it went
+	printf( "FS3 codec test: %d checks, %d failed\n", lzTestChecks, lzTestFailures );
+	return( (lzTestFailures == 0) ? 0 : 1 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lz_test_fill
+// Description  : Make a payload of a kind
+//
+// Inputs       : kind - the kind of payload
+//                buf - where to put it
+//                len - its size
+// Outputs      : none
+
+void lz_test_fill(LzTestKind kind, uint8_t *buf, int len) {
+
+	// Local variables
+	static const char *words[] = { "the ", "sector ", "of ", "a ", "file ", "is ", "written ",
+		"to ", "track ", "and ", "cache ", "server\n" };
+	const char *w;
+	int i, n;
+
+	switch (kind) {
+	case LZ_TEXT:
+		for (i=0; i<len; i+=n) {
+			w = words[rand() % (sizeof(words)/sizeof(char *))];
+			n = strlen(w);
+			memcpy( &buf[i], w, (n < len - i) ? n : len - i );
+		}
+		break;
+
+	case LZ_RANDOM:
+		for (i=0; i<len; i++) {
+			buf[i] = 'a' + rand() % 26;
+		}
+		break;
+
+	case LZ_INCOMPRESSIBLE:
+		for (i=0; i<len; i++) {
+			buf[i] = rand() & 0xff;
+		}
+		break;
+
+	default:
+		memset( buf, 'z', len );
+		break;
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lz_test_check
+// Description  : Count a check, saying what failed
+//
+// Inputs       : ok - the check passed
+//                what - what was checked
+//                kind - the kind of payload
+//                len - its size
+// Outputs      : none
+
+void lz_test_check(int ok, const char *what, LzTestKind kind, int len) {
+	lzTestChecks ++;
+	if ( !ok ) {
+		lzTestFailures ++;
+		printf( "FAILED: %s, %s payload of %d bytes\n", what, lzTestKinds[kind], len );
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lz_test_guarded
+// Description  : Check the guard bytes behind an output buffer are intact
+//
+// Inputs       : buf - the output buffer
+//                len - its size, the guard follows
+// Outputs      : 1 if they are, 0 if the decoder wrote past the buffer
+
+int lz_test_guarded(const uint8_t *buf, int len) {
+
+	// Local variables
+	int i;
+
+	for (i=0; i<LZ_TEST_GUARD; i++) {
+		if ( buf[len+i] != 0xa5 ) {
+			return( 0 );
+		}
+	}
+	return( 1 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lz_test_round_trip
+// Description  : Compress a payload and expand it, frame it and unframe it,
+//                checking the bytes come back and the frame is no bigger
+//                than FS3_LZ_FRAME_MAX
+//
+// Inputs       : kind - the kind of payload
+//                len - its size
+// Outputs      : none
+
+void lz_test_round_trip(LzTestKind kind, int len) {
+
+	// Local variables
+	static uint8_t src[LZ_TEST_MAX], zbuf[LZ_TEST_MAX*2], out[LZ_TEST_MAX+LZ_TEST_GUARD];
+	static uint8_t frame[FS3_LZ_FRAME_MAX(LZ_TEST_MAX)];
+	uint32_t hdr;
+	int zlen, flen;
+
+	lz_test_fill( kind, src, len );
+
+	// The block on its own, with room to spare
+	zlen = fs3_lz_compress( src, len, zbuf, sizeof(zbuf) );
+	lz_test_check( zlen >= 0, "compress", kind, len );
+	memset( out, 0xa5, sizeof(out) );
+	lz_test_check( (zlen >= 0) && (fs3_lz_decompress(zbuf, zlen, out, len) == len) &&
+			(memcmp(src, out, len) == 0) && lz_test_guarded(out, len), "decompress", kind, len );
+
+	// A block that doesn't fit is refused
+	if ( zlen > 0 ) {
+		lz_test_check( fs3_lz_compress(src, len, zbuf, zlen - 1) == -1, "compress into too small a buffer", kind, len );
+	}
+
+	// The frame, packed unless that doesn't save anything
+	flen = fs3_lz_frame( src, len, frame );
+	hdr = fs3_lz_header( frame );
+	lz_test_check( (flen <= FS3_LZ_FRAME_MAX(len)) && (FS3_LZ_LENGTH(hdr) == flen - FS3_LZ_HDR_SIZE), "frame size", kind, len );
+	if ( (kind == LZ_INCOMPRESSIBLE) || (len < 13) ) {
+		lz_test_check( !(hdr & FS3_LZ_PACKED), "incompressible frame sent raw", kind, len );
+	}
+	if ( ((kind == LZ_TEXT) || (kind == LZ_ZEROS)) && (len >= 1024) ) {
+		lz_test_check( (hdr & FS3_LZ_PACKED) && (flen < len * 3 / 4), "compressible frame packed", kind, len );
+	}
+	memset( out, 0xa5, sizeof(out) );
+	lz_test_check( (fs3_lz_unframe(hdr, &frame[FS3_LZ_HDR_SIZE], out, len) == 0) &&
+			(memcmp(src, out, len) == 0) && lz_test_guarded(out, len), "unframe", kind, len );
+
+	// The frame has to hold exactly the payload expected
+	lz_test_check( fs3_lz_unframe(hdr, &frame[FS3_LZ_HDR_SIZE], out, len + 1) == -1, "unframe longer payload", kind, len );
+	if ( len > 0 ) {
+		memset( out, 0xa5, sizeof(out) );
+		lz_test_check( (fs3_lz_unframe(hdr, &frame[FS3_LZ_HDR_SIZE], out, len - 1) == -1) && lz_test_guarded(out, len - 1),
+				"unframe shorter payload", kind, len );
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lz_test_damage
+// Description  : Feed the decoder every truncation of a packed frame, then
+//                frames with random bytes changed. A truncated frame must
+//                be refused; a corrupt one may decode to other bytes, but
+//                the decoder must never write past the payload
+//
+// Inputs       : kind - the kind of payload
+//                len - its size
+// Outputs      : none
+
+void lz_test_damage(LzTestKind kind, int len) {
+
+	// Local variables
+	static uint8_t src[LZ_TEST_MAX], out[LZ_TEST_MAX+LZ_TEST_GUARD];
+	static uint8_t frame[FS3_LZ_FRAME_MAX(LZ_TEST_MAX)], bad[FS3_LZ_FRAME_MAX(LZ_TEST_MAX)];
+	uint32_t hdr;
+	int flen, blen, i, j, ok, got;
+
+	lz_test_fill( kind, src, len );
+	flen = fs3_lz_frame( src, len, frame );
+	hdr = fs3_lz_header( frame );
+	blen = flen - FS3_LZ_HDR_SIZE;
+
+	// Shorter bodies (every one, for the smaller frames), as a packed frame and as a raw one
+	for (i=0, ok=1; (i<blen) && ok; i+=(blen > 4096) ? 1 + rand()%64 : 1) {
+		memset( out, 0xa5, sizeof(out) );
+		ok = (fs3_lz_unframe((hdr & FS3_LZ_PACKED) | i, &frame[FS3_LZ_HDR_SIZE], out, len) == -1) &&
+				lz_test_guarded(out, len);
+	}
+	lz_test_check( ok, "truncated frame refused", kind, len );
+
+	// Only packed frames have anything to corrupt
+	if ( !(hdr & FS3_LZ_PACKED) ) {
+		return;
+	}
+	for (i=0, ok=1; (i<LZ_TEST_CORRUPTIONS) && ok; i++) {
+		memcpy( bad, frame, flen );
+		for (j=0; j<1+rand()%4; j++) {
+			bad[FS3_LZ_HDR_SIZE + rand()%blen] ^= 1 + rand()%255;
+		}
+		memset( out, 0xa5, sizeof(out) );
+		got = fs3_lz_decompress( &bad[FS3_LZ_HDR_SIZE], blen, out, len );
+		ok = (got >= -1) && (got <= len) && lz_test_guarded(out, len);
+	}
+	lz_test_check( ok, "corrupt frame stays in its buffer", kind, len );
+}
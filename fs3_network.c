@@ -5,14 +5,19 @@
 
 //
 //  Author         : Patrick McDaniel
-//  Last Modified  : Thu 16 Sep 2021 03:04:04 PM EDT
+//  Last Modified  : Mon 19 Oct 2026 04:05:40 AM UTC
 //
 
 // Includes
+#include <stdio.h>
 #include <unistd.h>
 #include <errno.h>
+#include <time.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
+#include <poll.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <arpa/inet.h>
 #include <cmpsc311_log.h>
 #include <string.h>
@@ -21,165 +26,2143 @@
 // Project Includes
 #include <fs3_network.h>
 #include <fs3_driver.h>
+#include <fs3_lz.h>
+#include <fs3_cache.h>
 
+// Defines
+#define NET_SPAN_NONE 0              // A command that neither reads nor writes sectors
+#define NET_SPAN_READ 1              // Reads a run of sectors, any up to date replica can answer
+#define NET_SPAN_WRITE 2             // Writes a run of sectors, every replica has to see it
+#define NET_START_LATENCY 100000UL   // Round trip assumed for a connection until its replies come back (nsecs)
+#define NET_TIER_EPOCH 4096          // Sector accesses between halvings of every chunk's heat
+#define NET_TIER_HOT (2 * FS3_NET_TIER_CHUNK) // Heat that makes a slow chunk worth promoting (two passes over it)
+#define NET_TIER_QUEUE 64            // Hot chunks waiting for a place on the fast tier
+#define NET_TIER_SCAN 16             // Fast chunks the clock hand looks at for a victim
+#define NET_LEASE_SLACK 10000000UL   // Lease time given up to the server's clock and scheduling (nsecs)
+
+//
+//  Global data
+unsigned char *fs3_network_address = NULL; // Address of FS3 server
+unsigned short fs3_network_port = 0;       // Port of FS3 serve
+unsigned long fs3_network_delay = 0;       // Injected latency per round trip (usecs)
+int fs3_network_window = FS3_NET_DEFAULT_WINDOW; // Commands allowed in flight
+int fs3_network_connections = 1;           // Connections to open when the server shares its mount
+int fs3_network_affinity = FS3_NET_AFFINITY_TRACK; // How commands are spread over the connections
+int fs3_network_auto = 1;                  // Use the shared-memory ring when the server is local (no backend chosen)
+int fs3_network_compress = 0;              // Ask the server to compress payloads on the wire
+int fs3_network_servers = 1;               // Servers the disk is striped over
+int fs3_network_stripe = FS3_NET_DEFAULT_STRIPE; // Sectors in each stripe unit
+int fs3_network_replicas = 1;              // Servers holding a copy of each stripe
+int fs3_network_tier_tracks = 0;           // Tracks of the fast tier, 0 when the disk isn't tiered
+int fs3_network_leases = 0;                // Keep the cache coherent with other clients through a lease
+int socket_fds[FS3_NET_MAX_CONNECTIONS];   // The pool of sockets, socket_fds[0] carries mount/unmount
+
+FS3NetPending pendingOps[FS3_NET_MAX_CONNECTIONS][FS3_NET_RING]; // Per connection ring of commands awaiting replies, in send order
+int pendingHead[FS3_NET_MAX_CONNECTIONS];  // Oldest command in flight on each connection
+int pendingConn[FS3_NET_MAX_CONNECTIONS];  // Number of commands in flight on each connection
+int pendingShadow[FS3_NET_MAX_CONNECTIONS]; // Of those, the mirror and repair commands nobody waits for
+int pendingCount;                          // Number of driver commands in flight on all connections
+int netConns = 0;                          // Connections open, 0 when not mounted
+int netKey = 0;                            // File being worked on (file affinity)
+int netCompress = 0;                       // Payloads travel in frames (FS3_CAP_COMPRESS granted)
+char netFrame[FS3_LZ_FRAME_MAX(FS3_MAX_RANGE * FS3_SECTOR_SIZE)]; // Frame being sent or received
+const char *netAddresses[FS3_NET_MAX_SERVERS]; // Address of each server after the first (NULL for the default)
+unsigned short netPorts[FS3_NET_MAX_SERVERS];  // Port of each server after the first (0 for the default)
+FS3CmdBlk netMounts[FS3_NET_MAX_SERVERS];      // Reply of each server to the mount
+uint16_t netCaps;                              // Extensions all of the servers granted
+unsigned long netLatency[FS3_NET_MAX_CONNECTIONS]; // Smoothed round trip of each connection (nsecs)
+uint64_t netDirty[FS3_NET_MAX_SERVERS][FS3_MAX_TRACKS][FS3_TRACK_SIZE / 64]; // Sectors each replica missed a write to
+int netDirtyCount[FS3_NET_MAX_SERVERS];        // Number of those sectors on each replica
+uint32_t netRandom = 0x9e3779b9;               // State of the generator drawing replicas for reads
+char netRepairBuf[FS3_MAX_RANGE * FS3_SECTOR_SIZE]; // The run being carried to a replica that missed it
+
+// The one repair in progress: a run read from an up to date replica, on its
+// way to the replica that missed it
+struct {
+    int busy;    // The read is in flight
+    int stale;   // A write overlapped the run since it was read, drop it
+    int target;  // The replica being repaired
+    int source;  // The replica the run is read from
+    int32_t trk; // The run, on the servers
+    int16_t sec;
+    int cnt;
+    int next;    // Replica to look at first next time (so all of them get repaired)
+} netRepair;
+
+int16_t netTierMap[FS3_NET_TIER_CHUNKS];      // Fast slot holding each chunk of a tiered disk, -1 while it is at home on the slow tier
+int16_t netTierSlot[FS3_NET_TIER_CHUNKS];     // Chunk in each slot of the fast tier, -1 if free
+int netTierSlots;                             // Slots of the fast tier
+int netTierFree;                              // Of those, the free ones
+int netTierHand;                              // Clock hand over the slots, where the next victim search starts
+uint16_t netHeat[FS3_NET_TIER_CHUNKS];        // Sector accesses to each chunk, halved every epoch
+uint16_t netHeatEpoch[FS3_NET_TIER_CHUNKS];   // Epoch each chunk's heat was last brought up to date in
+uint16_t netEpoch;                            // Current epoch
+unsigned long netEpochAccesses;               // Sector accesses so far in the epoch
+int16_t netTierQueue[NET_TIER_QUEUE];         // Hot slow chunks in the order they got hot
+uint8_t netTierQueued[FS3_NET_TIER_CHUNKS];   // Chunks in the queue
+int netTierQHead;                             // Oldest entry of the queue
+int netTierQLen;                              // Entries in the queue
+char netTierBuf[FS3_NET_TIER_CHUNK * FS3_SECTOR_SIZE]; // The chunk being moved
+
+int netLease = 0;                              // The mount holds a lease (FS3_CAP_LEASE granted)
+int netRecalling = 0;                          // Recalls are being collected, nothing cached can be used until they are in
+unsigned long netLeaseUntil = 0;               // When the lease runs out, as far as this side can tell (nsecs)
+char netRecallBuf[FS3_SECTOR_SIZE];            // The recalls being collected
+
+// The one migration in progress: a chunk read from the tier it is on, on its
+// way to the other one (the map changes once the write is done)
+struct {
+    int busy;   // The read or the write is in flight
+    int stale;  // The driver wrote to the chunk since it was read, drop it
+    int chunk;  // The chunk moving
+    int to;     // The fast slot it goes to, -1 to go home
+} netMigration;
+
+unsigned long netCommands;  // Metrics: command blocks sent
+unsigned long netBytesOut;  // Metrics: bytes written to the server
+unsigned long netBytesIn;   // Metrics: bytes read from the server
+unsigned long netRawOut;    // Metrics: payload bytes sent in frames, before framing
+unsigned long netRawIn;     // Metrics: payload bytes received in frames, after unframing
+unsigned long netFrameOut;  // Metrics: frame bytes sent
+unsigned long netFrameIn;   // Metrics: frame bytes received
+unsigned long netPackNs;    // Metrics: time spent compressing (nsecs)
+unsigned long netUnpackNs;  // Metrics: time spent decompressing (nsecs)
+unsigned long netServerCommands[FS3_NET_MAX_SERVERS]; // Metrics: command blocks sent to each server
+unsigned long netServerReads[FS3_NET_MAX_SERVERS];    // Metrics: driver reads each replica answered
+unsigned long netMirrored;  // Metrics: write copies sent to the other replicas
+unsigned long netSkipped;   // Metrics: write copies skipped because the replica was lagging
+unsigned long netRepaired;  // Metrics: sectors written back to replicas that missed them
+unsigned long netRepairFailures; // Metrics: repairs that failed on the server
+unsigned long netPromoted;  // Metrics: chunks moved to the fast tier
+unsigned long netDemoted;   // Metrics: chunks moved back to the slow tier
+unsigned long netMigrationsDropped; // Metrics: moves overtaken by a write (or failed)
+unsigned long netTierFastSectors; // Metrics: sectors the driver found on the fast tier
+unsigned long netTierSlowSectors; // Metrics: sectors the driver found on the slow tier
+unsigned long netRecalls;   // Metrics: sectors other clients' writes recalled from the cache
+unsigned long netRecallRounds; // Metrics: LEASE commands sent to collect them
+unsigned long netLeaseFlushes; // Metrics: times so much was recalled the whole cache went
+
+static int network_tcp_open(int conn);
+static int network_tcp_send(FS3NetPending *pend);
+static int network_tcp_recv(FS3NetPending *pend);
+static void network_tcp_close(int conn);
+static int network_tcp_ready(uint32_t conns);
+
+FS3NetBackend fs3_tcp_backend = {"tcp", FS3_NET_MAX_CONNECTIONS, network_tcp_open, network_tcp_send, network_tcp_recv,
+                                 network_tcp_close, network_tcp_ready, NULL, 1};
+FS3NetBackend *fs3_network_backend = &fs3_tcp_backend; // Where commands go
+FS3NetBackend *fs3NetBackends[] = {&fs3_tcp_backend, &fs3_uring_backend, &fs3_shm_backend, &fs3_inproc_backend, NULL};
+
+//
+// Network functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : network_nsecs
+// Description  : Read the clock used to cost the codec
+//
+// Inputs       : none
+// Outputs      : monotonic time in nsecs
+
+static unsigned long network_nsecs(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((unsigned long)ts.tv_sec * 1000000000UL + ts.tv_nsec);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : network_send_all
+// Description  : Write a set of buffers to the socket, retrying short writes
+//
+// Inputs       : fd - the socket
+//                iov - the buffers to send
+//                cnt - the number of buffers
+// Outputs      : 0 if successful, -1 if failure
+
+static int network_send_all(int fd, struct iovec *iov, int cnt)
+{
+    ssize_t sent;
+
+    while (cnt > 0)
+    {
+        sent = writev(fd, iov, cnt);
+        if (sent == -1)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            logMessage(LOG_ERROR_LEVEL, "Error writing network data [%s]", strerror(errno));
+            return (-1);
+        }
+        while ((cnt > 0) && (sent >= (ssize_t)iov->iov_len)) // Skip the buffers that went out completely
+        {
+            sent -= iov->iov_len;
+            iov++;
+            cnt--;
+        }
+        if (cnt > 0) // Resume part way into a buffer
+        {
+            iov->iov_base = (char *)iov->iov_base + sent;
+            iov->iov_len -= sent;
+        }
+    }
+    return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : network_recv_all
+// Description  : Read exactly len bytes from the socket, retrying short reads
+//
+// Inputs       : fd - the socket
+//                buf - the buffer to read into
+//                len - the number of bytes to read
+// Outputs      : 0 if successful, -1 if failure
+
+static int network_recv_all(int fd, void *buf, size_t len)
+{
+    ssize_t got;
+    int one = 1;
+
+    while (len > 0)
+    {
+        // Ack right away, a server that still runs Nagle holds back its next reply until our ACK shows up
+        setsockopt(fd, IPPROTO_TCP, TCP_QUICKACK, &one, sizeof(one));
+        got = read(fd, buf, len);
+        if (got == -1 && errno == EINTR)
+        {
+            continue;
+        }
+        if (got <= 0)
+        {
+            logMessage(LOG_ERROR_LEVEL, "Error reading network data [%s]", (got == 0) ? "connection closed" : strerror(errno));
+            return (-1);
+        }
+        buf = (char *)buf + got;
+        len -= got;
+    }
+    return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : network_fs3_dial
+// Description  : Open a TCP connection to the FS3 server a connection of
+//                the pool goes to (connection i talks to server i modulo
+//                the number of servers)
+//
+// Inputs       : conn - the slot of the connection in the pool
+// Outputs      : the connected socket, -1 if failure
+
+int network_fs3_dial(int conn)
+{
+    int fd;
+    const char *ip;
+    int sPort;
+    int one = 1;
+    int server = conn % fs3_network_servers;
+    struct sockaddr_in caddr;
+
+    ip = (server == 0) ? (const char *)fs3_network_address : netAddresses[server];
+    if (ip == NULL)
+    {
+        ip = FS3_DEFAULT_IP;
+    }
+
+    sPort = (server == 0) ? fs3_network_port : netPorts[server];
+    if (sPort == 0)
+    {
+        sPort = FS3_DEFAULT_PORT;
+    }
+
+    caddr.sin_family = AF_INET;
+    caddr.sin_port = htons(sPort); // Set port
+    if (inet_aton(ip, &caddr.sin_addr) == 0)
+    {
+        logMessage(LOG_ERROR_LEVEL, "Bad FS3 server address [%s]", ip);
+        return (-1);
+    }
+
+    fd = socket(PF_INET, SOCK_STREAM, 0); // Create socket
+    if (fd == -1)
+    {
+        logMessage(LOG_ERROR_LEVEL, "Error on socket creation [%s]", strerror(errno)); // Sanity checks for errors
+        return (-1);
+    }
+    if (connect(fd, (const struct sockaddr *)&caddr, sizeof(caddr)) == -1) // Connect server to client
+    {
+        logMessage(LOG_ERROR_LEVEL, "Error connecting to FS3 server %s:%d [%s]", ip, sPort, strerror(errno));
+        close(fd);
+        return (-1);
+    }
+
+    // Commands are small and often pipelined, don't let Nagle hold them back waiting for ACKs
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    return (fd);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : network_tcp_open
+// Description  : Open a connection of the pool to the FS3 server
+//
+// Inputs       : conn - the slot of the connection in the pool
+// Outputs      : 0 if successful, -1 if failure
+
+static int network_tcp_open(int conn)
+{
+    if ((socket_fds[conn] = network_fs3_dial(conn)) == -1)
+    {
+        return (-1);
+    }
+    return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : network_tcp_send
+// Description  : Write a command (and its payload) to the FS3 server
+//
+// Inputs       : pend - the command being sent
+// Outputs      : 0 if successful, -1 if failure
+
+static int network_tcp_send(FS3NetPending *pend)
+{
+    uint8_t op;
+    int16_t sec;
+    int32_t trk;
+    uint8_t Cret;
+    FS3CmdBlk val;
+    struct iovec iov[2];
+    unsigned long start;
+
+    deconstruct_fs3_cmdblock(pend->cmd, &op, &sec, &trk, &Cret);
+    val = htonll64(pend->cmd); // Change cmdblk to network byte order
+    iov[0].iov_base = &val;
+    iov[0].iov_len = sizeof(val);
+    iov[1].iov_base = pend->buf;
+    iov[1].iov_len = FS3_OP_PAYLOAD(op, trk);
+    if (netCompress && FS3_OP_SENDS_SECTOR(op)) // The payload goes as a frame, compressed if that pays
+    {
+        start = network_nsecs();
+        iov[1].iov_base = netFrame;
+        iov[1].iov_len = fs3_lz_frame(pend->buf, FS3_OP_PAYLOAD(op, trk), netFrame);
+        netPackNs += network_nsecs() - start;
+        netRawOut += FS3_OP_PAYLOAD(op, trk);
+        netFrameOut += iov[1].iov_len;
+    }
+    return (network_send_all(socket_fds[pend->conn], iov, FS3_OP_SENDS_SECTOR(op) ? 2 : 1)); // Write sends the sector(s) right behind the command
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : network_tcp_recv
+// Description  : Read the reply to a command (and its payload) from the
+//                FS3 server
+//
+// Inputs       : pend - the command whose reply is next on the socket
+// Outputs      : 0 if successful, -1 if failure
+
+static int network_tcp_recv(FS3NetPending *pend)
+{
+    uint8_t op;
+    int16_t sec;
+    int32_t trk;
+    uint8_t Cret;
+    uint32_t hdr;
+    int len;
+    unsigned long start;
+
+    if (network_recv_all(socket_fds[pend->conn], &pend->ret, sizeof(pend->ret)) == -1) // Read the returned cmdblk from disk controller
+    {
+        return (-1);
+    }
+    pend->ret = ntohll64(pend->ret); // Change ret to host byte order
+
+    deconstruct_fs3_cmdblock(pend->cmd, &op, &sec, &trk, &Cret);
+    if (netCompress && FS3_OP_RECVS_SECTOR(op)) // The sector(s) come back as a frame
+    {
+        len = FS3_OP_PAYLOAD(op, trk);
+        if (network_recv_all(socket_fds[pend->conn], netFrame, FS3_LZ_HDR_SIZE) == -1)
+        {
+            return (-1);
+        }
+        hdr = fs3_lz_header(netFrame);
+        if ((FS3_LZ_LENGTH(hdr) > len) ||
+            (network_recv_all(socket_fds[pend->conn], &netFrame[FS3_LZ_HDR_SIZE], FS3_LZ_LENGTH(hdr)) == -1))
+        {
+            logMessage(LOG_ERROR_LEVEL, "Bad payload frame from FS3 server [0x%x]", hdr);
+            return (-1);
+        }
+        start = network_nsecs();
+        if (fs3_lz_unframe(hdr, &netFrame[FS3_LZ_HDR_SIZE], pend->buf, len) == -1)
+        {
+            logMessage(LOG_ERROR_LEVEL, "Corrupt payload frame from FS3 server");
+            return (-1);
+        }
+        netUnpackNs += network_nsecs() - start;
+        netRawIn += len;
+        netFrameIn += FS3_LZ_HDR_SIZE + FS3_LZ_LENGTH(hdr);
+        return (0);
+    }
+    if (FS3_OP_RECVS_SECTOR(op) && (network_recv_all(socket_fds[pend->conn], pend->buf, FS3_OP_PAYLOAD(op, trk)) == -1)) // Read brings the sector(s) behind the reply
+    {
+        return (-1);
+    }
+    return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : network_tcp_close
+// Description  : Close a connection to the FS3 server
+//
+// Inputs       : conn - the slot of the connection in the pool
+// Outputs      : none
+
+static void network_tcp_close(int conn)
+{
+    if (socket_fds[conn] != -1)
+    {
+        close(socket_fds[conn]); // Close socket and set to -1 to avoid use after close in unmount
+        socket_fds[conn] = -1;
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : network_tcp_ready
+// Description  : Wait until one of a set of connections has a reply coming
+//
+// Inputs       : conns - bit mask of the connections to wait on
+// Outputs      : the connection with data, -1 if failure
+
+static int network_tcp_ready(uint32_t conns)
+{
+    static int nextPoll = 0; // Start the scan somewhere new each time so no connection starves
+    struct pollfd fds[FS3_NET_MAX_CONNECTIONS];
+    int slot[FS3_NET_MAX_CONNECTIONS];
+    int i;
+    int c;
+    int n = 0;
+
+    for (i = 0; i < FS3_NET_MAX_CONNECTIONS; i++)
+    {
+        c = (nextPoll + i) % FS3_NET_MAX_CONNECTIONS;
+        if (conns & (1u << c))
+        {
+            fds[n].fd = socket_fds[c];
+            fds[n].events = POLLIN;
+            slot[n++] = c;
+        }
+    }
+    while (poll(fds, n, -1) == -1)
+    {
+        if (errno != EINTR)
+        {
+            logMessage(LOG_ERROR_LEVEL, "Error waiting on FS3 server connections [%s]", strerror(errno));
+            return (-1);
+        }
+    }
+    for (i = 0; i < n; i++)
+    {
+        if (fds[i].revents != 0) // Readable, or broken (the read will report it)
+        {
+            nextPoll = slot[i] + 1;
+            return (slot[i]);
+        }
+    }
+    return (-1);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : network_fs3_is_local
+// Description  : Check whether the FS3 server is on this host (loopback)
+//
+// Inputs       : none
+// Outputs      : 1 if local, 0 if not
+
+static int network_fs3_is_local(void)
+{
+    const char *ip = (fs3_network_address != NULL) ? (const char *)fs3_network_address : FS3_DEFAULT_IP;
+
+    return ((strncmp(ip, "127.", 4) == 0) || (strcmp(ip, "localhost") == 0));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : network_fs3_set_backend
+// Description  : Choose where commands are sent (before mounting)
+//
+// Inputs       : name - the name of the backend ("tcp", "uring", "shm" or "inproc")
+// Outputs      : 0 if successful, -1 if failure
+
+int network_fs3_set_backend(const char *name)
+{
+    int i;
+
+    if (netConns > 0)
+    {
+        logMessage(LOG_ERROR_LEVEL, "FS3 network backend can't change while mounted");
+        return (-1);
+    }
+    for (i = 0; fs3NetBackends[i] != NULL; i++)
+    {
+        if (strcmp(fs3NetBackends[i]->name, name) == 0)
+        {
+            fs3_network_backend = fs3NetBackends[i];
+            fs3_network_auto = 0; // Asked for by name, don't second guess it
+            return (0);
+        }
+    }
+    logMessage(LOG_ERROR_LEVEL, "Unknown FS3 network backend [%s]", name);
+    return (-1);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : network_fs3_set_key
+// Description  : Tell the network layer which file the next commands are
+//                for, used to keep a file on one connection (file affinity)
+//
+// Inputs       : key - the file handle
+// Outputs      : none
+
+void network_fs3_set_key(int key)
+{
+    netKey = (key < 0) ? 0 : key;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : network_fs3_add_server
+// Description  : Stripe the disk over one more server (the first one is
+//                fs3_network_address and fs3_network_port)
+//
+// Inputs       : address - the address of the server, NULL for the default
+//                port - the port of the server, 0 for the default
+// Outputs      : 0 if successful, -1 if failure
+
+int network_fs3_add_server(const char *address, unsigned short port)
+{
+    if (netConns > 0)
+    {
+        logMessage(LOG_ERROR_LEVEL, "FS3 servers can't change while mounted");
+        return (-1);
+    }
+    if (fs3_network_servers >= FS3_NET_MAX_SERVERS)
+    {
+        logMessage(LOG_ERROR_LEVEL, "FS3 disk can't be striped over more than %d servers", FS3_NET_MAX_SERVERS);
+        return (-1);
+    }
+    netAddresses[fs3_network_servers] = address;
+    netPorts[fs3_network_servers] = port;
+    fs3_network_servers++;
+    return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : network_fs3_groups
+// Description  : Return the number of stripe groups: the servers are split
+//                into groups of fs3_network_replicas, server g + i * groups
+//                holding replica i of group g (replica 0 is the primary)
+//
+// Inputs       : none
+// Outputs      : the number of groups
+
+static int network_fs3_groups(void)
+{
+    return (fs3_network_servers / fs3_network_replicas);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : network_fs3_tier
+// Description  : Find where a sector of a tiered disk lives. The disk is
+//                as big as the slow server, which is home to every chunk;
+//                a hot chunk sits in a slot of the fast server instead,
+//                slot s covering its sectors s * FS3_NET_TIER_CHUNK on
+//
+// Inputs       : trk - the track on the disk
+//                sec - the sector in the track
+//                ptrk - the track on the server (output)
+//                psec - the sector in that track (output)
+// Outputs      : the server (FS3_NET_TIER_FAST or FS3_NET_TIER_SLOW)
+
+static int network_fs3_tier(int32_t trk, int16_t sec, int32_t *ptrk, int16_t *psec)
+{
+    uint32_t pos = (uint32_t)trk * FS3_TRACK_SIZE + (uint16_t)sec;
+    int slot;
+
+    if ((trk < 0) || (pos >= FS3_NET_TIER_CHUNKS * FS3_NET_TIER_CHUNK) || ((slot = netTierMap[pos / FS3_NET_TIER_CHUNK]) == -1))
+    {
+        *ptrk = trk; // At home (or off the disk, and the slow server turns it down)
+        *psec = sec;
+        return (FS3_NET_TIER_SLOW);
+    }
+    pos = (uint32_t)slot * FS3_NET_TIER_CHUNK + pos % FS3_NET_TIER_CHUNK;
+    *ptrk = pos / FS3_TRACK_SIZE;
+    *psec = pos % FS3_TRACK_SIZE;
+    return (FS3_NET_TIER_FAST);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : network_fs3_stripe
+// Description  : Find where a sector of the disk lives. The disk is the
+//                tracks of all of the servers, numbered as one run of
+//                sectors and dealt out to the servers fs3_network_stripe
+//                sectors at a time (the stripe unit divides a track, so a
+//                unit never straddles tracks on either side). With
+//                replicas, it is dealt out to the groups and every server
+//                of a group holds it in the same place. A tiered disk
+//                isn't striped, its chunks are wherever the tiers put them
+//
+// Inputs       : trk - the track on the disk
+//                sec - the sector in the track
+//                ptrk - the track on the server (output)
+//                psec - the sector in that track (output)
+// Outputs      : the server (the group's primary)
+
+static int network_fs3_stripe(int32_t trk, int16_t sec, int32_t *ptrk, int16_t *psec)
+{
+    uint32_t pos = (uint32_t)trk * FS3_TRACK_SIZE + (uint16_t)sec; // Sector number on the whole disk
+    uint32_t unit = pos / fs3_network_stripe;
+    uint32_t phys;
+    int groups = network_fs3_groups();
+
+    if (fs3_network_tier_tracks > 0)
+    {
+        return (network_fs3_tier(trk, sec, ptrk, psec));
+    }
+    if (groups <= 1)
+    {
+        *ptrk = trk;
+        *psec = sec;
+        return (0);
+    }
+    phys = (unit / groups) * fs3_network_stripe + pos % fs3_network_stripe; // Sector number on the server
+    *ptrk = phys / FS3_TRACK_SIZE;
+    *psec = phys % FS3_TRACK_SIZE;
+    return (unit % groups);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : network_fs3_server
+// Description  : Return the server that holds a sector of the disk
+//
+// Inputs       : trk - the track on the disk
+//                sec - the sector in the track
+// Outputs      : the server
+
+int network_fs3_server(int32_t trk, int16_t sec)
+{
+    int32_t ptrk;
+    int16_t psec;
+
+    return (network_fs3_stripe(trk, sec, &ptrk, &psec));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : network_fs3_track
+// Description  : Return the track a sector of the disk is on, on its server
+//                (where the server's head has to be to reach it)
+//
+// Inputs       : trk - the track on the disk
+//                sec - the sector in the track
+// Outputs      : the track on the server
+
+int network_fs3_track(int32_t trk, int16_t sec)
+{
+    int32_t ptrk;
+    int16_t psec;
+
+    network_fs3_stripe(trk, sec, &ptrk, &psec);
+    return (ptrk);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : network_fs3_extent
+// Description  : Return how many sectors, from a sector of the disk on,
+//                follow each other on the same server (a range command
+//                can't go further; on a tiered disk it stops at the end
+//                of the chunk, which may move on its own)
+//
+// Inputs       : trk - the track on the disk
+//                sec - the sector in the track
+// Outputs      : the number of sectors
+
+int network_fs3_extent(int32_t trk, int16_t sec)
+{
+    if (fs3_network_tier_tracks > 0)
+    {
+        return (FS3_NET_TIER_CHUNK - sec % FS3_NET_TIER_CHUNK);
+    }
+    if (network_fs3_groups() <= 1)
+    {
+        return (FS3_TRACK_SIZE - sec);
+    }
+    return (fs3_network_stripe - sec % fs3_network_stripe);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : network_fs3_tracks
+// Description  : Return the number of tracks of the disk
+//
+// Inputs       : none
+// Outputs      : the tracks of all of the stripe groups (of the slow
+//                server, on a tiered disk)
+
+int network_fs3_tracks(void)
+{
+    if (fs3_network_tier_tracks > 0)
+    {
+        return (FS3_MAX_TRACKS);
+    }
+    return (network_fs3_groups() * FS3_MAX_TRACKS);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : network_fs3_route
+// Description  : Return the connection a command on a sector goes out on;
+//                commands that must follow each other (a seek and its
+//                transfer) always land on the same connection. Connection
+//                i goes to server i modulo the number of servers, and the
+//                server's connections share out its commands (a group's
+//                replicas share them the same way, until the commands are
+//                replicated)
+//
+// Inputs       : trk - the track of the command
+//                sec - the sector of the command
+// Outputs      : the connection in the pool
+
+int network_fs3_route(int32_t trk, int16_t sec)
+{
+    int32_t ptrk;
+    int16_t psec;
+    int server;
+    int groups = network_fs3_groups();
+    int per;
+
+    if (netConns <= 1)
+    {
+        return (0);
+    }
+    server = network_fs3_stripe(trk, sec, &ptrk, &psec);
+    per = netConns / groups; // Connections to each group
+    return (server + groups * (((fs3_network_affinity == FS3_NET_AFFINITY_FILE) ? netKey : ptrk) % per));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : network_fs3_place
+// Description  : Rewrite a command on the disk into the command its server
+//                runs (the source a copy names in its payload as well)
+//
+// Inputs       : op - the opcode
+//                sec - the sector, replaced by the server's
+//                trk - the track field, its track replaced by the server's
+//                buf - the payload of the command
+// Outputs      : 0 if successful, -1 if the command spans servers
+
+static int network_fs3_place(uint8_t op, int16_t *sec, int32_t *trk, void *buf)
+{
+    uint8_t *hdr = buf;
+    int32_t ptrk;
+    int16_t psec;
+    int server;
+
+    server = network_fs3_stripe(FS3_OP_TRACK(op, *trk), *sec, &ptrk, &psec);
+    *trk = *trk - FS3_OP_TRACK(op, *trk) + ptrk; // Whatever sits above the track (a count) stays
+    *sec = psec;
+    if (op == FS3_OP_COPY)
+    {
+        if (network_fs3_stripe((hdr[0] << 8) | hdr[1], (hdr[2] << 8) | hdr[3], &ptrk, &psec) != server)
+        {
+            logMessage(LOG_ERROR_LEVEL, "FS3 copy between two servers");
+            return (-1);
+        }
+        hdr[0] = (uint8_t)(ptrk >> 8);
+        hdr[1] = (uint8_t)(ptrk & 0xff);
+        hdr[2] = (uint8_t)((uint16_t)psec >> 8);
+        hdr[3] = (uint8_t)(psec & 0xff);
+    }
+    return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : network_fs3_span
+// Description  : Find the run of sectors a command (as its server runs it)
+//                reads or writes
+//
+// Inputs       : op - the opcode
+//                sec - the first sector
+//                trk - the track field
+//                ptrk - the track of the run (output)
+//                cnt - the sectors in the run (output)
+// Outputs      : NET_SPAN_READ, NET_SPAN_WRITE or NET_SPAN_NONE (for
+//                anything else, or a run off the disk the server turns down)
+
+static int network_fs3_span(uint8_t op, int16_t sec, int32_t trk, int32_t *ptrk, int *cnt)
+{
+    int kind = NET_SPAN_NONE;
+
+    *ptrk = FS3_OP_TRACK(op, trk);
+    *cnt = (FS3_OP_IS_RANGE(op) || (op == FS3_OP_COPY)) ? FS3_RANGE_COUNT(trk) : 1;
+    if ((op == FS3_OP_SKRDSECT) || (op == FS3_OP_RDRANGE) || (op == FS3_OP_HASH))
+    {
+        kind = NET_SPAN_READ;
+    }
+    else if ((op == FS3_OP_SKWRSECT) || (op == FS3_OP_WRRANGE) || (op == FS3_OP_WRDELTA) || (op == FS3_OP_COPY))
+    {
+        kind = NET_SPAN_WRITE;
+    }
+    if ((*ptrk < 0) || (*ptrk >= FS3_MAX_TRACKS) || (sec < 0) || (*cnt < 1) || (sec + *cnt > FS3_TRACK_SIZE))
+    {
+        return (NET_SPAN_NONE);
+    }
+    return (kind);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : network_fs3_mark
+// Description  : Record whether a replica holds the latest data of a run
+//
+// Inputs       : server - the replica
+//                trk - the track of the run, on the server
+//                sec - the first sector of the run
+//                cnt - the sectors in the run
+//                dirty - 1 if the replica missed a write to the run, 0 if
+//                        it is up to date
+// Outputs      : none
+
+static void network_fs3_mark(int server, int32_t trk, int16_t sec, int cnt, int dirty)
+{
+    uint64_t *word;
+    uint64_t bit;
+    int i;
+
+    for (i = sec; i < sec + cnt; i++)
+    {
+        word = &netDirty[server][trk][i / 64];
+        bit = 1ULL << (i % 64);
+        if (dirty && !(*word & bit))
+        {
+            *word |= bit;
+            netDirtyCount[server]++;
+        }
+        else if (!dirty && (*word & bit))
+        {
+            *word &= ~bit;
+            netDirtyCount[server]--;
+        }
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : network_fs3_dirty
+// Description  : Check whether a replica missed a write to any of a run
+//
+// Inputs       : server - the replica
+//                trk - the track of the run, on the server
+//                sec - the first sector of the run
+//                cnt - the sectors in the run
+// Outputs      : 1 if it did (or the run is off the disk), 0 if not
+
+static int network_fs3_dirty(int server, int32_t trk, int16_t sec, int cnt)
+{
+    int i;
+
+    if (netDirtyCount[server] == 0) // The common case, it hasn't missed anything
+    {
+        return (0);
+    }
+    if ((trk < 0) || (trk >= FS3_MAX_TRACKS) || (sec < 0) || (sec + cnt > FS3_TRACK_SIZE))
+    {
+        return (1);
+    }
+    for (i = sec; i < sec + cnt; i++)
+    {
+        if (netDirty[server][trk][i / 64] & (1ULL << (i % 64)))
+        {
+            return (1);
+        }
+    }
+    return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : network_fs3_pick
+// Description  : Choose the replica to read a run from: of the replicas
+//                holding the latest data, draw two and take the one with
+//                the least work ahead of it (commands in flight times its
+//                smoothed round trip). The primary never misses a write,
+//                so there is always one
+//
+// Inputs       : group - the stripe group holding the run
+//                trk - the track of the run, on the servers
+//                sec - the first sector of the run
+//                cnt - the sectors in the run
+// Outputs      : the server (and connection) to read from
+
+static int network_fs3_pick(int group, int32_t trk, int16_t sec, int cnt)
+{
+    int cands[FS3_NET_MAX_SERVERS];
+    int groups = network_fs3_groups();
+    int n = 0;
+    int a;
+    int b;
+    int r;
+
+    for (r = 0; r < fs3_network_replicas; r++)
+    {
+        if (!network_fs3_dirty(group + groups * r, trk, sec, cnt))
+        {
+            cands[n++] = group + groups * r;
+        }
+    }
+    if (n == 1)
+    {
+        return (cands[0]);
+    }
+
+    netRandom ^= netRandom << 13; // xorshift32, the draw only has to be cheap and spread out
+    netRandom ^= netRandom >> 17;
+    netRandom ^= netRandom << 5;
+    a = netRandom % n;
+    b = (a + 1 + (netRandom >> 16) % (n - 1)) % n; // A different one
+    if ((unsigned long)(pendingConn[cands[b]] + 1) * netLatency[cands[b]] < (unsigned long)(pendingConn[cands[a]] + 1) * netLatency[cands[a]])
+    {
+        return (cands[b]);
+    }
+    return (cands[a]);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : network_fs3_post
+// Description  : Send a command on a connection and queue it for its reply
+//
+// Inputs       : conn - the connection
+//                cmd - the command block, as the server runs it
+//                buf - the sector buffer (sent for writes, filled for reads)
+//                shadow - who waits for the reply (FS3_NET_DRIVER or one of
+//                         the network layer's own kinds)
+// Outputs      : 0 if successful, -1 if failure
+
+static int network_fs3_post(int conn, FS3CmdBlk cmd, void *buf, int shadow)
+{
+    uint8_t op;
+    int16_t sec;
+    int32_t trk;
+    uint8_t Cret;
+    FS3NetPending *pend;
+
+    deconstruct_fs3_cmdblock(cmd, &op, &sec, &trk, &Cret);
+    pend = &pendingOps[conn][(pendingHead[conn] + pendingConn[conn]) % FS3_NET_RING];
+    pend->conn = conn;
+    pend->shadow = shadow;
+    pend->cmd = cmd;
+    pend->buf = buf;
+    clock_gettime(CLOCK_MONOTONIC, &pend->sent);
+    if (fs3_network_backend->send(pend) == -1)
+    {
+        return (-1);
+    }
+    netCommands++;
+    netServerCommands[conn % fs3_network_servers]++;
+    netBytesOut += sizeof(cmd) + (FS3_OP_SENDS_SECTOR(op) ? FS3_OP_PAYLOAD(op, trk) : 0);
+    pendingConn[conn]++;
+    if (shadow != FS3_NET_DRIVER)
+    {
+        pendingShadow[conn]++;
+    }
+    else
+    {
+        pendingCount++;
+    }
+    return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : network_fs3_replicate
+// Description  : Send a driver command to a replicated stripe group. A read
+//                goes to one up to date replica, picked by load. A write
+//                goes to the primary, which answers for it, and a mirror
+//                copy goes to every other replica; a replica with
+//                FS3_NET_MAX_LAG commands still in flight skips the copy
+//                and has the run repaired in the background instead, so a
+//                slow replica never holds up the driver
+//
+// Inputs       : op - the opcode
+//                sec - the sector, on the servers
+//                trk - the track field, on the servers
+//                cmd - the command block
+//                buf - the payload of the command
+//                conn - the connection the command was routed to
+// Outputs      : 0 if successful, -1 if failure
+
+static int network_fs3_replicate(uint8_t op, int16_t sec, int32_t trk, FS3CmdBlk cmd, void *buf, int conn)
+{
+    uint8_t *hdr = buf;
+    int groups = network_fs3_groups();
+    int group = conn % groups;
+    int32_t ptrk;
+    int32_t strk = 0;
+    int16_t ssec = 0;
+    int kind;
+    int cnt;
+    int r;
+    int s;
+
+    kind = network_fs3_span(op, sec, trk, &ptrk, &cnt);
+    if (kind == NET_SPAN_READ)
+    {
+        conn = network_fs3_pick(group, ptrk, sec, cnt);
+        netServerReads[conn]++;
+        return (network_fs3_post(conn, cmd, buf, FS3_NET_DRIVER));
+    }
+    if (kind == NET_SPAN_NONE) // Nothing to keep in step, the primary takes it
+    {
+        return (network_fs3_post(group, cmd, buf, FS3_NET_DRIVER));
+    }
+
+    if (netRepair.busy && (netRepair.target % groups == group) && (netRepair.trk == ptrk) &&
+        (sec < netRepair.sec + netRepair.cnt) && (netRepair.sec < sec + cnt))
+    {
+        netRepair.stale = 1; // The run being repaired was read before this write
+    }
+    if (network_fs3_post(group, cmd, buf, FS3_NET_DRIVER) == -1)
+    {
+        return (-1);
+    }
+    if (op == FS3_OP_COPY)
+    {
+        strk = (hdr[0] << 8) | hdr[1];
+        ssec = (hdr[2] << 8) | hdr[3];
+    }
+    for (r = 1; r < fs3_network_replicas; r++)
+    {
+        s = group + groups * r;
+        if (pendingShadow[s] >= FS3_NET_MAX_LAG) // Lagging, let it catch up and repair the run later
+        {
+            network_fs3_mark(s, ptrk, sec, cnt, 1);
+            netSkipped++;
+            continue;
+        }
+        if (network_fs3_post(s, cmd, buf, FS3_NET_MIRROR) == -1)
+        {
+            return (-1);
+        }
+        netMirrored++;
+        if (op == FS3_OP_COPY) // The copy is only as good as the source the replica has
+        {
+            network_fs3_mark(s, ptrk, sec, cnt, network_fs3_dirty(s, strk, ssec, cnt));
+        }
+        else if (op != FS3_OP_WRDELTA) // Whole sectors bring it up to date, a delta only changes what it had
+        {
+            network_fs3_mark(s, ptrk, sec, cnt, 0);
+        }
+    }
+    return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : network_fs3_repair
+// Description  : Start repairing the next run a replica missed, if one has
+//                caught up on its mirrors: the run is read from an up to
+//                date replica, and written to it when the read comes back
+//                (one repair at a time, behind the driver's commands)
+//
+// Inputs       : none
+// Outputs      : 1 if a repair started, 0 if not, -1 if failure
+
+static int network_fs3_repair(void)
+{
+    FS3CmdBlk cmd;
+    uint64_t *bits;
+    int groups = network_fs3_groups();
+    int limit = (netCaps & FS3_CAP_RANGE) ? FS3_MAX_RANGE : 1;
+    int32_t trk;
+    int16_t sec;
+    int source;
+    int cnt;
+    int i;
+    int t;
+    int w;
+
+    if (netRepair.busy)
+    {
+        return (0);
+    }
+    for (i = 0; i < fs3_network_servers; i++)
+    {
+        t = (netRepair.next + i) % fs3_network_servers;
+        if ((netDirtyCount[t] == 0) || (pendingShadow[t] >= FS3_NET_MAX_LAG / 2)) // Up to date, or still working through its mirrors
+        {
+            continue;
+        }
+        bits = &netDirty[t][0][0];
+        for (w = 0; bits[w] == 0; w++); // The count says there is a bit somewhere
+        trk = w / (FS3_TRACK_SIZE / 64);
+        sec = (w % (FS3_TRACK_SIZE / 64)) * 64 + __builtin_ctzll(bits[w]);
+        for (cnt = 1; (cnt < limit) && (sec + cnt < FS3_TRACK_SIZE) && network_fs3_dirty(t, trk, sec + cnt, 1); cnt++);
+
+        source = network_fs3_pick(t % groups, trk, sec, cnt);
+        if (pendingShadow[source] >= FS3_NET_MAX_LAG)
+        {
+            return (0);
+        }
+        cmd = (cnt > 1) ? construct_fs3_cmdblock(FS3_OP_RDRANGE, sec, FS3_RANGE_TRK(trk, cnt), 0)
+                        : construct_fs3_cmdblock(FS3_OP_SKRDSECT, sec, trk, 0);
+        if (network_fs3_post(source, cmd, netRepairBuf, FS3_NET_REPAIR_READ) == -1)
+        {
+            return (-1);
+        }
+        netRepair.busy = 1;
+        netRepair.stale = 0;
+        netRepair.target = t;
+        netRepair.source = source;
+        netRepair.trk = trk;
+        netRepair.sec = sec;
+        netRepair.cnt = cnt;
+        netRepair.next = t + 1;
+        return (1);
+    }
+    return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : network_fs3_cool
+// Description  : Bring a chunk's heat up to date, halving it once for every
+//                epoch gone by since it was last looked at
+//
+// Inputs       : chunk - the chunk of the tiered disk
+// Outputs      : its heat
+
+static unsigned network_fs3_cool(int chunk)
+{
+    uint16_t age = netEpoch - netHeatEpoch[chunk];
+
+    netHeat[chunk] = (age >= 16) ? 0 : netHeat[chunk] >> age;
+    netHeatEpoch[chunk] = netEpoch;
+    return (netHeat[chunk]);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : network_fs3_heat
+// Description  : Count a driver command against the chunk it touches on a
+//                tiered disk: the chunk warms by the sectors it moves, a
+//                slow chunk that gets hot is queued for the fast tier, and
+//                a write to the chunk being moved spoils the move
+//
+// Inputs       : op - the opcode
+//                sec - the sector, on the disk
+//                trk - the track field, on the disk
+// Outputs      : none
+
+static void network_fs3_heat(uint8_t op, int16_t sec, int32_t trk)
+{
+    int32_t ptrk;
+    unsigned heat;
+    int chunk;
+    int kind;
+    int cnt;
+
+    if ((kind = network_fs3_span(op, sec, trk, &ptrk, &cnt)) == NET_SPAN_NONE)
+    {
+        return;
+    }
+    chunk = (ptrk * FS3_TRACK_SIZE + sec) / FS3_NET_TIER_CHUNK; // Runs never leave their chunk (network_fs3_extent)
+    if ((kind == NET_SPAN_WRITE) && netMigration.busy && (netMigration.chunk == chunk))
+    {
+        netMigration.stale = 1;
+    }
+    if ((netEpochAccesses += cnt) >= NET_TIER_EPOCH)
+    {
+        netEpoch++;
+        netEpochAccesses = 0;
+    }
+    heat = network_fs3_cool(chunk) + cnt;
+    netHeat[chunk] = CMPSC311_MINVAL(heat, UINT16_MAX);
+    if (netTierMap[chunk] != -1)
+    {
+        netTierFastSectors += cnt;
+        return;
+    }
+    netTierSlowSectors += cnt;
+    if ((heat >= NET_TIER_HOT) && !netTierQueued[chunk] && (netTierQLen < NET_TIER_QUEUE))
+    {
+        netTierQueue[(netTierQHead + netTierQLen++) % NET_TIER_QUEUE] = chunk;
+        netTierQueued[chunk] = 1;
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : network_fs3_unqueue
+// Description  : Take the oldest hot chunk off the promotion queue
+//
+// Inputs       : none
+// Outputs      : none
+
+static void network_fs3_unqueue(void)
+{
+    netTierQueued[netTierQueue[netTierQHead]] = 0;
+    netTierQHead = (netTierQHead + 1) % NET_TIER_QUEUE;
+    netTierQLen--;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : network_fs3_move
+// Description  : Start moving a chunk between the tiers by reading it from
+//                where it is now
+//
+// Inputs       : chunk - the chunk of the tiered disk
+//                to - the fast slot it goes to, -1 to send it home
+// Outputs      : 1 if the move started, -1 if failure
+
+static int network_fs3_move(int chunk, int to)
+{
+    uint32_t pos = (uint32_t)chunk * FS3_NET_TIER_CHUNK;
+    FS3CmdBlk cmd;
+    int32_t trk;
+    int16_t sec;
+    int server;
+
+    server = network_fs3_tier(pos / FS3_TRACK_SIZE, pos % FS3_TRACK_SIZE, &trk, &sec); // One connection per server, so it is the connection too
+    cmd = construct_fs3_cmdblock(FS3_OP_RDRANGE, sec, FS3_RANGE_TRK(trk, FS3_NET_TIER_CHUNK), 0);
+    if (network_fs3_post(server, cmd, netTierBuf, FS3_NET_MIGRATE_READ) == -1)
+    {
+        return (-1);
+    }
+    netMigration.busy = 1;
+    netMigration.stale = 0;
+    netMigration.chunk = chunk;
+    netMigration.to = to;
+    return (1);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : network_fs3_migrate
+// Description  : Start the next move between the tiers, if none is in
+//                progress: the oldest hot chunk goes to a free fast slot,
+//                and with none free the clock hand looks for the coldest
+//                fast chunk to send home first (unless the hot chunk isn't
+//                twice as hot, so chunks don't bounce back and forth)
+//
+// Inputs       : none
+// Outputs      : 1 if a move started, 0 if not, -1 if failure
+
+static int network_fs3_migrate(void)
+{
+    int victim = -1;
+    int chunk;
+    int slot;
+    int i;
+
+    while (!netMigration.busy && (netTierQLen > 0))
+    {
+        chunk = netTierQueue[netTierQHead];
+        if ((netTierMap[chunk] != -1) || (network_fs3_cool(chunk) < NET_TIER_HOT / 2)) // Already there, or went cold waiting
+        {
+            network_fs3_unqueue();
+            continue;
+        }
+        if (netTierFree > 0)
+        {
+            for (slot = netTierHand; netTierSlot[slot] != -1; slot = (slot + 1) % netTierSlots);
+            network_fs3_unqueue(); // Queued again if the move is dropped and it stays hot
+            return (network_fs3_move(chunk, slot));
+        }
+
+        for (i = 0; i < NET_TIER_SCAN; i++)
+        {
+            slot = (netTierHand + i) % netTierSlots;
+            if ((victim == -1) || (network_fs3_cool(netTierSlot[slot]) < netHeat[netTierSlot[victim]]))
+            {
+                victim = slot;
+            }
+        }
+        netTierHand = (netTierHand + NET_TIER_SCAN) % netTierSlots;
+        if ((unsigned)netHeat[netTierSlot[victim]] * 2 > netHeat[chunk])
+        {
+            network_fs3_unqueue();
+            return (0);
+        }
+        return (network_fs3_move(netTierSlot[victim], -1)); // The hot chunk takes the slot next time
+    }
+    return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : network_fs3_settle
+// Description  : Account for a reply on a replicated disk: a mirror that
+//                failed leaves its replica behind, a repair read goes on
+//                to its write, and a failed driver write leaves every
+//                replica but the primary behind. On a tiered disk a move
+//                goes on from its read to its write, and the chunk is only
+//                remapped once the write is done
+//
+// Inputs       : pend - the command that completed
+// Outputs      : 0 if successful, -1 if failure
+
+static int network_fs3_settle(FS3NetPending *pend)
+{
+    uint8_t op;
+    int16_t sec;
+    int32_t trk;
+    uint8_t Cret;
+    uint8_t failed;
+    int32_t ptrk;
+    FS3CmdBlk cmd;
+    int groups = network_fs3_groups();
+    uint32_t pos;
+    int kind;
+    int cnt;
+    int r;
+
+    deconstruct_fs3_cmdblock(pend->ret, &op, &sec, &trk, &failed);
+    deconstruct_fs3_cmdblock(pend->cmd, &op, &sec, &trk, &Cret);
+    kind = network_fs3_span(op, sec, trk, &ptrk, &cnt);
+    switch (pend->shadow)
+    {
+    case FS3_NET_DRIVER:
+        for (r = 1; (failed == 1) && (kind == NET_SPAN_WRITE) && (r < fs3_network_replicas); r++)
+        {
+            network_fs3_mark(pend->conn + groups * r, ptrk, sec, cnt, 1); // Whatever the primary ended up with, the rest follow it
+        }
+        break;
+
+    case FS3_NET_MIRROR:
+        if ((failed == 1) && (kind == NET_SPAN_WRITE))
+        {
+            network_fs3_mark(pend->conn, ptrk, sec, cnt, 1);
+        }
+        break;
+
+    case FS3_NET_REPAIR_READ:
+        netRepair.busy = 0;
+        if (failed == 1)
+        {
+            netRepairFailures++;
+            break;
+        }
+        if (netRepair.stale || network_fs3_dirty(netRepair.source, ptrk, sec, cnt) ||
+            (pendingShadow[netRepair.target] >= FS3_NET_MAX_LAG)) // Overtaken by a write, or no room, it is tried again later
+        {
+            break;
+        }
+        cmd = (cnt > 1) ? construct_fs3_cmdblock(FS3_OP_WRRANGE, sec, FS3_RANGE_TRK(ptrk, cnt), 0)
+                        : construct_fs3_cmdblock(FS3_OP_SKWRSECT, sec, ptrk, 0);
+        if (network_fs3_post(netRepair.target, cmd, netRepairBuf, FS3_NET_REPAIR_WRITE) == -1)
+        {
+            return (-1);
+        }
+        network_fs3_mark(netRepair.target, ptrk, sec, cnt, 0); // Anything sent to it from now on lands after the repair
+        break;
+
+    case FS3_NET_REPAIR_WRITE:
+        if (failed == 1)
+        {
+            network_fs3_mark(pend->conn, ptrk, sec, cnt, 1);
+            netRepairFailures++;
+            break;
+        }
+        netRepaired += cnt;
+        break;
+
+    case FS3_NET_MIGRATE_READ:
+        if ((failed == 1) || netMigration.stale)
+        {
+            netMigration.busy = 0;
+            netMigrationsDropped++;
+            netHeat[netMigration.chunk] /= 2; // Back off a chunk still being written, it has to warm up again
+            break;
+        }
+        pos = (uint32_t)((netMigration.to == -1) ? netMigration.chunk : netMigration.to) * FS3_NET_TIER_CHUNK;
+        cmd = construct_fs3_cmdblock(FS3_OP_WRRANGE, pos % FS3_TRACK_SIZE, FS3_RANGE_TRK(pos / FS3_TRACK_SIZE, FS3_NET_TIER_CHUNK), 0);
+        if (network_fs3_post((netMigration.to == -1) ? FS3_NET_TIER_SLOW : FS3_NET_TIER_FAST, cmd, netTierBuf, FS3_NET_MIGRATE_WRITE) == -1)
+        {
+            return (-1);
+        }
+        break;
+
+    case FS3_NET_MIGRATE_WRITE:
+        netMigration.busy = 0;
+        if ((failed == 1) || netMigration.stale) // The old place still has the latest data
+        {
+            netMigrationsDropped++;
+            netHeat[netMigration.chunk] /= 2;
+            break;
+        }
+        if (netMigration.to == -1)
+        {
+            netTierSlot[netTierMap[netMigration.chunk]] = -1;
+            netTierMap[netMigration.chunk] = -1;
+            netTierFree++;
+            netDemoted++;
+            break;
+        }
+        netTierMap[netMigration.chunk] = netMigration.to;
+        netTierSlot[netMigration.to] = netMigration.chunk;
+        netTierFree--;
+        netPromoted++;
+        break;
+    }
+    return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : network_fs3_recall
+// Description  : Keep the lease up to date with a reply: a reply flagged
+//                with recalls sends a LEASE command to collect them (the
+//                cache is off until they are in), the collected sectors
+//                are dropped from the cache, and any other reply extends
+//                the lease to a lease time after its command was sent
+//
+// Inputs       : pend - the command that completed
+// Outputs      : 0 if successful, -1 if failure
+
+static int network_fs3_recall(FS3NetPending *pend)
+{
+    uint8_t *list = pend->buf;
+    uint8_t op;
+    int16_t sec;
+    int32_t trk;
+    uint8_t failed;
+    unsigned long sent;
+    int i;
+
+    if (pend->shadow == FS3_NET_LEASE)
+    {
+        deconstruct_fs3_cmdblock(pend->ret, &op, &sec, &trk, &failed);
+        if (failed == 1)
+        {
+            logMessage(LOG_ERROR_LEVEL, "FS3 server would not hand over the recalled sectors");
+            return (-1);
+        }
+        if (trk == FS3_LEASE_ALL)
+        {
+            fs3_invalidate_cache_all();
+            netLeaseFlushes++;
+        }
+        for (i = 0; (trk != FS3_LEASE_ALL) && (i < trk) && (i < FS3_LEASE_BATCH); i++)
+        {
+            fs3_invalidate_cache((list[i * 4] << 8) | list[i * 4 + 1], (list[i * 4 + 2] << 8) | list[i * 4 + 3]);
+        }
+        netRecalls += (trk != FS3_LEASE_ALL) ? trk : 0;
+        netRecalling = 0;
+    }
+
+    if (pend->ret & FS3_LEASE_RECALL)
+    {
+        if (!netRecalling) // One collection at a time, it hands over everything waiting
+        {
+            if (network_fs3_post(0, construct_fs3_cmdblock(FS3_OP_LEASE, 0, 0, 0), netRecallBuf, FS3_NET_LEASE) == -1)
+            {
+                return (-1);
+            }
+            netRecalling = 1;
+            netRecallRounds++;
+        }
+        return (0);
+    }
+    sent = (unsigned long)pend->sent.tv_sec * 1000000000UL + pend->sent.tv_nsec; // The server renewed the lease no earlier than this
+    if (!netRecalling && (sent + FS3_LEASE_USECS * 1000UL - NET_LEASE_SLACK > netLeaseUntil))
+    {
+        netLeaseUntil = sent + FS3_LEASE_USECS * 1000UL - NET_LEASE_SLACK;
+    }
+    return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
 //
-//  Global data
-unsigned char *fs3_network_address = NULL; // Address of FS3 server
-unsigned short fs3_network_port = 0;       // Port of FS3 serve
-int socket_fd;
+// Function     : network_fs3_collect
+// Description  : Take the reply to the oldest command in flight on
+//                whichever connection answers first
+//
+// Inputs       : none
+// Outputs      : the command that completed, NULL if failure
+
+static FS3NetPending *network_fs3_collect(void)
+{
+    uint8_t op;
+    int16_t sec;
+    int32_t trk;
+    uint8_t Cret;
+    long waited;
+    struct timespec now;
+    FS3NetPending *pend;
+    uint32_t busy = 0;
+    int conn = 0;
+    int i;
+
+    for (i = 0; i < netConns; i++)
+    {
+        if (pendingConn[i] > 0)
+        {
+            busy |= 1u << i;
+            conn = i;
+        }
+    }
+    if ((busy & (busy - 1)) && ((conn = fs3_network_backend->ready(busy)) == -1)) // Several waiting, take the first to answer
+    {
+        return (NULL);
+    }
+    pend = &pendingOps[conn][pendingHead[conn]];
+    pendingHead[conn] = (pendingHead[conn] + 1) % FS3_NET_RING;
+    pendingConn[conn]--;
+    if (pend->shadow != FS3_NET_DRIVER)
+    {
+        pendingShadow[conn]--;
+    }
+    else
+    {
+        pendingCount--;
+    }
+
+    if ((fs3_network_delay > 0) && (pend->shadow == FS3_NET_DRIVER)) // Simulate a slower link, the reply shows up one delay after its command was sent
+    {
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        waited = (now.tv_sec - pend->sent.tv_sec) * 1000000L + (now.tv_nsec - pend->sent.tv_nsec) / 1000;
+        if (waited < (long)fs3_network_delay)
+        {
+            usleep(fs3_network_delay - waited);
+        }
+    }
+
+    if (fs3_network_backend->recv(pend) == -1)
+    {
+        return (NULL);
+    }
+    if ((fs3_network_replicas > 1) && (pend->shadow == FS3_NET_DRIVER)) // Smooth the round trip (1/8 of each new one), mirror replies wait to be collected and don't count
+    {
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        waited = (now.tv_sec - pend->sent.tv_sec) * 1000000000L + (now.tv_nsec - pend->sent.tv_nsec);
+        netLatency[conn] = (long)netLatency[conn] + (waited - (long)netLatency[conn]) / 8;
+    }
+
+    deconstruct_fs3_cmdblock(pend->cmd, &op, &sec, &trk, &Cret);
+    netBytesIn += sizeof(pend->ret) + (FS3_OP_RECVS_SECTOR(op) ? FS3_OP_PAYLOAD(op, trk) : 0);
+    if (netLease && (network_fs3_recall(pend) == -1))
+    {
+        return (NULL);
+    }
+    return (pend);
+}
 
+////////////////////////////////////////////////////////////////////////////////
 //
-// Network functions
+// Function     : network_fs3_quiesce
+// Description  : Before the unmount (nothing of the driver's in flight),
+//                collect every mirror reply and repair whatever the
+//                replicas missed, so they are the same when the next mount
+//                finds them (and let a move between tiers finish)
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+static int network_fs3_quiesce(void)
+{
+    FS3NetPending *pend;
+    unsigned long failures = netRepairFailures;
+    int inflight;
+    int started;
+    int i;
+
+    while (1)
+    {
+        for (i = 0, inflight = 0; i < netConns; i++)
+        {
+            inflight += pendingShadow[i];
+        }
+        if (inflight == 0)
+        {
+            if (netRepairFailures != failures) // The server keeps turning the repair down, don't spin on it
+            {
+                logMessage(LOG_WARNING_LEVEL, "FS3 replicas could not all be repaired before the unmount");
+                return (0);
+            }
+            if ((started = network_fs3_repair()) == -1)
+            {
+                return (-1);
+            }
+            if (started == 0) // Nothing left to repair
+            {
+                return (0);
+            }
+        }
+        if (((pend = network_fs3_collect()) == NULL) || (network_fs3_settle(pend) == -1))
+        {
+            return (-1);
+        }
+    }
+}
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-// Function     : network_fs3_syscall
-// Description  : Perform a system call over the network
+// Function     : network_fs3_hangup
+// Description  : Close every connection of the pool
 //
-// Inputs       : cmd - the command block to send
+// Inputs       : none
+// Outputs      : none
+
+static void network_fs3_hangup(void)
+{
+    int i;
+
+    for (i = 0; i < netConns; i++)
+    {
+        fs3_network_backend->close(i);
+        pendingShadow[i] = 0;
+    }
+    netConns = 0;
+    pendingCount = 0;
+    netRepair.busy = 0;
+    netMigration.busy = 0;
+    netCompress = 0;
+    netLease = 0;
+    netRecalling = 0;
+    if (fs3_network_auto)
+    {
+        fs3_network_backend = &fs3_tcp_backend; // Probe for a local server again on the next mount
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : network_fs3_merge_mounts
+// Description  : Combine the replies of the servers to a mount into the one
+//                the driver sees: it fails if any of them failed, and offers
+//                only the extensions all of them granted
+//
+// Inputs       : none
+// Outputs      : the combined reply
+
+static FS3CmdBlk network_fs3_merge_mounts(void)
+{
+    uint8_t op;
+    int16_t sec;
+    int32_t trk;
+    uint8_t Cret;
+    uint16_t caps = 0xffff;
+    int i;
+
+    for (i = 0; i < fs3_network_servers; i++)
+    {
+        deconstruct_fs3_cmdblock(netMounts[i], &op, &sec, &trk, &Cret);
+        if ((Cret == 1) || (trk != FS3_CAP_ACK)) // A failure, or a stock server that grants nothing
+        {
+            return (netMounts[i]);
+        }
+        caps &= (uint16_t)sec;
+    }
+    return (construct_fs3_cmdblock(FS3_OP_MOUNT, caps, FS3_CAP_ACK, 0));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : network_fs3_exchange
+// Description  : Send a command on a connection and wait for its reply,
+//                outside of the pipeline (only used while nothing is in flight)
+//
+// Inputs       : conn - the connection
+//                cmd - the command block to send
 //                ret - the returned command block
-//                buf - the buffer to place received data in
 // Outputs      : 0 if successful, -1 if failure
 
-int network_fs3_syscall(FS3CmdBlk cmd, FS3CmdBlk *ret, void *buf)
+static int network_fs3_exchange(int conn, FS3CmdBlk cmd, FS3CmdBlk *ret)
+{
+    FS3NetPending pend;
+
+    pend.conn = conn;
+    pend.cmd = cmd;
+    pend.buf = NULL;
+    if ((fs3_network_backend->send(&pend) == -1) || (fs3_network_backend->recv(&pend) == -1))
+    {
+        return (-1);
+    }
+    netCommands++;
+    netBytesOut += sizeof(cmd);
+    netBytesIn += sizeof(pend.ret);
+    *ret = pend.ret;
+    return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : network_fs3_open_pool
+// Description  : After a mount, open the rest of the connection pool if the
+//                servers let other connections join the mount's session;
+//                connections are added a round at a time, one to each
+//                server, so every server has as many
+//
+// Inputs       : mret - the (combined) reply to the mount
+// Outputs      : 0 if successful, -1 if failure
+
+static int network_fs3_open_pool(FS3CmdBlk mret)
 {
     uint8_t op;
     int16_t sec;
     int32_t trk;
     uint8_t Cret;
-    FS3CmdBlk val;
-
-    deconstruct_fs3_cmdblock(cmd, &op, &sec, &trk, &Cret); // deconstruct cmdblk to get op code
-    val = htonll64(cmd);                                   // Change cmdblk to network byte order
+    int32_t session[FS3_NET_MAX_SERVERS];
+    int want;
+    int per;
+    int i;
 
-    if (op == 0)
+    want = CMPSC311_MINVAL(fs3_network_connections, fs3_network_backend->max_connections / fs3_network_servers); // Per server
+    if ((fs3_network_replicas > 1) || (fs3_network_tier_tracks > 0) || netLease) // Replicas spread the load themselves, each one's latency is its single connection's; a move, or a recall, stays in order with the driver's commands
+    {
+        want = 1;
+    }
+    deconstruct_fs3_cmdblock(mret, &op, &sec, &trk, &Cret);
+    if ((want <= 1) || (trk != FS3_CAP_ACK) || (!((uint16_t)sec & FS3_CAP_SESSION)))
     {
-        char *ip;
-        int sPort;
+        return (0); // A single connection, or a server that ties the mount to it
+    }
 
-        if (fs3_network_address != NULL)
+    for (i = 0; i < fs3_network_servers; i++)
+    {
+        if ((network_fs3_exchange(i, construct_fs3_cmdblock(FS3_OP_JOIN, 0, 0, 0), &mret) == -1)) // Ask for the session id
         {
-            ip = (char *)fs3_network_address;
+            return (-1);
         }
-        else
+        deconstruct_fs3_cmdblock(mret, &op, &sec, &session[i], &Cret);
+        if (Cret == 1)
         {
-            ip = FS3_DEFAULT_IP;
+            return (0);
         }
-
-        if (fs3_network_port != 0)
+    }
+    for (per = 1; per < want; per++)
+    {
+        for (i = 0; i < fs3_network_servers; i++)
         {
-            sPort = fs3_network_port;
+            if (fs3_network_backend->open(netConns + i) == -1)
+            {
+                break;
+            }
+            if ((network_fs3_exchange(netConns + i, construct_fs3_cmdblock(FS3_OP_JOIN, 0, session[i], 0), &mret) == -1) ||
+                (deconstruct_fs3_cmdblock(mret, &op, &sec, &trk, &Cret), Cret == 1))
+            {
+                fs3_network_backend->close(netConns + i);
+                break;
+            }
+            pendingHead[netConns + i] = pendingConn[netConns + i] = 0;
         }
-        else
+        if (i < fs3_network_servers) // Carry on with the rounds we have
         {
-            sPort = FS3_DEFAULT_PORT;
+            while (--i >= 0)
+            {
+                fs3_network_backend->close(netConns + i);
+            }
+            break;
         }
+        netConns += fs3_network_servers;
+    }
+    logMessage(LOG_INFO_LEVEL, "FS3 network using %d connections to %d servers (session %d)", netConns, fs3_network_servers, session[0]);
+    return (0);
+}
 
-        struct sockaddr_in caddr;
-        caddr.sin_family = AF_INET;
-        caddr.sin_port = htons(sPort);               // Set port
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : network_fs3_submit
+// Description  : Send a command (and its payload) without waiting for the
+//                reply, replies are collected by network_fs3_complete (in
+//                order on each connection)
+//
+// Inputs       : cmd - the command block to send
+//                buf - the sector buffer (sent for writes, filled for reads),
+//                      one sector or a range command's whole run
+// Outputs      : 0 if successful, -1 if failure (or the window is full)
+
+int network_fs3_submit(FS3CmdBlk cmd, void *buf)
+{
+    uint8_t op;
+    int16_t sec;
+    int32_t trk;
+    uint8_t Cret;
+    int conn;
+    int i;
 
-        if (inet_aton(ip, &caddr.sin_addr) == 0)
+    deconstruct_fs3_cmdblock(cmd, &op, &sec, &trk, &Cret); // deconstruct cmdblk to get op code
+    if ((pendingCount >= fs3_network_window) || (pendingCount >= FS3_NET_MAX_WINDOW))
+    {
+        logMessage(LOG_ERROR_LEVEL, "FS3 network window full, complete a command first");
+        return (-1);
+    }
+    if (op == FS3_OP_MOUNT && netConns == 0)
+    {
+        if (fs3_network_servers > fs3_network_backend->max_connections)
         {
-            printf("failed on aton");
+            logMessage(LOG_ERROR_LEVEL, "FS3 network backend %s can't stripe over %d servers", fs3_network_backend->name, fs3_network_servers);
             return (-1);
         }
-        
-        socket_fd = socket(PF_INET, SOCK_STREAM, 0); // Create socket
-
-        if (socket_fd == -1)
+        if ((fs3_network_replicas < 1) || (fs3_network_servers % fs3_network_replicas != 0))
+        {
+            logMessage(LOG_ERROR_LEVEL, "FS3 can't split %d servers into groups of %d replicas", fs3_network_servers, fs3_network_replicas);
+            return (-1);
+        }
+        if ((fs3_network_tier_tracks > 0) && ((fs3_network_servers != 2) || (fs3_network_replicas != 1) || (fs3_network_tier_tracks > FS3_MAX_TRACKS)))
         {
-            printf("Error on socket creation [%s]\n", strerror(errno)); // Sanity checks for errors
+            logMessage(LOG_ERROR_LEVEL, "FS3 tiers need a fast and a slow server (unreplicated) and at most %d fast tracks", FS3_MAX_TRACKS);
             return (-1);
         }
-        if (connect(socket_fd, (const struct sockaddr *)&caddr, sizeof(caddr)) == -1) // Connect server to client
+        if ((fs3_network_servers == 1) && fs3_network_auto && network_fs3_is_local() && (fs3_shm_backend.open(0) == 0))
         {
-            return -1;
+            fs3_network_backend = &fs3_shm_backend; // Server on this host took the shared ring
         }
-        if (write(socket_fd, &val, sizeof(val)) != sizeof(val)) // Write cmdblk over server
+        else
         {
-            printf("Error writing network data [%s]\n", strerror(errno));
-            return -1;
+            for (i = 0; i < fs3_network_servers; i++) // One connection to each server to start with
+            {
+                if (fs3_network_backend->open(i) == -1)
+                {
+                    while (--i >= 0)
+                    {
+                        fs3_network_backend->close(i);
+                    }
+                    return (-1);
+                }
+            }
         }
-        if (read(socket_fd, ret, sizeof(ret)) != sizeof(ret)) // Read the returned cmdblk from disk controller
+        netConns = fs3_network_servers;
+        for (i = 0; i < netConns; i++)
         {
-            printf("Error reading network data [%s]\n", strerror(errno));
-            return (-1);
+            pendingHead[i] = pendingConn[i] = pendingShadow[i] = 0;
+            netLatency[i] = NET_START_LATENCY;
         }
-        *ret = ntohll64(*ret); // Change ret to host byte order
+        pendingCount = 0;
+        memset(netDirty, 0, sizeof(netDirty)); // The replicas start out the same
+        memset(netDirtyCount, 0, sizeof(netDirtyCount));
+        memset(&netRepair, 0, sizeof(netRepair));
+        memset(netTierMap, 0xff, sizeof(netTierMap)); // Every chunk starts out at home, the map lasts as long as the mount (like the driver's files)
+        memset(netTierSlot, 0xff, sizeof(netTierSlot));
+        memset(netHeat, 0, sizeof(netHeat));
+        memset(netHeatEpoch, 0, sizeof(netHeatEpoch));
+        memset(netTierQueued, 0, sizeof(netTierQueued));
+        memset(&netMigration, 0, sizeof(netMigration));
+        netTierSlots = netTierFree = fs3_network_tier_tracks * FS3_TRACK_SIZE / FS3_NET_TIER_CHUNK;
+        netTierHand = netTierQHead = netTierQLen = 0;
+        netEpoch = 0;
+        netEpochAccesses = 0;
     }
-    if (op == 1)
+    if (netConns == 0)
     {
-        if (write(socket_fd, &val, sizeof(val)) != sizeof(val)) // Sanity checks for errors
+        logMessage(LOG_ERROR_LEVEL, "FS3 network command sent without a connection (not mounted)");
+        return (-1);
+    }
+
+    conn = 0; // Mount and unmount belong to the first connection
+    if ((op != FS3_OP_MOUNT) && (op != FS3_OP_UMOUNT))
+    {
+        if (fs3_network_tier_tracks > 0)
+        {
+            network_fs3_heat(op, sec, trk);
+        }
+        conn = network_fs3_route(FS3_OP_TRACK(op, trk), sec);
+        if (fs3_network_servers > 1) // Commands name a place on the whole disk, the server wants its own
         {
-            printf("Error writing network data [%s]\n", strerror(errno));
-            return -1;
+            if (network_fs3_place(op, &sec, &trk, buf) == -1)
+            {
+                return (-1);
+            }
+            cmd = construct_fs3_cmdblock(op, sec, trk, Cret);
         }
-        if (read(socket_fd, ret, sizeof(ret)) != sizeof(ret))
+    }
+    if ((op == FS3_OP_MOUNT) && (trk == FS3_CAP_PROBE) && fs3_network_compress && fs3_network_backend->compress)
+    {
+        sec |= FS3_CAP_COMPRESS; // The wire encoding is ours to ask for
+        cmd = construct_fs3_cmdblock(op, sec, trk, Cret);
+    }
+    if ((op == FS3_OP_MOUNT) && (trk == FS3_CAP_PROBE) && fs3_network_leases && (fs3_network_servers == 1))
+    {
+        sec |= FS3_CAP_LEASE; // So is keeping the cache coherent, the driver never sees it
+        cmd = construct_fs3_cmdblock(op, sec, trk, Cret);
+    }
+    if ((op == FS3_OP_UMOUNT) && ((fs3_network_replicas > 1) || (fs3_network_tier_tracks > 0)) && (network_fs3_quiesce() == -1)) // Leave the replicas the same, let a move finish
+    {
+        return (-1);
+    }
+    for (i = 1; ((op == FS3_OP_MOUNT) || (op == FS3_OP_UMOUNT)) && (i < fs3_network_servers); i++) // The other servers first, the first one's reply stands for all
+    {
+        if (network_fs3_exchange(i, cmd, &netMounts[i]) == -1)
         {
-            printf("Error reading network data [%s]\n", strerror(errno));
+            network_fs3_hangup();
             return (-1);
         }
-        *ret = ntohll64(*ret); // Change ret to host byte order
+        netServerCommands[i]++;
+    }
+    if ((fs3_network_replicas > 1) && (op != FS3_OP_MOUNT) && (op != FS3_OP_UMOUNT))
+    {
+        return (network_fs3_replicate(op, sec, trk, cmd, buf, conn));
+    }
+    return (network_fs3_post(conn, cmd, buf, FS3_NET_DRIVER));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : network_fs3_complete
+// Description  : Wait for a reply, the oldest command in flight on
+//                whichever connection answers first
+//
+// Inputs       : cmd - the command that completed (may be NULL)
+//                ret - the returned command block
+//                buf - the buffer the command was using (may be NULL)
+// Outputs      : 0 if successful, -1 if failure
+
+int network_fs3_complete(FS3CmdBlk *cmd, FS3CmdBlk *ret, void **buf)
+{
+    uint8_t op;
+    int16_t sec;
+    int32_t trk;
+    uint8_t Cret;
+    FS3NetPending *pend;
+
+    if (pendingCount == 0)
+    {
+        logMessage(LOG_ERROR_LEVEL, "FS3 network complete called with no command in flight");
+        return (-1);
     }
-    if (op == 2)
+    do // Mirror, repair and move replies on the way are the network layer's own
     {
-        if (write(socket_fd, &val, sizeof(val)) != sizeof(val)) // Sanity checks for errors
+        if ((pend = network_fs3_collect()) == NULL)
         {
-            printf("Error writing network data [%s]\n", strerror(errno));
-            return -1;
+            return (-1);
         }
-        if (read(socket_fd, ret, sizeof(ret)) != sizeof(ret))
+        if (((fs3_network_replicas > 1) || (fs3_network_tier_tracks > 0)) && (network_fs3_settle(pend) == -1))
         {
-            printf("Error reading network data [%s]\n", strerror(errno));
             return (-1);
         }
+    } while (pend->shadow != FS3_NET_DRIVER);
+    if (cmd != NULL)
+    {
+        *cmd = pend->cmd;
+    }
+    if (buf != NULL)
+    {
+        *buf = pend->buf;
+    }
 
-        *ret = ntohll64(*ret); // Change ret to host byte order
-
-        if (read(socket_fd, buf, 1024) != 1024) // Read buf read buf received
+    deconstruct_fs3_cmdblock(pend->cmd, &op, &sec, &trk, &Cret);
+    if ((op == FS3_OP_MOUNT) && (fs3_network_servers > 1))
+    {
+        netMounts[0] = pend->ret;
+        pend->ret = network_fs3_merge_mounts();
+    }
+    if ((op == FS3_OP_MOUNT) && (fs3_network_tier_tracks > 0))
+    {
+        deconstruct_fs3_cmdblock(pend->ret, &op, &sec, &trk, &Cret);
+        if ((Cret != 1) && (trk == FS3_CAP_ACK)) // A copy in place can't follow a chunk to the other tier, the driver bounces it instead
         {
-            printf("Error reading network data [%s]\n", strerror(errno));
-            return (-1);
+            pend->ret = construct_fs3_cmdblock(op, sec & ~FS3_CAP_COPY, trk, Cret);
         }
     }
-    if (op == 3)
+    *ret = pend->ret;
+    if (op == FS3_OP_MOUNT)
     {
-        if (write(socket_fd, &val, sizeof(val)) != sizeof(val)) // Sanity checks for errors
+        deconstruct_fs3_cmdblock(pend->ret, &op, &sec, &trk, &Cret);
+        netCaps = (trk == FS3_CAP_ACK) ? (uint16_t)sec : 0;
+        netCompress = (netCaps & FS3_CAP_COMPRESS) && fs3_network_backend->compress;
+        netLease = (netCaps & FS3_CAP_LEASE) != 0;
+        netRecalling = 0;
+        netLeaseUntil = 0; // Held from the next reply on
+        if (fs3_network_leases && !netLease && (Cret != 1))
         {
-            printf("Error writing network data [%s]\n", strerror(errno));
-            return -1;
+            logMessage(LOG_WARNING_LEVEL, "FS3 cache holds no lease (that takes a single server granting one), it may miss other clients' writes");
         }
-        if (write(socket_fd, buf, 1024) != 1024) // Write/Send buf over server
+        if ((fs3_network_replicas > 1) && (Cret != 1) && !(netCaps & FS3_CAP_SEEKXFER))
         {
-            printf("Error writing network data [%s]\n", strerror(errno));
-            return -1;
+            logMessage(LOG_ERROR_LEVEL, "FS3 replicas need servers that take fused seek+transfer commands");
+            network_fs3_hangup(); // Every command has to say where it goes, any replica may get it
+            return (-1);
         }
-        if (read(socket_fd, ret, sizeof(ret)) != sizeof(ret))
+        if ((fs3_network_tier_tracks > 0) && (Cret != 1) && ((netCaps & (FS3_CAP_SEEKXFER | FS3_CAP_RANGE)) != (FS3_CAP_SEEKXFER | FS3_CAP_RANGE)))
         {
-            printf("Error reading network data [%s]\n", strerror(errno));
+            logMessage(LOG_ERROR_LEVEL, "FS3 tiers need servers that take fused seek+transfer and range commands");
+            network_fs3_hangup(); // A chunk moves in one range, and may move between a seek and its transfer
             return (-1);
         }
-        *ret = ntohll64(*ret); // Change ret to host byte order
-    }
-    if (op == 4)
-    {
-        if (write(socket_fd, &val, sizeof(val)) != sizeof(val)) // Sanity checks for errors
+        if (network_fs3_open_pool(pend->ret) == -1)
         {
-            printf("Error writing network data [%s]\n", strerror(errno));
-            return -1;
+            return (-1);
         }
-        if (read(socket_fd, ret, sizeof(ret)) != sizeof(ret))
+        return (0);
+    }
+    if (op == FS3_OP_UMOUNT)
+    {
+        network_fs3_hangup(); // The others only joined the session, dropping them is enough
+        return (0);
+    }
+    if ((fs3_network_replicas > 1) && (network_fs3_repair() == -1)) // Catch a replica up while the driver carries on
+    {
+        return (-1);
+    }
+    if ((fs3_network_tier_tracks > 0) && (network_fs3_migrate() == -1)) // Move a chunk between the tiers while the driver carries on
+    {
+        return (-1);
+    }
+    return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : network_fs3_outstanding
+// Description  : Return the number of commands waiting for a reply
+//
+// Inputs       : none
+// Outputs      : number of commands in flight
+
+int network_fs3_outstanding(void)
+{
+    return (pendingCount);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : network_fs3_commands
+// Description  : Return the number of commands sent since the start, each
+//                one a round trip to a server
+//
+// Inputs       : none
+// Outputs      : number of commands sent
+
+unsigned long network_fs3_commands(void)
+{
+    return (netCommands);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : network_fs3_lease_valid
+// Description  : Tell the cache whether what it holds can be used: always
+//                without a lease (nobody else writes), and with one only
+//                while it runs and no recalls are being collected
+//
+// Inputs       : none
+// Outputs      : 1 if cached sectors can be used, 0 if not
+
+int network_fs3_lease_valid(void)
+{
+    return ((!netLease) || ((!netRecalling) && (network_nsecs() < netLeaseUntil)));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : network_fs3_syscall
+// Description  : Perform a system call over the network
+//
+// Inputs       : cmd - the command block to send
+//                ret - the returned command block
+//                buf - the buffer to place received data in
+// Outputs      : 0 if successful, -1 if failure
+
+int network_fs3_syscall(FS3CmdBlk cmd, FS3CmdBlk *ret, void *buf)
+{
+    while (pendingCount > 0) // Synchronous calls go behind anything still in the pipe
+    {
+        if (network_fs3_complete(NULL, ret, NULL) == -1)
         {
-            printf("Error reading network data [%s]\n", strerror(errno));
             return (-1);
         }
-        close(socket_fd); // Close socket and set to -1 to avoid use after close in unmount
-        socket_fd = -1;
     }
+    if (network_fs3_submit(cmd, buf) == -1)
+    {
+        return (-1);
+    }
+    return (network_fs3_complete(NULL, ret, NULL));
+}
 
-    printf("Receivd a value of [%ld]\n", cmd);
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : network_fs3_log_metrics
+// Description  : Log the traffic metrics of the network layer
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
 
-    // Return successfully
+int network_fs3_log_metrics(void)
+{
+    int i;
+
+    printf("** FS3 network Metrics **\n");
+    printf("Commands sent    [    %lu]\n", netCommands);
+    printf("Bytes sent       [    %lu]\n", netBytesOut);
+    printf("Bytes received   [    %lu]\n", netBytesIn);
+    if (fs3_network_servers > 1) // Striped, show how evenly the commands spread
+    {
+        printf("Commands/server  [   ");
+        for (i = 0; i < fs3_network_servers; i++)
+        {
+            printf(" %lu", netServerCommands[i]);
+        }
+        printf("]\n");
+    }
+    if (fs3_network_replicas > 1) // Replicated, show where the reads went and how far the replicas fell behind
+    {
+        printf("Reads/server     [   ");
+        for (i = 0; i < fs3_network_servers; i++)
+        {
+            printf(" %lu", netServerReads[i]);
+        }
+        printf("]\n");
+        printf("Latency/server   [   ");
+        for (i = 0; i < fs3_network_servers; i++)
+        {
+            printf(" %.1f", (double)netLatency[i] / 1000);
+        }
+        printf(" usecs]\n");
+        printf("Mirrored writes  [    %lu, %lu skipped while lagging]\n", netMirrored, netSkipped);
+        printf("Sectors repaired [    %lu, %lu repairs failed]\n", netRepaired, netRepairFailures);
+    }
+    if (fs3_network_leases) // Leased, show how much other clients took back
+    {
+        printf("Sectors recalled [    %lu, in %lu collections, %lu whole cache drops]\n", netRecalls, netRecallRounds, netLeaseFlushes);
+    }
+    if (fs3_network_tier_tracks > 0) // Tiered, show how much the fast tier served and how much moved
+    {
+        printf("Fast tier hits   [    %.1f%% of %lu sectors]\n",
+               (netTierFastSectors + netTierSlowSectors > 0) ? (double)netTierFastSectors * 100 / (netTierFastSectors + netTierSlowSectors) : 0.0,
+               netTierFastSectors + netTierSlowSectors);
+        printf("Chunks moved     [    %lu promoted, %lu demoted, %lu dropped]\n", netPromoted, netDemoted, netMigrationsDropped);
+    }
+    if (netRawOut + netRawIn > 0) // Payloads went compressed, show what actually crossed the wire
+    {
+        printf("Wire bytes sent  [    %lu]\n", netBytesOut - netRawOut + netFrameOut);
+        printf("Wire bytes recvd [    %lu]\n", netBytesIn - netRawIn + netFrameIn);
+        printf("Payload ratio    [    out %%%.2f, in %%%.2f]\n", (netRawOut > 0) ? (double)netFrameOut * 100 / netRawOut : 100.0,
+               (netRawIn > 0) ? (double)netFrameIn * 100 / netRawIn : 100.0);
+        printf("Codec cost       [    %.2f usecs/sector packing, %.2f unpacking]\n",
+               (netRawOut > 0) ? (double)netPackNs / 1000 / ((double)netRawOut / FS3_SECTOR_SIZE) : 0.0,
+               (netRawIn > 0) ? (double)netUnpackNs / 1000 / ((double)netRawIn / FS3_SECTOR_SIZE) : 0.0);
+    }
+    if (fs3_network_backend->log_metrics != NULL)
+    {
+        return (fs3_network_backend->log_metrics());
+    }
     return (0);
 }
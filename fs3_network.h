@@ -7,10 +7,11 @@
 //  Description   : This is the network definitions for the FS3 system.
 //
 //  Author        : Patrick McDaniel
-//  Last Modified : Sun Oct 30 07:48:47 EDT 2016
+//  Last Modified : Mon 19 Oct 2026 04:50:48 AM UTC
 //
 
 // Include Files
+#include <time.h>
 
 // Project Include Files
 #include <fs3_controller.h>
@@ -20,11 +21,72 @@
 #define FS3_NET_HEADER_SIZE sizeof(FS3CmdBlk)
 #define FS3_DEFAULT_IP "127.0.0.1"
 #define FS3_DEFAULT_PORT 22887
+#define FS3_NET_MAX_WINDOW 64     // Most commands that can be in flight at once
+#define FS3_NET_DEFAULT_WINDOW 16 // Commands in flight unless configured otherwise
+#define FS3_NET_MAX_CONNECTIONS 8 // Most connections in the pool
+#define FS3_NET_MAX_SERVERS 4     // Most servers the disk can be striped over
+#define FS3_NET_MAX_TRACKS (FS3_NET_MAX_SERVERS * FS3_MAX_TRACKS) // Largest striped disk, in tracks
+#define FS3_NET_DEFAULT_STRIPE FS3_MAX_RANGE // Sectors in a stripe unit unless configured otherwise
+#define FS3_NET_MAX_LAG 32        // Most mirror and repair commands in flight on a connection before mirrors are skipped
+#define FS3_NET_RING (FS3_NET_MAX_WINDOW + FS3_NET_MAX_LAG) // Commands in flight on one connection, the driver's and the mirrors'
+#define FS3_NET_TIER_CHUNK FS3_MAX_RANGE // Sectors that move between tiers together (what one range command carries)
+#define FS3_NET_TIER_CHUNKS (FS3_MAX_TRACKS * FS3_TRACK_SIZE / FS3_NET_TIER_CHUNK) // Chunks of a tiered disk
+#define FS3_NET_TIER_FAST 0       // The server holding the hot chunks of a tiered disk
+#define FS3_NET_TIER_SLOW 1       // The server every chunk of a tiered disk has its home on
+#define FS3_NET_AFFINITY_TRACK 0  // Spread commands over the connections by track
+#define FS3_NET_AFFINITY_FILE 1   // Keep each file's commands on one connection
+#define FS3_NET_DRIVER 0          // A command the driver waits for
+#define FS3_NET_MIRROR 1          // A copy of a write sent to another replica
+#define FS3_NET_REPAIR_READ 2     // Reading a run from an up to date replica to repair another
+#define FS3_NET_REPAIR_WRITE 3    // Writing the run to the replica that missed it
+#define FS3_NET_MIGRATE_READ 4    // Reading a chunk from the tier it is leaving
+#define FS3_NET_MIGRATE_WRITE 5   // Writing the chunk to the tier it is moving to
+#define FS3_NET_LEASE 6           // Collecting the sectors the server recalled from the lease
 
+// One command waiting for its reply
+typedef struct {
+	int conn;             // The connection the command went out on
+	int shadow;           // Who waits for the reply (FS3_NET_DRIVER, or a command of the network layer's own)
+	FS3CmdBlk cmd;        // The command block that was sent
+	FS3CmdBlk ret;        // The command block that came back
+	void *buf;            // Where the reply payload goes (reads) or came from (writes)
+	struct timespec sent; // When the command went out (for the injected latency)
+	uint64_t due;         // When the reply arrives (simulated backends, usecs)
+} FS3NetPending;
+
+// A place commands can be sent to, over one or more connections; replies on
+// a connection are collected in the order its commands were sent
+typedef struct {
+	const char *name;             // Name used to select the backend
+	int max_connections;          // Most connections the backend can hold
+	int (*open)(int);             // Open a connection, the first one is opened by the mount
+	int (*send)(FS3NetPending *); // Issue a command (and its payload)
+	int (*recv)(FS3NetPending *); // Collect the reply (and payload) of the oldest command on its connection
+	void (*close)(int);           // Close a connection, after the unmount reply
+	int (*ready)(uint32_t);       // Wait for one of a mask of connections to have a reply
+	int (*log_metrics)(void);     // Log backend specific metrics (may be NULL)
+	int compress;                 // Can carry compressed payload frames (FS3_CAP_COMPRESS)
+} FS3NetBackend;
 
 // Global data
-extern unsigned char *fs3_network_address;     // Address of FS3 server
-extern unsigned short fs3_network_port;        // Port of FS3 server
+extern unsigned char *fs3_network_address;     // Address of FS3 server (the first one when striping)
+extern unsigned short fs3_network_port;        // Port of FS3 server (the first one when striping)
+extern int fs3_network_servers;                // Servers the disk is striped over
+extern int fs3_network_stripe;                 // Sectors in each stripe unit
+extern int fs3_network_replicas;               // Servers holding a copy of each stripe
+extern int fs3_network_tier_tracks;            // Tracks of the fast tier, 0 when the disk isn't tiered
+extern int fs3_network_leases;                 // Keep the cache coherent with other clients through a lease
+extern unsigned long fs3_network_delay;        // Injected latency per round trip (usecs)
+extern int fs3_network_window;                 // Commands allowed in flight
+extern int fs3_network_connections;            // Connections to open when the server shares its mount
+extern int fs3_network_affinity;               // How commands are spread over the connections
+extern int fs3_network_auto;                   // Use the shared-memory ring when the server is local
+extern int fs3_network_compress;               // Ask the server to compress payloads on the wire
+extern FS3NetBackend *fs3_network_backend;     // Where commands go
+extern FS3NetBackend fs3_tcp_backend;          // An FS3 server over TCP
+extern FS3NetBackend fs3_uring_backend;        // An FS3 server over TCP, driven through io_uring
+extern FS3NetBackend fs3_shm_backend;          // An FS3 server on this host, through a shared-memory ring
+extern FS3NetBackend fs3_inproc_backend;       // A controller inside this process
 
 //
 // Functional Prototypes
@@ -32,5 +94,50 @@ extern unsigned short fs3_network_port;        // Port of FS3 server
 int network_fs3_syscall(FS3CmdBlk cmd, FS3CmdBlk *ret, void *buf);
 	// This is the client/network system call for communicating with controller
 
+int network_fs3_submit(FS3CmdBlk cmd, void *buf);
+	// Send a command without waiting for its reply (pipelined)
+
+int network_fs3_complete(FS3CmdBlk *cmd, FS3CmdBlk *ret, void **buf);
+	// Collect the reply of the oldest command in flight
+
+int network_fs3_outstanding(void);
+	// Number of commands waiting for their replies
+
+unsigned long network_fs3_commands(void);
+	// Number of commands sent so far (a window sends several per round trip)
+
+int network_fs3_lease_valid(void);
+	// Whether cached sectors can be used (no lease needed, or it is held with nothing recalled)
+
+void network_fs3_set_key(int key);
+	// Name the file the next commands are for (file affinity)
+
+int network_fs3_route(int32_t trk, int16_t sec);
+	// Connection a command on the sector is sent on
+
+int network_fs3_server(int32_t trk, int16_t sec);
+	// Server that holds a sector of the (striped) disk
+
+int network_fs3_track(int32_t trk, int16_t sec);
+	// Track a sector of the disk is on, on its server
+
+int network_fs3_extent(int32_t trk, int16_t sec);
+	// Sectors from this one on that sit next to each other on the same server
+
+int network_fs3_tracks(void);
+	// Number of tracks of the disk, over all of the servers
+
+int network_fs3_add_server(const char *address, unsigned short port);
+	// Stripe (or mirror) the disk over one more server (before mounting)
+
+int network_fs3_set_backend(const char *name);
+	// Choose where commands are sent ("tcp", "uring", "shm" or "inproc")
+
+int network_fs3_dial(int conn);
+	// Open a TCP connection to the FS3 server of a connection, returns the socket
+
+int network_fs3_log_metrics(void);
+	// Log the commands and bytes exchanged with the server
+
 
 #endif
@@ -0,0 +1,936 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : fs3_refserver.c
+//  Description    : This is the reference FS3 server. It speaks the FS3
+//                   command block protocol to any number of clients from an
+//                   epoll event loop, keeping the disk in an mmap'd image
+//                   file so its contents survive restarts. Clients on the
+//                   same host can instead hand it a shared-memory ring
+//                   (fs3_shm.h) over a unix socket.
+//
+//  Author         : Patrick McDaniel
+//  Last Modified  : Mon 19 Oct 2026 04:50:00 AM UTC
+//
+
+// Include Files
+#define _GNU_SOURCE // accept4
+#include <stdio.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/un.h>
+#include <linux/futex.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <gcrypt.h>
+
+// Project Includes
+#include <fs3_controller.h>
+#include <fs3_common.h>
+#include <fs3_network.h>
+#include <fs3_shm.h>
+#include <fs3_lz.h>
+#include <cmpsc311_log.h>
+#include <cmpsc311_util.h>
+
+// Defines
+#define FS3_SERVER_ARGUMENTS "hvl:p:f:c:d:"
+#define FS3_DEFAULT_IMAGE "fs3_disk.img"
+#define FS3_SERVER_MAX_EVENTS 64
+#define FS3_SERVER_MAX_PAYLOAD (FS3_MAX_RANGE * FS3_SECTOR_SIZE)
+#define FS3_SERVER_MAX_OUTPUT (1024 * 1024) // Stop reading from a client with this much unsent
+#define FS3_DISK_SIZE ((size_t)FS3_MAX_TRACKS * sizeof(FS3Track))
+#define FS3_SERVER_HOLD_TICK 1 // Msecs between looks at replies held for recalls
+#define USAGE \
+	"USAGE: fs3_refserver [-h] [-v] [-l <logfile>] [-p <port>] [-f <image>] [-c <caps>] [-d <usecs>]\n" \
+	"\n" \
+	"where:\n" \
+	"    -h - help mode (display this message)\n" \
+	"    -v - verbose output\n" \
+	"    -l - write log messages to the filename <logfile>\n" \
+	"    -p - listen on port <port> (default 22887)\n" \
+	"    -f - keep the disk in the image file <image> (default fs3_disk.img)\n" \
+	"    -c - only grant the protocol extensions in the mask <caps>\n" \
+	"    -d - take <usecs> longer over every command (stand in for a slower device)\n" \
+	"\n" \
+
+// The state of one client connection
+typedef struct FS3ServerClient {
+	int                  fd;        // The client socket
+	FS3ControllerSession ses;       // Controller state (mount, track, extensions)
+	char                *in;        // Command block and payload being received
+	size_t               inLen;     // Bytes of the command received so far
+	char                *out;       // Replies waiting to be sent
+	size_t               outLen;    // Bytes in the output buffer
+	size_t               outOff;    // Bytes of the output buffer already sent
+	size_t               outCap;    // Size of the output buffer
+	int                  closing;   // Close once the output is flushed (unmounted)
+	uint32_t             events;    // Events currently registered with epoll
+	FS3ShmRing          *ring;      // Shared ring of a local client (fd is then its unix socket), NULL over TCP
+	int                  held;      // The reply to a write waits for other sessions to drop their copies
+	FS3CmdBlk            heldRet;   // That reply (over TCP, a ring keeps it in place)
+	struct FS3ServerClient *nextHeld; // Next client with a held reply
+	int                  handshake; // Local client that hasn't handed over its ring yet
+	int                  busy;      // Its ring still had work when its turn ended
+	struct FS3ServerClient *nextBusy; // Next client with a busy ring
+} FS3ServerClient;
+
+//
+// Global Data
+int epollFd = -1;             // The event loop
+int listenFd = -1;            // The listening socket
+int unixFd = -1;              // The unix socket local clients hand their rings to
+int diskFd = -1;              // The disk image file
+FS3ServerClient *heldClients = NULL; // Clients whose reply is held, nothing more is read from them
+FS3ServerClient *busyClients = NULL; // Local clients to come back to without waiting for a kick
+char fs3ServerPayload[FS3_SERVER_MAX_PAYLOAD];             // Payload unpacked from (or to be packed into) a frame
+char fs3ServerFrame[FS3_LZ_FRAME_MAX(FS3_SERVER_MAX_PAYLOAD)]; // Frame of a reply payload
+unsigned long fs3ServerDelay = 0; // Service time added to every command (usecs)
+volatile sig_atomic_t stopServer = 0; // Set by the signal handler to shut down
+
+//
+// Functional Prototypes
+
+int fs3_server_open_disk(char *image);        // Map the disk image
+int fs3_server_listen(unsigned short port);   // Create the listening socket
+int fs3_server_loop(void);                    // The event loop
+void fs3_server_shutdown(int sig);            // Signal handler
+
+//
+// Functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : main
+// Description  : The main function for the FS3 reference server
+//
+// Inputs       : argc - the number of command line parameters
+//                argv - the parameters
+// Outputs      : 0 if successful, -1 if failure
+
+int main( int argc, char *argv[] ) {
+
+	// Local variables
+	int ch, verbose = 0, log_initialized = 0, ret;
+	unsigned short port = FS3_DEFAULT_PORT;
+	unsigned int caps;
+	char *image = FS3_DEFAULT_IMAGE;
+	struct sigaction sa;
+
+	// Process the command line parameters
+	while ((ch = getopt(argc, argv, FS3_SERVER_ARGUMENTS)) != -1) {
+
+		switch (ch) {
+		case 'h': // Help, print usage
+			fprintf( stderr, USAGE );
+			return( -1 );
+
+		case 'v': // Verbose Flag
+			verbose = 1;
+			break;
+
+		case 'l': // Set the log filename
+			initializeLogWithFilename( optarg );
+			log_initialized = 1;
+			break;
+
+		case 'p': // Set the network port number
+			if ( sscanf(optarg, "%hu", &port) != 1 ) {
+				logMessage( LOG_ERROR_LEVEL, "Bad port number [%s]", optarg );
+				return(-1);
+			}
+			break;
+
+		case 'f': // Set the disk image
+			image = optarg;
+			break;
+
+		case 'c': // Restrict the protocol extensions
+			if ( sscanf(optarg, "%i", &caps) != 1 ) {
+				logMessage( LOG_ERROR_LEVEL, "Bad capability mask [%s]", optarg );
+				return(-1);
+			}
+			fs3_controller_caps = caps & FS3_CAP_ALL;
+			break;
+
+		case 'd': // Slow every command down
+			if ( sscanf(optarg, "%lu", &fs3ServerDelay) != 1 ) {
+				logMessage( LOG_ERROR_LEVEL, "Bad command delay [%s]", optarg );
+				return(-1);
+			}
+			break;
+
+		default:  // Default (unknown)
+			fprintf( stderr, "Unknown command line option (%c), aborting.\n", ch );
+			return( -1 );
+		}
+	}
+
+	// Setup the log as needed
+	if ( ! log_initialized ) {
+		initializeLogWithFilehandle( CMPSC311_LOG_STDERR );
+	}
+	FS3ControllerLLevel = registerLogLevel("FS3_CONTROLLER", 0); // Controller log level
+	gcry_check_version(NULL); // Sector hashes (FS3_OP_HASH)
+	if ( verbose ) {
+		enableLogLevels(FS3ControllerLLevel);
+	}
+
+	// Shut down cleanly (flushing the image) on a signal, and never die on a closed client
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = fs3_server_shutdown;
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+	signal(SIGPIPE, SIG_IGN);
+
+	if ( (fs3_server_open_disk(image) == -1) || (fs3_server_listen(port) == -1) ) {
+		return( -1 );
+	}
+	logMessage( LOG_INFO_LEVEL, "FS3 server listening on port %d, disk image [%s], extensions 0x%x",
+		port, image, fs3_controller_caps );
+	ret = fs3_server_loop();
+
+	// Flush the disk and shut down
+	msync(fs3_controller_disk, FS3_DISK_SIZE, MS_SYNC);
+	munmap(fs3_controller_disk, FS3_DISK_SIZE);
+	close(diskFd);
+	close(listenFd);
+	close(unixFd);
+	close(epollFd);
+	logMessage( LOG_INFO_LEVEL, "FS3 server shut down." );
+	return( ret );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_server_shutdown
+// Description  : Signal handler, asks the event loop to stop
+//
+// Inputs       : sig - the signal received
+// Outputs      : none
+
+void fs3_server_shutdown(int sig) {
+	stopServer = 1;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_server_open_disk
+// Description  : Open (creating as needed) the disk image and map it as the
+//                controller's disk
+//
+// Inputs       : image - the filename of the disk image
+// Outputs      : 0 if successful, -1 if failure
+
+int fs3_server_open_disk(char *image) {
+
+	struct stat st;
+	void *disk;
+
+	if ( (diskFd = open(image, O_RDWR|O_CREAT, 0644)) == -1 ) {
+		logMessage( LOG_ERROR_LEVEL, "Unable to open disk image [%s]: %s", image, strerror(errno) );
+		return( -1 );
+	}
+	if ( fstat(diskFd, &st) == -1 ) {
+		logMessage( LOG_ERROR_LEVEL, "Unable to stat disk image [%s]: %s", image, strerror(errno) );
+		return( -1 );
+	}
+	if ( ((size_t)st.st_size < FS3_DISK_SIZE) && (ftruncate(diskFd, FS3_DISK_SIZE) == -1) ) { // New image, zero filled
+		logMessage( LOG_ERROR_LEVEL, "Unable to size disk image [%s]: %s", image, strerror(errno) );
+		return( -1 );
+	}
+
+	disk = mmap(NULL, FS3_DISK_SIZE, PROT_READ|PROT_WRITE, MAP_SHARED, diskFd, 0);
+	if ( disk == MAP_FAILED ) {
+		logMessage( LOG_ERROR_LEVEL, "Unable to map disk image [%s]: %s", image, strerror(errno) );
+		return( -1 );
+	}
+	fs3_controller_disk = (FS3Track *)disk;
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_server_listen
+// Description  : Create the listening socket and the event loop
+//
+// Inputs       : port - the port to listen on
+// Outputs      : 0 if successful, -1 if failure
+
+int fs3_server_listen(unsigned short port) {
+
+	struct sockaddr_in saddr;
+	struct sockaddr_un uaddr;
+	struct epoll_event ev;
+	int one = 1, len;
+
+	if ( (listenFd = socket(PF_INET, SOCK_STREAM|SOCK_NONBLOCK, 0)) == -1 ) {
+		logMessage( LOG_ERROR_LEVEL, "Error on socket creation [%s]", strerror(errno) );
+		return( -1 );
+	}
+	setsockopt(listenFd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+	memset(&saddr, 0, sizeof(saddr));
+	saddr.sin_family = AF_INET;
+	saddr.sin_port = htons(port);
+	saddr.sin_addr.s_addr = htonl(INADDR_ANY);
+	if ( (bind(listenFd, (struct sockaddr *)&saddr, sizeof(saddr)) == -1) || (listen(listenFd, FS3_MAX_BACKLOG) == -1) ) {
+		logMessage( LOG_ERROR_LEVEL, "Unable to listen on port %d [%s]", port, strerror(errno) );
+		return( -1 );
+	}
+
+	if ( (epollFd = epoll_create1(0)) == -1 ) {
+		logMessage( LOG_ERROR_LEVEL, "Unable to create event loop [%s]", strerror(errno) );
+		return( -1 );
+	}
+	ev.events = EPOLLIN;
+	ev.data.ptr = NULL; // The listening sockets are the only events without a client
+	if ( epoll_ctl(epollFd, EPOLL_CTL_ADD, listenFd, &ev) == -1 ) {
+		logMessage( LOG_ERROR_LEVEL, "Unable to watch listening socket [%s]", strerror(errno) );
+		return( -1 );
+	}
+
+	// Local clients find the server by port in the abstract namespace, TCP still works if this fails
+	memset(&uaddr, 0, sizeof(uaddr));
+	uaddr.sun_family = AF_UNIX;
+	len = snprintf(&uaddr.sun_path[1], sizeof(uaddr.sun_path)-1, FS3_SHM_SOCKET, port);
+	ev.events = EPOLLIN;
+	ev.data.ptr = &unixFd;
+	if ( ((unixFd = socket(AF_UNIX, SOCK_STREAM|SOCK_NONBLOCK|SOCK_CLOEXEC, 0)) == -1) ||
+			(bind(unixFd, (struct sockaddr *)&uaddr, offsetof(struct sockaddr_un, sun_path)+1+len) == -1) ||
+			(listen(unixFd, FS3_MAX_BACKLOG) == -1) || (epoll_ctl(epollFd, EPOLL_CTL_ADD, unixFd, &ev) == -1) ) {
+		logMessage( LOG_WARNING_LEVEL, "No shared-memory transport, local clients will use TCP [%s]", strerror(errno) );
+		if ( unixFd != -1 ) {
+			close(unixFd);
+			unixFd = -1;
+		}
+	}
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_server_close_client
+// Description  : Drop a client connection and free its state
+//
+// Inputs       : cli - the client
+// Outputs      : none
+
+static void fs3_server_close_client(FS3ServerClient *cli) {
+	FS3ServerClient **link;
+
+	for ( link = &heldClients; cli->held && (*link != NULL); link = &(*link)->nextHeld ) {
+		if ( *link == cli ) {
+			*link = cli->nextHeld;
+			break;
+		}
+	}
+	for ( link = &busyClients; cli->busy && (*link != NULL); link = &(*link)->nextBusy ) {
+		if ( *link == cli ) {
+			*link = cli->nextBusy;
+			break;
+		}
+	}
+	fs3_controller_disconnect(&cli->ses);
+	epoll_ctl(epollFd, EPOLL_CTL_DEL, cli->fd, NULL);
+	close(cli->fd);
+	if ( cli->ring != NULL ) {
+		munmap(cli->ring, sizeof(FS3ShmRing));
+	}
+	free(cli->in);
+	free(cli->out);
+	free(cli);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_server_watch
+// Description  : Update the events the loop waits for on a client, reading
+//                only while its output is not backed up (and no reply is
+//                held) and writing only while there is output left
+//
+// Inputs       : cli - the client
+// Outputs      : 0 if successful, -1 if failure
+
+static int fs3_server_watch(FS3ServerClient *cli) {
+
+	struct epoll_event ev;
+
+	ev.events = 0;
+	if ( (!cli->closing) && (!cli->held) && (cli->outLen - cli->outOff < FS3_SERVER_MAX_OUTPUT) ) {
+		ev.events |= EPOLLIN;
+	}
+	if ( cli->outLen > cli->outOff ) {
+		ev.events |= EPOLLOUT;
+	}
+	if ( ev.events == cli->events ) {
+		return( 0 );
+	}
+	ev.data.ptr = cli;
+	cli->events = ev.events;
+	return( epoll_ctl(epollFd, EPOLL_CTL_MOD, cli->fd, &ev) );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_server_queue
+// Description  : Append reply bytes to a client's output buffer
+//
+// Inputs       : cli - the client
+//                data - the bytes to send
+//                len - the number of bytes
+// Outputs      : 0 if successful, -1 if failure
+
+static int fs3_server_queue(FS3ServerClient *cli, void *data, size_t len) {
+
+	char *grown;
+	size_t cap;
+
+	if ( cli->outOff == cli->outLen ) { // Everything was sent, start over at the front
+		cli->outOff = cli->outLen = 0;
+	}
+	if ( cli->outLen + len > cli->outCap ) {
+		cap = CMPSC311_MAXVAL(cli->outCap * 2, cli->outLen + len);
+		if ( (grown = realloc(cli->out, cap)) == NULL ) {
+			logMessage( LOG_ERROR_LEVEL, "Out of memory queueing a reply" );
+			return( -1 );
+		}
+		cli->out = grown;
+		cli->outCap = cap;
+	}
+	memcpy(&cli->out[cli->outLen], data, len);
+	cli->outLen += len;
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_server_flush
+// Description  : Send as much of a client's output as the socket takes
+//
+// Inputs       : cli - the client
+// Outputs      : 0 if successful, -1 if the connection failed
+
+static int fs3_server_flush(FS3ServerClient *cli) {
+
+	ssize_t sent;
+
+	while ( cli->outOff < cli->outLen ) {
+		sent = send(cli->fd, &cli->out[cli->outOff], cli->outLen - cli->outOff, MSG_NOSIGNAL);
+		if ( sent == -1 ) {
+			if ( errno == EINTR ) {
+				continue;
+			}
+			if ( (errno == EAGAIN) || (errno == EWOULDBLOCK) ) {
+				return( 0 );
+			}
+			logMessage( LOG_ERROR_LEVEL, "Error writing to client [%s]", strerror(errno) );
+			return( -1 );
+		}
+		cli->outOff += sent;
+	}
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_server_receive
+// Description  : Read whatever the client sent and execute every command
+//                that arrived complete, queueing the replies in order
+//
+// Inputs       : cli - the client
+// Outputs      : 0 if successful, -1 if the connection failed
+
+static int fs3_server_receive(FS3ServerClient *cli) {
+
+	FS3CmdBlk cmd, ret;
+	uint8_t op, rt;
+	int16_t sec;
+	int32_t trk;
+	size_t need, payload;
+	ssize_t got;
+	uint32_t hdr = 0;
+	char *data;
+	int packed;
+
+	while ( (!cli->closing) && (!cli->held) && (cli->outLen - cli->outOff < FS3_SERVER_MAX_OUTPUT) ) {
+
+		// Work out how much of the current command is still missing
+		need = sizeof(FS3CmdBlk);
+		payload = 0;
+		packed = (cli->ses.caps & FS3_CAP_COMPRESS) != 0; // Payloads travel in frames
+		if ( cli->inLen >= sizeof(FS3CmdBlk) ) {
+			memcpy(&cmd, cli->in, sizeof(cmd));
+			cmd = ntohll64(cmd);
+			deconstruct_fs3_cmdblock(cmd, &op, &sec, &trk, &rt);
+			if ( FS3_OP_SENDS_SECTOR(op) || FS3_OP_RECVS_SECTOR(op) ) {
+				payload = FS3_OP_PAYLOAD(op, trk);
+				if ( (payload == 0) || (payload > FS3_SERVER_MAX_PAYLOAD) ) {
+					logMessage( LOG_ERROR_LEVEL, "Client sent a bad range [%d sectors], dropping it", FS3_RANGE_COUNT(trk) );
+					return( -1 );
+				}
+			}
+			if ( FS3_OP_SENDS_SECTOR(op) && packed ) { // Header first, it says how much body follows
+				need += FS3_LZ_HDR_SIZE;
+				if ( cli->inLen >= need ) {
+					hdr = fs3_lz_header(&cli->in[sizeof(FS3CmdBlk)]);
+					if ( FS3_LZ_LENGTH(hdr) > payload ) {
+						logMessage( LOG_ERROR_LEVEL, "Client sent a bad payload frame [0x%x], dropping it", hdr );
+						return( -1 );
+					}
+					need += FS3_LZ_LENGTH(hdr);
+				}
+			} else if ( FS3_OP_SENDS_SECTOR(op) ) {
+				need += payload;
+			}
+		}
+
+		if ( cli->inLen < need ) {
+			got = recv(cli->fd, &cli->in[cli->inLen], need - cli->inLen, 0);
+			if ( got == -1 ) {
+				if ( errno == EINTR ) {
+					continue;
+				}
+				if ( (errno == EAGAIN) || (errno == EWOULDBLOCK) ) {
+					return( 0 );
+				}
+				logMessage( LOG_ERROR_LEVEL, "Error reading from client [%s]", strerror(errno) );
+				return( -1 );
+			}
+			if ( got == 0 ) {
+				logMessage( FS3ControllerLLevel, "Client disconnected" );
+				return( -1 );
+			}
+			cli->inLen += got;
+			continue;
+		}
+
+		// The command is complete, execute it and queue the reply (and any sectors read)
+		data = &cli->in[sizeof(FS3CmdBlk)];
+		if ( packed && FS3_OP_SENDS_SECTOR(op) &&
+				(fs3_lz_unframe(hdr, &data[FS3_LZ_HDR_SIZE], fs3ServerPayload, payload) == -1) ) {
+			logMessage( LOG_ERROR_LEVEL, "Client sent a corrupt payload frame, dropping it" );
+			return( -1 );
+		}
+		if ( packed ) {
+			data = fs3ServerPayload;
+		}
+		if ( fs3ServerDelay > 0 ) { // One device, so the wait holds up every client
+			usleep(fs3ServerDelay);
+		}
+		fs3_controller_execute(&cli->ses, cmd, data, &ret);
+		if ( fs3_controller_held(&cli->ses) > 0 ) { // A write that recalled other sessions' copies, answer once they let go
+			cli->inLen = 0;
+			cli->held = 1;
+			cli->heldRet = ret;
+			cli->nextHeld = heldClients;
+			heldClients = cli;
+			return( 0 );
+		}
+		ret = htonll64(ret);
+		if ( fs3_server_queue(cli, &ret, sizeof(ret)) == -1 ) {
+			return( -1 );
+		}
+		if ( FS3_OP_RECVS_SECTOR(op) && packed ) {
+			if ( fs3_server_queue(cli, fs3ServerFrame, fs3_lz_frame(data, payload, fs3ServerFrame)) == -1 ) {
+				return( -1 );
+			}
+		} else if ( FS3_OP_RECVS_SECTOR(op) && (fs3_server_queue(cli, data, payload) == -1) ) {
+			return( -1 );
+		}
+		cli->inLen = 0;
+		if ( op == FS3_OP_UMOUNT ) { // Push the image out and hang up once the reply is sent
+			msync(fs3_controller_disk, FS3_DISK_SIZE, MS_ASYNC);
+			cli->closing = 1;
+		}
+	}
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_server_post
+// Description  : Hand the reply to the oldest command on a local client's
+//                ring back, waking the client if it sleeps on it
+//
+// Inputs       : ring - the client's ring
+// Outputs      : none
+
+static void fs3_server_post(FS3ShmRing *ring) {
+
+	uint32_t head = ring->sqHead;
+
+	ring->sqHead = head + 1;
+	__atomic_store_n(&ring->cqTail, head + 1, __ATOMIC_SEQ_CST);
+	if ( __atomic_load_n(&ring->clientSleeping, __ATOMIC_SEQ_CST) ) {
+		syscall(SYS_futex, &ring->cqTail, FUTEX_WAKE, 1, NULL, NULL, 0);
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_server_busy
+// Description  : Come back to a local client's ring on the next turn of the
+//                loop, its commands didn't all fit in this one
+//
+// Inputs       : cli - the client (with a ring)
+// Outputs      : none
+
+static void fs3_server_busy(FS3ServerClient *cli) {
+	if ( ! cli->busy ) {
+		cli->busy = 1;
+		cli->nextBusy = busyClients;
+		busyClients = cli;
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_server_ring
+// Description  : Execute the commands a local client posted on its shared
+//                ring, polling for more for a while before going back to
+//                sleep until the client kicks the socket. A turn is at most
+//                a ring of commands, a ring still busy after that waits for
+//                the next turn of the loop so the other clients get theirs
+//
+// Inputs       : cli - the client (with a ring)
+// Outputs      : 0 if successful, -1 if the connection failed
+
+static int fs3_server_ring(FS3ServerClient *cli) {
+
+	FS3ShmRing *ring = cli->ring;
+	FS3CmdBlk cmd;
+	uint32_t head, idx;
+	uint8_t op, rt;
+	int16_t sec;
+	int32_t trk;
+	char kick[64];
+	ssize_t got;
+	int spins = 0, done = 0;
+
+	// Drain the kicks, the client closing its socket means it is gone
+	while ( (got = recv(cli->fd, kick, sizeof(kick), 0)) > 0 );
+	if ( (got == 0) || ((errno != EAGAIN) && (errno != EWOULDBLOCK) && (errno != EINTR)) ) {
+		logMessage( FS3ControllerLLevel, "Local client disconnected" );
+		return( -1 );
+	}
+	if ( cli->held ) { // Nothing moves until the held reply goes
+		return( 0 );
+	}
+
+	while ( ! stopServer ) {
+		head = ring->sqHead;
+		if ( done == FS3_SHM_ENTRIES ) { // Let the other clients in, this one goes again next turn
+			fs3_server_busy(cli);
+			return( 0 );
+		}
+		if ( head == __atomic_load_n(&ring->sqTail, __ATOMIC_ACQUIRE) ) {
+			if ( spins++ < FS3_SHM_SPIN ) {
+				continue;
+			}
+			__atomic_store_n(&ring->serverSleeping, 1, __ATOMIC_SEQ_CST); // The next command kicks us
+			if ( head != __atomic_load_n(&ring->sqTail, __ATOMIC_SEQ_CST) ) {
+				fs3_server_busy(cli); // Raced with a command, an extra kick is harmless
+			}
+			return( 0 );
+		}
+
+		// Execute in place, the reply (and any sectors read) go back in the same position
+		idx = head % FS3_SHM_ENTRIES;
+		cmd = ring->sq[idx];
+		deconstruct_fs3_cmdblock(cmd, &op, &sec, &trk, &rt);
+		if ( fs3ServerDelay > 0 ) {
+			usleep(fs3ServerDelay);
+		}
+		fs3_controller_execute(&cli->ses, cmd, ring->slots[idx], &ring->cq[idx]);
+		if ( op == FS3_OP_UMOUNT ) {
+			msync(fs3_controller_disk, FS3_DISK_SIZE, MS_ASYNC);
+		}
+		if ( fs3_controller_held(&cli->ses) > 0 ) { // The reply stays in place until the other sessions let go
+			cli->held = 1;
+			cli->nextHeld = heldClients;
+			heldClients = cli;
+			return( 0 );
+		}
+		fs3_server_post(ring);
+		spins = 0;
+		done ++;
+	}
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_server_accept_local
+// Description  : Accept all pending local clients, each is watched until it
+//                hands over its shared ring
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+static int fs3_server_accept_local(void) {
+
+	FS3ServerClient *cli;
+	struct epoll_event ev;
+	int fd;
+
+	while ( (fd = accept4(unixFd, NULL, NULL, SOCK_NONBLOCK|SOCK_CLOEXEC)) != -1 ) {
+		if ( (cli = calloc(1, sizeof(FS3ServerClient))) == NULL ) {
+			logMessage( LOG_ERROR_LEVEL, "Out of memory accepting a local client" );
+			close(fd);
+			continue;
+		}
+		cli->fd = fd;
+		cli->handshake = 1;
+		cli->events = ev.events = EPOLLIN;
+		ev.data.ptr = cli;
+		if ( epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &ev) == -1 ) {
+			logMessage( LOG_ERROR_LEVEL, "Unable to watch local client [%s]", strerror(errno) );
+			free(cli);
+			close(fd);
+		}
+	}
+	if ( (errno != EAGAIN) && (errno != EWOULDBLOCK) && (errno != EINTR) ) {
+		logMessage( LOG_ERROR_LEVEL, "Error accepting local client [%s]", strerror(errno) );
+		return( -1 );
+	}
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_server_handshake
+// Description  : Map the shared ring a local client sends once it connects,
+//                then tell it the ring is being served
+//
+// Inputs       : cli - the client (still handing over its ring)
+// Outputs      : 0 if successful (or not sent yet), -1 if the client is to be dropped
+
+static int fs3_server_handshake(FS3ServerClient *cli) {
+
+	FS3ShmRing *ring = MAP_FAILED;
+	struct msghdr msg;
+	struct iovec iov;
+	struct cmsghdr *cm;
+	struct stat st;
+	char ctl[CMSG_SPACE(sizeof(int))];
+	uint32_t magic = 0;
+	ssize_t got;
+	int memfd = -1, seals;
+
+	memset(&msg, 0, sizeof(msg));
+	iov.iov_base = &magic;
+	iov.iov_len = sizeof(magic);
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = ctl;
+	msg.msg_controllen = sizeof(ctl);
+	if ( ((got = recvmsg(cli->fd, &msg, MSG_CMSG_CLOEXEC)) == -1) &&
+			((errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == EINTR)) ) {
+		return( 0 );
+	}
+	if ( (got == sizeof(magic)) && (magic == FS3_SHM_MAGIC) &&
+			((cm = CMSG_FIRSTHDR(&msg)) != NULL) && (cm->cmsg_type == SCM_RIGHTS) ) {
+		memcpy(&memfd, CMSG_DATA(cm), sizeof(int));
+	}
+	// Only a ring sealed against shrinking is safe to map, one truncated under us would fault the server
+	if ( (memfd == -1) || ((seals = fcntl(memfd, F_GET_SEALS)) == -1) || (!(seals & F_SEAL_SHRINK)) ||
+			(fstat(memfd, &st) == -1) || ((size_t)st.st_size < sizeof(FS3ShmRing)) ||
+			((ring = mmap(NULL, sizeof(FS3ShmRing), PROT_READ|PROT_WRITE, MAP_SHARED, memfd, 0)) == MAP_FAILED) ||
+			(ring->magic != FS3_SHM_MAGIC) ) {
+		logMessage( LOG_ERROR_LEVEL, "Local client sent a bad ring, dropping it" );
+		if ( ring != MAP_FAILED ) {
+			munmap(ring, sizeof(FS3ShmRing));
+		}
+		if ( memfd != -1 ) {
+			close(memfd);
+		}
+		return( -1 );
+	}
+	close(memfd); // The mapping keeps the region alive
+
+	cli->ring = ring;
+	cli->handshake = 0;
+	if ( send(cli->fd, "a", 1, MSG_NOSIGNAL) != 1 ) {
+		logMessage( LOG_ERROR_LEVEL, "Unable to answer local client [%s]", strerror(errno) );
+		return( -1 );
+	}
+	logMessage( FS3ControllerLLevel, "Local client connected (shared-memory ring)" );
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_server_accept
+// Description  : Accept all pending client connections
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+static int fs3_server_accept(void) {
+
+	FS3ServerClient *cli;
+	struct epoll_event ev;
+	int fd, one = 1;
+
+	while ( (fd = accept4(listenFd, NULL, NULL, SOCK_NONBLOCK)) != -1 ) {
+		setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one)); // Replies are small, don't hold them back
+		if ( ((cli = calloc(1, sizeof(FS3ServerClient))) == NULL) ||
+				((cli->in = malloc(sizeof(FS3CmdBlk) + FS3_LZ_FRAME_MAX(FS3_SERVER_MAX_PAYLOAD))) == NULL) ) {
+			logMessage( LOG_ERROR_LEVEL, "Out of memory accepting a client" );
+			free(cli);
+			close(fd);
+			continue;
+		}
+		cli->fd = fd;
+		cli->events = ev.events = EPOLLIN;
+		ev.data.ptr = cli;
+		if ( epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &ev) == -1 ) {
+			logMessage( LOG_ERROR_LEVEL, "Unable to watch client [%s]", strerror(errno) );
+			free(cli->in);
+			free(cli);
+			close(fd);
+			continue;
+		}
+		logMessage( FS3ControllerLLevel, "Client connected" );
+	}
+	if ( (errno != EAGAIN) && (errno != EWOULDBLOCK) && (errno != EINTR) ) {
+		logMessage( LOG_ERROR_LEVEL, "Error accepting client [%s]", strerror(errno) );
+		return( -1 );
+	}
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_server_release
+// Description  : Send the held replies whose recalls are done (collected,
+//                or the leases ran out), and start reading from those
+//                clients again
+//
+// Inputs       : none
+// Outputs      : none
+
+static void fs3_server_release(void) {
+
+	FS3ServerClient **link = &heldClients, *cli;
+	FS3CmdBlk ret;
+
+	while ( (cli = *link) != NULL ) {
+		if ( fs3_controller_held(&cli->ses) > 0 ) {
+			link = &cli->nextHeld;
+			continue;
+		}
+		*link = cli->nextHeld;
+		cli->held = 0;
+		if ( cli->ring != NULL ) { // Answer in place, then carry on with what it posted since
+			fs3_server_post(cli->ring);
+			if ( fs3_server_ring(cli) == -1 ) {
+				fs3_server_close_client(cli);
+			}
+			continue;
+		}
+		ret = htonll64(cli->heldRet);
+		if ( (fs3_server_queue(cli, &ret, sizeof(ret)) == -1) || (fs3_server_flush(cli) == -1) ||
+				(fs3_server_watch(cli) == -1) ) {
+			fs3_server_close_client(cli);
+		}
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_server_run_busy
+// Description  : Give each ring left with work its next turn, those that
+//                are still busy after it go on the list for the one after
+//
+// Inputs       : none
+// Outputs      : none
+
+static void fs3_server_run_busy(void) {
+
+	FS3ServerClient *cli, *next;
+
+	for ( cli = busyClients, busyClients = NULL; cli != NULL; cli = next ) {
+		next = cli->nextBusy;
+		cli->busy = 0;
+		if ( fs3_server_ring(cli) == -1 ) {
+			fs3_server_close_client(cli);
+		}
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_server_loop
+// Description  : Serve clients until a signal asks the server to stop
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int fs3_server_loop(void) {
+
+	struct epoll_event events[FS3_SERVER_MAX_EVENTS];
+	FS3ServerClient *cli;
+	int n, i, timeout;
+
+	while ( ! stopServer ) {
+		// Don't wait at all while rings have work left over
+		timeout = (busyClients != NULL) ? 0 : ((heldClients != NULL) ? FS3_SERVER_HOLD_TICK : -1);
+		if ( (n = epoll_wait(epollFd, events, FS3_SERVER_MAX_EVENTS, timeout)) == -1 ) {
+			if ( errno == EINTR ) {
+				continue;
+			}
+			logMessage( LOG_ERROR_LEVEL, "Event loop failed [%s]", strerror(errno) );
+			return( -1 );
+		}
+
+		for ( i=0; i<n; i++ ) {
+			if ( (cli = events[i].data.ptr) == NULL ) {
+				fs3_server_accept();
+				continue;
+			}
+			if ( events[i].data.ptr == &unixFd ) {
+				fs3_server_accept_local();
+				continue;
+			}
+			if ( cli->handshake ) { // Local client, its ring comes first
+				if ( fs3_server_handshake(cli) == -1 ) {
+					fs3_server_close_client(cli);
+				}
+				continue;
+			}
+			if ( cli->ring != NULL ) { // Local client, everything goes through its ring
+				if ( fs3_server_ring(cli) == -1 ) {
+					fs3_server_close_client(cli);
+				}
+				continue;
+			}
+
+			// Execute what came in, then send what is ready, then drop finished or broken clients
+			if ( ((events[i].events & (EPOLLIN|EPOLLHUP|EPOLLERR)) && (fs3_server_receive(cli) == -1)) ||
+					(fs3_server_flush(cli) == -1) ||
+					(cli->closing && (cli->outOff == cli->outLen)) ) {
+				fs3_server_close_client(cli);
+				continue;
+			}
+			if ( fs3_server_watch(cli) == -1 ) {
+				fs3_server_close_client(cli);
+			}
+		}
+		fs3_server_release();
+		fs3_server_run_busy();
+	}
+	return( 0 );
+}
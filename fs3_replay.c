@@ -0,0 +1,364 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : fs3_replay.c
+//  Description    : This is the FS3 trace replayer. It makes the calls of a
+//                   trace (see fs3_trace.h) again, through the driver and
+//                   whatever backend it is given, either as fast as they go
+//                   or at the times they were first made, and reports how
+//                   long they took against how long they took when traced.
+//
+//   Author        : Patrick McDaniel
+//   Last Modified : Mon 19 Oct 2026 04:08:12 AM UTC
+//
+
+// Include Files
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+// Project Includes
+#include <fs3_driver.h>
+#include <fs3_controller.h>
+#include <fs3_common.h>
+#include <fs3_cache.h>
+#include <fs3_network.h>
+#include <fs3_trace.h>
+#include <cmpsc311_log.h>
+#include <cmpsc311_util.h>
+
+// Defines
+#define FS3_REPLAY_ARGUMENTS "htvc:w:a:b:l:i:p:"
+#define USAGE \
+	"USAGE: fs3_replay [-h] [-t] [-v] [-c <cache size>] [-w <window>] [-a <sectors>] [-b <backend>] [-l <logfile>]\n" \
+	"                  [-i <ip>] [-p <port>] <trace-file>\n" \
+	"\n" \
+	"where:\n" \
+	"    -h - help mode (display this message)\n" \
+	"    -t - make each call at the time it was made in the trace (default is as fast as they go)\n" \
+	"    -v - verbose output\n" \
+	"    -c - set the cache size (in number of sectors)\n" \
+	"    -w - keep up to <window> network commands in flight (2-64)\n" \
+	"    -a - read ahead <sectors> sectors after every read\n" \
+	"    -b - send commands to <backend>: tcp, uring, shm or inproc (as fs3_sim)\n" \
+	"    -l - write log messages to the filename <logfile>\n" \
+	"    -i - IP address of server to connect to.\n" \
+	"    -p - port number of server to connect to.\n" \
+	"\n" \
+	"    <trace-file> - a trace recorded by the driver (fs3_sim -T, or fs3_trace_start)\n" \
+	"\n" \
+
+//
+// Global Data
+uint16_t fs3ReplayCache = FS3_DEFAULT_CACHE_SIZE;  // Cache lines
+int fs3ReplayTimed = 0;                           // Keep the trace's timing
+
+//
+// Functional Prototypes
+
+int replay_trace(char *tfile);          // Replay a trace
+unsigned long replay_now(void);         // Read the clock
+
+//
+// Functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : main
+// Description  : The main function for the FS3 trace replayer
+//
+// Inputs       : argc - the number of command line parameters
+//                argv - the parameters
+// Outputs      : 0 if successful, -1 if failure
+
+int main( int argc, char *argv[] ) {
+
+	// Local variables
+	int ch, verbose = 0, log_initialized = 0;
+
+	// Process the command line parameters
+	while ((ch = getopt(argc, argv, FS3_REPLAY_ARGUMENTS)) != -1) {
+
+		switch (ch) {
+		case 'h': // Help, print usage
+			fprintf( stderr, USAGE );
+			return( -1 );
+
+		case 't': // Keep the trace's timing
+			fs3ReplayTimed = 1;
+			break;
+
+		case 'v': // Verbose Flag
+			verbose = 1;
+			break;
+
+		case 'l': // Set the log filename
+			initializeLogWithFilename( optarg );
+			log_initialized = 1;
+			break;
+
+		case 'c': // Set the cache size
+			if ( sscanf(optarg, "%hu", &fs3ReplayCache) != 1) {
+				logMessage(LOG_ERROR_LEVEL, "Failed parsing cache size [%s]", optarg);
+				return(-1);
+			}
+			break;
+
+		case 'w': // Set the network window
+			if ( (sscanf(optarg, "%d", &fs3_network_window) != 1) || (fs3_network_window < 2) ||
+					(fs3_network_window > FS3_NET_MAX_WINDOW) ) {
+				logMessage(LOG_ERROR_LEVEL, "Bad network window [%s]", optarg);
+				return(-1);
+			}
+			break;
+
+		case 'a': // Set the read ahead
+			if ( (sscanf(optarg, "%d", &fs3_readahead) != 1) || (fs3_readahead < 0) ) {
+				logMessage(LOG_ERROR_LEVEL, "Bad read ahead [%s]", optarg);
+				return(-1);
+			}
+			break;
+
+		case 'b': // Select the network backend
+			if ( network_fs3_set_backend(optarg) == -1 ) {
+				return(-1);
+			}
+			break;
+
+		case 'i': // Get the IP address
+			if (inet_addr(optarg) == INADDR_NONE) {
+				logMessage( LOG_ERROR_LEVEL, "Bad IP address [%s]", optarg );
+				return(-1);
+			}
+			fs3_network_address = (unsigned char *)strdup(optarg);
+			break;
+
+		case 'p': // Set the network port number
+			if ( sscanf(optarg, "%hu", &fs3_network_port) != 1 ) {
+				logMessage( LOG_ERROR_LEVEL, "Bad  port number [%s]", optarg );
+				return(-1);
+			}
+			break;
+
+		default:  // Default (unknown)
+			fprintf( stderr, "Unknown command line option (%c), aborting.\n", ch );
+			return( -1 );
+		}
+	}
+
+	// Setup the log as needed
+	if ( ! log_initialized ) {
+		initializeLogWithFilehandle( CMPSC311_LOG_STDERR );
+	}
+	FS3ControllerLLevel = registerLogLevel("FS3_CONTROLLER", 0); // Controller log level
+	FS3DriverLLevel= registerLogLevel("FS3_DRIVER", 0);          // Driver log level
+	FS3SimulatorLLevel= registerLogLevel("FS3_SIMULATOR", 0);    // Replay log level
+	if ( verbose ) {
+		enableLogLevels(FS3ControllerLLevel | FS3DriverLLevel | FS3SimulatorLLevel);
+	}
+
+	// The trace should be the next option
+	if ( optind >= argc ) {
+		fprintf( stderr, "Missing command line parameters, use -h to see usage, aborting.\n" );
+		return( -1 );
+	}
+	if ( replay_trace(argv[optind]) == -1 ) {
+		logMessage( LOG_ERROR_LEVEL, "FS3 trace replay failed." );
+		return( -1 );
+	}
+
+	// Return successfully
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : replay_trace
+// Description  : Make the calls of a trace again and report on them. The
+//                handles the trace's opens returned are mapped to the ones
+//                the replayed opens return; writes carry filler of the
+//                traced length (the trace doesn't keep the data).
+//
+// Inputs       : tfile - the trace file
+// Outputs      : 0 if successful, -1 if failure
+
+int replay_trace(char *tfile) {
+
+	// Local variables
+	int16_t fds[FS3_MAX_TOTAL_FILES];
+	unsigned long count[FS3_TRACE_OPS], took[FS3_TRACE_OPS], traced[FS3_TRACE_OPS];
+	unsigned long start, target, t0, t1, lag = 0, worst = 0, late = 0, calls = 0, skipped = 0, differ = 0, span = 0;
+	unsigned long bytes[FS3_TRACE_OPS];
+	char *data, *pos, *end, *buf = NULL, path[256];
+	size_t bufsize = 0;
+	struct timespec ts;
+	struct stat stats;
+	FS3TraceRecord *rec;
+	FS3TraceHeader *hdr;
+	int32_t ret;
+	int fd, i;
+
+	// Map the trace and check it
+	if ( ((fd=open(tfile, O_RDONLY)) == -1) || (fstat(fd, &stats) == -1) ) {
+		logMessage( LOG_ERROR_LEVEL, "Failure opening the trace file [%s], error: %s.", tfile, strerror(errno) );
+		return( -1 );
+	}
+	if ( (stats.st_size < sizeof(FS3TraceHeader)) ||
+			((data = mmap(NULL, stats.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED) ) {
+		logMessage( LOG_ERROR_LEVEL, "Failure mapping the trace file [%s].", tfile );
+		close( fd );
+		return( -1 );
+	}
+	close( fd );
+	hdr = (FS3TraceHeader *)data;
+	if ( (hdr->magic != FS3_TRACE_MAGIC) || (hdr->version != FS3_TRACE_VERSION) ) {
+		logMessage( LOG_ERROR_LEVEL, "File [%s] is not an FS3 trace.", tfile );
+		munmap( data, stats.st_size );
+		return( -1 );
+	}
+	pos = data + sizeof(FS3TraceHeader);
+	end = data + stats.st_size;
+
+	// Startup the interface
+	if ( (fs3_mount_disk() == -1) || (fs3_init_cache(fs3ReplayCache) == -1) ) {
+		logMessage( LOG_ERROR_LEVEL, "FS3 replay failed initialization.");
+		munmap( data, stats.st_size );
+		return( -1 );
+	}
+	memset(fds, 0xff, sizeof(fds));
+	memset(count, 0x0, sizeof(count));
+	memset(took, 0x0, sizeof(took));
+	memset(traced, 0x0, sizeof(traced));
+	memset(bytes, 0x0, sizeof(bytes));
+
+	// Make each call, waiting for its time if asked to
+	start = replay_now();
+	while ( pos < end ) {
+		rec = (FS3TraceRecord *)pos;
+		if ( (end - pos < sizeof(FS3TraceRecord)) || (end - pos < FS3_TRACE_RECORD_SIZE(rec)) || (rec->op >= FS3_TRACE_OPS) ) {
+			logMessage( LOG_WARNING_LEVEL, "Trace [%s] ends in a partial record, replaying what came before.", tfile );
+			break;
+		}
+		pos += FS3_TRACE_RECORD_SIZE(rec);
+		if ( (rec->op != FS3_TRACE_OPEN) && ((rec->fd < 0) || (rec->fd >= FS3_MAX_TOTAL_FILES) || (fds[rec->fd] == -1)) ) {
+			skipped ++;  // The trace started after the file was opened (or the open failed)
+			continue;
+		}
+		if ( (rec->op == FS3_TRACE_READ) || (rec->op == FS3_TRACE_WRITE) ) {
+			if ( rec->arg > bufsize ) {
+				bufsize = rec->arg;
+				buf = realloc(buf, bufsize);
+				CMPSC311_ASSERT0(buf != NULL, "Out of memory for the replay buffer");
+				memset(buf, 'x', bufsize);
+			}
+		}
+
+		if ( fs3ReplayTimed ) {
+			target = start + rec->nsecs;
+			if ( (t0 = replay_now()) < target ) {
+				ts.tv_sec = target / 1000000000UL;
+				ts.tv_nsec = target % 1000000000UL;
+				clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+			} else {
+				lag += t0 - target;
+				worst = CMPSC311_MAXVAL(worst, t0 - target);
+				late ++;
+			}
+		}
+
+		t0 = replay_now();
+		switch (rec->op) {
+		case FS3_TRACE_OPEN:
+			snprintf(path, sizeof(path), "%.*s", rec->namelen, (char *)(rec + 1));
+			ret = fs3_open(path);
+			if ( (rec->result >= 0) && (rec->result < FS3_MAX_TOTAL_FILES) ) {
+				fds[rec->result] = ret;
+			}
+			break;
+
+		case FS3_TRACE_CLOSE:
+			ret = fs3_close(fds[rec->fd]);
+			fds[rec->fd] = -1;
+			break;
+
+		case FS3_TRACE_READ:
+			ret = fs3_read(fds[rec->fd], buf, rec->arg);
+			break;
+
+		case FS3_TRACE_WRITE:
+			ret = fs3_write(fds[rec->fd], buf, rec->arg);
+			break;
+
+		default:
+			ret = fs3_seek(fds[rec->fd], rec->arg);
+			break;
+		}
+		t1 = replay_now();
+
+		// Tally it up against the trace
+		count[rec->op] ++;
+		took[rec->op] += t1 - t0;
+		traced[rec->op] += rec->took;
+		bytes[rec->op] += (ret > 0) ? ret : 0;
+		span = rec->nsecs + rec->took;
+		calls ++;
+		if ( ((rec->op == FS3_TRACE_OPEN) && ((ret == -1) != (rec->result == -1))) ||
+				((rec->op != FS3_TRACE_OPEN) && (ret != rec->result)) ) {
+			logMessage( FS3SimulatorLLevel, "Replayed %s of file %d returned %d, traced %d", fs3_trace_ops[rec->op],
+					rec->fd, ret, rec->result );
+			differ ++;
+		}
+	}
+	t1 = replay_now() - start;
+
+	// Say how it went
+	printf("** FS3 trace replay **\n");
+	printf("Calls replayed   [    %lu in %.3f secs, %.0f calls/s (%s)]\n", calls, t1 / 1e9, (t1 > 0) ? calls * 1e9 / t1 : 0,
+			(fs3ReplayTimed) ? "trace timing" : "as fast as possible");
+	printf("Traced span      [    %.3f secs]\n", span / 1e9);
+	if ( fs3ReplayTimed ) {
+		printf("Calls late       [    %lu, average %.1f usecs, worst %.1f usecs]\n", late, (late) ? lag / 1e3 / late : 0, worst / 1e3);
+	}
+	printf("Bytes            [    %lu read, %lu written]\n", bytes[FS3_TRACE_READ], bytes[FS3_TRACE_WRITE]);
+	printf("Calls skipped    [    %lu]\n", skipped);
+	printf("Results differ   [    %lu]\n", differ);
+	for (i=0; i<FS3_TRACE_OPS; i++) {
+		printf("Call [%-5s]     count [%8lu] latency avg [%8.1f] traced avg [%8.1f] usecs\n", fs3_trace_ops[i], count[i],
+				(count[i]) ? took[i] / 1e3 / count[i] : 0, (count[i]) ? traced[i] / 1e3 / count[i] : 0);
+	}
+
+	// Log cache metrics, shut down the interface
+	free(buf);
+	munmap( data, stats.st_size );
+	if ( (fs3_log_cache_metrics() == -1) || (network_fs3_log_metrics() == -1) ||
+			(fs3_unmount_disk() == -1) || (fs3_close_cache() == -1) ) {
+		logMessage( LOG_ERROR_LEVEL, "FS3 replay failed shutdown.");
+		return( -1 );
+	}
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : replay_now
+// Description  : Read the monotonic clock
+//
+// Inputs       : none
+// Outputs      : the time in nsecs
+
+unsigned long replay_now(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return( ts.tv_sec * 1000000000UL + ts.tv_nsec );
+}
@@ -0,0 +1,276 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : fs3_shm.c
+//  Description    : This is the shared-memory transport for the FS3 network
+//                   layer, used when the server runs on the same host.
+//                   Commands and sectors go through a memfd shared with the
+//                   server (see fs3_shm.h) instead of TCP loopback; the
+//                   client kicks a sleeping server with a byte on the unix
+//                   socket and sleeps on a futex when its reply is not in.
+//
+//  Author         : Patrick McDaniel
+//  Last Modified  : Mon 19 Oct 2026 04:35:41 AM UTC
+//
+
+// Includes
+#define _GNU_SOURCE // memfd_create
+#include <stdio.h>
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/un.h>
+#include <linux/futex.h>
+#include <cmpsc311_log.h>
+
+// Project Includes
+#include <fs3_network.h>
+#include <fs3_common.h>
+#include <fs3_shm.h>
+
+//
+// Global data
+FS3ShmRing *shmRing = NULL; // The region shared with the server
+int shmSock = -1;           // Unix socket to the server (kicks, and it closing means the peer is gone)
+int shmFd = -1;             // The memfd behind the region
+
+unsigned long shmKicks;     // Metrics: times the server had to be woken
+unsigned long shmSleeps;    // Metrics: times the client slept on a reply
+
+static int fs3_shm_open(int conn);
+static int fs3_shm_send(FS3NetPending *pend);
+static int fs3_shm_recv(FS3NetPending *pend);
+static void fs3_shm_close(int conn);
+static int fs3_shm_ready(uint32_t conns);
+static int fs3_shm_log_metrics(void);
+
+FS3NetBackend fs3_shm_backend = {"shm", 1, fs3_shm_open, fs3_shm_send, fs3_shm_recv,
+                                 fs3_shm_close, fs3_shm_ready, fs3_shm_log_metrics, 0};
+
+//
+// Implementation
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_shm_open
+// Description  : Create the shared region and hand it to the server
+//
+// Inputs       : conn - the slot of the connection (only one is offered)
+// Outputs      : 0 if successful, -1 if failure (no co-located server)
+
+static int fs3_shm_open(int conn)
+{
+    struct sockaddr_un addr;
+    struct msghdr msg;
+    struct iovec iov;
+    struct cmsghdr *cm;
+    char ctl[CMSG_SPACE(sizeof(int))];
+    uint32_t magic = FS3_SHM_MAGIC;
+    char ack;
+    int len;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    len = snprintf(&addr.sun_path[1], sizeof(addr.sun_path) - 1, FS3_SHM_SOCKET, // Abstract name, no file to clean up
+                   (fs3_network_port != 0) ? fs3_network_port : FS3_DEFAULT_PORT);
+    if (((shmSock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) == -1) ||
+        (connect(shmSock, (struct sockaddr *)&addr, offsetof(struct sockaddr_un, sun_path) + 1 + len) == -1))
+    {
+        fs3_shm_close(conn); // Nobody local to talk to
+        return (-1);
+    }
+
+    if (((shmFd = memfd_create("fs3-shm", MFD_CLOEXEC | MFD_ALLOW_SEALING)) == -1) || (ftruncate(shmFd, sizeof(FS3ShmRing)) == -1) ||
+        (fcntl(shmFd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW) == -1) || // The server refuses a ring that could shrink under it
+        ((shmRing = mmap(NULL, sizeof(FS3ShmRing), PROT_READ | PROT_WRITE, MAP_SHARED, shmFd, 0)) == MAP_FAILED))
+    {
+        logMessage(LOG_ERROR_LEVEL, "Unable to create the shared ring [%s]", strerror(errno));
+        shmRing = NULL;
+        fs3_shm_close(conn);
+        return (-1);
+    }
+    shmRing->magic = FS3_SHM_MAGIC;
+    shmRing->serverSleeping = 1; // The server is waiting in its event loop until the first kick
+
+    // Pass the memfd along with the magic, the server answers once it has it mapped
+    memset(&msg, 0, sizeof(msg));
+    iov.iov_base = &magic;
+    iov.iov_len = sizeof(magic);
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = ctl;
+    msg.msg_controllen = sizeof(ctl);
+    cm = CMSG_FIRSTHDR(&msg);
+    cm->cmsg_level = SOL_SOCKET;
+    cm->cmsg_type = SCM_RIGHTS;
+    cm->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cm), &shmFd, sizeof(int));
+    if ((sendmsg(shmSock, &msg, 0) != sizeof(magic)) || (read(shmSock, &ack, 1) != 1))
+    {
+        logMessage(LOG_WARNING_LEVEL, "FS3 server did not take the shared ring");
+        fs3_shm_close(conn);
+        return (-1);
+    }
+    logMessage(FS3DriverLLevel, "FS3 network using the shared-memory ring");
+    return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_shm_send
+// Description  : Post a command (and its payload) on the command ring,
+//                kicking the server if it went to sleep
+//
+// Inputs       : pend - the command being sent
+// Outputs      : 0 if successful, -1 if failure
+
+static int fs3_shm_send(FS3NetPending *pend)
+{
+    uint8_t op;
+    int16_t sec;
+    int32_t trk;
+    uint8_t Cret;
+    uint32_t tail = shmRing->sqTail;
+    uint32_t idx = tail % FS3_SHM_ENTRIES;
+
+    if (tail - shmRing->cqHead >= FS3_SHM_ENTRIES) // In flight is at most FS3_NET_RING, so this is a bug
+    {
+        logMessage(LOG_ERROR_LEVEL, "FS3 shared ring overflow");
+        return (-1);
+    }
+    deconstruct_fs3_cmdblock(pend->cmd, &op, &sec, &trk, &Cret);
+    shmRing->sq[idx] = pend->cmd;
+    if (FS3_OP_SENDS_SECTOR(op))
+    {
+        memcpy(shmRing->slots[idx], pend->buf, FS3_OP_PAYLOAD(op, trk));
+    }
+    __atomic_store_n(&shmRing->sqTail, tail + 1, __ATOMIC_SEQ_CST);
+
+    if (__atomic_exchange_n(&shmRing->serverSleeping, 0, __ATOMIC_SEQ_CST)) // One kick per sleep is enough
+    {
+        shmKicks++;
+        if (write(shmSock, "k", 1) != 1)
+        {
+            logMessage(LOG_ERROR_LEVEL, "FS3 server went away [%s]", strerror(errno));
+            return (-1);
+        }
+    }
+    return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_shm_recv
+// Description  : Take the reply to the oldest command off the completion
+//                ring, spinning briefly and then sleeping on the futex
+//
+// Inputs       : pend - the oldest command in flight
+// Outputs      : 0 if successful, -1 if failure
+
+static int fs3_shm_recv(FS3NetPending *pend)
+{
+    uint8_t op;
+    int16_t sec;
+    int32_t trk;
+    uint8_t Cret;
+    uint32_t head = shmRing->cqHead;
+    uint32_t tail;
+    uint32_t idx = head % FS3_SHM_ENTRIES;
+    struct timespec tmo = {0, 100 * 1000 * 1000};
+    struct pollfd pfd;
+    int spins = 0;
+
+    while ((tail = __atomic_load_n(&shmRing->cqTail, __ATOMIC_ACQUIRE)) == head)
+    {
+        if (spins++ < FS3_SHM_SPIN)
+        {
+            continue;
+        }
+        __atomic_store_n(&shmRing->clientSleeping, 1, __ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&shmRing->cqTail, __ATOMIC_SEQ_CST) == head) // Sleep unless the reply slipped in
+        {
+            shmSleeps++;
+            syscall(SYS_futex, &shmRing->cqTail, FUTEX_WAIT, head, &tmo, NULL, 0);
+        }
+        __atomic_store_n(&shmRing->clientSleeping, 0, __ATOMIC_SEQ_CST);
+
+        pfd.fd = shmSock; // Still nothing after a timeout, make sure the server is alive
+        pfd.events = POLLRDHUP;
+        if ((poll(&pfd, 1, 0) == 1) && (pfd.revents & (POLLRDHUP | POLLHUP | POLLERR)))
+        {
+            logMessage(LOG_ERROR_LEVEL, "FS3 server went away");
+            return (-1);
+        }
+    }
+
+    deconstruct_fs3_cmdblock(pend->cmd, &op, &sec, &trk, &Cret);
+    pend->ret = shmRing->cq[idx];
+    if (FS3_OP_RECVS_SECTOR(op))
+    {
+        memcpy(pend->buf, shmRing->slots[idx], FS3_OP_PAYLOAD(op, trk));
+    }
+    __atomic_store_n(&shmRing->cqHead, head + 1, __ATOMIC_RELEASE);
+    return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_shm_ready
+// Description  : Pick the connection to collect a reply from; there is only one
+//
+// Inputs       : conns - bit mask of the connections with commands in flight
+// Outputs      : the connection
+
+static int fs3_shm_ready(uint32_t conns)
+{
+    return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_shm_close
+// Description  : Let go of the shared region, the server notices the socket
+//                closing and drops its side
+//
+// Inputs       : conn - the slot of the connection
+// Outputs      : none
+
+static void fs3_shm_close(int conn)
+{
+    if (shmRing != NULL)
+    {
+        munmap(shmRing, sizeof(FS3ShmRing));
+        shmRing = NULL;
+    }
+    if (shmFd != -1)
+    {
+        close(shmFd);
+        shmFd = -1;
+    }
+    if (shmSock != -1)
+    {
+        close(shmSock);
+        shmSock = -1;
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_shm_log_metrics
+// Description  : Log how often either side had to be woken
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+static int fs3_shm_log_metrics(void)
+{
+    printf("Server kicks     [    %lu]\n", shmKicks);
+    printf("Client sleeps    [    %lu]\n", shmSleeps);
+    return (0);
+}
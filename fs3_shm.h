@@ -0,0 +1,48 @@
+#ifndef FS3_SHM_INCLUDED
+#define FS3_SHM_INCLUDED
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File          : fs3_shm.h
+//  Description   : This is the layout of the shared-memory transport used
+//                  between an FS3 client and a server on the same host. The
+//                  client creates a memfd holding a command ring, a
+//                  completion ring and one payload slot per ring entry, and
+//                  hands it to the server over a unix socket.
+//
+//  Author        : Patrick McDaniel
+//  Last Modified : Mon 19 Oct 2026 04:35:41 AM UTC
+//
+
+// Include Files
+#include <stdint.h>
+
+// Project Include Files
+#include <fs3_controller.h>
+#include <fs3_network.h>
+
+// Defines
+#define FS3_SHM_ENTRIES FS3_NET_RING                        // Entries in each ring (the most commands in flight, with lease recalls)
+#define FS3_SHM_SLOT_SIZE (FS3_MAX_RANGE * FS3_SECTOR_SIZE) // Payload slot of each entry
+#define FS3_SHM_MAGIC 0x46533353                            // "FS3S", sent with the memfd
+#define FS3_SHM_SOCKET "fs3_refserver.%u"                   // Abstract unix socket of the server on a port
+#define FS3_SHM_SPIN 4000                                   // Polls of the ring before going to sleep
+
+// The shared region. Command i (sq[i % FS3_SHM_ENTRIES]) carries its payload
+// in slots[i % FS3_SHM_ENTRIES], and its reply comes back in the same
+// position of the completion ring (the server answers in order). Each index
+// sits on its own cache line so producer and consumer don't false share.
+typedef struct {
+	uint32_t  magic;                                        // FS3_SHM_MAGIC once set up
+	uint32_t  sqHead __attribute__((aligned(64)));          // Next command the server takes
+	uint32_t  sqTail __attribute__((aligned(64)));          // Next command the client posts
+	uint32_t  cqHead __attribute__((aligned(64)));          // Next reply the client takes
+	uint32_t  cqTail __attribute__((aligned(64)));          // Next reply the server posts (futex word)
+	uint32_t  serverSleeping __attribute__((aligned(64)));  // Server waits for a kick on the socket
+	uint32_t  clientSleeping __attribute__((aligned(64)));  // Client waits on the cqTail futex
+	FS3CmdBlk sq[FS3_SHM_ENTRIES] __attribute__((aligned(64)));
+	FS3CmdBlk cq[FS3_SHM_ENTRIES] __attribute__((aligned(64)));
+	char      slots[FS3_SHM_ENTRIES][FS3_SHM_SLOT_SIZE] __attribute__((aligned(4096)));
+} FS3ShmRing;
+
+#endif
@@ -5,7 +5,7 @@
 //                   assignment #2 (beginning of FS3 interface).
 //
 //   Author        : Patrick McDaniel
-//   Last Modified : Wed 15 Sep 2021 01:47:31 PM EDT
+//   Last Modified : Mon 19 Oct 2026 04:18:55 AM UTC
 //
 
 // Include Files
@@ -17,34 +17,71 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <sys/mman.h>
+#include <time.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
+#include <pthread.h>
+#include <gcrypt.h>
 // Project Includes
 #include <fs3_driver.h>
 #include <fs3_controller.h>
 #include <fs3_common.h>
 #include <fs3_cache.h>
 #include <fs3_network.h>
+#include <fs3_inproc.h>
+#include <fs3_workload.h>
+#include <fs3_trace.h>
 #include <cmpsc311_log.h>
 #include <cmpsc311_util.h>
 
 // Defines
 #define FS3_WORKLOAD_DIR "workload"
 #define FS3_SIM_MAX_OPEN_FILES 256
-#define FS3_ARGUMENTS "hvc:l:i:p:"
+#define FS3_SIM_MAX_JOBS 64
+#define FS3_SIM_PARSE_BATCH 4096
+#define FS3_SIM_HASH_JOBS 4
+#define FS3_ARGUMENTS "hvc:l:i:p:L:C:d:q:w:a:b:m:n:Fzs:r:R:t:kS:j:T:"
 #define USAGE \
-	"USAGE: fs3_sim [-h] [-v] [-c <cache size>] [-l <logfile>] <workload-file>\n" \
+	"USAGE: fs3_sim [-h] [-v] [-c <cache size>] [-L <l2 file>] [-C <l2 size>] [-S <name>] [-q <quota>] [-w <window>] [-a <sectors>] [-d <usecs>] [-b <backend>] [-m <model>] [-n <conns>] [-F] [-z] [-s <sectors>] [-r <replicas>] [-R <passes>] [-t <tracks>] [-k] [-j <threads>] [-T <trace file>] [-l <logfile>] [-i <ip>] [-p <port>] <workload-file>\n" \
 	"\n" \
 	"where:\n" \
 	"    -h - help mode (display this message)\n" \
 	"    -v - verbose output\n" \
 	"    -c - set the cache size (in number of sectors)\n" \
+	"    -L - spill sectors evicted from the cache into the L2 file <l2 file>\n" \
+	"    -C - set the L2 cache size (in number of sectors)\n" \
+	"    -S - share the cache with the other clients on this host through the shared-memory segment <name>, made\n" \
+	"         with the -c size by the first one and kept after they exit (no -L, -q or -k with it)\n" \
+	"    -q - limit each file to <quota> cache lines\n" \
+	"    -w - keep up to <window> network commands in flight (2-64)\n" \
+	"    -a - read ahead <sectors> sectors after every read\n" \
+	"    -d - inject a delay of <usecs> into every network round trip\n" \
+	"    -b - send commands to <backend>: tcp, uring (tcp through io_uring), shm (shared-memory ring to a server on this host)\n" \
+	"         or inproc (controller in this process); default is shm when the server is local and takes it, else tcp\n" \
+	"    -m - inproc latency model <rtt>,<seek>,<xfer> in usecs (default 100,20,10)\n" \
+	"    -n - open <conns> connections to each server when it can share the mount (1-8 in all)\n" \
+	"    -F - spread commands over the connections by file instead of by track\n" \
+	"    -z - compress sector payloads on the wire when the server supports it (tcp)\n" \
+	"    -s - stripe the disk over the servers <sectors> sectors at a time (divides 1024, default 64)\n" \
+	"    -r - keep <replicas> copies of every stripe on as many servers (the servers given, in groups of <replicas>,\n" \
+	"         the first of each group is the primary); reads go to the least loaded copy\n" \
+	"    -R - after the workload, read every file back from the servers <passes> times with a cold cache and\n" \
+	"         report the read throughput\n" \
+	"    -t - tier the disk over two servers: the first is fast and keeps the hottest <tracks> tracks of data, the\n" \
+	"         second is slow and holds the rest; data moves between them in the background as it warms and cools\n" \
+	"    -k - keep the cache coherent with other clients of the server through a lease (one server, one connection)\n" \
+	"    -j - replay the workload on <threads> threads, each taking whole files (the commands of a file stay in\n" \
+	"         order), and report the ops/s and each thread's latency\n" \
+	"    -T - record every open, close, read, write and seek into <trace file>, for fs3_replay\n" \
 	"    -l - write log messages to the filename <logfile>\n" \
     "    -i - IP address of server to connect to.\n" \
     "    -p - port number of server to connect to.\n" \
+    "         Repeat -i and/or -p (up to 4 servers) to stripe the disk over several servers,\n" \
+    "         a server missing one of them takes the last one given\n" \
 	"\n" \
-	"    <workload-file> - file contain the workload to simulate\n" \
+	"    <workload-file> - file contain the workload to simulate, text or compiled by fs3_compile_workload\n" \
 	"\n" \
 
 // This is the file table
@@ -53,16 +90,75 @@ typedef struct {
 	int16_t   fhandle;   // This is a file handle for the opened file
 } FS3SimulationTable;
 
+// The commands of one file, replayed in order by one thread
+typedef struct {
+	FS3WorkloadOp *ops; // The commands on the file
+	int       count;     // Commands in the stream
+	int       size;      // Commands allocated
+} FS3SimulationStream;
+
+// What one replay thread did
+typedef struct {
+	pthread_t      thread;   // The thread
+	int            files;    // Streams it replayed
+	unsigned long  ops;      // Commands it ran
+	unsigned long  latency;  // Total time of its commands, nsecs
+	unsigned long  waited;   // Of that, time waiting for the driver, nsecs
+	unsigned long  worst;    // Longest command, nsecs
+} FS3SimulationWorker;
+
+// A workload file's source, read and hashed off the main thread for validation
+typedef struct {
+	char          *data;     // The contents of the source file
+	off_t          size;     // Its length
+	unsigned char  want[FS3_CHECKSUM_SIZE]; // Checksum of the source
+	unsigned char  have[FS3_CHECKSUM_SIZE]; // Checksum the servers gave for the FS3 file
+	int            hashed;   // 1 if want was computed, -1 if the source couldn't be read
+	int            served;   // 1 if have was computed
+} FS3SimulationSource;
+
 //
 // Global Data
 int verbose;
 uint16_t fs3CacheSize = FS3_DEFAULT_CACHE_SIZE; 
+char *fs3L2CacheFile = NULL;
+char *fs3SharedCache = NULL;
+char *fs3TraceFile = NULL;
+uint32_t fs3L2CacheSize = FS3_DEFAULT_L2_CACHE_SIZE;
+int fs3FileQuota = 0;
+int fs3ReadPasses = 0;
+int fs3SimJobs = 0;
+unsigned long fs3SimParseNs;    // Time spent parsing the workload, nsecs
+unsigned long fs3SimParseBytes; // Workload bytes parsed
+unsigned long fs3SimReplayNs;   // Time spent running the commands in FS3, nsecs
+unsigned long fs3SimReplayOps;  // Commands run
+char *fs3SimCompiled = NULL;   // The compiled workload being replayed, NULL for text
+int fs3SimFileSlots[FS3_WL_MAX_FILES]; // File table slot of each compiled workload file, -1 until opened
+
+// Threaded replay (-j), the driver keeps global state so one thread at a time is in it
+pthread_mutex_t fs3SimDriver = PTHREAD_MUTEX_INITIALIZER;
+FS3SimulationTable *fs3SimTable;
+FS3SimulationStream fs3SimStreams[FS3_SIM_MAX_OPEN_FILES];
+int fs3SimNextStream;
+int fs3SimFailed;
+
+// Validation, the source files are hashed while the servers hash the FS3 files
+FS3SimulationSource fs3SimSources[FS3_SIM_MAX_OPEN_FILES];
+int fs3SimNextSource;
 
 //
 // Functional Prototypes
 
 int simulate_FS3( char *wload );              // control loop of the FS3 simulation
-int validate_file(char *fname, int16_t mfh);  // Validate a file in the filesystem
+int validate_file(char *fname, int16_t mfh, FS3SimulationSource *src); // Validate a file in the filesystem
+int validate_files(FS3SimulationTable *ftable); // Validate every file of the workload
+void *hash_worker(void *arg);                 // Read and hash source files on one thread
+int benchmark_reads(FS3SimulationTable *ftable, int passes); // Time reading the files back
+int replay_file(FS3SimulationTable *ftable, FS3WorkloadOp *op); // Find (or open) a workload file
+int parse_batch(char **pos, char *end, FS3WorkloadOp *ops, int *linecount); // Parse the next batch of lines
+int replay_op(FS3SimulationTable *ftable, int idx, FS3WorkloadOp *op); // Run one workload command
+int replay_threads(char *pos, char *end, FS3SimulationTable *ftable, int jobs); // Replay the workload on threads
+void *replay_worker(void *arg);               // Replay files on one thread
 
 //
 // Functions
@@ -79,7 +175,9 @@ int validate_file(char *fname, int16_t mfh);  // Validate a file in the filesyst
 int main( int argc, char *argv[] ) {
 
 	// Local variables
-	int ch, verbose = 0, log_initialized = 0;
+	int ch, verbose = 0, log_initialized = 0, naddrs = 0, nports = 0, i;
+	char *addrs[FS3_NET_MAX_SERVERS];
+	unsigned short ports[FS3_NET_MAX_SERVERS];
 
 	// Process the command line parameters
 	while ((ch = getopt(argc, argv, FS3_ARGUMENTS)) != -1) {
@@ -105,16 +203,142 @@ int main( int argc, char *argv[] ) {
 			}
 			break;
 
-		case 'i': // Get the IP address
+		case 'L': // Set the L2 cache file
+			fs3L2CacheFile = strdup(optarg);
+			break;
+
+		case 'C': // Set the L2 cache size
+			if ( sscanf(optarg, "%u", &fs3L2CacheSize) != 1) {
+				logMessage(LOG_ERROR_LEVEL, "Failed parsing L2 cache size [%s]", optarg);
+				return(-1);
+			}
+			break;
+
+		case 'S': // Set the shared cache segment
+			fs3SharedCache = strdup(optarg);
+			break;
+
+		case 'T': // Set the trace file
+			fs3TraceFile = strdup(optarg);
+			break;
+
+		case 'q': // Set the per-file cache quota
+			if ( (sscanf(optarg, "%d", &fs3FileQuota) != 1) || (fs3FileQuota < 0) ) {
+				logMessage(LOG_ERROR_LEVEL, "Failed parsing cache quota [%s]", optarg);
+				return(-1);
+			}
+			break;
+
+		case 'w': // Set the network window
+			if ( (sscanf(optarg, "%d", &fs3_network_window) != 1) || (fs3_network_window < 2) ||
+					(fs3_network_window > FS3_NET_MAX_WINDOW) ) {
+				logMessage(LOG_ERROR_LEVEL, "Bad network window [%s]", optarg);
+				return(-1);
+			}
+			break;
+
+		case 'a': // Set the read ahead
+			if ( (sscanf(optarg, "%d", &fs3_readahead) != 1) || (fs3_readahead < 0) ) {
+				logMessage(LOG_ERROR_LEVEL, "Bad read ahead [%s]", optarg);
+				return(-1);
+			}
+			break;
+
+		case 'd': // Set the injected network delay
+			if ( sscanf(optarg, "%lu", &fs3_network_delay) != 1) {
+				logMessage(LOG_ERROR_LEVEL, "Failed parsing network delay [%s]", optarg);
+				return(-1);
+			}
+			break;
+
+		case 'b': // Select the network backend
+			if ( network_fs3_set_backend(optarg) == -1 ) {
+				return(-1);
+			}
+			break;
+
+		case 'm': // Set the in-process latency model
+			if ( fs3_inproc_set_model(optarg) == -1 ) {
+				return(-1);
+			}
+			break;
+
+		case 'n': // Set the size of the connection pool
+			if ( (sscanf(optarg, "%d", &fs3_network_connections) != 1) || (fs3_network_connections < 1) ||
+					(fs3_network_connections > FS3_NET_MAX_CONNECTIONS) ) {
+				logMessage(LOG_ERROR_LEVEL, "Bad number of connections [%s]", optarg);
+				return(-1);
+			}
+			break;
+
+		case 'F': // Connection affinity by file
+			fs3_network_affinity = FS3_NET_AFFINITY_FILE;
+			break;
+
+		case 'z': // Compressed payloads
+			fs3_network_compress = 1;
+			break;
+
+		case 's': // Set the stripe unit
+			if ( (sscanf(optarg, "%d", &fs3_network_stripe) != 1) || (fs3_network_stripe < 1) ||
+					(FS3_TRACK_SIZE % fs3_network_stripe != 0) ) {
+				logMessage(LOG_ERROR_LEVEL, "Bad stripe unit [%s]", optarg);
+				return(-1);
+			}
+			break;
+
+		case 'r': // Set the replicas of each stripe
+			if ( (sscanf(optarg, "%d", &fs3_network_replicas) != 1) || (fs3_network_replicas < 1) ||
+					(fs3_network_replicas > FS3_NET_MAX_SERVERS) ) {
+				logMessage(LOG_ERROR_LEVEL, "Bad number of replicas [%s]", optarg);
+				return(-1);
+			}
+			break;
+
+		case 't': // Set the tracks of the fast tier
+			if ( (sscanf(optarg, "%d", &fs3_network_tier_tracks) != 1) || (fs3_network_tier_tracks < 1) ||
+					(fs3_network_tier_tracks > FS3_MAX_TRACKS) ) {
+				logMessage(LOG_ERROR_LEVEL, "Bad number of fast tier tracks [%s]", optarg);
+				return(-1);
+			}
+			break;
+
+		case 'j': // Set the replay threads
+			if ( (sscanf(optarg, "%d", &fs3SimJobs) != 1) || (fs3SimJobs < 1) || (fs3SimJobs > FS3_SIM_MAX_JOBS) ) {
+				logMessage(LOG_ERROR_LEVEL, "Bad number of replay threads [%s]", optarg);
+				return(-1);
+			}
+			break;
+
+		case 'k': // Leased, coherent cache
+			fs3_network_leases = 1;
+			break;
+
+		case 'R': // Set the read benchmark passes
+			if ( (sscanf(optarg, "%d", &fs3ReadPasses) != 1) || (fs3ReadPasses < 0) ) {
+				logMessage(LOG_ERROR_LEVEL, "Bad number of read passes [%s]", optarg);
+				return(-1);
+			}
+			break;
+
+		case 'i': // Get the IP address (of one more server when repeated)
 			if (inet_addr(optarg) == INADDR_NONE) {
 				logMessage( LOG_ERROR_LEVEL, "Bad IP address [%s]", argv[optind] );
 				return(-1);
 			}
-			fs3_network_address = (unsigned char *)strdup(optarg);
+			if ( naddrs == FS3_NET_MAX_SERVERS ) {
+				logMessage( LOG_ERROR_LEVEL, "Too many servers [%s]", optarg );
+				return(-1);
+			}
+			addrs[naddrs++] = optarg;
 			break;
 
-		case 'p': // Set the network port number
-			if ( sscanf(optarg, "%hu", &fs3_network_port) != 1 ) {
+		case 'p': // Set the network port number (of one more server when repeated)
+			if ( nports == FS3_NET_MAX_SERVERS ) {
+				logMessage( LOG_ERROR_LEVEL, "Too many servers [%s]", optarg );
+				return(-1);
+			}
+			if ( sscanf(optarg, "%hu", &ports[nports++]) != 1 ) {
 				logMessage( LOG_ERROR_LEVEL, "Bad  port number [%s]", argv[optind] );
 				return(-1);
 			}
@@ -137,18 +361,36 @@ int main( int argc, char *argv[] ) {
 		enableLogLevels(FS3ControllerLLevel | FS3DriverLLevel | FS3SimulatorLLevel);
 	}
 
+	// The first -i/-p is the server, each one after it stripes the disk over another
+	if ( naddrs > 0 ) {
+		fs3_network_address = (unsigned char *)strdup(addrs[0]);
+	}
+	if ( nports > 0 ) {
+		fs3_network_port = ports[0];
+	}
+	for ( i=1; i<CMPSC311_MAXVAL(naddrs, nports); i++ ) {
+		if ( network_fs3_add_server((naddrs > 0) ? addrs[CMPSC311_MINVAL(i, naddrs-1)] : NULL,
+				(nports > 0) ? ports[CMPSC311_MINVAL(i, nports-1)] : 0) == -1 ) {
+			return(-1);
+		}
+	}
+
 	// The filename should be the next option
 	if ( optind >= argc ) {
 		fprintf( stderr, "Missing command line parameters, use -h to see usage, aborting.\n" );
 		return( -1 );
 	}
 
-	// Run the simulation
+	// Run the simulation, traced if asked
+	if ( (fs3TraceFile != NULL) && (fs3_trace_start(fs3TraceFile) == -1) ) {
+		return( -1 );
+	}
 	if ( simulate_FS3(argv[optind]) == 0 ) {
 		logMessage( LOG_INFO_LEVEL, "FS3 simulation completed successfully.\n\n" );
 	} else {
 		logMessage( LOG_INFO_LEVEL, "FS3 simulation failed.\n\n" );
 	}
+	fs3_trace_stop();
 
 	// Return successfully
 	return( 0 );
@@ -166,226 +408,263 @@ int main( int argc, char *argv[] ) {
 int simulate_FS3( char *wload ) {
 
 	// Local variables
-	char line[1024], fname[128], command[128], text[1025], *sep, *rbuf;
-	FILE *fhandle = NULL;
-	int32_t err=0, len, off, fields, linecount;
+	FS3WorkloadOp batch[FS3_SIM_PARSE_BATCH];
+	char *data = NULL, *pos, *end;
+	struct stat stats;
+	struct timespec start, stop;
+	int32_t linecount;
 	FS3SimulationTable ftable[FS3_SIM_MAX_OPEN_FILES];
-	int idx, i, millions;
+	int fd, count, idx, i, millions;
 
 	// Setup the file table
 	memset(ftable, 0x0, sizeof(FS3SimulationTable)*FS3_SIM_MAX_OPEN_FILES);
 
-	// Open the workload file
+	// Map the workload file, privately, the parser terminates strings and fixes up newlines in place
 	millions = linecount = 0;
-	if ( (fhandle=fopen(wload, "r")) == NULL ) {
+	if ( ((fd=open(wload, O_RDONLY)) == -1) || (fstat(fd, &stats) == -1) ) {
 		logMessage( LOG_ERROR_LEVEL, "Failure opening the workload file [%s], error: %s.\n",
 			wload, strerror(errno) );
 		return( -1 );
 	}
+	if ( (stats.st_size > 0) && ((data = mmap(NULL, stats.st_size, PROT_READ|PROT_WRITE, MAP_PRIVATE, fd, 0)) == MAP_FAILED) ) {
+		logMessage( LOG_ERROR_LEVEL, "Failure mapping the workload file [%s], error: %s.\n",
+			wload, strerror(errno) );
+		close( fd );
+		return( -1 );
+	}
+	close( fd );
+	pos = data;
+	end = data + stats.st_size;
+	madvise(data, stats.st_size, MADV_SEQUENTIAL);
+
+	// A compiled workload (from fs3_compile_workload) is replayed from its records
+	memset(fs3SimFileSlots, 0xff, sizeof(fs3SimFileSlots));
+	if ( (i = fs3_workload_compiled(data, stats.st_size)) == -1 ) {
+		logMessage( LOG_ERROR_LEVEL, "Compiled workload [%s] is corrupt.", wload );
+		munmap( data, stats.st_size );
+		return( -1 );
+	}
+	fs3SimCompiled = (i == 1) ? data : NULL;
 
 	// Startup the interface
-	if ( (fs3_mount_disk() == -1) || (fs3_init_cache(fs3CacheSize) == -1) ){
+	if ( (fs3_mount_disk() == -1) || (((fs3SharedCache != NULL) ? fs3_init_shared_cache(fs3SharedCache, fs3CacheSize) :
+			fs3_init_cache(fs3CacheSize)) == -1) ){
 		logMessage( LOG_ERROR_LEVEL, "FS3 simulator failed initialization.");
-		fclose( fhandle );
+		munmap( data, stats.st_size );
+		return( -1 );
+	}
+	if ( fs3_set_cache_quota(FS3_CACHE_ALL_FILES, fs3FileQuota, 0) == -1 ) {
+		logMessage( LOG_ERROR_LEVEL, "FS3 simulator failed setting the cache quota.");
+		munmap( data, stats.st_size );
+		return( -1 );
+	}
+	if ( (fs3L2CacheFile != NULL) && (fs3_init_l2_cache(fs3L2CacheFile, fs3L2CacheSize) == -1) ) {
+		logMessage( LOG_ERROR_LEVEL, "FS3 simulator failed L2 cache initialization.");
+		munmap( data, stats.st_size );
 		return( -1 );
 	}
 	logMessage(FS3SimulatorLLevel, "FS3 simulator initialization complete.");
 
-	// While file not done
-	while (!feof(fhandle)) {
+	// Replay on worker threads if asked, they take the whole workload and leave the loop below nothing
+	if ( (fs3SimJobs > 0) && (replay_threads(pos, end, ftable, fs3SimJobs) == -1) ) {
+		logMessage( LOG_ERROR_LEVEL, "FS3 threaded replay failed.");
+		munmap( data, stats.st_size );
+		return( -1 );
+	}
+
+	// Parse a batch of commands, then run them, until the workload is done
+	while ( (fs3SimJobs == 0) && ((count = parse_batch(&pos, end, batch, &linecount)) != 0) ) {
+		if ( count == -1 ) {
+			munmap( data, stats.st_size );
+			return( -1 );
+		}
 
-		// Get the line and bail out on fail
-		if (fgets(line, 1024, fhandle) != NULL) {
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		for (i=0; i<count; i++) {
 
 			// Give some output when doing long worklaods
-			if ( (linecount > 0) && (linecount)%1000000 == 0 ) {
+			if ( (batch[i].linecount > 1) && (batch[i].linecount-1)%1000000 == 0 ) {
 				millions ++;
 				fprintf( stderr, ". %d million operations.\n", millions );
-			} else if ( (linecount > 0) && (linecount)%100000 == 0 ) {
+			} else if ( (batch[i].linecount > 1) && (batch[i].linecount-1)%100000 == 0 ) {
 				fprintf( stderr, ". " );
 			}
 
-			// Parse out the string
-			linecount ++;
-			fields = sscanf(line, "%s %s %d %d", fname, command, &len, &off);
-			sep = strchr(line, ':');
-			if ( (fields != 4) || (sep == NULL) ) {
-				logMessage( LOG_ERROR_LEVEL, "FS3 un-parsable workload string, aborting [%s], line %d",
-						line, linecount );
-				fclose( fhandle );
+			// Run the command
+			if ( ((idx = replay_file(ftable, &batch[i])) == -1) || (replay_op(ftable, idx, &batch[i]) == -1) ) {
+				munmap( data, stats.st_size );
 				return( -1 );
 			}
-
-			// Just log the contents
-			logMessage(FS3SimulatorLLevel, "File [%s], command [%s], len=%d, offset=%d",
-					fname, command, len, off);
-
-			// Now walk the the table looking for the file
-			idx = -1;
-			i = 0;
-			while ( (i < FS3_SIM_MAX_OPEN_FILES) && (idx == -1) ) {
-				if ( (ftable[i].filename != NULL) && (strcmp(ftable[i].filename,fname) == 0) ) {
-					idx = i;
-				}
-				i++;
-			}
-
-			// File is not found, open the file
-			if (idx == -1) {
-
-				// Log message, find unused index and save filename for later use
-				logMessage(FS3SimulatorLLevel, "FS3_SIM : Opening file [%s]", fname);
-				idx = 0;
-				while ((ftable[idx].filename != NULL) && (idx < FS3_SIM_MAX_OPEN_FILES)) {
-					idx++;
-				}
-				CMPSC311_ASSERT1(idx<FS3_SIM_MAX_OPEN_FILES, "Too many open files on FS3 sim [%d]", idx);
-				ftable[idx].filename = strdup(fname);
-
-				// Now perform the open
-				ftable[idx].fhandle = fs3_open(ftable[idx].filename);
-				if (ftable[idx].fhandle == -1) {
-					// Failed, error out
-					logMessage(LOG_ERROR_LEVEL, "Open of new file [%s] failed, aborting simulation.", fname);
-					return(-1);
-				}
-
-			}
-
-			// Now execute the specific command
-			if (strncmp(command, "WRITEAT", 7) == 0) {
-
-				// Log the command executed
-				logMessage(FS3SimulatorLLevel, "FS3_SIM : Writing %d bytes at position %d from file [%s]", len, off, fname);
-
-				// First perform the seek
-				if (fs3_seek(ftable[idx].fhandle, off)) {
-					// Failed, error out
-					logMessage(LOG_ERROR_LEVEL, "Seek/WriteAt file [%s] to position %d failed, aborting simulation.", fname, off);
-					return(-1);
-				}
-
-				// Now see if we need more data to fill, terminate the lines
-				CMPSC311_ASSERT1(len<1024, "Simulated workload command text too large [%d]", len);
-				CMPSC311_ASSERT2((strlen(sep+1)>=len), "Workload str [%d<%d]", strlen(sep+1), len);
-				strncpy(text, sep+1, len);
-				text[len] = 0x0;
-				for (i=0; i<strlen(text); i++) {
-					if (text[i] == '^') {
-						text[i] = '\n';
-					}
-				}
-
-				// Now perform the write
-				if (fs3_write(ftable[idx].fhandle, text, len) != len) {
-					// Failed, error out
-					logMessage(LOG_ERROR_LEVEL, "WriteAt of file [%s], length %d failed, aborting simulation.", fname, len);
-					return(-1);
-				}
-
-
-			} else if (strncmp(command, "WRITE", 5) == 0) {
-
-				// Now see if we need more data to fill, terminate the lines
-				CMPSC311_ASSERT1(len<1024, "Simulated workload command text too large [%d]", len);
-				CMPSC311_ASSERT2((strlen(sep+1)>=len), "Workload str [%d<%d]", strlen(sep+1), len);
-				strncpy(text, sep+1, len);
-				text[len] = 0x0;
-				for (i=0; i<strlen(text); i++) {
-					if (text[i] == '^') {
-						text[i] = '\n';
-					}
-				}
-
-				// Log the command executed
-				logMessage(FS3SimulatorLLevel, "FS3_SIM : Writing %d bytes to file [%s]", len, fname);
-
-				// Now perform the write
-				if (fs3_write(ftable[idx].fhandle, text, len) != len) {
-					// Failed, error out
-					logMessage(LOG_ERROR_LEVEL, "Write of file [%s], length %d failed, aborting simulation.", fname, len);
-					return(-1);
-				}
-
-
-			} else if (strncmp(command, "SEEK", 4) == 0) {
-
-				// Log the command executed
-				logMessage(FS3SimulatorLLevel, "FS3_SIM : Seeking to position %d in file [%s]", off, fname);
-
-				// Now perform the seek
-				if (fs3_seek(ftable[idx].fhandle, off) != len) {
-					// Failed, error out
-					logMessage(LOG_ERROR_LEVEL, "Seek in file [%s] to position %d failed, aborting simulation.", fname, off);
-					return(-1);
-				}
-
-			} else if (strncmp(command, "READ", 4) == 0) {
-
-				// Log the command executed
-				logMessage(FS3SimulatorLLevel, "FS3_SIM : Reading %d bytes from file [%s]", len, fname);
-
-				// Now perform the read
-				rbuf = malloc(len);
-				if (fs3_read(ftable[idx].fhandle, rbuf, len) != len) {
-					// Failed, error out
-					logMessage(LOG_ERROR_LEVEL, "Read file [%s] of length %d failed, aborting simulation.", fname, off);
-					return(-1);
-				}
-				free(rbuf);
-				rbuf = NULL;
-
-			} else {
-
-				// Bomb out, don't understand the command
-				CMPSC311_ASSERT1(0, "FS3_SIM : Failed, unknown command [%s]", command);
-
-			}
-		}
-
-		// Check for the virtual level failing
-		if ( err ) {
-			logMessage( LOG_ERROR_LEVEL, "CRUS system failed, aborting [%d]", err );
-			fclose( fhandle );
-			return( -1 );
 		}
+		clock_gettime(CLOCK_MONOTONIC, &stop);
+		fs3SimReplayNs += (stop.tv_sec - start.tv_sec) * 1000000000UL + stop.tv_nsec - start.tv_nsec;
+		fs3SimReplayOps += count;
 	}
 
-	// Now walk the the table looking for the file
-	for (i=0; i<FS3_SIM_MAX_OPEN_FILES; i++) {
-		if (ftable[i].filename != NULL) {
-			if (validate_file(ftable[i].filename, ftable[i].fhandle) != 0) {
-				logMessage(LOG_ERROR_LEVEL, "FS3 Validation failed on file [%s].", ftable[i].filename,fname);
-				fclose( fhandle );
-				return(-1);
-			}
+	// Say how long parsing took against running the commands
+	printf("Workload %s  [    %.2f MB in %.3f secs, %.1f MB/s]\n", (fs3SimCompiled != NULL) ? "decode" : "parse ",
+			fs3SimParseBytes / 1e6, fs3SimParseNs / 1e9,
+			(fs3SimParseNs > 0) ? fs3SimParseBytes * 1e3 / fs3SimParseNs : 0);
+	printf("FS3 replay       [    %lu ops in %.3f secs, %.0f ops/s]\n", fs3SimReplayOps, fs3SimReplayNs / 1e9,
+			(fs3SimReplayNs > 0) ? fs3SimReplayOps * 1e9 / fs3SimReplayNs : 0);
+
+	// Time reading the files back, if asked to
+	if ( (fs3ReadPasses > 0) && (benchmark_reads(ftable, fs3ReadPasses) == -1) ) {
+		logMessage( LOG_ERROR_LEVEL, "FS3 read benchmark failed.");
+		munmap( data, stats.st_size );
+		return( -1 );
+	}
 
-			// Clean up the file
-			logMessage(FS3SimulatorLLevel, "Contents of file [%s] validated.", ftable[i].filename);
-			fs3_close(ftable[i].fhandle);
-			free(ftable[i].filename);
-			ftable[i].filename = NULL;
-		}
+	// Now check every file against its source
+	if ( validate_files(ftable) == -1 ) {
+		munmap( data, stats.st_size );
+		return(-1);
 	}
 
 	// Log cache metrics, shut down the interface
-	if ( fs3_log_cache_metrics() == -1 ) {
+	if ( (fs3_log_cache_metrics() == -1) || (network_fs3_log_metrics() == -1) ) {
 		logMessage(LOG_ERROR_LEVEL, "FS3 simulation failed, controller metrics failed");
 		return(-1);
 	}
 	if ((fs3_unmount_disk() == -1) || (fs3_close_cache() == -1)) {
 		logMessage( LOG_ERROR_LEVEL, "FS3 simulator failed shutdown.");
-		fclose( fhandle );
+		munmap( data, stats.st_size );
 		return( -1 );
 	}
 	logMessage(FS3SimulatorLLevel, "FS3 simulator shutdown complete.");
 	logMessage(LOG_OUTPUT_LEVEL, "FS3 simulation: all tests successful!!!.");
 
-	// Close the workload file, successfully
-	fclose( fhandle );
+	// Unmap the workload file, successfully
+	munmap( data, stats.st_size );
 	return( 0 );
 }
 
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : validate_files
+// Description  : Validate every file of the workload against its source. A
+//                pool of threads reads and hashes the source files while
+//                this thread has the servers hash the FS3 files, so both
+//                digests are ready when they are compared
+//
+// Inputs       : ftable - the file table
+// Outputs      : 0 if successful test, -1 if failure
+
+int validate_files(FS3SimulationTable *ftable) {
+
+	// Local variables
+	pthread_t hashers[FS3_SIM_HASH_JOBS];
+	char filename[256];
+	struct stat stats;
+	int i, files = 0, jobs = 0, ret = 0;
+
+	// Start the hashing threads, no more than there are files
+	for (i=0; i<FS3_SIM_MAX_OPEN_FILES; i++) {
+		if (ftable[i].filename != NULL) {
+			files ++;
+		}
+	}
+	memset(fs3SimSources, 0x0, sizeof(fs3SimSources));
+	fs3SimNextSource = 0;
+	gcry_check_version(NULL); // Set up the hash library before the threads use it
+	while ( (jobs < CMPSC311_MINVAL(files, FS3_SIM_HASH_JOBS)) &&
+			(pthread_create(&hashers[jobs], NULL, hash_worker, ftable) == 0) ) {
+		jobs ++;
+	}
+	if ( jobs == 0 ) {
+		hash_worker(ftable); // No threads, hash them here
+	}
+
+	// Meanwhile have the servers hash the FS3 files, as long as the sources are
+	for (i=0; i<FS3_SIM_MAX_OPEN_FILES; i++) {
+		if (ftable[i].filename != NULL) {
+			snprintf(filename, 256, "%s/%s", FS3_WORKLOAD_DIR, ftable[i].filename);
+			fs3SimSources[i].served = ( (stat(filename, &stats) == 0) && (stats.st_size > 0) &&
+					(fs3_checksum(ftable[i].fhandle, 0, stats.st_size, fs3SimSources[i].have) == 0) );
+		}
+	}
+	for (i=0; i<jobs; i++) {
+		pthread_join(hashers[i], NULL);
+	}
+
+	// Now compare, closing the files as they pass
+	for (i=0; i<FS3_SIM_MAX_OPEN_FILES; i++) {
+		if ( (ftable[i].filename != NULL) && (ret == 0) ) {
+			if (validate_file(ftable[i].filename, ftable[i].fhandle, &fs3SimSources[i]) != 0) {
+				logMessage(LOG_ERROR_LEVEL, "FS3 Validation failed on file [%s].", ftable[i].filename);
+				ret = -1;
+			} else {
+
+				// Clean up the file
+				logMessage(FS3SimulatorLLevel, "Contents of file [%s] validated.", ftable[i].filename);
+				fs3_close(ftable[i].fhandle);
+				free(ftable[i].filename);
+				ftable[i].filename = NULL;
+			}
+		}
+		free(fs3SimSources[i].data);
+		fs3SimSources[i].data = NULL;
+	}
+	return( ret );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : hash_worker
+// Description  : Read the source of workload files, one after another, and
+//                checksum them until none are left
+//
+// Inputs       : arg - the file table
+// Outputs      : NULL
+
+void *hash_worker(void *arg) {
+
+	// Local variables
+	FS3SimulationTable *ftable = arg;
+	FS3SimulationSource *src;
+	char filename[256];
+	struct stat stats;
+	int idx, fh;
+
+	while ( (idx = __atomic_fetch_add(&fs3SimNextSource, 1, __ATOMIC_RELAXED)) < FS3_SIM_MAX_OPEN_FILES ) {
+		if (ftable[idx].filename == NULL) {
+			continue;
+		}
+		src = &fs3SimSources[idx];
+		src->hashed = -1;
+
+		// First figure out how big the file is, setup buffer
+		snprintf(filename, 256, "%s/%s", FS3_WORKLOAD_DIR, ftable[idx].filename);
+		if ((stat(filename, &stats) != 0) || (stats.st_size == 0)) {
+			logMessage(LOG_ERROR_LEVEL, "Failure validating file [%s], missing or "
+				"unknown source.", filename);
+			continue;
+		}
+		if ((src->data = malloc(stats.st_size)) == NULL) {
+			logMessage(LOG_ERROR_LEVEL, "Failure validating file [%s], failed "
+				"buffer allocation.", filename);
+			continue;
+		}
+
+		// Now open the file and read the contents
+		if ((fh=open(filename, O_RDONLY)) == -1) {
+			logMessage(LOG_ERROR_LEVEL, "Failure validating file [%s], open failed ", filename);
+			continue;
+		}
+		if ((read(fh, src->data, stats.st_size)) != stats.st_size) {
+			logMessage(LOG_ERROR_LEVEL, "Failure validating file [%s], read failed ", filename);
+			close(fh);
+			continue;
+		}
+		close(fh);
+		src->size = stats.st_size;
+		if (fs3_checksum_buffer(src->data, 0, src->size, src->want) == 0) {
+			src->hashed = 1;
+		}
+	}
+	return( NULL );
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 //
 // Function     : validate_file
@@ -393,38 +672,31 @@ int simulate_FS3( char *wload ) {
 //
 // Inputs       : fname - the name of the file to validate
 //                mfh - the disk file handle
+//                src - the source of the file, read and hashed
 // Outputs      : 0 if successful test, -1 if failure
 
-int validate_file(char *fname, int16_t mfh) {
+int validate_file(char *fname, int16_t mfh, FS3SimulationSource *src) {
 
 	// Local variables
-	char filename[256], bkfile[256], *filbuf, *membuf;
-	struct stat stats;
+	char bkfile[256], *filbuf = src->data, *membuf;
 	int idx, fh;
 
-	// First figure out how big the file is, setup buffer
-	snprintf(filename, 256, "%s/%s", FS3_WORKLOAD_DIR, fname);
-	if ((stat(filename, &stats) != 0) || (stats.st_size == 0)) {
-		logMessage(LOG_ERROR_LEVEL, "Failure validating file [%s], missing or "
-			"unknown source.", filename);
-		return(-1);		
-	}
-	if ( ((filbuf = malloc(stats.st_size)) == NULL) || ((membuf = malloc(stats.st_size)) == NULL) ) {
-		logMessage(LOG_ERROR_LEVEL, "Failure validating file [%s], failed "
-			"buffer allocation.", filename);
-		return(-1);		
+	// The source must have been read
+	if ((src->hashed == -1) || (filbuf == NULL)) {
+		return(-1);
 	}
 
-	// Now open the file and read the contents
-	if ((fh=open(filename, O_RDONLY)) == -1) {
-		logMessage(LOG_ERROR_LEVEL, "Failure validating file [%s], open failed ", filename);
-		return(-1);		
+	// Compare checksums first, the server hashes the sectors so the data stays put
+	if ( (src->hashed == 1) && src->served && (memcmp(src->want, src->have, FS3_CHECKSUM_SIZE) == 0) ) {
+		logMessage(LOG_OUTPUT_LEVEL, "Validation of [%s], length %d sucessful (checksum).", fname, src->size);
+		return( 0 );
 	}
-	if ((read(fh, filbuf, stats.st_size)) == -1) {
-		logMessage(LOG_ERROR_LEVEL, "Failure validating file [%s], read failed ", filename);
+	logMessage(LOG_WARNING_LEVEL, "Checksum of [%s] does not match, reading it back to compare.", fname);
+	if ((membuf = malloc(src->size)) == NULL) {
+		logMessage(LOG_ERROR_LEVEL, "Failure validating file [%s], failed "
+			"buffer allocation.", fname);
 		return(-1);
 	}
-	close(fh);
 
 	// Seek to the beginning of the disk file, read the contents
 	if (fs3_seek(mfh, 0) == -1) {
@@ -432,9 +704,9 @@ int validate_file(char *fname, int16_t mfh) {
 		logMessage(LOG_ERROR_LEVEL, "Read fs3 file [%s] see to zero failed.", fname);
 		return(-1);
 	}
-	if (fs3_read(mfh, membuf, stats.st_size) != stats.st_size) {
+	if (fs3_read(mfh, membuf, src->size) != src->size) {
 		// Failed, error out
-		logMessage(LOG_ERROR_LEVEL, "Read fs3 file [%s] of length %d failed.", fname, stats.st_size);
+		logMessage(LOG_ERROR_LEVEL, "Read fs3 file [%s] of length %d failed.", fname, src->size);
 		return(-1);
 	}
 
@@ -445,14 +717,14 @@ int validate_file(char *fname, int16_t mfh) {
 			bkfile, strerror(errno));
 		return(-1);		
 	}
-	if ((write(fh, membuf, stats.st_size)) == -1) {
+	if ((write(fh, membuf, src->size)) == -1) {
 		logMessage(LOG_ERROR_LEVEL, "Failure writing backup file [%s].", bkfile);
 		return(-1);
 	}
 	close(fh);
 
 	// Now walk the buffers and compare byte for byte
-	for (idx=0; idx<stats.st_size; idx++) {
+	for (idx=0; idx<src->size; idx++) {
 		if (membuf[idx] != filbuf[idx]) {
 			logMessage(LOG_ERROR_LEVEL, "Validation of [%s] failed at offset %d (mem %x/'%c' "
 				"!= fil %x/'%c')", fname, idx, membuf[idx], membuf[idx], filbuf[idx], filbuf[idx]);
@@ -461,8 +733,377 @@ int validate_file(char *fname, int16_t mfh) {
 	}
 
 	// Free the buffers, log success, and return successfully
-	free(filbuf);
 	free(membuf);
-	logMessage(LOG_OUTPUT_LEVEL, "Validation of [%s], length %d sucessful.", fname, stats.st_size);
+	logMessage(LOG_OUTPUT_LEVEL, "Validation of [%s], length %d sucessful.", fname, src->size);
 	return( 0 );
 }
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : benchmark_reads
+// Description  : Read every file of the workload back, start to end, a
+//                number of times, dropping the cache before each pass so
+//                the sectors come from the servers, and report how fast
+//
+// Inputs       : ftable - the file table
+//                passes - the number of times to read the files
+// Outputs      : 0 if successful, -1 if failure
+
+int benchmark_reads(FS3SimulationTable *ftable, int passes) {
+
+	// Local variables
+	char filename[256], *buf;
+	struct stat stats;
+	struct timespec start, end;
+	unsigned long bytes = 0;
+	double secs;
+	int pass, i;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (pass=0; pass<passes; pass++) {
+
+		// Start cold, the point is to read from the servers
+		if ( (fs3_close_cache() == -1) || (fs3_init_cache(fs3CacheSize) == -1) ) {
+			return(-1);
+		}
+		for (i=0; i<FS3_SIM_MAX_OPEN_FILES; i++) {
+			if (ftable[i].filename == NULL) {
+				continue;
+			}
+			snprintf(filename, 256, "%s/%s", FS3_WORKLOAD_DIR, ftable[i].filename);
+			if ( (stat(filename, &stats) != 0) || ((buf = malloc(stats.st_size)) == NULL) ) {
+				logMessage(LOG_ERROR_LEVEL, "Read benchmark can't size file [%s]", filename);
+				return(-1);
+			}
+			if ( (fs3_seek(ftable[i].fhandle, 0) == -1) ||
+					(fs3_read(ftable[i].fhandle, buf, stats.st_size) != stats.st_size) ) {
+				logMessage(LOG_ERROR_LEVEL, "Read benchmark failed reading [%s]", ftable[i].filename);
+				free(buf);
+				return(-1);
+			}
+			free(buf);
+			bytes += stats.st_size;
+		}
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	// Log the throughput
+	secs = (end.tv_sec - start.tv_sec) + (double)(end.tv_nsec - start.tv_nsec) / 1e9;
+	printf("** FS3 read benchmark **\n");
+	printf("Passes           [    %d]\n", passes);
+	printf("Bytes read       [    %lu]\n", bytes);
+	printf("Read throughput  [    %.2f MB/s (%.3f secs)]\n", (secs > 0) ? (double)bytes / secs / 1e6 : 0.0, secs);
+	return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : replay_file
+// Description  : Find a workload file in the file table, opening it the
+//                first time it is named (a compiled workload's files are
+//                numbered, so they are looked up by name only once)
+//
+// Inputs       : ftable - the file table
+//                op - the command naming the file
+// Outputs      : the index of the file in the table, -1 if failure
+
+int replay_file(FS3SimulationTable *ftable, FS3WorkloadOp *op) {
+
+	// Local variables
+	char *fname = op->fname;
+	int idx, i;
+
+	if ( (op->file != -1) && (fs3SimFileSlots[op->file] != -1) ) {
+		return( fs3SimFileSlots[op->file] );
+	}
+
+	// Now walk the the table looking for the file
+	idx = -1;
+	i = 0;
+	while ( (i < FS3_SIM_MAX_OPEN_FILES) && (idx == -1) ) {
+		if ( (ftable[i].filename != NULL) && (strcmp(ftable[i].filename,fname) == 0) ) {
+			idx = i;
+		}
+		i++;
+	}
+
+	// File is not found, open the file
+	if (idx == -1) {
+
+		// Log message, find unused index and save filename for later use
+		logMessage(FS3SimulatorLLevel, "FS3_SIM : Opening file [%s]", fname);
+		idx = 0;
+		while ((ftable[idx].filename != NULL) && (idx < FS3_SIM_MAX_OPEN_FILES)) {
+			idx++;
+		}
+		CMPSC311_ASSERT1(idx<FS3_SIM_MAX_OPEN_FILES, "Too many open files on FS3 sim [%d]", idx);
+		ftable[idx].filename = strdup(fname);
+
+		// Now perform the open
+		ftable[idx].fhandle = fs3_open(ftable[idx].filename);
+		if (ftable[idx].fhandle == -1) {
+			// Failed, error out
+			logMessage(LOG_ERROR_LEVEL, "Open of new file [%s] failed, aborting simulation.", fname);
+			return(-1);
+		}
+
+	}
+	if ( op->file != -1 ) {
+		fs3SimFileSlots[op->file] = idx;
+	}
+	return( idx );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : parse_batch
+// Description  : Parse up to FS3_SIM_PARSE_BATCH lines of the workload,
+//                or decode as many records of a compiled one, timing it
+//                apart from running them
+//
+// Inputs       : pos - where parsing is, moved past the batch (text)
+//                end - the end of the workload
+//                ops - where to put the commands
+//                linecount - lines (or records) read so far, moved past the batch
+// Outputs      : the number of commands parsed, -1 if failure
+
+int parse_batch(char **pos, char *end, FS3WorkloadOp *ops, int *linecount) {
+
+	// Local variables
+	struct timespec start, stop;
+	char *from = *pos;
+	int count = 0, got = 1;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	if ( fs3SimCompiled != NULL ) {
+		for (; (count < FS3_SIM_PARSE_BATCH) && (*linecount < ((FS3WorkloadHeader *)fs3SimCompiled)->ops); count++) {
+			fs3_workload_decode(fs3SimCompiled, (*linecount)++, &ops[count]);
+		}
+		fs3SimParseBytes += count * sizeof(FS3WorkloadRecord);
+	} else {
+		while ( (count < FS3_SIM_PARSE_BATCH) && ((got = fs3_workload_parse_line(pos, end, &ops[count], *linecount + 1)) == 1) ) {
+			(*linecount) ++;
+			count ++;
+		}
+		fs3SimParseBytes += *pos - from;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &stop);
+	fs3SimParseNs += (stop.tv_sec - start.tv_sec) * 1000000000UL + stop.tv_nsec - start.tv_nsec;
+	return( (got == -1) ? -1 : count );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : replay_op
+// Description  : Run one parsed workload command against its file
+//
+// Inputs       : ftable - the file table
+//                idx - the file's index in the table
+//                op - the command
+// Outputs      : 0 if successful, -1 if failure
+
+int replay_op(FS3SimulationTable *ftable, int idx, FS3WorkloadOp *op) {
+
+	// Local variables
+	char *fname = ftable[idx].filename, *rbuf;
+	int32_t len = op->len, off = op->off;
+
+	// Just log the contents
+	logMessage(FS3SimulatorLLevel, "File [%s], command [%s], len=%d, offset=%d",
+			fname, fs3_workload_commands[op->command], len, off);
+
+	// Now execute the specific command
+	if (op->command == FS3_WL_WRITEAT) {
+
+		// Log the command executed
+		logMessage(FS3SimulatorLLevel, "FS3_SIM : Writing %d bytes at position %d from file [%s]", len, off, fname);
+
+		// First perform the seek
+		if (fs3_seek(ftable[idx].fhandle, off)) {
+			// Failed, error out
+			logMessage(LOG_ERROR_LEVEL, "Seek/WriteAt file [%s] to position %d failed, aborting simulation.", fname, off);
+			return(-1);
+		}
+
+		// Now perform the write
+		if (fs3_write(ftable[idx].fhandle, op->text, len) != len) {
+			// Failed, error out
+			logMessage(LOG_ERROR_LEVEL, "WriteAt of file [%s], length %d failed, aborting simulation.", fname, len);
+			return(-1);
+		}
+
+	} else if (op->command == FS3_WL_WRITE) {
+
+		// Log the command executed
+		logMessage(FS3SimulatorLLevel, "FS3_SIM : Writing %d bytes to file [%s]", len, fname);
+
+		// Now perform the write
+		if (fs3_write(ftable[idx].fhandle, op->text, len) != len) {
+			// Failed, error out
+			logMessage(LOG_ERROR_LEVEL, "Write of file [%s], length %d failed, aborting simulation.", fname, len);
+			return(-1);
+		}
+
+	} else if (op->command == FS3_WL_SEEK) {
+
+		// Log the command executed
+		logMessage(FS3SimulatorLLevel, "FS3_SIM : Seeking to position %d in file [%s]", off, fname);
+
+		// Now perform the seek
+		if (fs3_seek(ftable[idx].fhandle, off) != len) {
+			// Failed, error out
+			logMessage(LOG_ERROR_LEVEL, "Seek in file [%s] to position %d failed, aborting simulation.", fname, off);
+			return(-1);
+		}
+
+	} else {
+
+		// Log the command executed
+		logMessage(FS3SimulatorLLevel, "FS3_SIM : Reading %d bytes from file [%s]", len, fname);
+
+		// Now perform the read
+		rbuf = malloc(len);
+		if (fs3_read(ftable[idx].fhandle, rbuf, len) != len) {
+			// Failed, error out
+			logMessage(LOG_ERROR_LEVEL, "Read file [%s] of length %d failed, aborting simulation.", fname, off);
+			free(rbuf);
+			return(-1);
+		}
+		free(rbuf);
+	}
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : replay_threads
+// Description  : Split the workload into one stream per file and replay
+//                the streams on a number of threads, each thread taking
+//                the next whole file when it is done with one; commands
+//                go into the driver one at a time (it isn't reentrant),
+//                so what this shows is how commands from many files
+//                queue on it
+//
+// Inputs       : pos - the mapped workload
+//                end - the end of the workload
+//                ftable - the file table
+//                jobs - the number of threads
+// Outputs      : 0 if successful, -1 if failure
+
+int replay_threads(char *pos, char *end, FS3SimulationTable *ftable, int jobs) {
+
+	// Local variables
+	FS3SimulationWorker workers[FS3_SIM_MAX_JOBS];
+	FS3SimulationStream *stream;
+	FS3WorkloadOp batch[FS3_SIM_PARSE_BATCH];
+	struct timespec start, end_t;
+	unsigned long ops = 0;
+	double secs;
+	int linecount = 0, count, idx, i;
+
+	// Sort the commands into their files' streams, opening the files in workload order
+	while ( (count = parse_batch(&pos, end, batch, &linecount)) > 0 ) {
+		for (i=0; i<count; i++) {
+			if ( (idx = replay_file(ftable, &batch[i])) == -1 ) {
+				return( -1 );
+			}
+			stream = &fs3SimStreams[idx];
+			if (stream->count == stream->size) {
+				stream->size = (stream->size) ? stream->size * 2 : 256;
+				stream->ops = realloc(stream->ops, sizeof(FS3WorkloadOp) * stream->size);
+				CMPSC311_ASSERT0(stream->ops != NULL, "Out of memory for the workload");
+			}
+			stream->ops[stream->count++] = batch[i];
+		}
+	}
+	if ( count == -1 ) {
+		return( -1 );
+	}
+
+	// Replay them
+	fs3SimTable = ftable;
+	fs3SimNextStream = 0;
+	fs3SimFailed = 0;
+	memset(workers, 0x0, sizeof(workers));
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i=0; i<jobs; i++) {
+		if ( pthread_create(&workers[i].thread, NULL, replay_worker, &workers[i]) != 0 ) {
+			logMessage( LOG_ERROR_LEVEL, "Unable to start replay thread %d", i );
+			jobs = i;
+			fs3SimFailed = 1;
+			break;
+		}
+	}
+	for (i=0; i<jobs; i++) {
+		pthread_join(workers[i].thread, NULL);
+		ops += workers[i].ops;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end_t);
+	secs = (end_t.tv_sec - start.tv_sec) + (end_t.tv_nsec - start.tv_nsec) / 1e9;
+	fs3SimReplayNs += (unsigned long)(secs * 1e9);
+	fs3SimReplayOps += ops;
+
+	for (i=0; i<FS3_SIM_MAX_OPEN_FILES; i++) {
+		free(fs3SimStreams[i].ops);
+	}
+	memset(fs3SimStreams, 0x0, sizeof(fs3SimStreams));
+	if ( fs3SimFailed ) {
+		return( -1 );
+	}
+
+	// Say how it went
+	printf("Replay threads   [    %d, %lu ops in %.3f secs, %.0f ops/s]\n", jobs, ops, secs, (secs > 0) ? ops / secs : 0);
+	for (i=0; i<jobs; i++) {
+		printf("Thread [%3d]     files [%4d] ops [%8lu] latency avg [%8.1f] max [%8.1f] waiting avg [%8.1f] usecs\n",
+				i, workers[i].files, workers[i].ops,
+				(workers[i].ops) ? workers[i].latency / 1000.0 / workers[i].ops : 0, workers[i].worst / 1000.0,
+				(workers[i].ops) ? workers[i].waited / 1000.0 / workers[i].ops : 0);
+	}
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : replay_worker
+// Description  : Replay whole files, one after another, until none are left
+//                or another thread failed
+//
+// Inputs       : arg - the worker's record
+// Outputs      : NULL
+
+void *replay_worker(void *arg) {
+
+	// Local variables
+	FS3SimulationWorker *worker = arg;
+	FS3SimulationStream *stream;
+	struct timespec t0, t1, t2;
+	unsigned long took;
+	int idx, i, err;
+
+	while ( (!__atomic_load_n(&fs3SimFailed, __ATOMIC_RELAXED)) &&
+			((idx = __atomic_fetch_add(&fs3SimNextStream, 1, __ATOMIC_RELAXED)) < FS3_SIM_MAX_OPEN_FILES) ) {
+		stream = &fs3SimStreams[idx];
+		if (stream->count == 0) {
+			continue;
+		}
+		worker->files ++;
+		for (i=0; (i<stream->count) && (!__atomic_load_n(&fs3SimFailed, __ATOMIC_RELAXED)); i++) {
+			clock_gettime(CLOCK_MONOTONIC, &t0);
+			pthread_mutex_lock(&fs3SimDriver);
+			clock_gettime(CLOCK_MONOTONIC, &t1);
+			err = replay_op(fs3SimTable, idx, &stream->ops[i]);
+			pthread_mutex_unlock(&fs3SimDriver);
+			clock_gettime(CLOCK_MONOTONIC, &t2);
+			if ( err == -1 ) {
+				__atomic_store_n(&fs3SimFailed, 1, __ATOMIC_RELAXED);
+				break;
+			}
+			took = (t2.tv_sec - t0.tv_sec) * 1000000000UL + t2.tv_nsec - t0.tv_nsec;
+			worker->latency += took;
+			worker->waited += (t1.tv_sec - t0.tv_sec) * 1000000000UL + t1.tv_nsec - t0.tv_nsec;
+			worker->worst = CMPSC311_MAXVAL(worker->worst, took);
+			worker->ops ++;
+		}
+	}
+	return( NULL );
+}
@@ -0,0 +1,189 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : fs3_trace.c
+//  Description    : This is the FS3 call trace writer (see fs3_trace.h). The
+//                   records go through a large stdio buffer, so tracing a
+//                   call costs two clock reads and a copy.
+//
+//  Author         : Patrick McDaniel
+//  Last Modified  : Mon 19 Oct 2026 04:08:12 AM UTC
+//
+
+// Includes
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <cmpsc311_log.h>
+
+// Project Includes
+#include <fs3_trace.h>
+
+// Defines
+#define TRACE_BUFFER (1 << 20) // Bytes of records held before they are written
+
+//
+// Global data
+int fs3_tracing = 0;
+char *fs3_trace_ops[] = {"open", "close", "read", "write", "seek"};
+
+FILE *traceFile = NULL;       // Where the records go
+char *traceName = NULL;       // Its name (for messages)
+uint64_t traceStart;          // Monotonic clock at the start of the trace (nsecs)
+unsigned long traceRecords;   // Calls recorded
+int traceFailed;              // Writing the trace failed, stop recording
+
+//
+// Implementation
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_trace_now
+// Description  : Read the monotonic clock
+//
+// Inputs       : none
+// Outputs      : the time in nsecs
+
+static uint64_t fs3_trace_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_trace_start
+// Description  : Create the trace file and start recording calls
+//
+// Inputs       : path - the trace file
+// Outputs      : 0 if successful, -1 if failure
+
+int fs3_trace_start(const char *path)
+{
+    FS3TraceHeader hdr;
+    struct timespec ts;
+
+    if (traceFile != NULL)
+    {
+        logMessage(LOG_ERROR_LEVEL, "FS3 trace already running [%s]", traceName);
+        return (-1);
+    }
+    if ((traceFile = fopen(path, "w")) == NULL)
+    {
+        logMessage(LOG_ERROR_LEVEL, "Unable to create trace file [%s]: %s", path, strerror(errno));
+        return (-1);
+    }
+    setvbuf(traceFile, NULL, _IOFBF, TRACE_BUFFER);
+
+    memset(&hdr, 0, sizeof(hdr));
+    clock_gettime(CLOCK_REALTIME, &ts);
+    hdr.magic = FS3_TRACE_MAGIC;
+    hdr.version = FS3_TRACE_VERSION;
+    hdr.started = (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+    if (fwrite(&hdr, sizeof(hdr), 1, traceFile) != 1)
+    {
+        logMessage(LOG_ERROR_LEVEL, "Unable to write trace file [%s]: %s", path, strerror(errno));
+        fclose(traceFile);
+        traceFile = NULL;
+        return (-1);
+    }
+    traceName = strdup(path);
+    traceStart = fs3_trace_now();
+    traceRecords = 0;
+    traceFailed = 0;
+    fs3_tracing = 1;
+    return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_trace_stop
+// Description  : Stop recording and write out what is buffered
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int fs3_trace_stop(void)
+{
+    int ret = 0;
+
+    if (traceFile == NULL)
+    {
+        return (0);
+    }
+    fs3_tracing = 0;
+    if ((fclose(traceFile) != 0) || traceFailed)
+    {
+        logMessage(LOG_ERROR_LEVEL, "Writing trace file [%s] failed, it is incomplete", traceName);
+        ret = -1;
+    }
+    else
+    {
+        logMessage(LOG_INFO_LEVEL, "FS3 trace [%s] holds %lu calls", traceName, traceRecords);
+    }
+    traceFile = NULL;
+    free(traceName);
+    traceName = NULL;
+    return (ret);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_trace_clock
+// Description  : Note when a call starts, if it is being traced
+//
+// Inputs       : none
+// Outputs      : the time in nsecs, 0 when no trace is running
+
+uint64_t fs3_trace_clock(void)
+{
+    return (fs3_tracing ? fs3_trace_now() : 0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_trace_record
+// Description  : Record a call, now that it has returned
+//
+// Inputs       : op - FS3_TRACE_OPEN ... FS3_TRACE_SEEK
+//                fd - the file handle it was given (-1 for an open)
+//                arg - the count or location
+//                result - what it returned
+//                start - fs3_trace_clock() when it was called
+//                path - the path of an open, NULL otherwise
+// Outputs      : none
+
+void fs3_trace_record(uint8_t op, int16_t fd, uint32_t arg, int32_t result, uint64_t start, const char *path)
+{
+    static const char pad[8] = {0};
+    FS3TraceRecord rec;
+    uint64_t took;
+    int padlen;
+
+    if (!fs3_tracing || (start == 0)) // Started while the trace was off
+    {
+        return;
+    }
+    took = fs3_trace_now() - start;
+    rec.nsecs = (start > traceStart) ? start - traceStart : 0;
+    rec.took = (took > UINT32_MAX) ? UINT32_MAX : (uint32_t)took;
+    rec.op = op;
+    rec.namelen = (path != NULL) ? (uint8_t)strnlen(path, 255) : 0;
+    rec.fd = fd;
+    rec.arg = arg;
+    rec.result = result;
+    padlen = FS3_TRACE_RECORD_SIZE(&rec) - sizeof(rec) - rec.namelen;
+    if ((fwrite(&rec, sizeof(rec), 1, traceFile) != 1) ||
+        ((rec.namelen > 0) && (fwrite(path, rec.namelen, 1, traceFile) != 1)) ||
+        ((padlen > 0) && (fwrite(pad, padlen, 1, traceFile) != 1)))
+    {
+        logMessage(LOG_ERROR_LEVEL, "Writing trace file [%s] failed, tracing stopped: %s", traceName, strerror(errno));
+        traceFailed = 1;
+        fs3_tracing = 0;
+        return;
+    }
+    traceRecords++;
+}
@@ -0,0 +1,72 @@
+#ifndef FS3_TRACE_INCLUDED
+#define FS3_TRACE_INCLUDED
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File          : fs3_trace.h
+//  Description   : This is the interface of the FS3 call trace. While a
+//                  trace is running, the driver records every open, close,
+//                  read, write and seek an application makes: when it was
+//                  called, how long it took, its arguments and its result.
+//                  A trace is a header followed by one fixed size record
+//                  per call, an open's path right behind its record.
+//                  fs3_replay runs a trace again.
+//
+//  Author        : Patrick McDaniel
+//  Last Modified : Mon 19 Oct 2026 04:08:12 AM UTC
+//
+
+// Include Files
+#include <stdint.h>
+
+// Defines
+#define FS3_TRACE_MAGIC 0x54335346  // "FS3T" at the front of a trace (host order)
+#define FS3_TRACE_VERSION 1         // Layout of the trace
+#define FS3_TRACE_OPEN 0            // fs3_open, the path follows the record
+#define FS3_TRACE_CLOSE 1           // fs3_close
+#define FS3_TRACE_READ 2            // fs3_read, arg is the count
+#define FS3_TRACE_WRITE 3           // fs3_write, arg is the count
+#define FS3_TRACE_SEEK 4            // fs3_seek, arg is the location
+#define FS3_TRACE_OPS 5             // Kinds of call
+#define FS3_TRACE_RECORD_SIZE(rec) (sizeof(FS3TraceRecord) + (((rec)->namelen + 7) & ~7)) // Bytes of a record and its path
+
+// The front of a trace
+typedef struct {
+	uint32_t  magic;     // FS3_TRACE_MAGIC
+	uint16_t  version;   // FS3_TRACE_VERSION
+	uint16_t  unused;    // (zero)
+	uint64_t  started;   // Wall clock when the trace started (nsecs since the epoch)
+} FS3TraceHeader;
+
+// One call
+typedef struct {
+	uint64_t  nsecs;     // When it was called, from the start of the trace
+	uint32_t  took;      // How long it took (nsecs, UINT32_MAX if longer)
+	uint8_t   op;        // FS3_TRACE_OPEN ... FS3_TRACE_SEEK
+	uint8_t   namelen;   // Bytes of the path behind an open (padded to 8)
+	int16_t   fd;        // The file handle it was given (-1 for an open)
+	uint32_t  arg;       // The count or location
+	int32_t   result;    // What it returned (the handle, for an open)
+} FS3TraceRecord;
+
+//
+// Global data
+extern int fs3_tracing;              // A trace is running
+extern char *fs3_trace_ops[];        // Call names, by FS3_TRACE_*
+
+//
+// Functional Prototypes
+
+int fs3_trace_start(const char *path);
+	// Start recording calls into the trace file path
+
+int fs3_trace_stop(void);
+	// Stop recording and finish the trace file
+
+uint64_t fs3_trace_clock(void);
+	// Time to hand to fs3_trace_record, 0 when no trace is running
+
+void fs3_trace_record(uint8_t op, int16_t fd, uint32_t arg, int32_t result, uint64_t start, const char *path);
+	// Record a call that began at start (path only for an open)
+
+#endif
@@ -0,0 +1,521 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : fs3_uring.c
+//  Description    : This is the io_uring transport for the FS3 network layer.
+//                   Commands are staged into a per connection send buffer
+//                   and replies are read into a per connection stream
+//                   buffer; one io_uring_enter pushes out every staged send
+//                   and posts a receive on every connection still owed
+//                   replies, so a window of commands costs a handful of
+//                   syscalls instead of several per command. Both buffers
+//                   are cache line aligned slices of one mapping registered
+//                   with the ring. When io_uring is not available the
+//                   backend falls back to the blocking TCP backend.
+//
+//  Author         : Patrick McDaniel
+//  Last Modified  : Mon 19 Oct 2026 03:21:44 AM UTC
+//
+
+// Includes
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#include <cmpsc311_log.h>
+#include <cmpsc311_util.h>
+
+// Project Includes
+#include <fs3_network.h>
+#include <fs3_common.h>
+
+//
+// Defines
+#define FS3_URING_ENTRIES 64                 // Submission queue entries
+#define FS3_URING_STAGE (128 * 1024)         // Outgoing bytes staged per connection
+#define FS3_URING_STREAM (128 * 1024)        // Incoming bytes buffered per connection
+#define FS3_URING_MAX_REPLY (sizeof(FS3CmdBlk) + FS3_MAX_RANGE * FS3_SECTOR_SIZE)
+#define FS3_URING_SEND 0                     // Kind of request in the low bit of user_data
+#define FS3_URING_RECV 1
+
+//
+// Support Data
+
+typedef struct
+{
+    int fd;        // The socket
+    char *stage;   // Commands and payloads waiting to be sent
+    size_t stTail; // End of the staged bytes
+    size_t stSent; // Staged bytes already sent
+    size_t stBusy; // Bytes of the send in the ring, 0 if none
+    char *stream;  // Replies received and not yet collected
+    size_t rxHead; // Start of the uncollected bytes
+    size_t rxTail; // End of the received bytes
+    int rxBusy;    // A receive is in the ring
+    size_t owed;   // Reply bytes the server still has to send
+    int inflight;  // Requests in the ring for this connection
+    int broken;    // The connection failed
+} FS3UringConn;
+// struct that holds the state of one connection
+
+//
+// Global data
+int uringFd = -1;                 // The ring, -1 before it is set up
+unsigned *sqHead;                 // Submission queue (shared with the kernel)
+unsigned *sqTail;
+unsigned *sqMask;
+unsigned *sqArray;
+unsigned sqEntries;
+struct io_uring_sqe *sqes;
+unsigned *cqHead;                 // Completion queue (shared with the kernel)
+unsigned *cqTail;
+unsigned *cqMask;
+struct io_uring_cqe *cqes;
+unsigned sqUnsubmitted;           // Entries queued since the last enter
+int uringFixed;                   // The buffers are registered with the ring
+FS3UringConn uringConns[FS3_NET_MAX_CONNECTIONS];
+
+unsigned long uringEnters;        // Metrics: io_uring_enter calls
+unsigned long uringRequests;      // Metrics: requests submitted
+unsigned long uringPartials;      // Metrics: short sends and receives resumed
+
+static int fs3_uring_open(int conn);
+static int fs3_uring_send(FS3NetPending *pend);
+static int fs3_uring_recv(FS3NetPending *pend);
+static void fs3_uring_close(int conn);
+static int fs3_uring_ready(uint32_t conns);
+static int fs3_uring_log_metrics(void);
+
+FS3NetBackend fs3_uring_backend = {"uring", FS3_NET_MAX_CONNECTIONS, fs3_uring_open, fs3_uring_send, fs3_uring_recv,
+                                   fs3_uring_close, fs3_uring_ready, fs3_uring_log_metrics, 0};
+
+//
+// Implementation
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_uring_setup
+// Description  : Create the ring, map its queues and register the stage and
+//                stream buffers of every connection
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+static int fs3_uring_setup(void)
+{
+    struct io_uring_params p;
+    struct iovec iov[2 * FS3_NET_MAX_CONNECTIONS];
+    size_t sqSize;
+    size_t cqSize;
+    char *sq;
+    char *cq;
+    char *bufs;
+    int i;
+
+    memset(&p, 0, sizeof(p));
+    if ((uringFd = syscall(__NR_io_uring_setup, FS3_URING_ENTRIES, &p)) == -1)
+    {
+        logMessage(LOG_WARNING_LEVEL, "io_uring not available [%s]", strerror(errno));
+        return (-1);
+    }
+    sqSize = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    cqSize = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) // One mapping holds both rings
+    {
+        sqSize = cqSize = CMPSC311_MAXVAL(sqSize, cqSize);
+    }
+    sq = mmap(NULL, sqSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, uringFd, IORING_OFF_SQ_RING);
+    cq = (p.features & IORING_FEAT_SINGLE_MMAP) ? sq : mmap(NULL, cqSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, uringFd, IORING_OFF_CQ_RING);
+    sqes = mmap(NULL, p.sq_entries * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, uringFd, IORING_OFF_SQES);
+    bufs = mmap(NULL, FS3_NET_MAX_CONNECTIONS * (FS3_URING_STAGE + FS3_URING_STREAM), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if ((sq == MAP_FAILED) || (cq == MAP_FAILED) || (sqes == MAP_FAILED) || (bufs == MAP_FAILED))
+    {
+        logMessage(LOG_WARNING_LEVEL, "Unable to map the io_uring queues [%s]", strerror(errno));
+        close(uringFd);
+        uringFd = -1;
+        return (-1);
+    }
+
+    sqHead = (unsigned *)(sq + p.sq_off.head);
+    sqTail = (unsigned *)(sq + p.sq_off.tail);
+    sqMask = (unsigned *)(sq + p.sq_off.ring_mask);
+    sqArray = (unsigned *)(sq + p.sq_off.array);
+    sqEntries = p.sq_entries;
+    cqHead = (unsigned *)(cq + p.cq_off.head);
+    cqTail = (unsigned *)(cq + p.cq_off.tail);
+    cqMask = (unsigned *)(cq + p.cq_off.ring_mask);
+    cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+
+    for (i = 0; i < FS3_NET_MAX_CONNECTIONS; i++) // Page aligned slices, so every buffer starts on a cache line
+    {
+        uringConns[i].stage = bufs + i * (FS3_URING_STAGE + FS3_URING_STREAM);
+        uringConns[i].stream = uringConns[i].stage + FS3_URING_STAGE;
+        uringConns[i].fd = -1;
+        iov[2 * i].iov_base = uringConns[i].stage;
+        iov[2 * i].iov_len = FS3_URING_STAGE;
+        iov[2 * i + 1].iov_base = uringConns[i].stream;
+        iov[2 * i + 1].iov_len = FS3_URING_STREAM;
+    }
+    uringFixed = (syscall(__NR_io_uring_register, uringFd, IORING_REGISTER_BUFFERS, iov, 2 * FS3_NET_MAX_CONNECTIONS) == 0);
+    if (!uringFixed) // Over the locked memory limit, say, plain reads and writes still work
+    {
+        logMessage(LOG_WARNING_LEVEL, "io_uring buffer registration failed [%s], using unregistered buffers", strerror(errno));
+    }
+    return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_uring_prep
+// Description  : Queue a read or write on a connection's socket
+//
+// Inputs       : conn - the connection
+//                kind - FS3_URING_SEND or FS3_URING_RECV
+//                addr - the buffer (inside the connection's stage or stream)
+//                len - the number of bytes
+// Outputs      : 0 if successful, -1 if the queue is full
+
+static int fs3_uring_prep(int conn, int kind, char *addr, size_t len)
+{
+    struct io_uring_sqe *sqe;
+    unsigned tail = *sqTail;
+    unsigned idx;
+
+    if (tail - __atomic_load_n(sqHead, __ATOMIC_ACQUIRE) >= sqEntries)
+    {
+        return (-1);
+    }
+    idx = tail & *sqMask;
+    sqe = &sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    if (uringFixed)
+    {
+        sqe->opcode = (kind == FS3_URING_SEND) ? IORING_OP_WRITE_FIXED : IORING_OP_READ_FIXED;
+        sqe->buf_index = 2 * conn + kind; // Stage and stream buffers alternate in the registration
+    }
+    else
+    {
+        sqe->opcode = (kind == FS3_URING_SEND) ? IORING_OP_WRITE : IORING_OP_READ;
+    }
+    sqe->fd = uringConns[conn].fd;
+    sqe->addr = (uint64_t)(uintptr_t)addr;
+    sqe->len = len;
+    sqe->off = (uint64_t)-1; // Sockets have no offset
+    sqe->user_data = (uint64_t)(conn << 1 | kind);
+    sqArray[idx] = idx;
+    __atomic_store_n(sqTail, tail + 1, __ATOMIC_RELEASE);
+    sqUnsubmitted++;
+    uringConns[conn].inflight++;
+    return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_uring_reap
+// Description  : Account for every completion in the completion queue,
+//                resuming short transfers on the next drive
+//
+// Inputs       : none
+// Outputs      : number of completions handled
+
+static int fs3_uring_reap(void)
+{
+    struct io_uring_cqe *cqe;
+    FS3UringConn *c;
+    unsigned head = *cqHead;
+    int n = 0;
+
+    while (head != __atomic_load_n(cqTail, __ATOMIC_ACQUIRE))
+    {
+        cqe = &cqes[head & *cqMask];
+        c = &uringConns[cqe->user_data >> 1];
+        c->inflight--;
+        if ((cqe->user_data & 1) == FS3_URING_SEND)
+        {
+            if (cqe->res > 0)
+            {
+                uringPartials += ((size_t)cqe->res < c->stBusy); // The rest goes out on the next drive
+                c->stSent += cqe->res;
+                if (c->stSent == c->stTail)
+                {
+                    c->stSent = c->stTail = 0;
+                }
+            }
+            else if ((cqe->res != -EINTR) && (cqe->res != -EAGAIN))
+            {
+                logMessage(LOG_ERROR_LEVEL, "Error writing network data [%s]", strerror(-cqe->res));
+                c->broken = 1;
+            }
+            c->stBusy = 0;
+        }
+        else
+        {
+            if (cqe->res > 0)
+            {
+                uringPartials += ((size_t)cqe->res < c->owed);
+                c->rxTail += cqe->res;
+                c->owed -= CMPSC311_MINVAL((size_t)cqe->res, c->owed);
+            }
+            else if ((cqe->res != -EINTR) && (cqe->res != -EAGAIN))
+            {
+                logMessage(LOG_ERROR_LEVEL, "Error reading network data [%s]", (cqe->res == 0) ? "connection closed" : strerror(-cqe->res));
+                c->broken = 1;
+            }
+            c->rxBusy = 0;
+        }
+        head++;
+        n++;
+    }
+    __atomic_store_n(cqHead, head, __ATOMIC_RELEASE);
+    return (n);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_uring_drive
+// Description  : Post a send for every connection with staged bytes and a
+//                receive for every connection that is owed replies, submit
+//                them all with one io_uring_enter and wait for a completion
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure (nothing left to wait for)
+
+static int fs3_uring_drive(void)
+{
+    FS3UringConn *c;
+    int inflight = 0;
+    int i;
+
+    for (i = 0; i < FS3_NET_MAX_CONNECTIONS; i++)
+    {
+        c = &uringConns[i];
+        if ((c->fd != -1) && (!c->broken) && (c->stBusy == 0) && (c->stTail > c->stSent) &&
+            (fs3_uring_prep(i, FS3_URING_SEND, c->stage + c->stSent, c->stTail - c->stSent) == 0))
+        {
+            c->stBusy = c->stTail - c->stSent;
+        }
+        if ((c->fd != -1) && (!c->broken) && (!c->rxBusy) && (c->owed > 0))
+        {
+            if (FS3_URING_STREAM - c->rxTail < FS3_URING_MAX_REPLY) // Make room for the biggest reply
+            {
+                memmove(c->stream, c->stream + c->rxHead, c->rxTail - c->rxHead);
+                c->rxTail -= c->rxHead;
+                c->rxHead = 0;
+            }
+            if (fs3_uring_prep(i, FS3_URING_RECV, c->stream + c->rxTail, FS3_URING_STREAM - c->rxTail) == 0)
+            {
+                c->rxBusy = 1;
+            }
+        }
+        inflight += c->inflight;
+    }
+    if (inflight == 0)
+    {
+        logMessage(LOG_ERROR_LEVEL, "FS3 io_uring transport has nothing to wait for");
+        return (-1);
+    }
+
+    while (syscall(__NR_io_uring_enter, uringFd, sqUnsubmitted, 1, IORING_ENTER_GETEVENTS, NULL, 0) == -1)
+    {
+        if (errno != EINTR)
+        {
+            logMessage(LOG_ERROR_LEVEL, "io_uring_enter failed [%s]", strerror(errno));
+            return (-1);
+        }
+    }
+    uringEnters++;
+    uringRequests += sqUnsubmitted;
+    sqUnsubmitted = 0;
+    fs3_uring_reap();
+    return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_uring_open
+// Description  : Open a connection to the FS3 server (setting up the ring
+//                the first time, or falling back to the TCP backend)
+//
+// Inputs       : conn - the slot of the connection in the pool
+// Outputs      : 0 if successful, -1 if failure
+
+static int fs3_uring_open(int conn)
+{
+    FS3UringConn *c = &uringConns[conn];
+
+    if ((uringFd == -1) && (fs3_uring_setup() == -1))
+    {
+        logMessage(LOG_WARNING_LEVEL, "FS3 network falling back to the tcp backend");
+        fs3_network_backend = &fs3_tcp_backend;
+        return (fs3_tcp_backend.open(conn));
+    }
+    if ((c->fd = network_fs3_dial(conn)) == -1)
+    {
+        return (-1);
+    }
+    c->stTail = c->stSent = c->stBusy = 0;
+    c->rxHead = c->rxTail = c->owed = 0;
+    c->rxBusy = c->inflight = c->broken = 0;
+    return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_uring_send
+// Description  : Stage a command (and its payload) for the next submit
+//
+// Inputs       : pend - the command being sent
+// Outputs      : 0 if successful, -1 if failure
+
+static int fs3_uring_send(FS3NetPending *pend)
+{
+    FS3UringConn *c = &uringConns[pend->conn];
+    uint8_t op;
+    int16_t sec;
+    int32_t trk;
+    uint8_t Cret;
+    FS3CmdBlk val;
+    size_t payload;
+
+    deconstruct_fs3_cmdblock(pend->cmd, &op, &sec, &trk, &Cret);
+    payload = FS3_OP_SENDS_SECTOR(op) ? FS3_OP_PAYLOAD(op, trk) : 0;
+    while (FS3_URING_STAGE - c->stTail < sizeof(val) + payload) // Stage is full, wait for it to go out
+    {
+        if (c->broken || (fs3_uring_drive() == -1))
+        {
+            return (-1);
+        }
+    }
+
+    val = htonll64(pend->cmd); // Change cmdblk to network byte order
+    memcpy(c->stage + c->stTail, &val, sizeof(val));
+    if (payload > 0)
+    {
+        memcpy(c->stage + c->stTail + sizeof(val), pend->buf, payload);
+    }
+    c->stTail += sizeof(val) + payload;
+    c->owed += sizeof(FS3CmdBlk) + (FS3_OP_RECVS_SECTOR(op) ? FS3_OP_PAYLOAD(op, trk) : 0);
+    return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_uring_recv
+// Description  : Collect the reply to the oldest command on a connection,
+//                submitting staged sends and waiting for data as needed
+//
+// Inputs       : pend - the oldest command in flight on its connection
+// Outputs      : 0 if successful, -1 if failure
+
+static int fs3_uring_recv(FS3NetPending *pend)
+{
+    FS3UringConn *c = &uringConns[pend->conn];
+    uint8_t op;
+    int16_t sec;
+    int32_t trk;
+    uint8_t Cret;
+    size_t payload;
+
+    deconstruct_fs3_cmdblock(pend->cmd, &op, &sec, &trk, &Cret);
+    payload = FS3_OP_RECVS_SECTOR(op) ? FS3_OP_PAYLOAD(op, trk) : 0;
+    while (c->rxTail - c->rxHead < sizeof(FS3CmdBlk) + payload)
+    {
+        if (c->broken || (fs3_uring_drive() == -1))
+        {
+            return (-1);
+        }
+    }
+
+    memcpy(&pend->ret, c->stream + c->rxHead, sizeof(FS3CmdBlk));
+    pend->ret = ntohll64(pend->ret); // Change ret to host byte order
+    if (payload > 0)
+    {
+        memcpy(pend->buf, c->stream + c->rxHead + sizeof(FS3CmdBlk), payload);
+    }
+    c->rxHead += sizeof(FS3CmdBlk) + payload;
+    if ((c->rxHead == c->rxTail) && (!c->rxBusy))
+    {
+        c->rxHead = c->rxTail = 0;
+    }
+    return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_uring_ready
+// Description  : Wait until one of a set of connections has a reply coming
+//
+// Inputs       : conns - bit mask of the connections to wait on
+// Outputs      : the connection with data, -1 if failure
+
+static int fs3_uring_ready(uint32_t conns)
+{
+    static int nextPoll = 0; // Start the scan somewhere new each time so no connection starves
+    FS3UringConn *c;
+    int i;
+    int n;
+
+    while (1)
+    {
+        for (i = 0; i < FS3_NET_MAX_CONNECTIONS; i++)
+        {
+            n = (nextPoll + i) % FS3_NET_MAX_CONNECTIONS;
+            c = &uringConns[n];
+            if ((conns & (1u << n)) && ((c->rxTail - c->rxHead >= sizeof(FS3CmdBlk)) || c->broken))
+            {
+                nextPoll = n + 1;
+                return (n);
+            }
+        }
+        if (fs3_uring_drive() == -1)
+        {
+            return (-1);
+        }
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_uring_close
+// Description  : Close a connection, waiting out its requests in the ring
+//
+// Inputs       : conn - the slot of the connection in the pool
+// Outputs      : none
+
+static void fs3_uring_close(int conn)
+{
+    FS3UringConn *c = &uringConns[conn];
+
+    if (c->fd == -1)
+    {
+        return;
+    }
+    shutdown(c->fd, SHUT_RDWR); // Anything still in the ring completes with an error
+    c->broken = 1;
+    while ((c->inflight > 0) && (fs3_uring_drive() == 0))
+        ;
+    close(c->fd);
+    c->fd = -1;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_uring_log_metrics
+// Description  : Log how well the transport batched its syscalls
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+static int fs3_uring_log_metrics(void)
+{
+    printf("io_uring enters  [    %lu]\n", uringEnters);
+    printf("io_uring requests[    %lu]\n", uringRequests);
+    printf("Transfers resumed[    %lu]\n", uringPartials);
+    printf("Fixed buffers    [    %s]\n", uringFixed ? "yes" : "no");
+    return (0);
+}
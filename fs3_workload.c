@@ -0,0 +1,207 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : fs3_workload.c
+//  Description    : This is the reader of FS3 simulator workloads. Text
+//                   workloads are parsed in place from a private mapping,
+//                   compiled ones (see fs3_workload.h) are checked once
+//                   and then read record by record.
+//
+//   Author        : Patrick McDaniel
+//   Last Modified : Mon 19 Oct 2026 04:03:18 AM UTC
+//
+
+// Include Files
+#include <string.h>
+
+// Project Includes
+#include <fs3_workload.h>
+#include <cmpsc311_log.h>
+
+//
+// Global Data
+char *fs3_workload_commands[] = { "WRITEAT", "WRITE", "SEEK", "READ" };
+
+//
+// Functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_workload_parse_int
+// Description  : Read a decimal number (blanks before it are skipped)
+//                without running past the end of the line
+//
+// Inputs       : pos - where to start, moved past the number
+//                eol - the end of the line
+//                val - where to put the number
+// Outputs      : 0 if successful, -1 if there is no number
+
+static int fs3_workload_parse_int(char **pos, char *eol, int32_t *val) {
+
+	// Local variables
+	char *p = *pos;
+	int32_t sign = 1, n = 0;
+
+	for (; (p<eol) && ((*p == ' ') || (*p == '\t')); p++);
+	if ( (p<eol) && (*p == '-') ) {
+		sign = -1;
+		p++;
+	}
+	if ( (p == eol) || (*p < '0') || (*p > '9') ) {
+		return( -1 );
+	}
+	for (; (p<eol) && (*p >= '0') && (*p <= '9'); p++) {
+		n = n * 10 + (*p - '0');
+	}
+	*val = sign * n;
+	*pos = p;
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_workload_parse_line
+// Description  : Parse the next line of the mapped workload in place: the
+//                file name and command are terminated where the blanks
+//                after them were, and a write's text has its '^' turned
+//                into newlines where it lies, so nothing is copied
+//
+// Inputs       : pos - the start of the line, moved to the next one
+//                end - the end of the workload
+//                op - where to put the command
+//                linecount - the line number (for messages)
+// Outputs      : 1 if a command was parsed, 0 at the end, -1 if failure
+
+int fs3_workload_parse_line(char **pos, char *end, FS3WorkloadOp *op, int linecount) {
+
+	// Local variables
+	char *line = *pos, *eol, *p, *command, *cend, *sep;
+
+	if ( line >= end ) {
+		return( 0 );
+	}
+	if ( (eol = memchr(line, '\n', end - line)) == NULL ) {
+		eol = end;
+	}
+	*pos = (eol == end) ? end : eol + 1;
+
+	// The file name and the command, then the length and the offset
+	for (p=line; (p<eol) && ((*p == ' ') || (*p == '\t')); p++);
+	op->fname = p;
+	for (; (p<eol) && (*p != ' ') && (*p != '\t'); p++);
+	for (command=p; (command<eol) && ((*command == ' ') || (*command == '\t')); command++);
+	for (cend=command; (cend<eol) && (*cend != ' ') && (*cend != '\t'); cend++);
+	if ( (p == op->fname) || (cend == command) || (cend == eol) || ((sep = memchr(line, ':', eol - line)) == NULL) ) {
+		logMessage( LOG_ERROR_LEVEL, "FS3 un-parsable workload string, aborting [%.*s], line %d", (int)(eol - line), line, linecount );
+		return( -1 );
+	}
+	*p = 0x0;
+	*cend = 0x0;
+	p = cend + 1;
+	if ( (fs3_workload_parse_int(&p, eol, &op->len) == -1) || (fs3_workload_parse_int(&p, eol, &op->off) == -1) ) {
+		logMessage( LOG_ERROR_LEVEL, "FS3 un-parsable workload string, aborting [%s %s %.*s], line %d",
+				op->fname, command, (int)(eol - p), p, linecount );
+		return( -1 );
+	}
+	op->linecount = linecount;
+	op->file = -1;
+	op->text = sep + 1;
+	if ( strncmp(command, "WRITEAT", 7) == 0 ) {
+		op->command = FS3_WL_WRITEAT;
+	} else if ( strncmp(command, "WRITE", 5) == 0 ) {
+		op->command = FS3_WL_WRITE;
+	} else if ( strncmp(command, "SEEK", 4) == 0 ) {
+		op->command = FS3_WL_SEEK;
+	} else if ( strncmp(command, "READ", 4) == 0 ) {
+		op->command = FS3_WL_READ;
+	} else {
+		logMessage( LOG_ERROR_LEVEL, "FS3_SIM : Failed, unknown command [%s], line %d", command, linecount );
+		return( -1 );
+	}
+
+	// A write's text follows the colon, it may take the line's newline but no more
+	if ( (op->command == FS3_WL_WRITEAT) || (op->command == FS3_WL_WRITE) ) {
+		if ( (op->len < 0) || (op->len >= FS3_WL_MAX_TEXT) || (op->len > *pos - op->text) ) {
+			logMessage( LOG_ERROR_LEVEL, "Simulated workload command text bad length [%d], line %d", op->len, linecount );
+			return( -1 );
+		}
+		for (p=op->text; (p = memchr(p, '^', op->text + op->len - p)) != NULL; *p++ = '\n');
+	}
+	return( 1 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_workload_compiled
+// Description  : Tell a compiled workload from a text one, and check that
+//                a compiled one holds what its header says (names
+//                terminated, records naming files it has, text inside the
+//                payload) so it can be replayed without looking again
+//
+// Inputs       : data - the mapped workload
+//                size - its size
+// Outputs      : 1 if compiled, 0 if text, -1 if corrupt
+
+int fs3_workload_compiled(char *data, size_t size) {
+
+	// Local variables
+	FS3WorkloadHeader hdr;
+	FS3WorkloadRecord *rec;
+	char *names;
+	uint64_t i;
+
+	if ( (size < sizeof(hdr)) || (((FS3WorkloadHeader *)data)->magic != FS3_WL_MAGIC) ) {
+		return( 0 );
+	}
+	memcpy(&hdr, data, sizeof(hdr));
+	if ( (hdr.version != FS3_WL_VERSION) || (hdr.files > FS3_WL_MAX_FILES) || (hdr.ops > size / sizeof(FS3WorkloadRecord)) || (hdr.payload > size) ||
+			(size != sizeof(hdr) + hdr.files * FS3_WL_NAME_MAX + hdr.ops * sizeof(FS3WorkloadRecord) + hdr.payload) ) {
+		logMessage( LOG_ERROR_LEVEL, "Compiled workload header is bad (version %u, %u files, %lu ops, %lu bytes of text)",
+				hdr.version, hdr.files, (unsigned long)hdr.ops, (unsigned long)hdr.payload );
+		return( -1 );
+	}
+
+	names = data + sizeof(hdr);
+	for (i=0; i<hdr.files; i++) {
+		if ( memchr(&names[i * FS3_WL_NAME_MAX], 0x0, FS3_WL_NAME_MAX) == NULL ) {
+			logMessage( LOG_ERROR_LEVEL, "Compiled workload file %lu has no name", (unsigned long)i );
+			return( -1 );
+		}
+	}
+	rec = (FS3WorkloadRecord *)(names + hdr.files * FS3_WL_NAME_MAX);
+	for (i=0; i<hdr.ops; i++) {
+		if ( (rec[i].command > FS3_WL_READ) || (rec[i].file >= hdr.files) ||
+				( (rec[i].command <= FS3_WL_WRITE) && ((rec[i].len < 0) || (rec[i].len >= FS3_WL_MAX_TEXT) ||
+				(rec[i].text > hdr.payload) || (rec[i].len > hdr.payload - rec[i].text)) ) ) {
+			logMessage( LOG_ERROR_LEVEL, "Compiled workload record %lu is bad", (unsigned long)i );
+			return( -1 );
+		}
+	}
+	return( 1 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_workload_decode
+// Description  : Get a record of a (checked) compiled workload as a command
+//
+// Inputs       : data - the mapped workload
+//                n - the record
+//                op - where to put the command
+// Outputs      : none
+
+void fs3_workload_decode(char *data, uint64_t n, FS3WorkloadOp *op) {
+
+	// Local variables
+	FS3WorkloadHeader *hdr = (FS3WorkloadHeader *)data;
+	char *names = data + sizeof(FS3WorkloadHeader);
+	FS3WorkloadRecord *rec = (FS3WorkloadRecord *)(names + hdr->files * FS3_WL_NAME_MAX) + n;
+	char *payload = (char *)((FS3WorkloadRecord *)(names + hdr->files * FS3_WL_NAME_MAX) + hdr->ops);
+
+	op->fname = &names[rec->file * FS3_WL_NAME_MAX];
+	op->text = payload + rec->text;
+	op->len = rec->len;
+	op->off = rec->off;
+	op->command = rec->command;
+	op->file = rec->file;
+	op->linecount = (int)(n + 1);
+}
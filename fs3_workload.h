@@ -0,0 +1,81 @@
+#ifndef FS3_WORKLOAD_INCLUDED
+#define FS3_WORKLOAD_INCLUDED
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File          : fs3_workload.h
+//  Description   : This is the interface to FS3 simulator workloads, the
+//                  text format (one "<file> <command> <len> <off>:<text>"
+//                  line per command, '^' standing for a newline) and the
+//                  compiled form fs3_compile_workload makes of it: a
+//                  header, the table of file names, one fixed size record
+//                  per command and the write text, newlines in place, in a
+//                  single blob. Both are replayed straight from a mapping.
+//
+//  Author        : Patrick McDaniel
+//  Last Modified : Mon 19 Oct 2026 04:03:18 AM UTC
+//
+
+// Include Files
+#include <stdint.h>
+#include <stddef.h>
+
+// Defines
+#define FS3_WL_WRITEAT 0         // Seek, then write
+#define FS3_WL_WRITE 1           // Write at the file position
+#define FS3_WL_SEEK 2            // Seek
+#define FS3_WL_READ 3            // Read at the file position
+#define FS3_WL_MAX_TEXT 1024     // Write text must be shorter than this
+#define FS3_WL_MAX_FILES 256     // Files in a compiled workload
+#define FS3_WL_NAME_MAX 128      // File name, with its terminator, in a compiled workload
+#define FS3_WL_MAGIC 0x57335346  // "FS3W" at the front of a compiled workload (host order)
+#define FS3_WL_VERSION 1         // Layout of the compiled workload
+
+// The front of a compiled workload, followed by the file table
+// (files * FS3_WL_NAME_MAX bytes), the records and the payload
+typedef struct {
+	uint32_t  magic;     // FS3_WL_MAGIC
+	uint16_t  version;   // FS3_WL_VERSION
+	uint16_t  files;     // Names in the file table
+	uint64_t  ops;       // Records
+	uint64_t  payload;   // Bytes of write text
+} FS3WorkloadHeader;
+
+// One command of a compiled workload
+typedef struct {
+	uint8_t   command;   // FS3_WL_WRITEAT ... FS3_WL_READ
+	uint8_t   unused;    // (zero)
+	uint16_t  file;      // Its file in the file table
+	int32_t   len;       // The length field
+	int32_t   off;       // The offset field
+	uint32_t  text;      // Where a write's text is in the payload
+} FS3WorkloadRecord;
+
+// A command ready to run, its strings point into the mapped workload
+typedef struct {
+	char     *fname;     // The file it works on
+	char     *text;      // The text written (newlines in place)
+	int32_t   len;       // The length field
+	int32_t   off;       // The offset field
+	int       command;   // FS3_WL_WRITEAT ... FS3_WL_READ
+	int       file;      // Its file in a compiled workload's table, -1 for text
+	int       linecount; // The line (or record, from 1) it came from
+} FS3WorkloadOp;
+
+//
+// Global data
+extern char *fs3_workload_commands[]; // Command names, by FS3_WL_*
+
+//
+// Functional Prototypes
+
+int fs3_workload_parse_line(char **pos, char *end, FS3WorkloadOp *op, int linecount);
+	// Parse the text line at *pos in place, 1 if it was a command, 0 at the end, -1 if bad
+
+int fs3_workload_compiled(char *data, size_t size);
+	// 1 if the mapping is a well formed compiled workload, 0 if it is text, -1 if it is corrupt
+
+void fs3_workload_decode(char *data, uint64_t n, FS3WorkloadOp *op);
+	// Get record n of a compiled workload as a command
+
+#endif
@@ -0,0 +1,153 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : fs3_workload_test.c
+//  Description    : This is the test of the compiled workload format. It
+//                   parses a text workload and decodes the same workload
+//                   as fs3_compile_workload wrote it, side by side, and
+//                   checks every command comes out the same: file, command,
+//                   length, offset and the text of writes.
+//
+//   Author        : Patrick McDaniel
+//   Last Modified : Mon 19 Oct 2026 04:38:27 AM UTC
+//
+
+// Include Files
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+// Project Includes
+#include <fs3_workload.h>
+#include <cmpsc311_log.h>
+
+//
+// Functional Prototypes
+
+char *map_workload(char *wload, size_t *size);                 // Map a workload to parse in place
+int compare_workloads(char *text, size_t tsize, char *compiled, size_t csize); // Check one against the other
+
+//
+// Functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : main
+// Description  : The main function for the compiled workload test
+//
+// Inputs       : argc - the number of command line parameters
+//                argv - the parameters
+// Outputs      : 0 if the workloads match, 1 otherwise
+
+int main( int argc, char *argv[] ) {
+
+	// Local variables
+	char *text, *compiled;
+	size_t tsize, csize;
+	int ret;
+
+	initializeLogWithFilehandle( CMPSC311_LOG_STDERR );
+	if ( argc != 3 ) {
+		fprintf( stderr, "USAGE: fs3_workload_test <workload-file> <compiled-file>\n" );
+		return( 1 );
+	}
+	if ( ((text = map_workload(argv[1], &tsize)) == NULL) || ((compiled = map_workload(argv[2], &csize)) == NULL) ) {
+		return( 1 );
+	}
+	ret = compare_workloads( text, tsize, compiled, csize );
+	munmap( text, tsize );
+	munmap( compiled, csize );
+	return( (ret == 0) ? 0 : 1 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : map_workload
+// Description  : Map a workload privately, so a text one can be parsed in place
+//
+// Inputs       : wload - the workload file
+//                size - where to put its size
+// Outputs      : the mapping, NULL if failure
+
+char *map_workload(char *wload, size_t *size) {
+
+	// Local variables
+	struct stat stats;
+	char *data;
+	int fd;
+
+	if ( ((fd=open(wload, O_RDONLY)) == -1) || (fstat(fd, &stats) == -1) || (stats.st_size == 0) ) {
+		logMessage( LOG_ERROR_LEVEL, "Failure opening the workload file [%s], error: %s.",
+			wload, (errno) ? strerror(errno) : "empty" );
+		return( NULL );
+	}
+	if ( (data = mmap(NULL, stats.st_size, PROT_READ|PROT_WRITE, MAP_PRIVATE, fd, 0)) == MAP_FAILED ) {
+		logMessage( LOG_ERROR_LEVEL, "Failure mapping the workload file [%s], error: %s.",
+			wload, strerror(errno) );
+		close( fd );
+		return( NULL );
+	}
+	close( fd );
+	*size = stats.st_size;
+	return( data );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : compare_workloads
+// Description  : Walk a text workload and its compiled form together,
+//                command by command
+//
+// Inputs       : text - the mapped text workload
+//                tsize - its size
+//                compiled - the mapped compiled workload
+//                csize - its size
+// Outputs      : 0 if they hold the same commands, -1 otherwise
+
+int compare_workloads(char *text, size_t tsize, char *compiled, size_t csize) {
+
+	// Local variables
+	FS3WorkloadHeader *hdr = (FS3WorkloadHeader *)compiled;
+	FS3WorkloadOp top, cop;
+	char *pos = text, *end = text + tsize;
+	uint64_t n = 0;
+	int got;
+
+	// One of each kind
+	if ( (fs3_workload_compiled(text, tsize) != 0) || (fs3_workload_compiled(compiled, csize) != 1) ) {
+		logMessage( LOG_ERROR_LEVEL, "Expected a text workload and a compiled one." );
+		return( -1 );
+	}
+
+	// Every line against its record
+	while ( (got = fs3_workload_parse_line(&pos, end, &top, n + 1)) == 1 ) {
+		if ( n == hdr->ops ) {
+			logMessage( LOG_ERROR_LEVEL, "Compiled workload ends at line %lu of the text.", (unsigned long)n + 1 );
+			return( -1 );
+		}
+		fs3_workload_decode( compiled, n++, &cop );
+		if ( (strcmp(top.fname, cop.fname) != 0) || (top.command != cop.command) ||
+				(top.len != cop.len) || (top.off != cop.off) || (cop.linecount != n) ||
+				(((top.command == FS3_WL_WRITEAT) || (top.command == FS3_WL_WRITE)) &&
+				 (memcmp(top.text, cop.text, top.len) != 0)) ) {
+			logMessage( LOG_ERROR_LEVEL, "Line %lu differs: text [%s %s %d %d], compiled [%s %s %d %d].",
+				(unsigned long)n, top.fname, fs3_workload_commands[top.command], top.len, top.off,
+				cop.fname, fs3_workload_commands[cop.command], cop.len, cop.off );
+			return( -1 );
+		}
+	}
+	if ( (got == -1) || (n != hdr->ops) ) {
+		logMessage( LOG_ERROR_LEVEL, "Workloads differ in length, %lu lines of text against %lu records.",
+			(unsigned long)n, (unsigned long)hdr->ops );
+		return( -1 );
+	}
+
+	printf( "FS3 workload test: %lu commands match\n", (unsigned long)n );
+	return( 0 );
+}